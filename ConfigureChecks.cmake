@@ -26,6 +26,10 @@ check_include_files(
   sys/endian.h
   HAVE_SYS_ENDIAN_H
 )
+check_include_files(
+  sys/mman.h
+  HAVE_SYS_MMAN_H
+)
 check_include_files(
   sys/param.h
   HAVE_SYS_PARAM_H
@@ -134,6 +138,10 @@ else()
     mkdir
     HAVE_MKDIR
   ) #Unix <sys/stat.h>,<sys/types.h>
+  check_function_exists(
+    mmap
+    HAVE_MMAP
+  ) #Unix <sys/mman.h>
   check_function_exists(
     open
     HAVE_OPEN
@@ -154,6 +162,10 @@ else()
     fstat
     HAVE_FSTAT
   ) #Unix <sys/stat.h>,<sys/types.h>,<unistd.h>
+  check_function_exists(
+    fsync
+    HAVE_FSYNC
+  ) #Unix <unistd.h>
   check_function_exists(
     strdup
     HAVE_STRDUP
@@ -116,12 +116,18 @@ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
 /* Define to 1 if you have the `_mkdir' function. */
 #cmakedefine HAVE__MKDIR 1
 
+/* Define to 1 if you have the `mmap' function. */
+#cmakedefine HAVE_MMAP 1
+
 /* Define to 1 if you have the `open' function. */
 #cmakedefine HAVE_OPEN 1
 
 /* Define to 1 if you have the `_open' function. */
 #cmakedefine HAVE__OPEN 1
 
+/* Define to 1 if you have the `fsync' function. */
+#cmakedefine HAVE_FSYNC 1
+
 /* Define to 1 if you have the `read' function. */
 #cmakedefine HAVE_READ 1
 
@@ -140,6 +146,9 @@ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
 /* Define to 1 if you have the `setenv' function. */
 #cmakedefine HAVE_SETENV 1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#cmakedefine HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/param.h> header file. */
 #cmakedefine HAVE_SYS_PARAM_H 1
 
@@ -198,6 +207,9 @@ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
 /* whether we should bring our own TZ-Data */
 #cmakedefine USE_BUILTIN_TZDATA
 
+/* whether our own TZ-Data is compiled into the library */
+#cmakedefine USE_EMBEDDED_TZDATA
+
 /* Define to empty if `const' does not conform to ANSI C. */
 #cmakedefine const
 
@@ -15,12 +15,20 @@
 #include "icalmemory.h"
 #include "icalparser.h"
 #include "icalrestriction.h"
+#include "icaltime_p.h"
 #include "icaltimezone.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <limits.h>
 
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+
 struct icalcomponent_impl {
     char id[5];
     icalcomponent_kind kind;
@@ -42,17 +50,35 @@ struct icalcomponent_impl {
 static void icalcomponent_add_children(icalcomponent *impl, va_list args);
 static icalcomponent *icalcomponent_new_impl(icalcomponent_kind kind);
 
+/* A TZID to rename, and the TZID to rename it to */
+typedef struct icaltzidrename {
+    char *from;
+    char *to;
+} icaltzidrename;
+
+/* The TZIDs to rename when merging, with a hash index by the current TZID */
+typedef struct icaltzidrenames {
+    icalarray *pairs;
+    size_t *slots;
+    size_t mask;
+} icaltzidrenames;
+
 static void icalcomponent_merge_vtimezone(icalcomponent *comp,
-                                          icalcomponent *vtimezone, icalarray *tzids_to_rename);
+                                          icalcomponent *vtimezone,
+                                          icaltzidrenames *tzids_to_rename);
 static void icalcomponent_handle_conflicting_vtimezones(icalcomponent *comp,
                                                         icalcomponent *vtimezone,
-                                                        icalproperty *tzid_prop,
                                                         const char *tzid,
-                                                        icalarray *tzids_to_rename);
+                                                        const char *content,
+                                                        uint32_t content_hash,
+                                                        icaltzidrenames *tzids_to_rename);
 static size_t icalcomponent_get_tzid_prefix_len(const char *tzid);
-static void icalcomponent_rename_tzids(icalcomponent *comp, icalarray *rename_table);
+static char *icalcomponent_get_vtimezone_content(icalcomponent *vtimezone, uint32_t *hash);
+static void icalcomponent_add_tzid_rename(icaltzidrenames *renames,
+                                          const char *from, const char *to);
+static void icalcomponent_rename_tzids(icalcomponent *comp, icaltzidrenames *renames);
 static void icalcomponent_rename_tzids_callback(icalparameter *param, void *data);
-static int icalcomponent_compare_vtimezones(icalcomponent *vtimezone1, icalcomponent *vtimezone2);
+static void icalcomponent_sort_timezones(icalcomponent *comp);
 static int icalcomponent_compare_timezone_fn(const void *elem1, const void *elem2);
 
 void icalcomponent_add_children(icalcomponent *impl, va_list args)
@@ -904,13 +930,40 @@ static icaltime_span icaltime_span_from_datetimeperiod(const struct icaldatetime
     return ret;
 }
 
-static int icaldatetimeperiod_start_compare(const void *a, const void *b)
+/* Sorts an array of icaldatetimeperiodtype by their start, converting each
+   start to its sort key once. */
+static void icaldatetimeperiod_sort_by_start(icalarray *dtps)
 {
-    const struct icaldatetimeperiodtype *adtp = a, *bdtp = b;
-    const struct icaltimetype
-        at = (!icaltime_is_null_time(adtp->time) ? adtp->time : adtp->period.start),
-        bt = (!icaltime_is_null_time(bdtp->time) ? bdtp->time : bdtp->period.start);
-    return icaltime_compare(at, bt);
+    icaltimekeyed *keyed;
+    struct icaldatetimeperiodtype *sorted;
+    size_t n = dtps->num_elements, i;
+
+    keyed = icalmemory_new_buffer(n * sizeof(icaltimekeyed));
+    sorted = icalmemory_new_buffer(n * sizeof(struct icaldatetimeperiodtype));
+    if (!keyed || !sorted) {
+        icalmemory_free_buffer(keyed);
+        icalmemory_free_buffer(sorted);
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        const struct icaldatetimeperiodtype *dtp = icalarray_element_at(dtps, i);
+
+        keyed[i].key = icaltime_sort_key(!icaltime_is_null_time(dtp->time) ? dtp->time : dtp->period.start);
+        keyed[i].index = i;
+    }
+    icaltime_sort_keyed(keyed, n);
+
+    for (i = 0; i < n; i++) {
+        sorted[i] = *(struct icaldatetimeperiodtype *)icalarray_element_at(dtps, keyed[i].index);
+    }
+    for (i = 0; i < n; i++) {
+        memcpy(icalarray_element_at(dtps, i), &sorted[i], sizeof(struct icaldatetimeperiodtype));
+    }
+
+    icalmemory_free_buffer(keyed);
+    icalmemory_free_buffer(sorted);
 }
 
 void icalcomponent_foreach_recurrence(icalcomponent *comp,
@@ -1015,17 +1068,15 @@ void icalcomponent_foreach_recurrence(icalcomponent *comp,
             rrule_itr = icalrecur_iterator_new(recur, dtstart);
 
             if (rrule_itr) {
-                if (recur->count == 0) {
-                    icaltimetype mystart = start;
+                icaltimetype mystart = start;
 
-                    /* make sure we include any recurrence that ends in timespan */
-                    /* duration should be positive */
-                    dtduration.is_neg = 1;
-                    mystart = icaltime_add(mystart, dtduration);
-                    dtduration.is_neg = 0;
+                /* make sure we include any recurrence that ends in timespan */
+                /* duration should be positive */
+                dtduration.is_neg = 1;
+                mystart = icaltime_add(mystart, dtduration);
+                dtduration.is_neg = 0;
 
-                    icalrecur_iterator_set_start(rrule_itr, mystart);
-                }
+                icalrecur_iterator_set_start(rrule_itr, mystart);
                 rrule_time = icalrecur_iterator_next(rrule_itr);
                 if (!icaltime_is_null_time(rrule_time)) {
                     rrule_span = icaltime_span_from_time(rrule_time, dtduration);
@@ -1043,7 +1094,7 @@ void icalcomponent_foreach_recurrence(icalcomponent *comp,
         icalarray_append(rdates, &rdate_period);
     }
     if (rdates->num_elements > 0) {
-        icalarray_sort(rdates, icaldatetimeperiod_start_compare);
+        icaldatetimeperiod_sort_by_start(rdates);
         rdate_period = *((struct icaldatetimeperiodtype *)icalarray_element_at(rdates, rdate_idx));
         rdate_span = icaltime_span_from_datetimeperiod(rdate_period, dtduration);
     }
@@ -1104,6 +1155,271 @@ void icalcomponent_foreach_recurrence(icalcomponent *comp,
     }
 }
 
+/** A span collected by a worker of icalcomponent_foreach_recurrence_parallel() */
+struct recurrence_span {
+    struct icaltime_span span;
+    const icalcomponent *comp;
+    size_t comp_no; /* position of comp among the expanded components */
+    size_t span_no; /* position of the span among those of comp */
+};
+
+struct recurrence_shard {
+    icalcomponent **comps;
+    size_t num_comps;
+    size_t next_comp; /* the next component to hand out to a worker */
+    struct icaltimetype start;
+    struct icaltimetype end;
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct recurrence_worker {
+    struct recurrence_shard *shard;
+    icalarray *spans;
+    size_t comp_no;
+    size_t span_no;
+    size_t merged; /* the number of spans passed on to the caller */
+    bool failed;   /* a span could not be stored */
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_t thread;
+#endif
+};
+
+/* Components are handed out to the workers this many at a time */
+#define RECURRENCE_SHARD_SIZE 8
+
+static void recurrence_worker_callback(const icalcomponent *comp,
+                                       const struct icaltime_span *span,
+                                       void *data)
+{
+    struct recurrence_worker *worker = (struct recurrence_worker *)data;
+    struct recurrence_span rspan;
+
+    rspan.span = *span;
+    rspan.comp = comp;
+    rspan.comp_no = worker->comp_no;
+    rspan.span_no = worker->span_no++;
+
+    if (!worker->failed) {
+        size_t num_spans = worker->spans->num_elements;
+
+        icalarray_append(worker->spans, &rspan);
+        worker->failed = (worker->spans->num_elements == num_spans);
+    }
+}
+
+static int recurrence_span_compare(const void *a, const void *b)
+{
+    const struct recurrence_span *sa = a, *sb = b;
+
+    if (sa->span.start != sb->span.start) {
+        return (sa->span.start < sb->span.start) ? -1 : 1;
+    } else if (sa->comp_no != sb->comp_no) {
+        return (sa->comp_no < sb->comp_no) ? -1 : 1;
+    } else if (sa->span_no != sb->span_no) {
+        return (sa->span_no < sb->span_no) ? -1 : 1;
+    }
+    return 0;
+}
+
+static void *recurrence_worker_run(void *data)
+{
+    struct recurrence_worker *worker = (struct recurrence_worker *)data;
+    struct recurrence_shard *shard = worker->shard;
+
+    for (;;) {
+        size_t first, last;
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+        pthread_mutex_lock(&shard->mutex);
+#endif
+        first = shard->next_comp;
+        last = first + RECURRENCE_SHARD_SIZE;
+        if (last > shard->num_comps) {
+            last = shard->num_comps;
+        }
+        shard->next_comp = last;
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+        pthread_mutex_unlock(&shard->mutex);
+#endif
+
+        if (first == last || worker->failed) {
+            break;
+        }
+
+        for (worker->comp_no = first; worker->comp_no < last && !worker->failed;
+             worker->comp_no++) {
+            worker->span_no = 0;
+            icalcomponent_foreach_recurrence(shard->comps[worker->comp_no],
+                                             shard->start, shard->end,
+                                             recurrence_worker_callback, worker);
+        }
+    }
+
+    /* Sort here, so that only a merge is left for the caller */
+    icalarray_sort(worker->spans, recurrence_span_compare);
+
+    return NULL;
+}
+
+static int recurrence_default_num_threads(void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 0) {
+        return (n < 64) ? (int)n : 64;
+    }
+#endif
+    return 1;
+}
+
+void icalcomponent_foreach_recurrence_parallel(icalcomponent *comp,
+                                               struct icaltimetype start,
+                                               struct icaltimetype end,
+                                               int num_threads,
+                                               void (*callback)(const icalcomponent *comp,
+                                                                const struct icaltime_span *span,
+                                                                void *data),
+                                               void *callback_data)
+{
+    struct recurrence_shard shard;
+    struct recurrence_worker *workers;
+    icalcomponent *c;
+    icalpvl_elem itr;
+    int num_workers, num_running, w;
+
+    if (comp == NULL || callback == NULL) {
+        return;
+    }
+
+    if (icalcomponent_isa(comp) != ICAL_VCALENDAR_COMPONENT) {
+        icalcomponent_foreach_recurrence(comp, start, end, callback, callback_data);
+        return;
+    }
+
+    memset(&shard, 0, sizeof(shard));
+    shard.start = start;
+    shard.end = end;
+
+    shard.comps = malloc(sizeof(icalcomponent *) * ((size_t)icalpvl_count(comp->components) + 1));
+    if (shard.comps == NULL) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return;
+    }
+
+    for (itr = icalpvl_head(comp->components); itr != 0; itr = icalpvl_next(itr)) {
+        c = (icalcomponent *)icalpvl_data(itr);
+        if (c->kind != ICAL_VTIMEZONE_COMPONENT) {
+            shard.comps[shard.num_comps++] = c;
+        }
+    }
+
+    /* Lazily initialized state that the workers share is set up before
+       they start: the builtin timezones, and the timezone arrays of the
+       enclosing components, which TZID lookups sort on demand */
+    (void)icaltimezone_get_utc_timezone();
+    for (c = comp; c != NULL; c = c->parent) {
+        icalcomponent_sort_timezones(c);
+    }
+
+    if (num_threads <= 0) {
+        num_threads = recurrence_default_num_threads();
+    }
+    num_workers = (int)((shard.num_comps + RECURRENCE_SHARD_SIZE - 1) / RECURRENCE_SHARD_SIZE);
+    if (num_workers > num_threads) {
+        num_workers = num_threads;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    workers = calloc((size_t)num_workers, sizeof(struct recurrence_worker));
+    if (workers == NULL) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        free(shard.comps);
+        return;
+    }
+
+    for (w = 0; w < num_workers; w++) {
+        workers[w].shard = &shard;
+        workers[w].spans = icalarray_new(sizeof(struct recurrence_span), 64);
+        if (workers[w].spans == NULL) {
+            /* icalarray_new() has set the error */
+            while (w-- > 0) {
+                icalarray_free(workers[w].spans);
+            }
+            free(workers);
+            free(shard.comps);
+            return;
+        }
+    }
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_mutex_init(&shard.mutex, NULL);
+
+    /* The calling thread works too, as worker 0.  If a thread fails to
+       start, the running workers take over its share of the components. */
+    for (num_running = 1; num_running < num_workers; num_running++) {
+        if (pthread_create(&workers[num_running].thread, NULL,
+                           recurrence_worker_run, &workers[num_running]) != 0) {
+            break;
+        }
+    }
+    recurrence_worker_run(&workers[0]);
+    for (w = 1; w < num_running; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&shard.mutex);
+#else
+    num_running = 1;
+    recurrence_worker_run(&workers[0]);
+#endif
+
+    /* The error of a worker thread is not seen by the caller's icalerrno */
+    for (w = 0; w < num_running; w++) {
+        if (workers[w].failed) {
+            icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+            num_running = 0;
+        }
+    }
+
+    /* Merge the sorted spans of the workers in time order */
+    for (;;) {
+        struct recurrence_span *next = NULL;
+        int next_worker = -1;
+
+        for (w = 0; w < num_running; w++) {
+            struct recurrence_worker *worker = &workers[w];
+
+            if (worker->merged < worker->spans->num_elements) {
+                struct recurrence_span *rspan =
+                    icalarray_element_at(worker->spans, worker->merged);
+
+                if (next == NULL || recurrence_span_compare(rspan, next) < 0) {
+                    next = rspan;
+                    next_worker = w;
+                }
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+        workers[next_worker].merged++;
+
+        (*callback)(next->comp, &next->span, callback_data);
+    }
+
+    for (w = 0; w < num_workers; w++) {
+        icalarray_free(workers[w].spans);
+    }
+    free(workers);
+    free(shard.comps);
+}
+
 int icalcomponent_check_restrictions(icalcomponent *comp)
 {
     icalerror_check_arg_rz(comp != 0, "comp");
@@ -2123,7 +2439,7 @@ icalcomponent *icalcomponent_new_vresource(void)
 void icalcomponent_merge_component(icalcomponent *comp, icalcomponent *comp_to_merge)
 {
     icalcomponent *subcomp, *next_subcomp;
-    icalarray *tzids_to_rename;
+    icaltzidrenames tzids_to_rename;
     size_t i;
 
     /* Check that both components are VCALENDAR components. */
@@ -2133,8 +2449,9 @@ void icalcomponent_merge_component(icalcomponent *comp, icalcomponent *comp_to_m
     /* Step through each subcomponent of comp_to_merge, looking for VTIMEZONEs.
        For each VTIMEZONE found, check if we need to add it to comp and if we
        need to rename it and all TZID references to it. */
-    tzids_to_rename = icalarray_new(sizeof(char *), 16);
-    if (!tzids_to_rename) {
+    memset(&tzids_to_rename, 0, sizeof(tzids_to_rename));
+    tzids_to_rename.pairs = icalarray_new(sizeof(icaltzidrename), 16);
+    if (!tzids_to_rename.pairs) {
         return;
     }
 
@@ -2143,23 +2460,27 @@ void icalcomponent_merge_component(icalcomponent *comp, icalcomponent *comp_to_m
         next_subcomp = icalcomponent_get_next_component(comp_to_merge, ICAL_VTIMEZONE_COMPONENT);
         /* This will add the VTIMEZONE to comp, if necessary, and also update
            the array of TZIDs we need to rename. */
-        icalcomponent_merge_vtimezone(comp, subcomp, tzids_to_rename);
+        icalcomponent_merge_vtimezone(comp, subcomp, &tzids_to_rename);
         /* FIXME: Handle possible NEWFAILED error. */
 
         subcomp = next_subcomp;
     }
 
     /* If we need to do any renaming of TZIDs, do it now. */
-    if (tzids_to_rename->num_elements != 0) {
-        icalcomponent_rename_tzids(comp_to_merge, tzids_to_rename);
+    if (tzids_to_rename.pairs->num_elements != 0) {
+        icalcomponent_rename_tzids(comp_to_merge, &tzids_to_rename);
 
         /* Now free the tzids_to_rename array. */
-        for (i = 0; i < tzids_to_rename->num_elements; i++) {
-            icalmemory_free_buffer(icalarray_element_at(tzids_to_rename, i));
+        for (i = 0; i < tzids_to_rename.pairs->num_elements; i++) {
+            icaltzidrename *rename = icalarray_element_at(tzids_to_rename.pairs, i);
+
+            icalmemory_free_buffer(rename->from);
+            icalmemory_free_buffer(rename->to);
         }
     }
-    icalarray_free(tzids_to_rename);
-    tzids_to_rename = 0;
+    icalmemory_free_buffer(tzids_to_rename.slots);
+    icalarray_free(tzids_to_rename.pairs);
+
     /* Now move all the components from comp_to_merge to comp, excluding
        VTIMEZONE components. */
     subcomp = icalcomponent_get_first_component(comp_to_merge, ICAL_ANY_COMPONENT);
@@ -2178,11 +2499,13 @@ void icalcomponent_merge_component(icalcomponent *comp, icalcomponent *comp_to_m
 }
 
 static void icalcomponent_merge_vtimezone(icalcomponent *comp,
-                                          icalcomponent *vtimezone, icalarray *tzids_to_rename)
+                                          icalcomponent *vtimezone,
+                                          icaltzidrenames *tzids_to_rename)
 {
     icalproperty *tzid_prop;
     const char *tzid;
-    char *tzid_copy;
+    char *tzid_copy, *content, *existing_content;
+    uint32_t content_hash, existing_content_hash;
     icaltimezone *existing_vtimezone;
 
     /* Get the TZID of the VTIMEZONE. */
@@ -2223,108 +2546,134 @@ static void icalcomponent_merge_vtimezone(icalcomponent *comp,
         return;
     }
 
-    if (!icalcomponent_compare_vtimezones(comp, vtimezone)) {
-        /* FIXME: Handle possible NEWFAILED error. */
-
+    /* The content of the new VTIMEZONE is serialized and hashed once, and
+       then compared with each of the candidates in comp. */
+    content = icalcomponent_get_vtimezone_content(vtimezone, &content_hash);
+    existing_content =
+        icalcomponent_get_vtimezone_content(icaltimezone_get_component(existing_vtimezone),
+                                            &existing_content_hash);
+    if (content && existing_content &&
+        (content_hash != existing_content_hash || strcmp(content, existing_content) != 0)) {
         /* Now we have two different VTIMEZONEs with the same TZID. */
-        icalcomponent_handle_conflicting_vtimezones(comp, vtimezone, tzid_prop,
-                                                    tzid_copy, tzids_to_rename);
+        icalcomponent_handle_conflicting_vtimezones(comp, vtimezone, tzid_copy,
+                                                    content, content_hash, tzids_to_rename);
     }
+    /* FIXME: Handle possible NEWFAILED error. */
+
+    icalmemory_free_buffer(existing_content);
+    icalmemory_free_buffer(content);
     icalmemory_free_buffer(tzid_copy);
 }
 
 static void icalcomponent_handle_conflicting_vtimezones(icalcomponent *comp,
                                                         icalcomponent *vtimezone,
-                                                        icalproperty *tzid_prop,
                                                         const char *tzid,
-                                                        icalarray *tzids_to_rename)
+                                                        const char *content,
+                                                        uint32_t content_hash,
+                                                        icaltzidrenames *tzids_to_rename)
 {
     int suffix, max_suffix = 0;
-    size_t i, num_elements, tzid_len;
-    char *tzid_copy, *new_tzid, suffix_buf[32];
-
-    _unused(tzid_prop);
+    size_t i, lower, upper, num_elements, tzid_len;
+    char *new_tzid, suffix_buf[32];
 
     /* Find the length of the TZID without any trailing digits. */
     tzid_len = icalcomponent_get_tzid_prefix_len(tzid);
 
-    /* Step through each of the VTIMEZONEs in comp. We may already have the
-       clashing VTIMEZONE in the calendar, but it may have been renamed
-       (i.e. a unique number added on the end of the TZID, e.g. 'London2').
-       So we compare the new VTIMEZONE with any VTIMEZONEs that have the
-       same prefix (e.g. 'London'). If it matches any of those, we have to
-       rename the TZIDs to that TZID, else we rename to a new TZID, using
-       the biggest numeric suffix found + 1. */
+    /* We may already have the clashing VTIMEZONE in the calendar, but it
+       may have been renamed (i.e. a unique number added on the end of the
+       TZID, e.g. 'London2'). So we compare the new VTIMEZONE with any
+       VTIMEZONEs that have the same prefix (e.g. 'London'). If it matches
+       any of those, we have to rename the TZIDs to that TZID, else we rename
+       to a new TZID, using the biggest numeric suffix found + 1.
+       The timezones are sorted by TZID, so the ones with the same prefix are
+       next to each other, starting at the first one not less than the
+       prefix. */
+    icalcomponent_sort_timezones(comp);
     num_elements = comp->timezones ? comp->timezones->num_elements : 0;
-    for (i = 0; i < num_elements; i++) {
+    lower = 0;
+    upper = num_elements;
+    while (lower < upper) {
+        size_t middle = (lower + upper) >> 1;
+        icaltimezone *zone = icalarray_element_at(comp->timezones, middle);
+
+        if (strncmp(icaltimezone_get_tzid(zone), tzid, tzid_len) < 0) {
+            lower = middle + 1;
+        } else {
+            upper = middle;
+        }
+    }
+
+    for (i = lower; i < num_elements; i++) {
         icaltimezone *zone;
         const char *existing_tzid;
-        char *existing_tzid_copy;
+        char *existing_content;
+        uint32_t existing_content_hash;
         size_t existing_tzid_len;
+        bool same;
 
         zone = icalarray_element_at(comp->timezones, i);
         existing_tzid = icaltimezone_get_tzid(zone);
 
+        /* Check if we have the same prefix. */
+        if (strncmp(tzid, existing_tzid, tzid_len) != 0) {
+            break;
+        }
+
         /* Find the length of the TZID without any trailing digits. */
         existing_tzid_len = icalcomponent_get_tzid_prefix_len(existing_tzid);
+        if (existing_tzid_len != tzid_len) {
+            continue;
+        }
 
-        /* Check if we have the same prefix. */
-        if (tzid_len == existing_tzid_len && !strncmp(tzid, existing_tzid, tzid_len)) {
-            /* Compare the VTIMEZONEs. */
-            if (icalcomponent_compare_vtimezones(icaltimezone_get_component(zone), vtimezone)) {
-                /* The VTIMEZONEs match, so we can use the existing VTIMEZONE. But
-                   we have to rename TZIDs to this TZID. */
-                tzid_copy = icalmemory_strdup(tzid);
-                if (!tzid_copy) {
-                    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-                    return;
-                }
-                existing_tzid_copy = icalmemory_strdup(existing_tzid);
-                if (!existing_tzid_copy) {
-                    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-                    icalmemory_free_buffer(tzid_copy);
-                } else {
-                    icalarray_append(tzids_to_rename, tzid_copy);
-                    icalmemory_free_buffer(tzid_copy);
-                    icalarray_append(tzids_to_rename, existing_tzid_copy);
-                    icalmemory_free_buffer(existing_tzid_copy);
-                }
-                return;
-            } else {
-                /* FIXME: Handle possible NEWFAILED error. */
+        /* Convert the suffix to an integer and remember the maximum numeric
+           suffix found. */
+        suffix = atoi(existing_tzid + existing_tzid_len);
+        if (max_suffix < suffix) {
+            max_suffix = suffix;
+        }
 
-                /* Convert the suffix to an integer and remember the maximum numeric
-                   suffix found. */
-                suffix = atoi(existing_tzid + existing_tzid_len);
-                if (max_suffix < suffix) {
-                    max_suffix = suffix;
-                }
-            }
+        /* The VTIMEZONE with the same TZID is known to be different. */
+        if (!strcmp(tzid, existing_tzid)) {
+            continue;
         }
-    }
 
-    /* We didn't find a VTIMEZONE that matched, so we have to rename the TZID,
-       using the maximum numerical suffix found + 1. */
-    tzid_copy = icalmemory_strdup(tzid);
-    if (!tzid_copy) {
-        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-        return;
+        /* Compare the VTIMEZONEs. */
+        existing_content =
+            icalcomponent_get_vtimezone_content(icaltimezone_get_component(zone),
+                                                &existing_content_hash);
+        if (!existing_content) {
+            /* FIXME: Handle possible NEWFAILED error. */
+            continue;
+        }
+        same = (content_hash == existing_content_hash && !strcmp(content, existing_content));
+        icalmemory_free_buffer(existing_content);
+
+        if (same) {
+            /* The VTIMEZONEs match, so we can use the existing VTIMEZONE. But
+               we have to rename TZIDs to this TZID. */
+            icalcomponent_add_tzid_rename(tzids_to_rename, tzid, existing_tzid);
+            return;
+        }
     }
 
+    /* We didn't find a VTIMEZONE that matched, so we have to rename the TZID,
+       using the maximum numerical suffix found + 1, and add the VTIMEZONE
+       to comp with the new TZID. */
     snprintf(suffix_buf, sizeof(suffix_buf), "%i", max_suffix + 1);
     new_tzid = icalmemory_new_buffer(tzid_len + strlen(suffix_buf) + 1);
     if (!new_tzid) {
         icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-        icalmemory_free_buffer(tzid_copy);
         return;
     }
 
     strncpy(new_tzid, tzid, tzid_len);
     strcpy(new_tzid + tzid_len, suffix_buf);
-    icalarray_append(tzids_to_rename, tzid_copy);
-    icalarray_append(tzids_to_rename, new_tzid);
-    icalmemory_free_buffer(tzid_copy);
+    icalcomponent_add_tzid_rename(tzids_to_rename, tzid, new_tzid);
+    icalproperty_set_tzid(icalcomponent_get_first_property(vtimezone, ICAL_TZID_PROPERTY), new_tzid);
     icalmemory_free_buffer(new_tzid);
+
+    icalcomponent_remove_component(icalcomponent_get_parent(vtimezone), vtimezone);
+    icalcomponent_add_component(comp, vtimezone);
 }
 
 /* Returns the length of the TZID, without any trailing digits. */
@@ -2343,34 +2692,150 @@ static size_t icalcomponent_get_tzid_prefix_len(const char *tzid)
     return len;
 }
 
+static uint32_t icalcomponent_hash_string(const char *str)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
 /**
- * Renames all references to the given TZIDs to a new name. rename_table
+ * Returns the VTIMEZONE serialized with an empty TZID, so that it can be
+ * compared with other VTIMEZONEs ignoring their TZIDs, and sets hash to the
+ * hash of the string. Returns NULL on error.
+ */
+static char *icalcomponent_get_vtimezone_content(icalcomponent *vtimezone, uint32_t *hash)
+{
+    icalproperty *prop;
+    const char *tzid;
+    char *tzid_copy, *content;
+
+    prop = icalcomponent_get_first_property(vtimezone, ICAL_TZID_PROPERTY);
+    if (!prop) {
+        return NULL;
+    }
+
+    tzid = icalproperty_get_tzid(prop);
+    if (!tzid) {
+        return NULL;
+    }
+
+    tzid_copy = icalmemory_strdup(tzid);
+    if (!tzid_copy) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return NULL;
+    }
+
+    icalproperty_set_tzid(prop, "");
+    content = icalcomponent_as_ical_string_r(vtimezone);
+    icalproperty_set_tzid(prop, tzid_copy);
+    icalmemory_free_buffer(tzid_copy);
+
+    if (content) {
+        *hash = icalcomponent_hash_string(content);
+    }
+
+    return content;
+}
+
+/* Adds a pair of the current TZID and the new TZID to rename it to. */
+static void icalcomponent_add_tzid_rename(icaltzidrenames *renames,
+                                          const char *from, const char *to)
+{
+    icaltzidrename rename;
+
+    rename.from = icalmemory_strdup(from);
+    rename.to = icalmemory_strdup(to);
+    if (!rename.from || !rename.to) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        icalmemory_free_buffer(rename.from);
+        icalmemory_free_buffer(rename.to);
+        return;
+    }
+
+    icalarray_append(renames->pairs, &rename);
+}
+
+/* Returns the TZID to rename the given TZID to, or NULL if it is kept. */
+static const char *icalcomponent_find_tzid_rename(icaltzidrenames *renames, const char *tzid)
+{
+    icaltzidrename *rename;
+    size_t slot, i;
+
+    if (!renames->slots) {
+        /* Index the pairs by the current TZID, the first pair for a TZID
+           taking precedence. The slots hold the pair index + 1. */
+        size_t num_slots = 16;
+
+        while (num_slots < 2 * renames->pairs->num_elements) {
+            num_slots *= 2;
+        }
+
+        renames->slots = icalmemory_new_buffer(num_slots * sizeof(size_t));
+        if (!renames->slots) {
+            return NULL;
+        }
+        memset(renames->slots, 0, num_slots * sizeof(size_t));
+        renames->mask = num_slots - 1;
+
+        for (i = 0; i < renames->pairs->num_elements; i++) {
+            rename = icalarray_element_at(renames->pairs, i);
+            slot = icalcomponent_hash_string(rename->from) & renames->mask;
+            while (renames->slots[slot] &&
+                   strcmp(rename->from,
+                          ((icaltzidrename *)icalarray_element_at(
+                               renames->pairs, renames->slots[slot] - 1))
+                              ->from) != 0) {
+                slot = (slot + 1) & renames->mask;
+            }
+            if (!renames->slots[slot]) {
+                renames->slots[slot] = i + 1;
+            }
+        }
+    }
+
+    slot = icalcomponent_hash_string(tzid) & renames->mask;
+    while (renames->slots[slot]) {
+        rename = icalarray_element_at(renames->pairs, renames->slots[slot] - 1);
+        if (!strcmp(tzid, rename->from)) {
+            return rename->to;
+        }
+        slot = (slot + 1) & renames->mask;
+    }
+
+    return NULL;
+}
+
+/**
+ * Renames all references to the given TZIDs to a new name. renames
  * contains pairs of strings - a current TZID, and the new TZID to rename it
  * to.
  */
-static void icalcomponent_rename_tzids(icalcomponent *comp, icalarray *rename_table)
+static void icalcomponent_rename_tzids(icalcomponent *comp, icaltzidrenames *renames)
 {
-    icalcomponent_foreach_tzid(comp, icalcomponent_rename_tzids_callback, rename_table);
+    icalcomponent_foreach_tzid(comp, icalcomponent_rename_tzids_callback, renames);
 }
 
 static void icalcomponent_rename_tzids_callback(icalparameter *param, void *data)
 {
-    icalarray *rename_table = data;
-    const char *tzid;
-    size_t i;
+    icaltzidrenames *renames = data;
+    const char *tzid, *new_tzid;
 
     tzid = icalparameter_get_tzid(param);
     if (!tzid) {
         return;
     }
 
-    /* Step through the rename table to see if the current TZID matches
-       any of the ones we want to rename. */
-    for (i = 0; i < rename_table->num_elements - 1; i += 2) {
-        if (!strcmp(tzid, icalarray_element_at(rename_table, i))) {
-            icalparameter_set_tzid(param, icalarray_element_at(rename_table, i + 1));
-            break;
-        }
+    /* Look up the current TZID in the rename table. */
+    new_tzid = icalcomponent_find_tzid_rename(renames, tzid);
+    if (new_tzid) {
+        icalparameter_set_tzid(param, new_tzid);
     }
 }
 
@@ -2424,10 +2889,7 @@ icaltimezone *icalcomponent_get_timezone(icalcomponent *comp, const char *tzid)
     }
 
     /* Sort the array if necessary (by the TZID string). */
-    if (!comp->timezones_sorted) {
-        icalarray_sort(comp->timezones, icalcomponent_compare_timezone_fn);
-        comp->timezones_sorted = 1;
-    }
+    icalcomponent_sort_timezones(comp);
 
     /* Do a simple binary search. */
     lower = 0;
@@ -2452,6 +2914,14 @@ icaltimezone *icalcomponent_get_timezone(icalcomponent *comp, const char *tzid)
     return NULL;
 }
 
+static void icalcomponent_sort_timezones(icalcomponent *comp)
+{
+    if (comp->timezones && !comp->timezones_sorted) {
+        icalarray_sort(comp->timezones, icalcomponent_compare_timezone_fn);
+        comp->timezones_sorted = 1;
+    }
+}
+
 /**
  * A function to compare 2 icaltimezone elements, used for qsort().
  */
@@ -2469,75 +2939,6 @@ static int icalcomponent_compare_timezone_fn(const void *elem1, const void *elem
     return strcmp(zone1_tzid, zone2_tzid);
 }
 
-/**
- * Compares 2 VTIMEZONE components to see if they match, ignoring their TZIDs.
- * It returns 1 if they match, 0 if they don't, or -1 on error.
- */
-static int icalcomponent_compare_vtimezones(icalcomponent *vtimezone1, icalcomponent *vtimezone2)
-{
-    icalproperty *prop1, *prop2;
-    const char *tzid1, *tzid2;
-    char *tzid2_copy, *string1, *string2;
-    int cmp;
-
-    /* Get the TZID property of the first VTIMEZONE. */
-    prop1 = icalcomponent_get_first_property(vtimezone1, ICAL_TZID_PROPERTY);
-    if (!prop1) {
-        return -1;
-    }
-
-    tzid1 = icalproperty_get_tzid(prop1);
-    if (!tzid1) {
-        return -1;
-    }
-
-    /* Get the TZID property of the second VTIMEZONE. */
-    prop2 = icalcomponent_get_first_property(vtimezone2, ICAL_TZID_PROPERTY);
-    if (!prop2) {
-        return -1;
-    }
-
-    tzid2 = icalproperty_get_tzid(prop2);
-    if (!tzid2) {
-        return -1;
-    }
-
-    /* Copy the second TZID, and set the property to the same as the first
-       TZID, since we don't care if these match of not. */
-    tzid2_copy = icalmemory_strdup(tzid2);
-    if (!tzid2_copy) {
-        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-        return 0;
-    }
-
-    icalproperty_set_tzid(prop2, tzid1);
-
-    /* Now convert both VTIMEZONEs to strings and compare them. */
-    string1 = icalcomponent_as_ical_string_r(vtimezone1);
-    if (!string1) {
-        icalmemory_free_buffer(tzid2_copy);
-        return -1;
-    }
-
-    string2 = icalcomponent_as_ical_string_r(vtimezone2);
-    if (!string2) {
-        icalmemory_free_buffer(string1);
-        icalmemory_free_buffer(tzid2_copy);
-        return -1;
-    }
-
-    cmp = strcmp(string1, string2);
-
-    icalmemory_free_buffer(string1);
-    icalmemory_free_buffer(string2);
-
-    /* Now reset the second TZID. */
-    icalproperty_set_tzid(prop2, tzid2_copy);
-    icalmemory_free_buffer(tzid2_copy);
-
-    return (cmp == 0) ? 1 : 0;
-}
-
 /**
  * @brief Sets the RELCALID property of a component.
  *
@@ -2804,6 +3205,44 @@ static int comp_compare(void *a, void *b)
     return r;
 }
 
+void icalcomponent_sort_by_dtstart(icalcomponent **comps, size_t n)
+{
+    icaltimekeyed *keyed;
+    icalcomponent **sorted;
+    size_t i;
+
+    icalerror_check_arg_rv(comps || n == 0, "comps");
+
+    if (n < 2) {
+        return;
+    }
+
+    keyed = icalmemory_new_buffer(n * sizeof(icaltimekeyed));
+    sorted = icalmemory_new_buffer(n * sizeof(icalcomponent *));
+    if (!keyed || !sorted) {
+        icalmemory_free_buffer(keyed);
+        icalmemory_free_buffer(sorted);
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct icaltimetype dtstart = icalcomponent_get_dtstart(comps[i]);
+
+        keyed[i].key = icaltime_is_null_time(dtstart) ? INT64_MIN : icaltime_sort_key(dtstart);
+        keyed[i].index = i;
+    }
+    icaltime_sort_keyed(keyed, n);
+
+    for (i = 0; i < n; i++) {
+        sorted[i] = comps[keyed[i].index];
+    }
+    memcpy(comps, sorted, n * sizeof(icalcomponent *));
+
+    icalmemory_free_buffer(keyed);
+    icalmemory_free_buffer(sorted);
+}
+
 void icalcomponent_normalize(icalcomponent *comp)
 {
     icalproperty *prop;
@@ -470,12 +470,62 @@ LIBICAL_ICAL_EXPORT void icalcomponent_foreach_recurrence(icalcomponent *comp,
                                                                            void *data),
                                                           void *callback_data);
 
+/**
+ * @brief Cycles through all recurrences of the components of a calendar,
+ * expanding them in parallel.
+ *
+ * @param comp           A valid VCALENDAR component
+ * @param start          Ignore timespans before this
+ * @param end            Ignore timespans after this
+ * @param num_threads    The maximum number of threads to use, or 0 to use
+ *                       one per online processor
+ * @param callback       Function called for each timespan within the range
+ * @param callback_data  Pointer passed back to the callback function
+ *
+ * Like calling icalcomponent_foreach_recurrence() on each child component
+ * of @p comp, but the children are shared out to a number of worker threads,
+ * and the timespans of all of them are passed to @p callback in the order
+ * of their start times (the timespans of the same start time in the order of
+ * the children).  The callback is always called from the calling thread,
+ * after all of the children have been expanded.
+ *
+ * The children must not be accessed by other threads during the call.
+ * Without thread support, or if @p comp is not a VCALENDAR, the expansion
+ * is done in the calling thread.
+ *
+ * If the timespans cannot all be stored, ::icalerrno is set to
+ * ::ICAL_NEWFAILED_ERROR and @p callback is not called.
+ *
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icalcomponent_foreach_recurrence_parallel(icalcomponent *comp,
+                                                                   struct icaltimetype start,
+                                                                   struct icaltimetype end,
+                                                                   int num_threads,
+                                                                   void (*callback)(const icalcomponent *comp,
+                                                                                    const struct icaltime_span *span,
+                                                                                    void *data),
+                                                                   void *callback_data);
+
 /**
  * @brief Normalizes (reorders and sorts the properties) the specified icalcomponent @p comp.
  * @since 3.0
  */
 LIBICAL_ICAL_EXPORT void icalcomponent_normalize(icalcomponent *comp);
 
+/**
+ * @brief Sorts an array of components by the icaltime_sort_key() of their DTSTART.
+ *
+ * The DTSTART of each component is looked up and converted once, rather
+ * than on every comparison. Components without a DTSTART sort first, and
+ * components with equal keys keep their order.
+ *
+ * @param comps The components to sort, in place
+ * @param n The number of components
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icalcomponent_sort_by_dtstart(icalcomponent **comps, size_t n);
+
 /**
  * Computes the datetime corresponding to the specified @p icalproperty and @p icalcomponent.
  * If the property is a DATE-TIME with a TZID parameter and a corresponding VTIMEZONE
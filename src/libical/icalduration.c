@@ -19,6 +19,8 @@
 #include "icaltime.h"
 #include "icaltimezone.h"
 
+#include <stdint.h>
+
 /* From Seth Alves, <alves@hungry.com>   */
 struct icaldurationtype icaldurationtype_from_int(int t)
 {
@@ -42,7 +44,8 @@ struct icaldurationtype icaldurationtype_from_string(const char *str)
     int time_flag = 0;
     int date_flag = 0;
     int digits = -1;
-    int scan_size = -1;
+    int64_t value;
+    int j;
     int size = (int)strlen(str);
     char p;
     struct icaldurationtype d;
@@ -99,12 +102,13 @@ struct icaldurationtype icaldurationtype_from_string(const char *str)
             if (begin_flag == 0) {
                 goto error;
             }
-            /* Get all of the digits, not one at a time */
-            scan_size = sscanf(&str[i], "%10d", &digits); /*limit to 10digits.
-                                                                  increase as needed */
-            if (scan_size == 0) {
-                goto error;
+            /* Get all of the digits, not one at a time, limited to 10 digits
+               like sscanf("%10d") */
+            value = 0;
+            for (j = i; j < size && j < i + 10 && str[j] >= '0' && str[j] <= '9'; j++) {
+                value = value * 10 + (str[j] - '0');
             }
+            digits = (int)value;
             break;
         }
 
@@ -1146,6 +1146,8 @@ struct icalrecur_iterator_impl {
     struct icaltimetype iend;   /* Gregorian end time for iterator */
     struct icaltimetype last;   /* last time returned from iterator */
     int32_t occurrence_no;      /* number of steps made on the iterator */
+    int32_t start_no;           /* occurrence_no when positioned at istart */
+    bool prev_pending;          /* icalrecur_iterator_prev() returns last first */
 
     int32_t set_pos;             /* our position in the recurrence set */
     int32_t recurrence_set_size; /* the size of the recurrence set */
@@ -1176,6 +1178,20 @@ struct icalrecur_iterator_impl {
 
     icalrecurrencetype_byrule byrule;
     icalrecurrence_iterator_by_data bydata[ICAL_BY_NUM_PARTS];
+
+    /* State of icalrecur_iterator_next_timet() and icalrecur_iterator_prev(),
+       which step in local seconds (see __greg_local_seconds()) for countable
+       rules.  Once they do, icalrecur_iterator_next() continues the same way,
+       and the above is stale until the iterator is restarted. */
+    bool fast_active;
+    bool fast_pending;                /* nothing returned since positioning */
+    struct recur_period *fast_period; /* the current period */
+    int32_t fast_index;               /* index in the period of the next occurrence */
+    int32_t fast_total;               /* number of occurrences in the period */
+    int64_t fast_begin;               /* no occurrences before this time */
+    int64_t fast_end;                 /* no occurrences from this time on */
+
+    int start_bydata_indices[ICAL_BY_NUM_PARTS]; /* BY indices as set up for DTSTART */
 };
 
 static void daysmask_clearall(unsigned long mask[])
@@ -1289,12 +1305,75 @@ static int __greg_month_diff(icaltimetype a, icaltimetype b)
     return (12 * (b.year - a.year) + (b.month - a.month));
 }
 
+/** Floor division, rounding towards negative infinity */
+static int64_t __floor_div(int64_t a, int64_t b)
+{
+    return (a / b) - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+/** Calculate the number of days from 1970-01-01 to a Gregorian date */
+static int64_t __greg_days_from_civil(int year, int month, int day)
+{
+    int64_t y = (int64_t)year - (month <= 2);
+    int64_t era = __floor_div(y, 400);
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/** Calculate the Gregorian date that is a number of days from 1970-01-01 */
+static void __greg_civil_from_days(int64_t days, int *year, int *month, int *day)
+{
+    int64_t z = days + 719468;
+    int64_t era = __floor_div(z, 146097);
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+
+    *day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *year = (int)(era * 400 + yoe + (*month <= 2));
+}
+
+/** Convert a Gregorian date-time to seconds on a continuous local time line.
+    The time zone is ignored, just like the iterator does when stepping. */
+static int64_t __greg_local_seconds(icaltimetype tt)
+{
+    return __greg_days_from_civil(tt.year, tt.month, tt.day) * 86400 +
+           tt.hour * 3600 + tt.minute * 60 + tt.second;
+}
+
+/** Whether HOURLY, MINUTELY and SECONDLY steps of @p impl are elapsed time
+    rather than local time.  ICU steps them in the time zone of DTSTART,
+    which skips or repeats local times at DST changes, so that the local
+    times of the occurrences depend on each change since DTSTART. */
+static bool recur_steps_elapsed(icalrecur_iterator *impl)
+{
+#if defined(HAVE_LIBICU)
+    return impl->rule->freq <= ICAL_HOURLY_RECURRENCE && impl->dtstart.zone &&
+           impl->dtstart.zone != icaltimezone_get_utc_timezone();
+#else
+    _unused(impl);
+    return false;
+#endif
+}
+
+/** Calculate the number of whole units of @p unit seconds between 2 dates */
+static int64_t unit_diff(icaltimetype a, icaltimetype b, int unit)
+{
+    return __floor_div(__greg_local_seconds(b), unit) -
+           __floor_div(__greg_local_seconds(a), unit);
+}
+
 static void __get_start_time(icalrecur_iterator *impl, icaltimetype date,
                              int *hour, int *minute, int *second)
 {
     icalrecurrencetype_frequency freq = impl->rule->freq;
 
-    if (freq == ICAL_HOURLY_RECURRENCE) {
+    if (freq <= ICAL_HOURLY_RECURRENCE) {
         *hour = date.hour;
     } else if (has_by_data(impl, ICAL_BY_HOUR)) {
         *hour = impl->bydata[ICAL_BY_HOUR].by.data[0];
@@ -1302,7 +1381,7 @@ static void __get_start_time(icalrecur_iterator *impl, icaltimetype date,
         *hour = impl->rstart.hour;
     }
 
-    if (freq == ICAL_MINUTELY_RECURRENCE) {
+    if (freq <= ICAL_MINUTELY_RECURRENCE) {
         *minute = date.minute;
     } else if (has_by_data(impl, ICAL_BY_MINUTE)) {
         *minute = impl->bydata[ICAL_BY_MINUTE].by.data[0];
@@ -1337,25 +1416,221 @@ static int __day_diff(icalrecur_iterator *impl, icaltimetype a, icaltimetype b);
  *   - Leap months in Chinese and Hebrew calendars are handled differently
  */
 
-icalarray *icalrecurrencetype_rscale_supported_calendars(void)
+/*
+ * The supported calendars are enumerated only once, into a fixed table.
+ */
+#define RSCALE_CALENDARS_MAX 40
+#define RSCALE_CALENDAR_NAME_SIZE 32
+
+static char rscale_calendars[RSCALE_CALENDARS_MAX][RSCALE_CALENDAR_NAME_SIZE];
+static int num_rscale_calendars = 0;
+
+static void rscale_calendars_init(void)
 {
     UErrorCode status = U_ZERO_ERROR;
     UEnumeration *en;
-    icalarray *calendars;
     const char *cal;
 
+    en = ucal_getKeywordValuesForLocale("calendar", "", false, &status);
+    while ((cal = uenum_next(en, NULL, &status)) &&
+           num_rscale_calendars < RSCALE_CALENDARS_MAX) {
+        if (strlen(cal) < RSCALE_CALENDAR_NAME_SIZE) {
+            strcpy(rscale_calendars[num_rscale_calendars++], cal);
+        }
+    }
+    uenum_close(en);
+}
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+static pthread_once_t rscale_calendars_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void rscale_calendars_load(void)
+{
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_once(&rscale_calendars_once, rscale_calendars_init);
+#else
+    static bool loaded = false;
+
+    if (!loaded) {
+        rscale_calendars_init();
+        loaded = true;
+    }
+#endif
+}
+
+static bool rscale_calendar_is_supported(const char *calendar)
+{
+    int i;
+
+    rscale_calendars_load();
+
+    for (i = 0; i < num_rscale_calendars; i++) {
+        if (!strcmp(rscale_calendars[i], calendar)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+icalarray *icalrecurrencetype_rscale_supported_calendars(void)
+{
+    icalarray *calendars;
+    int i;
+
+    rscale_calendars_load();
+
     calendars = icalarray_new(sizeof(const char **), 20);
+    for (i = 0; i < num_rscale_calendars; i++) {
+        const char *cal = rscale_calendars[i];
 
-    en = ucal_getKeywordValuesForLocale("calendar", "", false, &status);
-    while ((cal = uenum_next(en, NULL, &status))) {
-        cal = icalmemory_tmp_copy(cal);
         icalarray_append(calendars, &cal);
     }
-    uenum_close(en);
 
     return calendars;
 }
 
+/*
+ * Opening an ICU calendar loads its locale and time zone data, which is
+ * far more expensive than cloning an open one.  Each thread keeps a few
+ * prototype calendars, by calendar type and time zone, to clone from.
+ */
+#define RSCALE_PROTOTYPES_SIZE 8
+#define RSCALE_TZID_SIZE 64
+
+typedef struct rscale_prototype {
+    char calendar[RSCALE_CALENDAR_NAME_SIZE];
+    char tzid[RSCALE_TZID_SIZE]; /* UTF-8, empty for the unknown zone */
+    UCalendar *ucal;
+} rscale_prototype;
+
+typedef struct rscale_prototypes {
+    int next; /* the entry to replace next when all are used */
+    rscale_prototype entries[RSCALE_PROTOTYPES_SIZE];
+} rscale_prototypes;
+
+static void rscale_prototypes_free(rscale_prototypes *protos)
+{
+    int i;
+
+    for (i = 0; i < RSCALE_PROTOTYPES_SIZE; i++) {
+        if (protos->entries[i].ucal) {
+            ucal_close(protos->entries[i].ucal);
+        }
+    }
+    free(protos);
+}
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+static pthread_key_t rscale_prototypes_key;
+static pthread_once_t rscale_prototypes_key_once = PTHREAD_ONCE_INIT;
+
+static void rscale_prototypes_destroy(void *buf)
+{
+    if (buf) {
+        rscale_prototypes_free((rscale_prototypes *)buf);
+    }
+
+    pthread_setspecific(rscale_prototypes_key, NULL);
+}
+
+static void rscale_prototypes_key_alloc(void)
+{
+    pthread_key_create(&rscale_prototypes_key, rscale_prototypes_destroy);
+}
+#else
+static ICAL_GLOBAL_VAR rscale_prototypes *global_rscale_prototypes = 0;
+#endif
+
+/* Not allocated with icalmemory_new_buffer(), as the prototypes stay around
+   for the lifetime of the thread */
+static rscale_prototypes *get_rscale_prototypes(void)
+{
+    rscale_prototypes *protos;
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_once(&rscale_prototypes_key_once, rscale_prototypes_key_alloc);
+
+    protos = pthread_getspecific(rscale_prototypes_key);
+    if (!protos) {
+        protos = calloc(1, sizeof(rscale_prototypes));
+        pthread_setspecific(rscale_prototypes_key, protos);
+    }
+#else
+    if (!global_rscale_prototypes) {
+        global_rscale_prototypes = calloc(1, sizeof(rscale_prototypes));
+    }
+    protos = global_rscale_prototypes;
+#endif
+
+    return protos;
+}
+
+/** Open a calendar of type @p calendar in the time zone with UTF-8 location
+    @p tzid (or NULL for the unknown zone), cloned from a prototype if possible */
+static UCalendar *rscale_calendar_open(const char *calendar, const char *tzid,
+                                       UErrorCode *status)
+{
+    char locale[ULOC_KEYWORD_AND_VALUES_CAPACITY] = {0};
+    UChar *utzid = (UChar *)UCAL_UNKNOWN_ZONE_ID;
+    rscale_prototypes *protos = get_rscale_prototypes();
+    rscale_prototype *proto = NULL;
+    UCalendar *ucal;
+    int i;
+
+    if (!tzid) {
+        tzid = "";
+    }
+
+    if (protos && strlen(calendar) < RSCALE_CALENDAR_NAME_SIZE &&
+        strlen(tzid) < RSCALE_TZID_SIZE) {
+        for (i = 0; i < RSCALE_PROTOTYPES_SIZE; i++) {
+            proto = &protos->entries[i];
+
+            if (proto->ucal && !strcmp(proto->calendar, calendar) &&
+                !strcmp(proto->tzid, tzid)) {
+                return ucal_clone(proto->ucal, status);
+            }
+        }
+
+        /* Not found: replace the next entry */
+        proto = &protos->entries[protos->next];
+        protos->next = (protos->next + 1) % RSCALE_PROTOTYPES_SIZE;
+        if (proto->ucal) {
+            ucal_close(proto->ucal);
+            proto->ucal = NULL;
+        }
+    }
+
+    /* Convert the UTF8 time zone location to ICU UChar */
+    if (*tzid) {
+        size_t len = (strlen(tzid) + 1) * U_SIZEOF_UCHAR;
+
+        utzid = icalmemory_tmp_buffer(len);
+        utzid = u_strFromUTF8Lenient(utzid, (int32_t)len, NULL, tzid, -1, status);
+        if (U_FAILURE(*status)) {
+            return NULL;
+        }
+    }
+
+    /* Create locale for the calendar */
+    (void)uloc_setKeywordValue("calendar", calendar,
+                               locale, sizeof(locale), status);
+
+    ucal = ucal_open(utzid, -1, locale, UCAL_DEFAULT, status);
+    if (!ucal || U_FAILURE(*status) || !proto) {
+        return ucal;
+    }
+
+    /* Keep it as prototype, and hand out a clone */
+    strcpy(proto->calendar, calendar);
+    strcpy(proto->tzid, tzid);
+    proto->ucal = ucal;
+
+    return ucal_clone(ucal, status);
+}
+
 static void set_second(icalrecur_iterator *impl, int second)
 {
     ucal_set(impl->rscale, UCAL_SECOND, (int32_t)second);
@@ -1698,12 +1973,10 @@ static int initialize_rscale(icalrecur_iterator *impl)
 {
     struct icalrecurrencetype *rule = impl->rule;
     struct icaltimetype dtstart = impl->dtstart;
-    char locale[ULOC_KEYWORD_AND_VALUES_CAPACITY] = {0};
     UErrorCode status = U_ZERO_ERROR;
-    UChar *tzid = (UChar *)UCAL_UNKNOWN_ZONE_ID;
     bool is_hebrew = false;
 
-    /* Convert the UTF8 timezoneid of dstart to ICU UChar. */
+    /* Get the UTF8 timezoneid of dtstart */
     const char *src = icaltimezone_get_location((icaltimezone *)dtstart.zone);
     if (!src) {
         const char *prefix = icaltimezone_tzid_prefix();
@@ -1714,22 +1987,9 @@ static int initialize_rscale(icalrecur_iterator *impl)
             src += strlen(prefix);
         }
     }
-    if (src) {
-        size_t len = (strlen(src) + 1) * U_SIZEOF_UCHAR;
-        tzid = icalmemory_tmp_buffer(len);
-        tzid = u_strFromUTF8Lenient(tzid, (int32_t)len, NULL, src, -1, &status);
-        if (U_FAILURE(status)) {
-            icalerror_set_errno(ICAL_INTERNAL_ERROR);
-            return 0;
-        }
-    }
-
-    /* Create locale for Gregorian calendar */
-    (void)uloc_setKeywordValue("calendar", "gregorian",
-                               locale, sizeof(locale), &status);
 
     /* Create Gregorian calendar and set to DTSTART */
-    impl->greg = ucal_open(tzid, -1, locale, UCAL_DEFAULT, &status);
+    impl->greg = rscale_calendar_open("gregorian", src, &status);
     if (impl->greg) {
         ucal_setDateTime(impl->greg,
                          (int32_t)dtstart.year,
@@ -1748,8 +2008,6 @@ static int initialize_rscale(icalrecur_iterator *impl)
         /* Use Gregorian as RSCALE */
         impl->rscale = impl->greg;
     } else {
-        UEnumeration *en;
-        const char *cal;
         char *r;
 
         /* Lowercase the specified calendar */
@@ -1758,25 +2016,14 @@ static int initialize_rscale(icalrecur_iterator *impl)
         }
 
         /* Check if specified calendar is supported */
-        en = ucal_getKeywordValuesForLocale("calendar", "", false, &status);
-        while ((cal = uenum_next(en, NULL, &status))) {
-            if (!strcmp(cal, rule->rscale)) {
-                is_hebrew = !strcmp(rule->rscale, "hebrew");
-                break;
-            }
-        }
-        uenum_close(en);
-        if (!cal) {
+        if (!rscale_calendar_is_supported(rule->rscale)) {
             icalerror_set_errno(ICAL_UNIMPLEMENTED_ERROR);
             return 0;
         }
-
-        /* Create locale for RSCALE calendar */
-        (void)uloc_setKeywordValue("calendar", rule->rscale,
-                                   locale, sizeof(locale), &status);
+        is_hebrew = !strcmp(rule->rscale, "hebrew");
 
         /* Create RSCALE calendar and set to DTSTART */
-        impl->rscale = ucal_open(tzid, -1, locale, UCAL_DEFAULT, &status);
+        impl->rscale = rscale_calendar_open(rule->rscale, src, &status);
         if (impl->rscale) {
             UDate millis = ucal_getMillis(impl->greg, &status);
 
@@ -2222,20 +2469,34 @@ static void adjust_to_byday(icalrecur_iterator *impl)
     /* This depends on impl->bydata[ICAL_BY_DAY].by.data being correctly sorted by
      * day. This should probably be abstracted to make such assumption
      * more explicit. */
+    short week_start = (short)impl->rule->week_start;
     short this_dow = (short)get_day_of_week(impl);
-    short dow = (short)(impl->bydata[ICAL_BY_DAY].by.data[0] - this_dow);
+    short dow = (short)(impl->bydata[ICAL_BY_DAY].by.data[0]);
 
-    /* Normalize day of week around week start */
-    if (dow != 0 && this_dow < (short)impl->rule->week_start) {
-        dow -= 7;
-    }
+    /* Days of week relative to week start */
+    this_dow = (short)((this_dow - week_start + 7) % 7);
+    dow = (short)((dow - week_start + 7) % 7 - this_dow);
 
-    if ((this_dow < impl->bydata[ICAL_BY_DAY].by.data[0] && dow >= 0) || dow < 0) {
-        /* initial time is after first day of ICAL_BY_DAY data */
+    if (dow != 0) {
+        /* Move to the first day of ICAL_BY_DAY data in the same week */
         increment_monthday(impl, dow);
     }
 }
 
+static void save_bydata_indices(icalrecur_iterator *impl, int indices[])
+{
+    for (int byrule = 0; byrule < ICAL_BY_NUM_PARTS; byrule++) {
+        indices[byrule] = impl->bydata[byrule].index;
+    }
+}
+
+static void restore_bydata_indices(icalrecur_iterator *impl, const int indices[])
+{
+    for (int byrule = 0; byrule < ICAL_BY_NUM_PARTS; byrule++) {
+        impl->bydata[byrule].index = indices[byrule];
+    }
+}
+
 icalrecur_iterator *icalrecur_iterator_new(struct icalrecurrencetype *rule,
                                            struct icaltimetype dtstart)
 {
@@ -2359,6 +2620,8 @@ icalrecur_iterator *icalrecur_iterator_new(struct icalrecurrencetype *rule,
         return 0;
     }
 
+    save_bydata_indices(impl, impl->start_bydata_indices);
+
     return impl;
 }
 
@@ -2376,6 +2639,9 @@ void icalrecur_iterator_free(icalrecur_iterator *i)
     }
 #endif
 
+    if (i->fast_period) {
+        icalmemory_free_buffer(i->fast_period);
+    }
     icalrecurrencetype_unref(i->rule);
     icalmemory_free_buffer(i);
 }
@@ -3441,114 +3707,505 @@ static int check_contracting_rules(icalrecur_iterator *impl)
     return 0;
 }
 
-/* Initialize data relating to BYSETPOS, in particular:
- * set_pos, sp_idxp, sp_idxn, and recurrence_set_size.
- * This must be called at the start of each new period
+/*
+ * Members of a recurrence period (a year, month, week, day, ...) are all
+ * combinations of its day offsets with the hour, minute and second lists,
+ * in lexicographic and therefore chronological order.  BYSETPOS selects
+ * among the members of the whole period, or among those of each day if
+ * per_day is set (DAILY rules with BYDAY, which repeat over whole weeks).
  *
- * next == 1 indicates we are advancing the iterator,
- * and so are at the start of a new period, while
- * next == 0 indicates we are at the end of one
+ * This lets us count and locate occurrences without stepping through them.
  */
-static void setup_setpos(icalrecur_iterator *impl, int next)
+struct recur_period {
+    int64_t origin; /* local seconds at day offset 0 */
+    int64_t length; /* seconds from one period to the next (fixed layouts) */
+    int32_t days[ICAL_YEARDAYS_MASK_SIZE]; /* day offsets, ascending */
+    short ndays;
+    const short *hms[3]; /* hour, minute and second lists, ascending */
+    short nhms[3];
+    bool per_day;
+};
+
+static short count_below(const int32_t *list, short n, int64_t v)
 {
-    /* Save data that may be modified */
-    int days_index = impl->days_index;
-    int bydata_indices[ICAL_BY_NUM_PARTS];
-    for (int byrule = 0; byrule < ICAL_BY_NUM_PARTS; byrule++) {
-        bydata_indices[byrule] = impl->bydata[byrule].index;
+    short i = 0;
+
+    while (i < n && list[i] < v) {
+        i++;
     }
-    struct icaltimetype last = impl->last;
 
-    impl->recurrence_set_size = 1;
-    int period_change = 1;
-    do {
-        switch (impl->rule->freq) {
-        case ICAL_SECONDLY_RECURRENCE:
-            break;
-        case ICAL_MINUTELY_RECURRENCE:
-            /* call next_second instead of next_minute
-             * to avoid going to the next minute */
-            period_change = (next ? next_second : prev_second)(impl);
-            break;
-        case ICAL_HOURLY_RECURRENCE:
-            period_change = (next ? next_minute : prev_minute)(impl);
-            break;
-        case ICAL_DAILY_RECURRENCE:
-            period_change = (next ? next_hour : prev_hour)(impl);
-            break;
-        case ICAL_WEEKLY_RECURRENCE:
-            period_change = (next ? next_weekday_by_week : prev_weekday_by_week)(impl);
-            break;
-        case ICAL_MONTHLY_RECURRENCE:
-            /* call next_yearday instead of next_month
-             * to avoid expanding month days */
-            period_change = (next ? next_yearday : prev_yearday)(impl, NULL);
-            break;
-        case ICAL_YEARLY_RECURRENCE:
-            period_change = (next ? next_yearday : prev_yearday)(impl, NULL);
+    return i;
+}
+
+static int32_t period_day_size(const struct recur_period *p)
+{
+    return (int32_t)p->nhms[0] * p->nhms[1] * p->nhms[2];
+}
+
+/** Number of members in a day of the period that are earlier than
+    @p sod seconds into that day */
+static int32_t period_day_rank(const struct recur_period *p, int sod)
+{
+    int v[3] = {sod / 3600, (sod / 60) % 60, sod % 60};
+    int32_t rank = 0, weight = period_day_size(p);
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        short below = 0;
+
+        while (below < p->nhms[i] && p->hms[i][below] < v[i]) {
+            below++;
+        }
+
+        weight /= p->nhms[i];
+        rank += below * weight;
+
+        if (below == p->nhms[i] || p->hms[i][below] != v[i]) {
             break;
-        default:
-            icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
-            return;
         }
-        if (period_change == 0 && check_contracting_rules(impl)) {
-            impl->recurrence_set_size++;
+    }
+
+    return rank;
+}
+
+/** Resolve BYSETPOS against a set of @p size members into ascending,
+    distinct 1-based positions.  Returns the number of positions. */
+static short resolve_setpos(icalrecur_iterator *impl, int32_t size, int32_t pos[])
+{
+    const icalrecurrence_by_data *by = &impl->bydata[ICAL_BY_SET_POS].by;
+    short i, j, n = 0;
+
+    for (i = 0; i < by->size; i++) {
+        int32_t p = (by->data[i] > 0) ? by->data[i] : size + 1 + by->data[i];
+
+        if (p < 1 || p > size) {
+            continue;
         }
-    } while (period_change == 0);
 
-    if (next) {
-        impl->set_pos = 1;
-        impl->sp_idxp = 0;
-        impl->sp_idxn = impl->bydata[ICAL_BY_SET_POS].by.size - 1;
-    } else {
-        impl->set_pos = impl->recurrence_set_size;
-        impl->sp_idxp = impl->sp_pmax;
-        impl->sp_idxn = impl->sp_pmax + 1;
+        for (j = n; j > 0 && pos[j - 1] > p; j--) {
+            pos[j] = pos[j - 1];
+        }
+        if (j > 0 && pos[j - 1] == p) {
+            /* Duplicate, undo the shift */
+            for (; j < n; j++) {
+                pos[j] = pos[j + 1];
+            }
+            continue;
+        }
+        pos[j] = p;
+        n++;
     }
 
-    /* Restore what was modified
-     * Because we do not expand month/year days,
-     * the days bitfield is not modified */
-    set_datetime(impl, last);
-    impl->last = last;
-    impl->days_index = days_index;
-    for (int byrule = 0; byrule < ICAL_BY_NUM_PARTS; byrule++) {
-        impl->bydata[byrule].index = bydata_indices[byrule];
+    return n;
+}
+
+/** Number of members selected by BYSETPOS among the first @p upto
+    members of a set of @p size members */
+static int32_t setpos_rank(icalrecur_iterator *impl, int32_t size, int32_t upto)
+{
+    int32_t pos[ICAL_BY_SETPOS_SIZE];
+    short i, n;
+
+    if (!has_by_data(impl, ICAL_BY_SET_POS)) {
+        return upto;
     }
+
+    n = resolve_setpos(impl, size, pos);
+    for (i = 0; i < n && pos[i] <= upto; i++) {
+    }
+
+    return i;
 }
 
-/* If s1 occurs before s2 in the recurrence set, return -1
- * If s1 occurs after, return 1
- * If they are equal, return 0
- */
-static inline int setpos_cmp(int s1, int s2, int next)
+/** Number of occurrences in the period */
+static int32_t period_total(icalrecur_iterator *impl, const struct recur_period *p)
 {
-    if (s1 < s2) {
-        return (next ? -1 : 1);
-    } else if (s2 < s1) {
-        return (next ? 1 : -1);
+    int32_t day_size = period_day_size(p);
+
+    if (p->per_day) {
+        return p->ndays * setpos_rank(impl, day_size, day_size);
     }
-    return 0;
+
+    return setpos_rank(impl, p->ndays * day_size, p->ndays * day_size);
 }
 
-/* Check whether impl->set_pos is a valid recurrence set position
- *
- * next == 1 indicates that we should increase and decrease
- * sp_idxp and sp_idxn, respectively, while
- * next == 0 indicates that we should decrease and increase them
- */
-static int check_setpos(icalrecur_iterator *impl, int next)
+/** Number of occurrences in the period that are earlier than @p t */
+static int32_t period_rank(icalrecur_iterator *impl, const struct recur_period *p, int64_t t)
 {
-    if (!has_by_data(impl, ICAL_BY_SET_POS)) {
-        return 1;
+    int64_t x = t - p->origin;
+    int32_t day_size = period_day_size(p);
+    int32_t in_day = 0;
+    short before;
+
+    if (x <= 0) {
+        return 0;
     }
-    icalrecurrence_by_data *by = &(impl->bydata[ICAL_BY_SET_POS].by);
-    int32_t set_pos;
 
-    /* If we have positive BYSETPOS data */
-    if (impl->sp_pmax >= 0) {
-        set_pos = by->data[impl->sp_idxp];
-        /* Increment positive index while set_pos is before impl->set_pos */
+    before = count_below(p->days, p->ndays, x / 86400);
+    if (before < p->ndays && p->days[before] == x / 86400) {
+        in_day = period_day_rank(p, (int)(x % 86400));
+    }
+
+    if (p->per_day) {
+        return before * setpos_rank(impl, day_size, day_size) +
+               setpos_rank(impl, day_size, in_day);
+    }
+
+    return setpos_rank(impl, p->ndays * day_size, before * day_size + in_day);
+}
+
+/** Local time of the occurrence with 0-based index @p j in the period */
+static int64_t period_occurrence(icalrecur_iterator *impl, const struct recur_period *p, int32_t j)
+{
+    int32_t day_size = period_day_size(p);
+    int32_t idx = j;
+    int64_t t;
+
+    if (has_by_data(impl, ICAL_BY_SET_POS)) {
+        int32_t pos[ICAL_BY_SETPOS_SIZE];
+
+        if (p->per_day) {
+            short n = resolve_setpos(impl, day_size, pos);
+
+            idx = (j / n) * day_size + pos[j % n] - 1;
+        } else {
+            (void)resolve_setpos(impl, p->ndays * day_size, pos);
+            idx = pos[j] - 1;
+        }
+    }
+
+    t = p->origin + (int64_t)p->days[idx / day_size] * 86400;
+    idx %= day_size;
+    t += p->hms[0][idx / (p->nhms[1] * p->nhms[2])] * 3600;
+    t += p->hms[1][(idx / p->nhms[2]) % p->nhms[1]] * 60;
+    t += p->hms[2][idx % p->nhms[2]];
+
+    return t;
+}
+
+static bool by_is_ascending(const icalrecurrence_by_data *by)
+{
+    short i;
+
+    for (i = 1; i < by->size; i++) {
+        if (by->data[i - 1] >= by->data[i]) {
+            return false;
+        }
+    }
+
+    return (by->size > 0);
+}
+
+/** Whether the occurrences of each period are fully described by the
+    expanding BY* rule parts, with no contracting rule part filtering them
+    afterwards, so that they can be counted per period */
+static bool recur_is_countable(icalrecur_iterator *impl)
+{
+    icalrecurrencetype_frequency freq = impl->rule->freq;
+    int byrule;
+
+    if ((impl->rule->rscale && strcasecmp(impl->rule->rscale, "GREGORIAN")) ||
+        impl->rule->skip != ICAL_SKIP_OMIT) {
+        /* Skipped days may move into another period */
+        return false;
+    }
+
+    if (recur_steps_elapsed(impl)) {
+        /* Periods are counted in local seconds */
+        return false;
+    }
+
+    if (impl->dtstart.is_date && freq <= ICAL_HOURLY_RECURRENCE) {
+        /* Sub-daily rules with a DATE DTSTART are stepped by days */
+        return false;
+    }
+
+    /* The time lists that make up the period must be strictly ascending */
+    if ((freq > ICAL_HOURLY_RECURRENCE &&
+         !by_is_ascending(&impl->bydata[ICAL_BY_HOUR].by)) ||
+        (freq > ICAL_MINUTELY_RECURRENCE &&
+         !by_is_ascending(&impl->bydata[ICAL_BY_MINUTE].by)) ||
+        (freq > ICAL_SECONDLY_RECURRENCE &&
+         !by_is_ascending(&impl->bydata[ICAL_BY_SECOND].by))) {
+        return false;
+    }
+
+    for (byrule = 0; byrule < ICAL_BY_SET_POS; byrule++) {
+        if (!has_by_data(impl, byrule) || expand_map[freq].map[byrule] != CONTRACT) {
+            continue;
+        }
+
+        if (freq == ICAL_MONTHLY_RECURRENCE && byrule == ICAL_BY_MONTH) {
+            /* Handled by increment_month() */
+            continue;
+        }
+
+        if (freq == ICAL_DAILY_RECURRENCE && byrule == ICAL_BY_DAY) {
+            /* Handled by period_fixed() */
+            continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/** Describe the current period of a YEARLY or MONTHLY rule from its
+    year days bitmask */
+static void period_from_daysmask(icalrecur_iterator *impl, struct recur_period *p)
+{
+    short doy;
+
+    /* Bit 0 of the mask is day -ICAL_YEARDAYS_MASK_OFFSET of the year */
+    p->origin = (__greg_days_from_civil(impl->period_start.year, 1, 1) -
+                 ICAL_YEARDAYS_MASK_OFFSET - 1) *
+                86400;
+    p->length = 0;
+    p->per_day = false;
+    p->ndays = 0;
+
+    /* The start month need not match BYMONTH, in which case next()
+       rejects all of its days */
+    if (impl->rule->freq != ICAL_MONTHLY_RECURRENCE ||
+        check_contract_restriction(impl, ICAL_BY_MONTH, impl->period_start.month, NULL)) {
+        for (doy = daymask_find_next_bit(impl->days, -ICAL_YEARDAYS_MASK_OFFSET);
+             doy < ICAL_YEARDAYS_MASK_SIZE - ICAL_YEARDAYS_MASK_OFFSET;
+             doy = daymask_find_next_bit(impl->days, doy + 1)) {
+            p->days[p->ndays++] = doy + ICAL_YEARDAYS_MASK_OFFSET;
+        }
+    }
+
+    p->hms[0] = impl->bydata[ICAL_BY_HOUR].by.data;
+    p->nhms[0] = impl->bydata[ICAL_BY_HOUR].by.size;
+    p->hms[1] = impl->bydata[ICAL_BY_MINUTE].by.data;
+    p->nhms[1] = impl->bydata[ICAL_BY_MINUTE].by.size;
+    p->hms[2] = impl->bydata[ICAL_BY_SECOND].by.data;
+    p->nhms[2] = impl->bydata[ICAL_BY_SECOND].by.size;
+}
+
+/** Describe the first period of a rule whose periods all share the same
+    layout, i.e. WEEKLY and shorter frequencies.  Period k then starts at
+    origin + k * length. */
+static bool period_fixed(icalrecur_iterator *impl, struct recur_period *p)
+{
+    static const short zero = 0;
+    const icalrecurrence_by_data *byday = &impl->bydata[ICAL_BY_DAY].by;
+    struct icaltimetype start = impl->dtstart;
+    int64_t day = __greg_days_from_civil(start.year, start.month, start.day);
+    int64_t interval = impl->rule->interval;
+    int i;
+
+    p->ndays = 1;
+    p->days[0] = 0;
+    p->per_day = false;
+    for (i = 0; i < 3; i++) {
+        p->hms[i] = &zero;
+        p->nhms[i] = 1;
+    }
+
+    switch (impl->rule->freq) {
+    case ICAL_SECONDLY_RECURRENCE:
+        p->origin = __greg_local_seconds(start);
+        p->length = interval;
+        return true;
+
+    case ICAL_MINUTELY_RECURRENCE:
+        p->origin = day * 86400 + start.hour * 3600 + start.minute * 60;
+        p->length = 60 * interval;
+        break;
+
+    case ICAL_HOURLY_RECURRENCE:
+        p->origin = day * 86400 + start.hour * 3600;
+        p->length = 3600 * interval;
+        break;
+
+    case ICAL_DAILY_RECURRENCE:
+        p->origin = day * 86400;
+        p->length = 86400 * interval;
+
+        if (has_by_data(impl, ICAL_BY_DAY)) {
+            /* Fold BYDAY into a period spanning whole weeks */
+            int64_t span = (interval % 7) ? 7 * interval : interval;
+            int weekdays = 0;
+
+            for (i = 0; i < byday->size; i++) {
+                if (icalrecurrencetype_day_position(byday->data[i]) != 0) {
+                    return false;
+                }
+                weekdays |= 1 << (int)icalrecurrencetype_day_day_of_week(byday->data[i]);
+            }
+
+            p->ndays = 0;
+            for (i = 0; i * interval < span; i++) {
+                /* 1970-01-01 was a Thursday */
+                int64_t dow = __floor_div(day + i * interval + 4, 7);
+                dow = day + i * interval + 4 - 7 * dow + ICAL_SUNDAY_WEEKDAY;
+
+                if (weekdays & (1 << dow)) {
+                    p->days[p->ndays++] = (int32_t)(i * interval);
+                }
+            }
+            p->length = 86400 * span;
+            p->per_day = true;
+        }
+        break;
+
+    case ICAL_WEEKLY_RECURRENCE: {
+        int wkst = (int)impl->rule->week_start;
+        int dow = icaltime_day_of_week(start);
+
+        p->origin = (day - (dow - wkst + 7) % 7) * 86400;
+        p->length = 7 * 86400 * interval;
+
+        if (byday->size > 0) {
+            p->ndays = 0;
+            for (i = 0; i < byday->size; i++) {
+                dow = (int)icalrecurrencetype_day_day_of_week(byday->data[i]);
+                p->days[p->ndays] = (dow - wkst + 7) % 7;
+                if (p->ndays > 0 && p->days[p->ndays] <= p->days[p->ndays - 1]) {
+                    return false;
+                }
+                p->ndays++;
+            }
+        } else {
+            p->days[0] = (dow - wkst + 7) % 7;
+        }
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    if (impl->rule->freq != ICAL_MINUTELY_RECURRENCE) {
+        if (impl->rule->freq != ICAL_HOURLY_RECURRENCE) {
+            p->hms[0] = impl->bydata[ICAL_BY_HOUR].by.data;
+            p->nhms[0] = impl->bydata[ICAL_BY_HOUR].by.size;
+        }
+        p->hms[1] = impl->bydata[ICAL_BY_MINUTE].by.data;
+        p->nhms[1] = impl->bydata[ICAL_BY_MINUTE].by.size;
+    }
+    p->hms[2] = impl->bydata[ICAL_BY_SECOND].by.data;
+    p->nhms[2] = impl->bydata[ICAL_BY_SECOND].by.size;
+
+    return true;
+}
+
+/* Initialize data relating to BYSETPOS, in particular:
+ * set_pos, sp_idxp, sp_idxn, and recurrence_set_size.
+ * This must be called at the start of each new period
+ *
+ * next == 1 indicates we are advancing the iterator,
+ * and so are at the start of a new period, while
+ * next == 0 indicates we are at the end of one
+ */
+static void setup_setpos(icalrecur_iterator *impl, int next)
+{
+    /* Save data that may be modified */
+    int days_index = impl->days_index;
+    int bydata_indices[ICAL_BY_NUM_PARTS];
+    save_bydata_indices(impl, bydata_indices);
+    struct icaltimetype last = impl->last;
+
+    if ((impl->rule->freq == ICAL_YEARLY_RECURRENCE ||
+         impl->rule->freq == ICAL_MONTHLY_RECURRENCE) &&
+        recur_is_countable(impl)) {
+        /* Every member of the expanded period is part of the set */
+        struct recur_period p;
+
+        period_from_daysmask(impl, &p);
+        impl->recurrence_set_size = p.ndays * period_day_size(&p);
+    } else {
+        impl->recurrence_set_size = 1;
+        int period_change = 1;
+        do {
+            switch (impl->rule->freq) {
+            case ICAL_SECONDLY_RECURRENCE:
+                break;
+            case ICAL_MINUTELY_RECURRENCE:
+                /* call next_second instead of next_minute
+                 * to avoid going to the next minute */
+                period_change = (next ? next_second : prev_second)(impl);
+                break;
+            case ICAL_HOURLY_RECURRENCE:
+                period_change = (next ? next_minute : prev_minute)(impl);
+                break;
+            case ICAL_DAILY_RECURRENCE:
+                period_change = (next ? next_hour : prev_hour)(impl);
+                break;
+            case ICAL_WEEKLY_RECURRENCE:
+                period_change = (next ? next_weekday_by_week : prev_weekday_by_week)(impl);
+                break;
+            case ICAL_MONTHLY_RECURRENCE:
+                /* call next_yearday instead of next_month
+                 * to avoid expanding month days */
+                period_change = (next ? next_yearday : prev_yearday)(impl, NULL);
+                break;
+            case ICAL_YEARLY_RECURRENCE:
+                period_change = (next ? next_yearday : prev_yearday)(impl, NULL);
+                break;
+            default:
+                icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
+                return;
+            }
+            if (period_change == 0 && check_contracting_rules(impl)) {
+                impl->recurrence_set_size++;
+            }
+        } while (period_change == 0);
+    }
+
+    if (next) {
+        impl->set_pos = 1;
+        impl->sp_idxp = 0;
+        impl->sp_idxn = impl->bydata[ICAL_BY_SET_POS].by.size - 1;
+    } else {
+        impl->set_pos = impl->recurrence_set_size;
+        impl->sp_idxp = impl->sp_pmax;
+        impl->sp_idxn = impl->sp_pmax + 1;
+    }
+
+    /* Restore what was modified
+     * Because we do not expand month/year days,
+     * the days bitfield is not modified */
+    set_datetime(impl, last);
+    impl->last = last;
+    impl->days_index = days_index;
+    restore_bydata_indices(impl, bydata_indices);
+}
+
+/* If s1 occurs before s2 in the recurrence set, return -1
+ * If s1 occurs after, return 1
+ * If they are equal, return 0
+ */
+static inline int setpos_cmp(int s1, int s2, int next)
+{
+    if (s1 < s2) {
+        return (next ? -1 : 1);
+    } else if (s2 < s1) {
+        return (next ? 1 : -1);
+    }
+    return 0;
+}
+
+/* Check whether impl->set_pos is a valid recurrence set position
+ *
+ * next == 1 indicates that we should increase and decrease
+ * sp_idxp and sp_idxn, respectively, while
+ * next == 0 indicates that we should decrease and increase them
+ */
+static int check_setpos(icalrecur_iterator *impl, int next)
+{
+    if (!has_by_data(impl, ICAL_BY_SET_POS)) {
+        return 1;
+    }
+    icalrecurrence_by_data *by = &(impl->bydata[ICAL_BY_SET_POS].by);
+    int32_t set_pos;
+
+    /* If we have positive BYSETPOS data */
+    if (impl->sp_pmax >= 0) {
+        set_pos = by->data[impl->sp_idxp];
+        /* Increment positive index while set_pos is before impl->set_pos */
         while (setpos_cmp(set_pos, impl->set_pos, next) < 0) {
             if (next && impl->sp_idxp < impl->sp_pmax) {
                 impl->sp_idxp++;
@@ -3583,8 +4240,20 @@ static int check_setpos(icalrecur_iterator *impl, int next)
     return 0;
 }
 
+static bool recur_fast_walk(icalrecur_iterator *impl, bool forward, struct icaltimetype *tt);
+
 struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
 {
+    struct icaltimetype next;
+
+    if (impl && recur_fast_walk(impl, true, &next)) {
+        return next;
+    }
+
+    if (impl) {
+        impl->prev_pending = false;
+    }
+
     /* Quit if we reached COUNT or if last time is after the UNTIL time */
     if (!impl ||
         (impl->rule->count != 0 && impl->occurrence_no >= impl->rule->count) ||
@@ -3594,7 +4263,7 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
     }
 
     /* If initial time is valid, return it */
-    if ((impl->occurrence_no == 0) &&
+    if ((impl->occurrence_no == impl->start_no) &&
         (icaltime_compare(impl->last, impl->istart) >= 0) &&
         check_contracting_rules(impl) &&
         check_setpos(impl, 1)) {
@@ -3683,6 +4352,39 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
     return impl->last;
 }
 
+/** Step back to the occurrence before @p impl_last by stepping from DTSTART,
+    for rules whose local times depend on the DST changes since DTSTART */
+static struct icaltimetype __iterator_step_back(icalrecur_iterator *impl,
+                                                const icalrecur_iterator *impl_last)
+{
+    struct icaltimetype next;
+    int32_t count = 0;
+
+    if (!__iterator_set_start(impl, impl->dtstart)) {
+        return icaltime_null_time();
+    }
+    while (!icaltime_is_null_time(next = icalrecur_iterator_next(impl)) &&
+           icaltime_compare(next, impl_last->last) < 0) {
+        count++;
+    }
+
+    if (!__iterator_set_start(impl, impl->dtstart)) {
+        return icaltime_null_time();
+    }
+    while (count-- > 0) {
+        (void)icalrecur_iterator_next(impl);
+    }
+    impl->istart = impl_last->istart;
+
+    if (impl->occurrence_no == 0 ||
+        (!icaltime_is_null_time(impl->istart) &&
+         icaltime_compare(impl->last, impl->istart) < 0)) {
+        return icaltime_null_time();
+    }
+
+    return impl->last;
+}
+
 struct icaltimetype icalrecur_iterator_prev(icalrecur_iterator *impl)
 {
     /* Quit if last time is before the DTSTART time */
@@ -3690,8 +4392,24 @@ struct icaltimetype icalrecur_iterator_prev(icalrecur_iterator *impl)
         return icaltime_null_time();
     }
 
+    struct icaltimetype prev;
+
+    if (impl->prev_pending) {
+        /* The reverse range starts at this occurrence */
+        impl->prev_pending = false;
+        if (icaltime_compare(impl->last, impl->istart) < 0) {
+            return icaltime_null_time();
+        }
+        return impl->last;
+    }
+
+    if (recur_fast_walk(impl, false, &prev)) {
+        return prev;
+    }
+
     int period_change = 1, prev_index;
     icalrecur_iterator impl_last = *impl;
+    struct icaltimetype stepped = impl->last;
 
     /* Iterate until we get the next valid time */
     do {
@@ -3733,6 +4451,13 @@ struct icaltimetype icalrecur_iterator_prev(icalrecur_iterator *impl)
 
         impl->last = occurrence_as_icaltime(impl, 1);
 
+        if (recur_steps_elapsed(impl) && icaltime_compare(impl->last, stepped) >= 0) {
+            /* A time in the hour repeated at the end of DST resolved
+               to its later instance, so stepping back got nowhere */
+            return __iterator_step_back(impl, &impl_last);
+        }
+        stepped = impl->last;
+
         /* Ignore times that are before the DTSTART time */
         if (icaltime_compare(impl->last, impl->dtstart) < 0 ||
             (!icaltime_is_null_time(impl->istart) &&
@@ -3765,16 +4490,32 @@ struct icaltimetype icalrecur_iterator_prev(icalrecur_iterator *impl)
 }
 
 /** Set bydata->index so that bydata->by.data[bydata->index] == tfield, if possible.
+ *  Otherwise, position it so that the next value used is the first one
+ *  after tfield, moving the start time forward with set_unit if tfield
+ *  precedes all of them.
  */
-static void set_bydata_start(icalrecurrence_iterator_by_data *bydata, int tfield)
+static void set_bydata_start(icalrecur_iterator *impl, icalrecurrencetype_byrule byrule,
+                             int tfield, void (*set_unit)(icalrecur_iterator *, int))
 {
-    int bdi;
+    icalrecurrence_iterator_by_data *bydata = &impl->bydata[byrule];
+    int bdi, below = 0;
+
     for (bdi = 0;
          bdi < bydata->by.size; bdi++) {
         if (bydata->by.data[bdi] == tfield) {
             bydata->index = bdi;
             return;
         }
+        if (bydata->by.data[bdi] < tfield) {
+            below++;
+        }
+    }
+
+    if (below > 0) {
+        bydata->index = below - 1;
+    } else if (bydata->by.size > 0) {
+        bydata->index = 0;
+        set_unit(impl, bydata->by.data[0]);
     }
 }
 
@@ -3786,8 +4527,14 @@ static bool __iterator_set_start(icalrecur_iterator *impl, icaltimetype start)
 
     impl->istart = start;
     impl->occurrence_no = 0;
+    impl->start_no = 0;
     impl->days_index = ICAL_YEARDAYS_MASK_SIZE;
 
+    /* Expand from the first values of the BY* rules, as a new iterator does */
+    for (int byrule = 0; byrule < ICAL_BY_NUM_PARTS; byrule++) {
+        impl->bydata[byrule].index = 0;
+    }
+
     /* Set Gregorian start date */
     set_start(impl, start);
 
@@ -3796,16 +4543,19 @@ static bool __iterator_set_start(icalrecur_iterator *impl, icaltimetype start)
         /* For YEARLY rule, begin by setting up the year days array.
            The YEARLY rules work by expanding one year at a time. */
 
+        /* Get start date as RSCALE date */
+        start = occurrence_as_icaltime(impl, 0);
+
         if ((interval > 1) &&
-            (diff = (impl->istart.year - impl->rstart.year) % interval)) {
+            (diff = (start.year - impl->rstart.year) % interval)) {
             /* Specified start year doesn't match interval -
                bump start to first day of next year that matches interval */
             set_day_of_year(impl, 1);
             increment_year(impl, interval - diff);
-        }
 
-        /* Get (adjusted) start date as RSCALE date */
-        start = occurrence_as_icaltime(impl, 0);
+            /* Get (adjusted) start date as RSCALE date */
+            start = occurrence_as_icaltime(impl, 0);
+        }
 
         /* Expand days array for (adjusted) start year -
            fail after hitting the year 20000 if no expanded days match */
@@ -3905,32 +4655,32 @@ static bool __iterator_set_start(icalrecur_iterator *impl, icaltimetype start)
 
     case ICAL_HOURLY_RECURRENCE:
         if ((interval > 1) &&
-            (diff = abs(impl->istart.hour - impl->rstart.hour) % interval)) {
+            (diff = (int)(unit_diff(impl->dtstart, occurrence_as_icaltime(impl, 1), 3600) % interval))) {
             /* Specified hour doesn't match interval -
                bump start to next hour that matches interval */
             increment_hour(impl, interval - diff);
         }
-        set_bydata_start(&impl->bydata[ICAL_BY_HOUR], impl->istart.hour);
+        set_bydata_start(impl, ICAL_BY_HOUR, occurrence_as_icaltime(impl, 0).hour, &set_hour);
         break;
 
     case ICAL_MINUTELY_RECURRENCE:
         if ((interval > 1) &&
-            (diff = abs(impl->istart.minute - impl->rstart.minute) % interval)) {
+            (diff = (int)(unit_diff(impl->dtstart, occurrence_as_icaltime(impl, 1), 60) % interval))) {
             /* Specified minute doesn't match interval -
                bump start to next minute that matches interval */
             increment_minute(impl, interval - diff);
         }
-        set_bydata_start(&impl->bydata[ICAL_BY_MINUTE], impl->istart.minute);
+        set_bydata_start(impl, ICAL_BY_MINUTE, occurrence_as_icaltime(impl, 0).minute, &set_minute);
         break;
 
     case ICAL_SECONDLY_RECURRENCE:
         if ((interval > 1) &&
-            (diff = abs(impl->istart.second - impl->rstart.second) % interval)) {
+            (diff = (int)(unit_diff(impl->dtstart, occurrence_as_icaltime(impl, 1), 1) % interval))) {
             /* Specified second doesn't match interval -
                bump start to next second that matches interval */
             increment_second(impl, interval - diff);
         }
-        set_bydata_start(&impl->bydata[ICAL_BY_SECOND], impl->istart.second);
+        set_bydata_start(impl, ICAL_BY_SECOND, occurrence_as_icaltime(impl, 0).second, &set_second);
         break;
 
     default:
@@ -3952,30 +4702,722 @@ static bool __iterator_set_start(icalrecur_iterator *impl, icaltimetype start)
     return true;
 }
 
-bool icalrecur_iterator_set_start(icalrecur_iterator *impl,
-                                  struct icaltimetype start)
+/** Count the occurrences of a WEEKLY or shorter rule that are earlier
+    than @p target, stopping at @p limit */
+static bool count_fixed(icalrecur_iterator *impl, int64_t target,
+                        int32_t limit, int32_t *count)
 {
-    /* We can't adjust start date if we need to count occurrences */
-    if (impl->rule->count > 0) {
-        icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
+    struct recur_period p;
+    int64_t k, n;
+    int32_t first;
+
+    if (!period_fixed(impl, &p)) {
         return false;
     }
 
-    /* Convert start to same time zone as DTSTART */
-    start = icaltime_convert_to_zone(start, (icaltimezone *)impl->dtstart.zone);
+    first = period_rank(impl, &p, __greg_local_seconds(impl->dtstart));
+    k = __floor_div(target - p.origin, p.length);
+    n = k * period_total(impl, &p) - first;
 
-    if (icaltime_compare(start, impl->dtstart) < 0) {
-        /* If start is before DTSTART, use DTSTART */
-        start = impl->dtstart;
-    } else if (!icaltime_is_null_time(impl->rule->until) &&
-               icaltime_compare(start, impl->rule->until) > 0) {
-        /* If start is after UNTIL, we're done */
-        impl->last = start;
-        return true;
-    }
+    p.origin += k * p.length;
+    n += period_rank(impl, &p, target);
 
-    return __iterator_set_start(impl, start);
-}
+    *count = (int32_t)((n < 0) ? 0 : (n > limit) ? limit : n);
+
+    return true;
+}
+
+/** Count the occurrences of a YEARLY or MONTHLY rule that are earlier
+    than @p target, stopping at @p limit.  One period is expanded at a time,
+    and its occurrences counted from the bitmask. */
+static bool count_daysmask(icalrecur_iterator *impl, struct icaltimetype target,
+                           int32_t limit, int32_t *count)
+{
+    void (*next_period)(icalrecur_iterator *, int) =
+        (impl->rule->freq == ICAL_YEARLY_RECURRENCE) ? &__next_year : &__next_month;
+    int64_t t = __greg_local_seconds(target);
+    struct recur_period p;
+    int64_t n;
+
+    if (!__iterator_set_start(impl, impl->dtstart)) {
+        return false;
+    }
+
+    period_from_daysmask(impl, &p);
+    n = -period_rank(impl, &p, __greg_local_seconds(impl->dtstart));
+
+    for (;;) {
+        int32_t rank = period_rank(impl, &p, t);
+
+        n += rank;
+
+        if (n >= limit || rank < period_total(impl, &p) ||
+            impl->period_start.year > target.year ||
+            impl->period_start.year > MAX_TIME_T_YEAR) {
+            break;
+        }
+
+        /* Increment to and expand the next period */
+        reset_period_start(impl);
+        next_period(impl, impl->rule->interval);
+        period_from_daysmask(impl, &p);
+    }
+
+    *count = (int32_t)((n > limit) ? limit : n);
+
+    return true;
+}
+
+/** Count the occurrences that are earlier than @p target, stopping at
+    @p limit, by stepping through them */
+static bool count_stepping(icalrecur_iterator *impl, struct icaltimetype target,
+                           int32_t limit, int32_t *count)
+{
+    if (!__iterator_set_start(impl, impl->dtstart)) {
+        return false;
+    }
+
+    *count = 0;
+    while (*count < limit) {
+        struct icaltimetype next = icalrecur_iterator_next(impl);
+
+        if (icaltime_is_null_time(next) || icaltime_compare(next, target) >= 0) {
+            break;
+        }
+        (*count)++;
+    }
+
+    return true;
+}
+
+/** Count the occurrences that are earlier than @p target (which must not
+    be earlier than DTSTART), honoring COUNT but not UNTIL.
+    The iterator must be restarted afterwards. */
+static bool __iterator_count_before(icalrecur_iterator *impl, icaltimetype target,
+                                    int32_t *count)
+{
+    int32_t limit = (impl->rule->count > 0) ? impl->rule->count : INT32_MAX;
+    bool counted = false;
+
+    /* Counting may step the BY indices, which __iterator_set_start()
+       does not reset, so save them */
+    int bydata_indices[ICAL_BY_NUM_PARTS];
+    save_bydata_indices(impl, bydata_indices);
+
+    *count = 0;
+
+    if (recur_is_countable(impl)) {
+        switch (impl->rule->freq) {
+        case ICAL_YEARLY_RECURRENCE:
+        case ICAL_MONTHLY_RECURRENCE:
+            counted = count_daysmask(impl, target, limit, count);
+            break;
+        default:
+            counted = count_fixed(impl, __greg_local_seconds(target), limit, count);
+            break;
+        }
+    }
+
+    if (!counted && !count_stepping(impl, target, limit, count)) {
+        return false;
+    }
+
+    restore_bydata_indices(impl, bydata_indices);
+
+    return true;
+}
+
+/** Like __iterator_set_start(), but also restores the number of occurrences
+    that precede @p start, so that a COUNT limit is still honored */
+static bool __iterator_seek(icalrecur_iterator *impl, icaltimetype start)
+{
+    int32_t count;
+
+    if (!__iterator_count_before(impl, start, &count)) {
+        return false;
+    }
+
+    if (!__iterator_set_start(impl, start)) {
+        return false;
+    }
+
+    impl->occurrence_no = impl->start_no = count;
+
+    return true;
+}
+
+/** Like __iterator_seek(), but by stepping from DTSTART, for rules whose
+    occurrences can not be located otherwise */
+static bool __iterator_step_to(icalrecur_iterator *impl, icaltimetype start)
+{
+    if (!__iterator_set_start(impl, impl->dtstart)) {
+        return false;
+    }
+
+    for (;;) {
+        struct icaltimetype next = icalrecur_iterator_next(impl);
+
+        if (icaltime_is_null_time(next)) {
+            break;
+        }
+        if (icaltime_compare(next, start) >= 0) {
+            /* Stay at the occurrence, which next() returns as the first one */
+            impl->occurrence_no--;
+            impl->start_no = impl->occurrence_no;
+            impl->istart = start;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/** Position @p p at the period of the occurrence of a countable rule with
+    0-based index @p n, and set @p j to its index within the period.
+    For YEARLY and MONTHLY rules, the iterator is left at that period.
+    Returns false if there are fewer occurrences. */
+static bool period_locate(icalrecur_iterator *impl, struct recur_period *p,
+                          int32_t n, int32_t *j)
+{
+    int64_t t = __greg_local_seconds(impl->dtstart);
+    int64_t k;
+    int32_t total;
+
+    if (impl->rule->freq == ICAL_YEARLY_RECURRENCE ||
+        impl->rule->freq == ICAL_MONTHLY_RECURRENCE) {
+        void (*next_period)(icalrecur_iterator *, int) =
+            (impl->rule->freq == ICAL_YEARLY_RECURRENCE) ? &__next_year : &__next_month;
+
+        if (!__iterator_set_start(impl, impl->dtstart)) {
+            return false;
+        }
+
+        period_from_daysmask(impl, p);
+        k = (int64_t)n + period_rank(impl, p, t);
+
+        while (k >= (total = period_total(impl, p))) {
+            if (impl->period_start.year > MAX_TIME_T_YEAR) {
+                return false;
+            }
+            k -= total;
+
+            reset_period_start(impl);
+            next_period(impl, impl->rule->interval);
+            period_from_daysmask(impl, p);
+        }
+    } else {
+        if (!period_fixed(impl, p) || (total = period_total(impl, p)) == 0) {
+            return false;
+        }
+
+        k = (int64_t)n + period_rank(impl, p, t);
+        p->origin += (k / total) * p->length;
+        k %= total;
+    }
+
+    *j = (int32_t)k;
+
+    return true;
+}
+
+/** Convert local seconds (see __greg_local_seconds()) to a time like DTSTART */
+static struct icaltimetype occurrence_from_local_seconds(icalrecur_iterator *impl, int64_t t)
+{
+    struct icaltimetype tt = impl->dtstart;
+
+    __greg_civil_from_days(__floor_div(t, 86400), &tt.year, &tt.month, &tt.day);
+    if (!tt.is_date) {
+        t -= __floor_div(t, 86400) * 86400;
+        tt.hour = (int)(t / 3600);
+        tt.minute = (int)(t / 60 % 60);
+        tt.second = (int)(t % 60);
+    }
+
+    return tt;
+}
+
+/** Find the @p n th occurrence (counting from 1) of the recurrence set.
+    Returns the null time if there are fewer occurrences. */
+static struct icaltimetype __iterator_nth_occurrence(icalrecur_iterator *impl, int32_t n)
+{
+    struct icaltimetype tt = icaltime_null_time();
+    struct recur_period p;
+    int32_t j;
+
+    if (!recur_is_countable(impl)) {
+        /* Step through them */
+        int bydata_indices[ICAL_BY_NUM_PARTS];
+
+        save_bydata_indices(impl, bydata_indices);
+        if (__iterator_set_start(impl, impl->dtstart)) {
+            while (n-- > 0) {
+                struct icaltimetype next = icalrecur_iterator_next(impl);
+
+                if (icaltime_is_null_time(next)) {
+                    break;
+                }
+                tt = next;
+            }
+        }
+        restore_bydata_indices(impl, bydata_indices);
+        return tt;
+    }
+
+    if (!period_locate(impl, &p, n - 1, &j)) {
+        return tt;
+    }
+
+    return occurrence_from_local_seconds(impl, period_occurrence(impl, &p, j));
+}
+
+/** Convert @p tt to a bound that orders against the occurrences of the
+    iterator: in the time zone of DTSTART, a DATE (rounded up to the next
+    day) if DTSTART is a DATE, and no later than the last iterable year */
+static struct icaltimetype recur_bound(icalrecur_iterator *impl, struct icaltimetype tt)
+{
+    tt = icaltime_convert_to_zone(tt, (icaltimezone *)impl->dtstart.zone);
+
+    if (impl->dtstart.is_date && !tt.is_date) {
+        bool round_up = (tt.hour || tt.minute || tt.second);
+
+        tt.is_date = 1;
+        tt.hour = tt.minute = tt.second = 0;
+        if (round_up) {
+            icaltime_adjust(&tt, 1, 0, 0, 0);
+        }
+    } else if (!impl->dtstart.is_date && tt.is_date) {
+        tt.is_date = 0;
+        tt.hour = tt.minute = tt.second = 0;
+    }
+
+    if (tt.year > MAX_TIME_T_YEAR) {
+        tt.year = MAX_TIME_T_YEAR + 1;
+        tt.month = tt.day = 1;
+        tt.hour = tt.minute = tt.second = 0;
+    }
+
+    return tt;
+}
+
+/** The earliest bound (see recur_bound()) that no occurrence before
+    UNTIL reaches */
+static struct icaltimetype recur_until_bound(icalrecur_iterator *impl)
+{
+    struct icaltimetype until = impl->rule->until;
+
+    if (impl->dtstart.is_date) {
+        /* A DATE occurrence on the day of UNTIL is always included */
+        until.is_date = 1;
+        until.hour = until.minute = until.second = 0;
+        icaltime_adjust(&until, 1, 0, 0, 0);
+    } else if (until.is_date) {
+        /* A DATE-TIME occurrence on the day of a DATE UNTIL is not */
+        until = recur_bound(impl, until);
+    } else {
+        until = icaltime_convert_to_zone(until, (icaltimezone *)impl->dtstart.zone);
+        icaltime_adjust(&until, 0, 0, 0, 1);
+    }
+
+    return recur_bound(impl, until);
+}
+
+/** Check if @p impl can step through the occurrences in local seconds.
+    These must also be seconds since the epoch: the times are either UTC
+    or floating (which count as UTC), as stepping in a time zone may have
+    to skip or repeat local times.  Sub-daily rules with a DATE DTSTART
+    are not countable, so they are not stepped in seconds either. */
+static bool recur_fast_eligible(icalrecur_iterator *impl)
+{
+    struct recur_period p;
+
+    if ((impl->dtstart.zone && impl->dtstart.zone != icaltimezone_get_utc_timezone()) ||
+        !recur_is_countable(impl)) {
+        return false;
+    }
+
+    /* Periods that are not laid out alike are expanded one at a time */
+    return impl->rule->freq == ICAL_YEARLY_RECURRENCE ||
+           impl->rule->freq == ICAL_MONTHLY_RECURRENCE ||
+           (period_fixed(impl, &p) && period_total(impl, &p) > 0);
+}
+
+/** The end of the iterator in local seconds, for stepping in local seconds.
+    The end is exclusive, unless @p inclusive. */
+static int64_t recur_fast_end(icalrecur_iterator *impl, bool inclusive)
+{
+    int64_t end = __greg_days_from_civil(MAX_TIME_T_YEAR + 1, 1, 1) * 86400;
+
+    if (!icaltime_is_null_time(impl->rule->until)) {
+        int64_t until = __greg_local_seconds(recur_until_bound(impl));
+
+        if (until < end) {
+            end = until;
+        }
+    }
+    if (!icaltime_is_null_time(impl->iend)) {
+        struct icaltimetype tt = impl->iend;
+        int64_t iend;
+
+        if (inclusive) {
+            tt.is_date = 0;
+            icaltime_adjust(&tt, 0, 0, 0, 1);
+        }
+        iend = __greg_local_seconds(recur_bound(impl, tt));
+        if (iend < end) {
+            end = iend;
+        }
+    }
+
+    return end;
+}
+
+/** Move the period of the fast path to the one containing the occurrence
+    with index @p j relative to the current period, and adjust @p j to it.
+    Going back stops at the period that starts the iterator. */
+static bool recur_fast_move(icalrecur_iterator *impl, int32_t *j)
+{
+    struct recur_period *p = impl->fast_period;
+    int inc = impl->rule->interval;
+
+    while (*j >= impl->fast_total || *j < 0) {
+        bool forward = (*j >= 0);
+
+        if (!forward) {
+            /* Where the earlier periods end at the latest: the days of a
+               YEARLY period may reach into the next year */
+            int64_t end = p->origin;
+
+            if (impl->rule->freq == ICAL_YEARLY_RECURRENCE) {
+                end += (int64_t)(ICAL_YEARDAYS_MASK_SIZE - 365) * 86400;
+            } else if (impl->rule->freq == ICAL_MONTHLY_RECURRENCE) {
+                end = __greg_days_from_civil(impl->period_start.year,
+                                             impl->period_start.month, 1) *
+                      86400;
+            }
+
+            if (end <= impl->fast_begin) {
+                /* Earlier periods are before the start */
+                return false;
+            }
+        }
+
+        if (p->length > 0) {
+            /* All periods are alike */
+            p->origin += forward ? p->length : -p->length;
+            *j += forward ? -impl->fast_total : impl->fast_total;
+            continue;
+        }
+
+        if (forward) {
+            if (impl->period_start.year > MAX_TIME_T_YEAR) {
+                return false;
+            }
+            *j -= impl->fast_total;
+        }
+
+        /* Expand the next or previous period */
+        reset_period_start(impl);
+        if (impl->rule->freq == ICAL_YEARLY_RECURRENCE) {
+            __next_year(impl, forward ? inc : -inc);
+        } else {
+            __next_month(impl, forward ? inc : -inc);
+        }
+        period_from_daysmask(impl, p);
+        impl->fast_total = period_total(impl, p);
+
+        if (!forward) {
+            *j += impl->fast_total;
+        }
+    }
+
+    return true;
+}
+
+/** Position @p p at the period containing local time @p t, and set @p j
+    to the index of the first occurrence in it that is not earlier than @p t.
+    This does not count the occurrences before the period, so that the
+    occurrence number is unknown. */
+static bool period_seek(icalrecur_iterator *impl, struct recur_period *p,
+                        int64_t t, int32_t *j)
+{
+    if (impl->rule->freq == ICAL_YEARLY_RECURRENCE ||
+        impl->rule->freq == ICAL_MONTHLY_RECURRENCE) {
+        void (*next_period)(icalrecur_iterator *, int) =
+            (impl->rule->freq == ICAL_YEARLY_RECURRENCE) ? &__next_year : &__next_month;
+        struct icaltimetype start = occurrence_from_local_seconds(impl, t);
+        int year = start.year;
+
+        if (impl->rule->freq == ICAL_YEARLY_RECURRENCE) {
+            /* With BYWEEKNO, the days of a year may reach into the next */
+            start.year--;
+            start.month = start.day = 1;
+        }
+        if (icaltime_compare(start, impl->dtstart) < 0) {
+            start = impl->dtstart;
+        }
+
+        if (!__iterator_set_start(impl, start)) {
+            return false;
+        }
+        period_from_daysmask(impl, p);
+
+        /* Move on while the occurrences around t can be in a later period */
+        while ((*j = period_rank(impl, p, t)) == period_total(impl, p) &&
+               impl->period_start.year <= year) {
+            reset_period_start(impl);
+            next_period(impl, impl->rule->interval);
+            period_from_daysmask(impl, p);
+        }
+    } else {
+        if (!period_fixed(impl, p)) {
+            return false;
+        }
+        p->origin += __floor_div(t - p->origin, p->length) * p->length;
+        *j = period_rank(impl, p, t);
+    }
+
+    return true;
+}
+
+/** Start stepping in local seconds from local time @p from, which has
+    already been returned if it is an occurrence and @p returned is true.
+    Only the start, end and last time are kept from the general iterator
+    state, which is to be restarted before it is used again. */
+static bool recur_fast_enter(icalrecur_iterator *impl, int64_t from, bool returned)
+{
+    struct recur_period *p = impl->fast_period;
+    struct icaltimetype istart = impl->istart;
+    struct icaltimetype prev = impl->last;
+    int64_t last = recur_fast_end(impl, true);
+    int32_t n = 0, j;
+
+    if (!p) {
+        p = (struct recur_period *)icalmemory_new_buffer(sizeof(struct recur_period));
+        if (!p) {
+            return false;
+        }
+        impl->fast_period = p;
+    }
+
+    /* Occurrences earlier than DTSTART or the iterator start are never
+       returned, and neither are those after the end of the iterator */
+    impl->fast_begin = __greg_local_seconds(impl->dtstart);
+    if (!icaltime_is_null_time(istart) && icaltime_compare(istart, impl->dtstart) > 0) {
+        impl->fast_begin = __greg_local_seconds(recur_bound(impl, istart));
+    }
+    impl->fast_end = recur_fast_end(impl, false);
+    if (from >= last) {
+        from = last;
+        returned = false;
+    }
+    if (from < impl->fast_begin) {
+        from = impl->fast_begin;
+        returned = false;
+    }
+
+    if (impl->rule->count == 0) {
+        /* Go straight to the period */
+        if (!period_seek(impl, p, from, &impl->fast_index)) {
+            return false;
+        }
+        impl->fast_total = period_total(impl, p);
+    } else {
+        /* Locate the occurrence by its number, to honor COUNT */
+        if (!__iterator_count_before(impl, occurrence_from_local_seconds(impl, from), &n)) {
+            return false;
+        }
+
+        if (n < impl->rule->count && period_locate(impl, p, n, &impl->fast_index)) {
+            impl->fast_total = period_total(impl, p);
+        } else if (n > 0 && period_locate(impl, p, n - 1, &impl->fast_index)) {
+            /* There are no more occurrences, but we can go back */
+            impl->fast_total = period_total(impl, p);
+            impl->fast_index++;
+            impl->fast_end = INT64_MIN;
+        } else {
+            /* There are no occurrences at all */
+            impl->fast_total = 0;
+            impl->fast_index = 0;
+            impl->fast_begin = INT64_MAX;
+            impl->fast_end = INT64_MIN;
+        }
+    }
+
+    impl->occurrence_no = n;
+    impl->fast_pending = true;
+    impl->fast_active = true;
+
+    if (returned && impl->fast_end != INT64_MIN) {
+        /* Step over the occurrence returned */
+        bool found;
+
+        j = impl->fast_index;
+        found = recur_fast_move(impl, &j);
+        impl->fast_index = j;
+
+        if (found && period_occurrence(impl, p, j) == from) {
+            impl->fast_index++;
+            impl->occurrence_no++;
+            impl->fast_pending = false;
+        }
+    }
+
+    /* Seeking and counting restarted the iterator */
+    impl->istart = istart;
+    impl->last = prev;
+
+    return true;
+}
+
+/** Stop stepping in local seconds, without repositioning the iterator.
+    Locating the periods may have stepped the BY indices, so they are set
+    back to how a new iterator has them. */
+static void recur_fast_reset(icalrecur_iterator *impl)
+{
+    if (impl->fast_active) {
+        restore_bydata_indices(impl, impl->start_bydata_indices);
+        impl->fast_active = false;
+    }
+}
+
+/** Step to the next occurrence in local seconds, returning false at the end */
+static bool recur_fast_next(icalrecur_iterator *impl, int64_t *t)
+{
+    int32_t j = impl->fast_index;
+    bool found;
+
+    if (impl->fast_end == INT64_MIN ||
+        (impl->rule->count > 0 && impl->occurrence_no >= impl->rule->count)) {
+        return false;
+    }
+
+    found = recur_fast_move(impl, &j);
+    impl->fast_index = j;
+
+    if (!found || (*t = period_occurrence(impl, impl->fast_period, j)) >= impl->fast_end) {
+        return false;
+    }
+
+    impl->fast_index = j + 1;
+    impl->fast_pending = false;
+    impl->occurrence_no++;
+
+    return true;
+}
+
+/** Step to the previous occurrence in local seconds, returning false at
+    the start */
+static bool recur_fast_prev(icalrecur_iterator *impl, int64_t *t)
+{
+    int32_t back = impl->fast_pending ? 1 : 2;
+    int32_t j = impl->fast_index - back;
+    bool found;
+
+    found = recur_fast_move(impl, &j);
+
+    if (!found || (*t = period_occurrence(impl, impl->fast_period, j)) < impl->fast_begin) {
+        /* Stay where we were */
+        impl->fast_index = j + back;
+        return false;
+    }
+
+    impl->fast_index = j + 1;
+    impl->fast_pending = false;
+    impl->occurrence_no -= back - 1;
+
+    return true;
+}
+
+/** Step icalrecur_iterator_next() or icalrecur_iterator_prev() through
+    the expanded periods of a countable rule.  Going back starts doing so,
+    going forward only continues.  Returns false if the general iterator is
+    to be used. */
+static bool recur_fast_walk(icalrecur_iterator *impl, bool forward, struct icaltimetype *tt)
+{
+    int64_t t;
+
+    if (!impl->fast_active && !forward && recur_fast_eligible(impl)) {
+        (void)recur_fast_enter(impl, __greg_local_seconds(recur_bound(impl, impl->last)),
+                               impl->occurrence_no != impl->start_no);
+    }
+
+    if (!impl->fast_active) {
+        return false;
+    }
+
+    if (!(forward ? recur_fast_next(impl, &t) : recur_fast_prev(impl, &t))) {
+        *tt = icaltime_null_time();
+        return true;
+    }
+
+    impl->last = occurrence_from_local_seconds(impl, t);
+    *tt = impl->last;
+    return true;
+}
+
+bool icalrecur_iterator_next_timet(icalrecur_iterator *impl, icaltime_t *next)
+{
+    int64_t t;
+
+    icalerror_check_arg_rz((impl != 0), "impl");
+    icalerror_check_arg_rz((next != 0), "next");
+
+    if (!impl->fast_active && recur_fast_eligible(impl)) {
+        (void)recur_fast_enter(impl, __greg_local_seconds(recur_bound(impl, impl->last)),
+                               impl->occurrence_no != impl->start_no);
+    }
+
+    if (!impl->fast_active) {
+        /* Use the general iterator */
+        struct icaltimetype tt = icalrecur_iterator_next(impl);
+
+        if (icaltime_is_null_time(tt)) {
+            return false;
+        }
+
+        *next = icaltime_as_timet_with_zone(tt, tt.zone ? tt.zone : icaltimezone_get_utc_timezone());
+        return true;
+    }
+
+    if (!recur_fast_next(impl, &t)) {
+        return false;
+    }
+
+    *next = (icaltime_t)t;
+    return true;
+}
+
+bool icalrecur_iterator_set_start(icalrecur_iterator *impl,
+                                  struct icaltimetype start)
+{
+    recur_fast_reset(impl);
+    impl->prev_pending = false;
+
+    /* Convert start to same time zone as DTSTART */
+    start = icaltime_convert_to_zone(start, (icaltimezone *)impl->dtstart.zone);
+
+    if (icaltime_compare(start, impl->dtstart) < 0) {
+        /* If start is before DTSTART, use DTSTART */
+        start = impl->dtstart;
+    } else if (!icaltime_is_null_time(impl->rule->until) &&
+               icaltime_compare(start, impl->rule->until) > 0) {
+        /* If start is after UNTIL, we're done */
+        impl->last = start;
+        return true;
+    }
+
+    if (recur_steps_elapsed(impl)) {
+        /* The local times depend on the DST changes since DTSTART */
+        return __iterator_step_to(impl, start);
+    }
+
+    if (impl->rule->count > 0) {
+        /* Restore the number of occurrences before start */
+        return __iterator_seek(impl, start);
+    }
+
+    return __iterator_set_start(impl, start);
+}
 
 bool icalrecur_iterator_set_end(icalrecur_iterator *impl,
                                 struct icaltimetype end)
@@ -3985,6 +5427,10 @@ bool icalrecur_iterator_set_end(icalrecur_iterator *impl,
 
     impl->iend = end;
 
+    if (impl->fast_active && impl->fast_end != INT64_MIN) {
+        impl->fast_end = recur_fast_end(impl, false);
+    }
+
     return true;
 }
 
@@ -3992,8 +5438,11 @@ bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
                                   struct icaltimetype from,
                                   struct icaltimetype to)
 {
-    if (impl->rule->count > 0 || icaltime_is_null_time(from)) {
-        /* Can't set a range without 'from' or if we need to count occurrences */
+    recur_fast_reset(impl);
+    impl->prev_pending = false;
+
+    if (icaltime_is_null_time(from)) {
+        /* Can't set a range without 'from' */
         icalerror_set_errno(ICAL_MALFORMEDDATA_ERROR);
         return false;
     }
@@ -4001,11 +5450,15 @@ bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
     if (!icaltime_is_null_time(to) && icaltime_compare(to, from) < 0) {
         /* Setting up for the reverse iterator */
         const icaltimezone *zone = impl->dtstart.zone;
+        struct icaltimetype after, begin, next;
+        int32_t found = 0;
+        int span;
 
         /* Convert 'from' to same time zone as DTSTART */
         from = icaltime_convert_to_zone(from, (icaltimezone *)zone);
 
-        if (icaltime_compare(from, impl->rule->until) > 0) {
+        if (!icaltime_is_null_time(impl->rule->until) &&
+            icaltime_compare(from, impl->rule->until) > 0) {
             /* If 'from' is after UNTIL, use UNTIL */
             from = impl->rule->until;
         } else if (icaltime_compare(from, impl->dtstart) < 0) {
@@ -4014,17 +5467,6 @@ bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
             return true;
         }
 
-        if (!__iterator_set_start(impl, from)) {
-            return false;
-        }
-
-        /* __iterator_set_start() may back us up earlier than 'from'
-           Iterate forward until we are later than 'from'.
-        */
-        while (icaltime_compare(impl->last, from) < 0) {
-            (void)icalrecur_iterator_next(impl);
-        }
-
         /* Convert 'to' to same time zone as DTSTART */
         to = icaltime_convert_to_zone(to, (icaltimezone *)zone);
 
@@ -4033,9 +5475,98 @@ bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
             to = impl->dtstart;
         }
 
+        if (recur_fast_eligible(impl)) {
+            /* Walk back from the end of the expanded periods */
+            impl->istart = to;
+            impl->iend = from;
+            impl->last = from;
+
+            return recur_fast_enter(impl, INT64_MAX, false);
+        }
+
+        if (impl->rule->count > 0) {
+            /* If 'from' is after the last occurrence, use that */
+            struct icaltimetype last = __iterator_nth_occurrence(impl, impl->rule->count);
+
+            if (!icaltime_is_null_time(last) && icaltime_compare(from, last) > 0) {
+                from = last;
+            }
+        }
+
+        /* Occurrences before this bound are at or before 'from' */
+        after = from;
+        if (impl->dtstart.is_date) {
+            after.is_date = 1;
+            after.hour = after.minute = after.second = 0;
+            icaltime_adjust(&after, 1, 0, 0, 0);
+        } else {
+            after.is_date = 0;
+            icaltime_adjust(&after, 0, 0, 0, 1);
+        }
+
+        /* Find the occurrences before 'after' over a window that doubles
+           until there are any */
+        impl->iend = icaltime_null_time();
+        for (span = impl->rule->interval;; span *= 2) {
+            /* Zoned sub-daily rules are stepped from DTSTART anyway */
+            bool at_dtstart = (span > INT_MAX / 732 || recur_steps_elapsed(impl));
+
+            begin = after;
+            switch (impl->rule->freq) {
+            case ICAL_SECONDLY_RECURRENCE:
+                icaltime_adjust(&begin, 0, 0, 0, -span);
+                break;
+            case ICAL_MINUTELY_RECURRENCE:
+                icaltime_adjust(&begin, 0, 0, -span, 0);
+                break;
+            case ICAL_HOURLY_RECURRENCE:
+                icaltime_adjust(&begin, 0, -span, 0, 0);
+                break;
+            case ICAL_DAILY_RECURRENCE:
+                icaltime_adjust(&begin, -span, 0, 0, 0);
+                break;
+            case ICAL_WEEKLY_RECURRENCE:
+                icaltime_adjust(&begin, -7 * span, 0, 0, 0);
+                break;
+            case ICAL_MONTHLY_RECURRENCE:
+                icaltime_adjust(&begin, -31 * span, 0, 0, 0);
+                break;
+            default:
+                icaltime_adjust(&begin, -366 * span, 0, 0, 0);
+                break;
+            }
+            if (at_dtstart || icaltime_compare(begin, impl->dtstart) <= 0) {
+                at_dtstart = true;
+                begin = impl->dtstart;
+            }
+
+            if (!icalrecur_iterator_set_start(impl, begin)) {
+                return false;
+            }
+            for (found = 0; !icaltime_is_null_time(next = icalrecur_iterator_next(impl)) &&
+                            icaltime_compare(next, after) < 0;
+                 found++) {
+            }
+
+            if (found > 0 || at_dtstart) {
+                break;
+            }
+        }
+
+        /* Step to the last of them again, which prev() returns first.
+           Going back to it instead would resolve its local time again. */
+        if (found > 0) {
+            if (!icalrecur_iterator_set_start(impl, begin)) {
+                return false;
+            }
+            while (found-- > 0) {
+                (void)icalrecur_iterator_next(impl);
+            }
+            impl->prev_pending = true;
+        }
+
         impl->istart = to;
         impl->iend = from;
-        impl->days_index = 0;
     } else {
         if (!icalrecur_iterator_set_start(impl, from)) {
             return false;
@@ -4112,7 +5643,7 @@ bool icalrecur_expand_recurrence(const char *rule,
     struct icalrecurrencetype *recur;
     icalrecur_iterator *ritr;
     icaltime_t tt;
-    struct icaltimetype icstart, next;
+    struct icaltimetype icstart;
     int i = 0;
 
     memset(array, 0, (size_t)count * sizeof(icaltime_t));
@@ -4126,11 +5657,7 @@ bool icalrecur_expand_recurrence(const char *rule,
 
     ritr = icalrecur_iterator_new(recur, icstart);
     if (ritr) {
-        for (next = icalrecur_iterator_next(ritr);
-             !icaltime_is_null_time(next) && i < count;
-             next = icalrecur_iterator_next(ritr)) {
-            tt = icaltime_as_timet(next);
-
+        while (i < count && icalrecur_iterator_next_timet(ritr, &tt)) {
             if (tt >= start) {
                 array[i++] = tt;
             }
@@ -4143,6 +5670,114 @@ bool icalrecur_expand_recurrence(const char *rule,
     return true;
 }
 
+/** Count the occurrences of @p impl in [@p start, @p end) */
+static int recur_count_in(icalrecur_iterator *impl,
+                          struct icaltimetype start, struct icaltimetype end)
+{
+    int32_t before, count;
+
+    start = recur_bound(impl, start);
+    end = recur_bound(impl, end);
+
+    if (!icaltime_is_null_time(impl->rule->until)) {
+        struct icaltimetype until = recur_until_bound(impl);
+
+        if (icaltime_compare(end, until) > 0) {
+            end = until;
+        }
+    }
+
+    if (icaltime_compare(start, impl->dtstart) < 0) {
+        start = impl->dtstart;
+    }
+
+    if (icaltime_compare(end, start) <= 0) {
+        return 0;
+    }
+
+    if (!recur_is_countable(impl)) {
+        /* Step from start, rather than twice from DTSTART */
+        if (!icalrecur_iterator_set_start(impl, start)) {
+            return -1;
+        }
+
+        for (count = 0; count < INT32_MAX; count++) {
+            struct icaltimetype next = icalrecur_iterator_next(impl);
+
+            if (icaltime_is_null_time(next) || icaltime_compare(next, end) >= 0) {
+                break;
+            }
+        }
+
+        return (int)count;
+    }
+
+    if (!__iterator_count_before(impl, start, &before) ||
+        !__iterator_count_before(impl, end, &count)) {
+        return -1;
+    }
+
+    return (int)(count - before);
+}
+
+int icalrecur_count_in(struct icalrecurrencetype *rule, struct icaltimetype dtstart,
+                       struct icaltimetype start, struct icaltimetype end)
+{
+    icalrecur_iterator *impl;
+    int count;
+
+    icalerror_check_arg_rz(rule != NULL, "rule");
+
+    if (icaltime_is_null_time(start) || icaltime_is_null_time(end)) {
+        icalerror_set_errno(ICAL_BADARG_ERROR);
+        return -1;
+    }
+
+    impl = icalrecur_iterator_new(rule, dtstart);
+    if (!impl) {
+        return -1;
+    }
+
+    count = recur_count_in(impl, start, end);
+
+    icalrecur_iterator_free(impl);
+
+    return count;
+}
+
+bool icalrecur_has_occurrence_in(struct icalrecurrencetype *rule, struct icaltimetype dtstart,
+                                 struct icaltimetype start, struct icaltimetype end)
+{
+    icalrecur_iterator *impl;
+    bool found = false;
+
+    icalerror_check_arg_rz(rule != NULL, "rule");
+
+    if (icaltime_is_null_time(start) || icaltime_is_null_time(end)) {
+        icalerror_set_errno(ICAL_BADARG_ERROR);
+        return false;
+    }
+
+    impl = icalrecur_iterator_new(rule, dtstart);
+    if (!impl) {
+        return false;
+    }
+
+    if (recur_is_countable(impl)) {
+        found = (recur_count_in(impl, start, end) > 0);
+    } else if (icalrecur_iterator_set_start(impl, recur_bound(impl, start))) {
+        /* Look for the first occurrence at or after start */
+        struct icaltimetype next = icalrecur_iterator_next(impl);
+
+        found = (!icaltime_is_null_time(next) &&
+                 icaltime_compare(next, recur_bound(impl, end)) < 0);
+    }
+
+    icalrecur_iterator_free(impl);
+
+    return found;
+}
+
 ical_invalid_rrule_handling ical_get_invalid_rrule_handling_setting(void)
 {
     ical_invalid_rrule_handling myHandling;
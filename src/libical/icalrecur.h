@@ -322,7 +322,9 @@ LIBICAL_ICAL_EXPORT icalrecur_iterator *icalrecur_iterator_new(struct icalrecurr
  * Sets the date-time at which the iterator will start,
  * where @p start is a value between DTSTART and UNTIL.
  *
- * NOTE: CAN NOT be used with RRULEs that contain COUNT.
+ * For RRULEs that contain COUNT, the occurrences before @p start are
+ * counted so that COUNT is still honored.  For most rules this is done
+ * without stepping through them.
  * @since 3.0
  */
 LIBICAL_ICAL_EXPORT bool icalrecur_iterator_set_start(icalrecur_iterator *impl,
@@ -348,7 +350,7 @@ LIBICAL_ICAL_EXPORT bool icalrecur_iterator_set_end(icalrecur_iterator *impl,
  * the reverse iterator will be set to start at @p from
  * and will return values down to and including @p to.
  *
- * NOTE: CAN NOT be used with RRULEs that contain COUNT.
+ * For RRULEs that contain COUNT, @p from is limited to the last occurrence.
  * @since 4.0
  */
 LIBICAL_ICAL_EXPORT bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
@@ -360,6 +362,23 @@ LIBICAL_ICAL_EXPORT bool icalrecur_iterator_set_range(icalrecur_iterator *impl,
  */
 LIBICAL_ICAL_EXPORT struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *);
 
+/**
+ * @brief Gets the next occurrence from an iterator, as seconds past the POSIX epoch.
+ *
+ * Returns the same occurrence as icalrecur_iterator_next() would, converted
+ * to UTC (floating times are taken as UTC).  For Gregorian rules with a UTC
+ * or floating DTSTART, the occurrences are calculated directly in seconds,
+ * which is much faster than stepping through them as icaltimetype values.
+ * Calls to icalrecur_iterator_next() and icalrecur_iterator_next_timet()
+ * may be mixed.
+ *
+ * @param impl The iterator
+ * @param next Set to the next occurrence
+ * @return false if there are no more occurrences
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT bool icalrecur_iterator_next_timet(icalrecur_iterator *impl, icaltime_t *next);
+
 /**
  * Gets the previous occurrence from an iterator.
  * @since 4.0
@@ -382,6 +401,35 @@ LIBICAL_ICAL_EXPORT void icalrecur_iterator_free(icalrecur_iterator *);
 LIBICAL_ICAL_EXPORT bool icalrecur_expand_recurrence(const char *rule, icaltime_t start,
                                                      int count, icaltime_t *array);
 
+/**
+ * @brief Counts the occurrences of a recurrence rule in a time range.
+ *
+ * Counts the occurrences generated by @p rule for @p dtstart that fall
+ * in the half-open range [@p start, @p end), honoring COUNT and UNTIL.
+ * For Gregorian rules whose occurrences are regular within each period,
+ * the count is computed per period, without generating each occurrence.
+ *
+ * @return The number of occurrences, or -1 on error
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT int icalrecur_count_in(struct icalrecurrencetype *rule,
+                                           struct icaltimetype dtstart,
+                                           struct icaltimetype start,
+                                           struct icaltimetype end);
+
+/**
+ * @brief Checks if a recurrence rule has any occurrence in a time range.
+ *
+ * Like icalrecur_count_in(), but only tells whether there is at least one
+ * occurrence in the half-open range [@p start, @p end).
+ *
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT bool icalrecur_has_occurrence_in(struct icalrecurrencetype *rule,
+                                                     struct icaltimetype dtstart,
+                                                     struct icaltimetype start,
+                                                     struct icaltimetype end);
+
 /* ical_invalid_rrule_handling :
  *    How should the ICAL library handle RRULEs with invalid BYxxx part combos?
  */
@@ -43,12 +43,15 @@
 
 #include "icaltime.h"
 #include "icaldate_p.h"
+#include "icaltime_p.h"
 #include "icalerror.h"
 #include "icalmemory.h"
 #include "icaltimezone.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* The first array is for non-leap years, the second for leap years*/
 static const int days_in_year_passed_month[2][13] = {
@@ -56,176 +59,136 @@ static const int days_in_year_passed_month[2][13] = {
     {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
     {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366}};
 
-static int icaltime_leap_days(int y1, int y2)
+int64_t icaltime_days_from_civil(int64_t year, int month, int day)
 {
-    --y1;
-    --y2;
-    return (y2 / 4 - y1 / 4) - (y2 / 100 - y1 / 100) + (y2 / 400 - y1 / 400);
+    /* Count the years from March, so that the leap day is the last one */
+    int64_t y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t year_of_era = y - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + day_of_era - 719468;
+}
+
+void icaltime_civil_from_days(int64_t days, int64_t *year, int *month, int *day)
+{
+    int64_t era, day_of_era, year_of_era, day_of_year, mp;
+
+    /* Count the years from March, so that the leap day is the last one */
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    day_of_era = days - era * 146097;
+    year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    mp = (5 * day_of_year + 2) / 153;
+
+    *day = (int)(day_of_year - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *year = year_of_era + era * 400 + (*month <= 2);
 }
 
 /*
- *  Function to convert a struct tm time specification
- *  to an ANSI-compatible icaltime_t using the specified time zone.
+ *  Function to convert a date and time
+ *  to an ANSI-compatible icaltime_t in UTC.
  *  This is different from the standard mktime() function
  *  in that we don't want the automatic adjustments for
  *  local daylight savings time applied to the result.
- *  This function expects well-formed input.
+ *  The day may be outside of the month, like with mktime().
  *
  *  The out_time_t is to store the result, it can be NULL.
  *  Returns false on failure, true on success.
  */
-static bool make_time(const struct tm *tm, int tzm, icaltime_t *out_time_t)
+static bool make_time(int year, int month, int day, int hour, int minute, int second,
+                      icaltime_t *out_time_t)
 {
-    icaltime_t tim;
-    int febs;
-
-    static const int days[] = {-1, 30, 58, 89, 119, 150, 180, 211, 242, 272, 303, 333, 364};
-
     /* check that month specification within range */
 
-    if (tm->tm_mon < 0 || tm->tm_mon > 11) {
+    if (month < 1 || month > 12) {
         return false;
     }
 
-    if (tm->tm_year < 2) {
+    if (year < 1902) {
         return false;
     }
 
 #if (SIZEOF_ICALTIME_T == 4)
     /* check that year specification within range */
 
-    if (tm->tm_year > 138) {
+    if (year > 2038) {
         return false;
     }
 
     /* check for upper bound of Jan 17, 2038 (to avoid possibility of 32-bit arithmetic overflow) */
-    if (tm->tm_year == 138) {
-        if (tm->tm_mon > 0) {
+    if (year == 2038) {
+        if (month > 1) {
             return false;
-        } else if (tm->tm_mday > 17) {
+        } else if (day > 17) {
             return false;
         }
     }
 #else
     /* We don't support years >= 10000, because the function has not been tested at this range. */
-    if (tm->tm_year >= 8100) {
+    if (year >= 10000) {
         return false;
     }
 #endif /* SIZEOF_ICALTIME_T */
 
-    /*
-     *  calculate elapsed days since start of the epoch (midnight Jan
-     *  1st, 1970 UTC) 17 = number of leap years between 1900 and 1970
-     *  (number of leap days to subtract)
-     */
-
-    tim = (icaltime_t)((tm->tm_year - 70) * 365 + ((tm->tm_year - 1) / 4) - 17);
-
-    /* adjust: no leap days every 100 years, except every 400 years. */
-
-    febs = (tm->tm_year - 100) - ((tm->tm_mon <= 1) ? 1 : 0);
-    tim -= febs / 100;
-    tim += febs / 400;
-
-    /* add number of days elapsed in the current year */
-
-    tim += days[tm->tm_mon];
-
-    /* check and adjust for leap years */
-
-    if ((tm->tm_year & 3) == 0 && tm->tm_mon > 1) {
-        tim += 1;
-    }
-
-    /* elapsed days to current date */
-
-    tim += tm->tm_mday;
-
-    /* calculate elapsed hours since start of the epoch */
-
-    tim = tim * 24 + tm->tm_hour;
-
-    /* calculate elapsed minutes since start of the epoch */
-
-    tim = tim * 60 + tm->tm_min;
-
-    /* adjust per time zone specification */
-
-    tim -= tzm;
-
-    /* calculate elapsed seconds since start of the epoch */
-
-    tim = tim * 60 + tm->tm_sec;
-
-    /* return number of seconds since start of the epoch */
+    /* calculate elapsed days, hours, minutes and seconds since start of the epoch */
 
     if (out_time_t) {
-        *out_time_t = tim;
+        int64_t tim = icaltime_days_from_civil(year, month, day);
+
+        tim = (tim * 24 + hour) * 60 + minute;
+        *out_time_t = (icaltime_t)(tim * 60 + second);
     }
 
     return true;
 }
 
-/*
- * Code adapted from Python 2.4.1 sources (Lib/calendar.py).
- */
-static icaltime_t icaltime_timegm(const struct tm *tm)
+/* Sets the date and time of tt from a time in UTC. Returns false if the
+   year does not fit, like gmtime(). */
+static bool icaltime_set_from_timet(struct icaltimetype *tt, icaltime_t t)
 {
-    int year;
-    icaltime_t days;
-    icaltime_t hours;
-    icaltime_t minutes;
-    icaltime_t seconds;
-
-    /* Validate the tm structure by passing it through make_time() */
-    if (!make_time(tm, 0, NULL)) {
-        /* we have some invalid data in the tm struct */
-        return 0;
-    }
-
-    year = 1900 + tm->tm_year;
-    days = (icaltime_t)(365 * (year - 1970) + icaltime_leap_days(1970, year));
-    days += days_in_year_passed_month[0][tm->tm_mon];
+    int64_t seconds = (int64_t)t;
+    int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    int time = (int)(seconds - days * 86400);
+    int64_t year;
 
-    if (tm->tm_mon > 1 && icaltime_is_leap_year(year)) {
-        ++days;
+    icaltime_civil_from_days(days, &year, &tt->month, &tt->day);
+    if (year - 1900 > INT_MAX || year - 1900 < INT_MIN) {
+        return false;
     }
 
-    days += tm->tm_mday - 1;
-    hours = days * 24 + tm->tm_hour;
-    minutes = hours * 60 + tm->tm_min;
-    seconds = minutes * 60 + tm->tm_sec;
+    tt->year = (int)year;
+    tt->hour = time / 3600;
+    tt->minute = time / 60 % 60;
+    tt->second = time % 60;
 
-    return seconds;
+    return true;
 }
 
 struct icaltimetype icaltime_from_timet_with_zone(const icaltime_t tm, const bool is_date,
                                                   const icaltimezone *zone)
 {
     struct icaltimetype tt;
-    struct tm t;
     icaltimezone *utc_zone;
 
     utc_zone = icaltimezone_get_utc_timezone();
 
-    /* Convert the icaltime_t to a struct tm in UTC time. We can trust gmtime for this. */
-    memset(&t, 0, sizeof(struct tm));
-    if (!icalgmtime_r(&tm, &t)) {
+    /* Convert the icaltime_t to a date and time in UTC. */
+    if (!icaltime_set_from_timet(&tt, tm)) {
         return is_date ? icaltime_null_date() : icaltime_null_time();
     }
 
-    tt.year = t.tm_year + 1900;
-    tt.month = t.tm_mon + 1;
-    tt.day = t.tm_mday;
-    tt.hour = t.tm_hour;
-    tt.minute = t.tm_min;
-    tt.second = t.tm_sec;
     tt.is_date = 0;
     tt.is_daylight = 0;
     tt.zone = (zone == NULL) ? NULL : utc_zone;
 
     /* Use our timezone functions to convert to the required timezone. */
-    icaltimezone_convert_time(&tt, utc_zone, (icaltimezone *)zone);
+    if (zone != NULL && zone != utc_zone) {
+        icaltimezone_convert_time(&tt, utc_zone, (icaltimezone *)zone);
+    }
 
     tt.is_date = is_date;
 
@@ -239,6 +202,45 @@ struct icaltimetype icaltime_from_timet_with_zone(const icaltime_t tm, const boo
     return tt;
 }
 
+void icaltime_from_timets_with_zone(const icaltime_t *times, size_t n, const bool is_date,
+                                    const icaltimezone *zone, struct icaltimetype *tts)
+{
+    icaltimezone *utc_zone;
+    size_t i;
+
+    icalerror_check_arg_rv((times && tts) || n == 0, "times");
+
+    utc_zone = icaltimezone_get_utc_timezone();
+
+    for (i = 0; i < n; i++) {
+        /* Times which do not fit are left as null dates until the end, so
+           that they are not converted. */
+        if (!icaltime_set_from_timet(&tts[i], times[i])) {
+            tts[i] = icaltime_null_date();
+            continue;
+        }
+        tts[i].is_date = 0;
+        tts[i].is_daylight = 0;
+        tts[i].zone = (zone == NULL) ? NULL : utc_zone;
+    }
+
+    /* Use our timezone functions to convert to the required timezone. */
+    if (zone != NULL && zone != utc_zone) {
+        icaltimezone_convert_times(utc_zone, (icaltimezone *)zone, tts, n);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (tts[i].is_date) {
+            tts[i] = is_date ? icaltime_null_date() : icaltime_null_time();
+        } else if (is_date) {
+            tts[i].is_date = 1;
+            tts[i].hour = 0;
+            tts[i].minute = 0;
+            tts[i].second = 0;
+        }
+    }
+}
+
 struct icaltimetype icaltime_current_time_with_zone(const icaltimezone *zone)
 {
     return icaltime_from_timet_with_zone(icaltime(NULL), 0, zone);
@@ -251,7 +253,6 @@ struct icaltimetype icaltime_today(void)
 
 icaltime_t icaltime_as_timet(const struct icaltimetype tt)
 {
-    struct tm stm;
     icaltime_t t = (icaltime_t)-1;
 
     /* If the time is the special null time, return 0. */
@@ -259,33 +260,29 @@ icaltime_t icaltime_as_timet(const struct icaltimetype tt)
         return 0;
     }
 
-    /* Copy the icaltimetype to a struct tm. */
-    memset(&stm, 0, sizeof(struct tm));
-
     if (icaltime_is_date(tt)) {
-        stm.tm_sec = stm.tm_min = stm.tm_hour = 0;
+        (void)make_time(tt.year, tt.month, tt.day, 0, 0, 0, &t);
     } else {
-        stm.tm_sec = tt.second;
-        stm.tm_min = tt.minute;
-        stm.tm_hour = tt.hour;
+        (void)make_time(tt.year, tt.month, tt.day, tt.hour, tt.minute, tt.second, &t);
     }
 
-    stm.tm_mday = tt.day;
-    stm.tm_mon = tt.month - 1;
-    stm.tm_year = tt.year - 1900;
-    stm.tm_isdst = -1;
+    return t;
+}
 
-    if (!make_time(&stm, 0, &t)) {
-        t = ((icaltime_t)-1);
-    }
+void icaltime_as_timets(const struct icaltimetype *tts, icaltime_t *times, size_t n)
+{
+    size_t i;
 
-    return t;
+    icalerror_check_arg_rv((tts && times) || n == 0, "tts");
+
+    for (i = 0; i < n; i++) {
+        times[i] = icaltime_as_timet(tts[i]);
+    }
 }
 
 icaltime_t icaltime_as_timet_with_zone(const struct icaltimetype tt, const icaltimezone *zone)
 {
     icaltimezone *utc_zone;
-    struct tm stm;
     icaltime_t t;
     struct icaltimetype local_tt;
 
@@ -306,18 +303,11 @@ icaltime_t icaltime_as_timet_with_zone(const struct icaltimetype tt, const icalt
         icaltimezone_convert_time(&local_tt, (icaltimezone *)zone, utc_zone);
     }
 
-    /* Copy the icaltimetype to a struct tm. */
-    memset(&stm, 0, sizeof(struct tm));
-
-    stm.tm_sec = local_tt.second;
-    stm.tm_min = local_tt.minute;
-    stm.tm_hour = local_tt.hour;
-    stm.tm_mday = local_tt.day;
-    stm.tm_mon = local_tt.month - 1;
-    stm.tm_year = local_tt.year - 1900;
-    stm.tm_isdst = -1;
-
-    t = icaltime_timegm(&stm);
+    if (!make_time(local_tt.year, local_tt.month, local_tt.day,
+                   local_tt.hour, local_tt.minute, local_tt.second, &t)) {
+        /* we have some invalid data */
+        t = 0;
+    }
 
     return t;
 }
@@ -364,6 +354,84 @@ struct icaltimetype icaltime_normalize(const struct icaltimetype tt)
     return ret;
 }
 
+bool icaltime_scan_digits(const char *str, int width, int *value)
+{
+    int result = 0;
+    int i;
+
+    for (i = 0; i < width; i++) {
+        unsigned int digit = (unsigned int)(unsigned char)str[i] - '0';
+
+        if (digit > 9) {
+            return false;
+        }
+        result = result * 10 + (int)digit;
+    }
+
+    *value = result;
+    return true;
+}
+
+/* Scans the 8 digits of a date in the basic format YYYYMMDD, checking them
+   all at once. */
+static bool icaltime_scan_basic_date(const char *str, struct icaltimetype *tt)
+{
+    uint64_t chars;
+    int digits[8];
+    int i;
+
+    /* Every byte is a digit if its high nibble is 3 and adding 6 keeps it so */
+    memcpy(&chars, str, 8);
+    if (((chars & 0xF0F0F0F0F0F0F0F0ULL) |
+         (((chars + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL) {
+        return false;
+    }
+
+    for (i = 0; i < 8; i++) {
+        digits[i] = str[i] - '0';
+    }
+    tt->year = ((digits[0] * 10 + digits[1]) * 10 + digits[2]) * 10 + digits[3];
+    tt->month = digits[4] * 10 + digits[5];
+    tt->day = digits[6] * 10 + digits[7];
+
+    return true;
+}
+
+/* Scans the lexical forms of icaltime_from_string() which consist of digits
+   at fixed positions. Returns false for anything else, which is left to
+   sscanf() to keep its handling of signs and white space. */
+static bool icaltime_scan_fixed(const char *str, size_t size, struct icaltimetype *tt)
+{
+    switch (size) {
+    case 8:
+        return icaltime_scan_basic_date(str, tt);
+    case 10:
+        return str[4] == '-' && str[7] == '-' &&
+               icaltime_scan_digits(str, 4, &tt->year) &&
+               icaltime_scan_digits(str + 5, 2, &tt->month) &&
+               icaltime_scan_digits(str + 8, 2, &tt->day);
+    case 15:
+    case 16:
+        return str[8] == 'T' &&
+               icaltime_scan_basic_date(str, tt) &&
+               icaltime_scan_digits(str + 9, 2, &tt->hour) &&
+               icaltime_scan_digits(str + 11, 2, &tt->minute) &&
+               icaltime_scan_digits(str + 13, 2, &tt->second);
+    case 19:
+    case 20:
+        return str[4] == '-' && str[7] == '-' && str[10] == 'T' && str[13] == ':' &&
+               str[16] == ':' &&
+               icaltime_scan_digits(str, 4, &tt->year) &&
+               icaltime_scan_digits(str + 5, 2, &tt->month) &&
+               icaltime_scan_digits(str + 8, 2, &tt->day) &&
+               icaltime_scan_digits(str + 11, 2, &tt->hour) &&
+               icaltime_scan_digits(str + 14, 2, &tt->minute) &&
+               icaltime_scan_digits(str + 17, 2, &tt->second);
+    default:
+        return false;
+    }
+}
+
 struct icaltimetype icaltime_from_string(const char *str)
 {
     struct icaltimetype tt = icaltime_null_time();
@@ -388,6 +456,14 @@ struct icaltimetype icaltime_from_string(const char *str)
         goto FAIL;
     }
 
+    if (icaltime_scan_fixed(str, size, &tt)) {
+        return tt;
+    }
+
+    /* Restore the fields, which may be partly scanned */
+    tt.year = tt.month = tt.day = 0;
+    tt.hour = tt.minute = tt.second = 0;
+
     if (tt.is_date == 1) {
         if (size == 10) {
             char dsep1, dsep2;
@@ -755,6 +831,117 @@ int icaltime_compare_date_only_tz(const struct icaltimetype a_in,
     return 0;
 }
 
+int64_t icaltime_sort_key(const struct icaltimetype tt)
+{
+    /* Normalize the month, which is 0 in null times */
+    int64_t year = tt.year + (tt.month > 0 ? (tt.month - 1) / 12 : tt.month / 12 - 1);
+    int month = tt.month - (int)(year - tt.year) * 12;
+    int64_t seconds = icaltime_days_from_civil(year, month, tt.day) * 86400;
+
+    if (tt.is_date) {
+        return seconds * 2;
+    }
+
+    seconds += (tt.hour * 60 + tt.minute) * 60 + tt.second;
+    if (tt.zone) {
+        seconds -= icaltimezone_get_utc_offset((icaltimezone *)tt.zone, &tt, NULL);
+    }
+
+    return seconds * 2 + 1;
+}
+
+static int icaltime_compare_keyed(const void *a, const void *b)
+{
+    const icaltimekeyed *ka = a, *kb = b;
+
+    if (ka->key != kb->key) {
+        return (ka->key < kb->key) ? -1 : 1;
+    } else if (ka->index != kb->index) {
+        return (ka->index < kb->index) ? -1 : 1;
+    }
+    return 0;
+}
+
+void icaltime_sort_keyed(icaltimekeyed *keyed, size_t n)
+{
+    qsort(keyed, n, sizeof(icaltimekeyed), icaltime_compare_keyed);
+}
+
+void icaltime_sort(struct icaltimetype *tts, size_t n)
+{
+    icaltimekeyed *keyed;
+    struct icaltimetype *sorted;
+    size_t i;
+
+    icalerror_check_arg_rv(tts || n == 0, "tts");
+
+    if (n < 2) {
+        return;
+    }
+
+    keyed = icalmemory_new_buffer(n * sizeof(icaltimekeyed));
+    sorted = icalmemory_new_buffer(n * sizeof(struct icaltimetype));
+    if (!keyed || !sorted) {
+        icalmemory_free_buffer(keyed);
+        icalmemory_free_buffer(sorted);
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        keyed[i].key = icaltime_sort_key(tts[i]);
+        keyed[i].index = i;
+    }
+    icaltime_sort_keyed(keyed, n);
+
+    for (i = 0; i < n; i++) {
+        sorted[i] = tts[keyed[i].index];
+    }
+    memcpy(tts, sorted, n * sizeof(struct icaltimetype));
+
+    icalmemory_free_buffer(keyed);
+    icalmemory_free_buffer(sorted);
+}
+
+void icaltime_merge(const struct icaltimetype *a, size_t na,
+                    const struct icaltimetype *b, size_t nb,
+                    struct icaltimetype *merged)
+{
+    int64_t key_a = 0, key_b = 0;
+    size_t ia = 0, ib = 0;
+
+    icalerror_check_arg_rv(a || na == 0, "a");
+    icalerror_check_arg_rv(b || nb == 0, "b");
+    icalerror_check_arg_rv(merged || na + nb == 0, "merged");
+
+    if (na > 0) {
+        key_a = icaltime_sort_key(a[0]);
+    }
+    if (nb > 0) {
+        key_b = icaltime_sort_key(b[0]);
+    }
+
+    while (ia < na && ib < nb) {
+        if (key_b < key_a) {
+            *merged++ = b[ib++];
+            if (ib < nb) {
+                key_b = icaltime_sort_key(b[ib]);
+            }
+        } else {
+            *merged++ = a[ia++];
+            if (ia < na) {
+                key_a = icaltime_sort_key(a[ia]);
+            }
+        }
+    }
+
+    if (ia < na) {
+        memcpy(merged, a + ia, (na - ia) * sizeof(struct icaltimetype));
+    } else if (ib < nb) {
+        memcpy(merged, b + ib, (nb - ib) * sizeof(struct icaltimetype));
+    }
+}
+
 /* These are defined in icalduration.c:
 struct icaltimetype  icaltime_add(struct icaltimetype t,
                                   struct icaldurationtype  d)
@@ -769,6 +956,7 @@ void icaltime_adjust(struct icaltimetype *tt,
     int second, minute, hour, day;
     int minutes_overflow, hours_overflow, days_overflow = 0, years_overflow;
     int days_in_month;
+    int64_t year;
 
     /* If we are passed a date make sure to ignore hour minute and second */
     if (tt->is_date) {
@@ -819,6 +1007,32 @@ IS_DATE:
 
     /* Add on the days. */
     day = tt->day + days + days_overflow;
+    if (day > 0) {
+        /* Stay in the month, or move to the next one */
+        days_in_month = icaltime_days_in_month(tt->month, tt->year);
+        if (day <= days_in_month) {
+            tt->day = day;
+            return;
+        } else if (day <= days_in_month + 28) {
+            tt->month++;
+            if (tt->month >= 13) {
+                tt->year++;
+                tt->month = 1;
+            }
+            tt->day = day - days_in_month;
+            return;
+        }
+    }
+
+    /* Count whole days in the Gregorian calendar, unless the result may be
+       in the years where icaltime_is_leap_year() uses the Julian rule. */
+    if (tt->year > 1752 && (day > 0 || tt->year - 1752 > (1 - day) / 365 + 1)) {
+        icaltime_civil_from_days(icaltime_days_from_civil(tt->year, tt->month, day), &year,
+                                 &tt->month, &tt->day);
+        tt->year = (int)year;
+        return;
+    }
+
     if (day > 0) {
         for (;;) {
             days_in_month = icaltime_days_in_month(tt->month, tt->year);
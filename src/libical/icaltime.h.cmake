@@ -60,6 +60,7 @@
  *      - icaltime_compare(struct icaltimetype a,struct icaltimetype b)
  *      - icaltime_compare_date_only(struct icaltimetype a,
  *              struct icaltimetype b)
+ *      - icaltime_sort_key(struct icaltimetype tt)
  *      - icaltime_adjust(struct icaltimetype *tt, int days, int hours,
  *              int minutes, int seconds);
  *      - icaltime_normalize(struct icaltimetype t);
@@ -73,6 +74,7 @@
 #include "libical_ical_export.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #define icaltime_t ${ICAL_ICALTIME_T_TYPE}
 
@@ -165,6 +167,24 @@ LIBICAL_ICAL_EXPORT struct icaltimetype icaltime_from_timet_with_zone(const ical
                                                                       const bool is_date,
                                                                       const icaltimezone *zone);
 
+/**
+ * @brief Creates an array of times, like icaltime_from_timet_with_zone().
+ *
+ * Converting sorted times to a timezone walks its changes along with them
+ * instead of looking up each time.
+ *
+ * @param times The times expressed as seconds past UNIX epoch
+ * @param n The number of times
+ * @param is_date Whether to create DATE values
+ * @param zone The timezone to create the times in, NULL for floating times
+ * @param tts Set to the @p n new times
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltime_from_timets_with_zone(const icaltime_t *times, size_t n,
+                                                        const bool is_date,
+                                                        const icaltimezone *zone,
+                                                        struct icaltimetype *tts);
+
 /**     @brief Constructor.
  *
  * Creates a time from an ISO format string.
@@ -196,6 +216,18 @@ LIBICAL_ICAL_EXPORT struct icaltimetype icaltime_from_day_of_year(const int doy,
  */
 LIBICAL_ICAL_EXPORT icaltime_t icaltime_as_timet(const struct icaltimetype);
 
+/**
+ * @brief Converts an array of times to seconds past the UNIX epoch, each like
+ * icaltime_as_timet().
+ *
+ * @param tts The times to convert
+ * @param times Set to the @p n converted times
+ * @param n The number of times
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltime_as_timets(const struct icaltimetype *tts, icaltime_t *times,
+                                            size_t n);
+
 /**     @brief Returns the time as seconds past the UNIX epoch, using the
  *      given timezone.
  *
@@ -323,6 +355,56 @@ LIBICAL_ICAL_EXPORT int icaltime_compare_date_only_tz(const struct icaltimetype
                                                       const struct icaltimetype b,
                                                       icaltimezone *tz);
 
+/**
+ * @brief Returns a key which sorts times by the instant they refer to.
+ *
+ * The key counts half-seconds since 1970-01-01 00:00:00 UTC, so that keys
+ * compare like icaltime_compare() without converting times again:
+ * - times with a timezone are converted to UTC once;
+ * - floating times are taken as UTC;
+ * - DATE values are taken as the start of their day in no timezone, and
+ *   sort before any DATE-TIME on the same day, which is the odd half-second.
+ *
+ * Unlike icaltime_compare(), times with the same timezone are ordered by
+ * their instant rather than by their local time, which only differs around
+ * changes of the UTC offset. Floating times and DATE values are not compared
+ * with the local time of times with a timezone.
+ *
+ * @param tt The time
+ * @return The sort key of @p tt
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT int64_t icaltime_sort_key(const struct icaltimetype tt);
+
+/**
+ * @brief Sorts an array of times by icaltime_sort_key().
+ *
+ * Each key is computed once. Times with equal keys keep their order.
+ *
+ * @param tts The times to sort, in place
+ * @param n The number of times
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltime_sort(struct icaltimetype *tts, size_t n);
+
+/**
+ * @brief Merges two arrays of times sorted by icaltime_sort_key().
+ *
+ * Times with equal keys are taken from @p a first. Each key is computed
+ * once.
+ *
+ * @param a The first sorted times
+ * @param na The number of times in @p a
+ * @param b The second sorted times
+ * @param nb The number of times in @p b
+ * @param merged Set to the @p na + @p nb merged times, which must not overlap
+ *        @p a or @p b
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltime_merge(const struct icaltimetype *a, size_t na,
+                                        const struct icaltimetype *b, size_t nb,
+                                        struct icaltimetype *merged);
+
 /** Adds or subtracts a number of days, hours, minutes and seconds. */
 /**     @brief Internal, shouldn't be part of the public API
  *
@@ -0,0 +1,37 @@
+/*======================================================================
+ FILE: icaltime_p.h
+
+ SPDX-FileCopyrightText: 2000, Eric Busboom <eric@civicknowledge.com>
+ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
+======================================================================*/
+
+#ifndef ICALTIME_P_H
+#define ICALTIME_P_H
+
+#include "libical_ical_export.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Day numbers since 1970-01-01 in the proleptic Gregorian calendar.
+   The month must be 1 to 12, the day may be outside of the month. */
+LIBICAL_ICAL_NO_EXPORT int64_t icaltime_days_from_civil(int64_t year, int month, int day);
+
+LIBICAL_ICAL_NO_EXPORT void icaltime_civil_from_days(int64_t days,
+                                                     int64_t *year, int *month, int *day);
+
+/* Scans the number of exactly width decimal digits, without sign or white
+   space. Returns false if any of the characters is not a digit. */
+LIBICAL_ICAL_NO_EXPORT bool icaltime_scan_digits(const char *str, int width, int *value);
+
+/* Sort keys of icaltime_sort_key() with the position they were taken from */
+typedef struct icaltimekeyed {
+    int64_t key;
+    size_t index;
+} icaltimekeyed;
+
+/* Sorts by key, and by position among equal keys */
+LIBICAL_ICAL_NO_EXPORT void icaltime_sort_keyed(icaltimekeyed *keyed, size_t n);
+
+#endif /* ICALTIME_P_H */
@@ -17,10 +17,12 @@
 #include "icalerror.h"
 #include "icalparser.h"
 #include "icalmemory.h"
+#include "icaltime_p.h"
 #include "icaltz-util.h"
 
 #include <ctype.h>
 #include <stddef.h> /* for ptrdiff_t */
+#include <stdint.h>
 #include <stdlib.h>
 #include <limits.h>
 
@@ -36,8 +38,23 @@ static pthread_mutex_t builtin_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 #else
 static pthread_mutex_t builtin_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
-// To avoid use-after-free in multithreaded applications when accessing icaltimezone::changes
+// To serialize the expansion of icaltimezone::changes in multithreaded applications
 static pthread_mutex_t changes_mutex = PTHREAD_MUTEX_INITIALIZER;
+#if defined(__ATOMIC_ACQUIRE)
+// Readers find the published icaltimezone::changes without taking changes_mutex
+#define ICALTIMEZONE_LOCKFREE_CHANGES 1
+#define changes_load(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define changes_store(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#endif
+#endif
+
+#if !defined(ICALTIMEZONE_LOCKFREE_CHANGES)
+#define changes_load(ptr) (*(ptr))
+#define changes_store(ptr, val) (*(ptr) = (val))
+#endif
+
+#if defined(USE_EMBEDDED_TZDATA)
+#include "icaltimezone_embedded.h"
 #endif
 
 #if defined(_WIN32)
@@ -110,11 +127,93 @@ struct _icaltimezonechange {
     /**< Whether this is STANDARD or DAYLIGHT time. */
 };
 
+typedef struct _icaltimezoneoffset icaltimezoneoffset;
+
+struct _icaltimezoneoffset {
+    int utc_offset;
+    int is_daylight;
+};
+
+typedef struct _icaltimezonetransitions icaltimezonetransitions;
+
+struct _icaltimezonetransitions {
+    icalarray *changes;
+    /**< The icaltimezonechange elements, sorted by the time of the change. */
+
+    size_t num_changes;
+
+    int64_t *utc;
+    /**< The time of each change, in seconds since the epoch. */
+
+    int64_t *local;
+    /**< The local time from which each change applies, in seconds since the
+       epoch as if it were UTC. If the clock goes back this is the first of
+       the local times which are used twice. */
+
+    int64_t *overlap_end;
+    /**< The local time at which the times which are used twice end, the
+       same as local if the clock does not go back. */
+
+    icaltimezoneoffset (*offsets)[3];
+    /**< The offset which applies from each change on: [0] after overlap_end,
+       [1] and [2] before it, for standard and for daylight time. */
+
+    icaltimezoneoffset before;
+    /**< The offset which applies before the first change. */
+
+    icaltimezonetransitions *retired;
+    /**< The changes this expansion replaced. Other threads may still be
+       searching them, so they are only freed with the timezone. */
+};
+
+typedef struct _icaltimezonecursor icaltimezonecursor;
+
+/** Remembers where the last offset lookup in a zone ended, so that the
+    next one for a nearby time can start searching from there. */
+struct _icaltimezonecursor {
+    icaltimezone *zone;
+    /**< The zone whose changes are searched, NULL for UTC and floating times. */
+
+    const icaltimezonetransitions *changes;
+    /**< The changes searched last, or NULL if they were not looked up yet. */
+
+    size_t change_num;
+    /**< The number of changes on or before the last time looked up. */
+
+    bool searched;
+    /**< Whether the last lookup had to search the changes, rather than
+       find the change at or a few after the last one. */
+};
+
+/** The number of zones whose cursor each thread keeps for offset lookups */
+#define ICALTIMEZONE_THREAD_CURSORS 4
+
+typedef struct _icaltimezonethreadcursors icaltimezonethreadcursors;
+
+struct _icaltimezonethreadcursors {
+    icaltimezonecursor cursors[ICALTIMEZONE_THREAD_CURSORS];
+    int next;
+    /**< The cursor to replace next when all are used. */
+
+    size_t lookups;
+    size_t hits;
+};
+
 /** An array of icaltimezones for the builtin timezones. */
 static ICAL_GLOBAL_VAR icalarray *builtin_timezones = NULL;
 
+/** An open-addressing hash table of the builtin timezones which were listed
+    in the zones.tab file, by location. It is not modified after it is built,
+    so it can be searched without locking. */
+static ICAL_GLOBAL_VAR icaltimezone **builtin_timezones_index = NULL;
+static ICAL_GLOBAL_VAR size_t builtin_timezones_index_mask = 0;
+
+/** The number of builtin timezones in builtin_timezones_index. The ones
+    after them were added later, for deprecated locations. */
+static ICAL_GLOBAL_VAR size_t builtin_timezones_indexed = 0;
+
 /** This is the special UTC timezone, which isn't in builtin_timezones. */
-static ICAL_GLOBAL_VAR icaltimezone utc_timezone = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+static ICAL_GLOBAL_VAR icaltimezone utc_timezone = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 static ICAL_GLOBAL_VAR char *zone_files_directory = NULL;
 
@@ -126,9 +225,24 @@ static ICAL_GLOBAL_VAR int use_builtin_tzdata = false;
 
 static void icaltimezone_reset(icaltimezone *zone);
 static void icaltimezone_expand_changes(icaltimezone *zone, int end_year);
+static void icaltimezone_expand_vtimezone_after(icalcomponent *comp, int expanded_year,
+                                                int end_year, icalarray *changes);
+static icaltimezonetransitions *icaltimezone_get_changes(icaltimezone *zone, int end_year);
+static icaltimezonetransitions *icaltimezone_transitions_new(icalarray *changes);
+static void icaltimezone_transitions_free(icaltimezonetransitions *changes);
 static int icaltimezone_compare_change_fn(const void *elem1, const void *elem2);
 
-static size_t icaltimezone_find_nearby_change(icaltimezone *zone, const icaltimezonechange *change);
+static size_t icaltimezone_count_not_after(const int64_t *values, size_t num_values, int64_t value);
+
+static void icaltimezone_cursor_init(icaltimezonecursor *cursor, icaltimezone *zone);
+static const icaltimezoneoffset *icaltimezone_cursor_local(icaltimezonecursor *cursor, int year,
+                                                           int64_t local, int is_daylight);
+static const icaltimezoneoffset *icaltimezone_cursor_utc(icaltimezonecursor *cursor, int year,
+                                                         int64_t utc);
+static icaltimezonecursor *icaltimezone_get_thread_cursor(icaltimezone *zone,
+                                                          icaltimezonecursor *fallback,
+                                                          bool *cached);
+static void icaltimezone_count_thread_cursor(const icaltimezonecursor *cursor, bool cached);
 
 static void icaltimezone_adjust_change(icaltimezonechange *tt,
                                        int days, int hours, int minutes, int seconds);
@@ -158,8 +272,18 @@ static void icaltimezone_init_builtin_timezones(void);
 
 static void icaltimezone_parse_zone_tab(void);
 
+static void icaltimezone_index_builtin_timezones(icalarray *timezones);
+
+static icaltimezone *icaltimezone_find_builtin_timezone(const char *location);
+
 static char *icaltimezone_load_get_line_fn(char *s, size_t size, void *data);
 
+static char *icaltimezone_load_get_embedded_line_fn(char *s, size_t size, void *data);
+
+static const char *icaltimezone_get_embedded_zone(const char *location);
+
+static char *icaltimezone_read_line(char *s, size_t size, FILE *fp, const char **embedded);
+
 static void format_utc_offset(int utc_offset, char *buffer, size_t buffer_size);
 static const char *get_zone_directory_builtin(void);
 
@@ -234,7 +358,10 @@ icaltimezone *icaltimezone_copy(const icaltimezone *originalzone)
 
     icaltimezone_changes_lock();
     if (zone->changes != NULL) {
-        zone->changes = icalarray_copy(zone->changes);
+        zone->changes = icaltimezone_transitions_new(icalarray_copy(zone->changes->changes));
+        if (zone->changes == NULL) {
+            zone->end_year = 0;
+        }
     }
     icaltimezone_changes_unlock();
 
@@ -258,6 +385,8 @@ void icaltimezone_free(icaltimezone *zone, int free_struct)
  */
 static void icaltimezone_reset(icaltimezone *zone)
 {
+    int expansion_window = zone->expansion_window;
+
     if (zone->tzid) {
         icalmemory_free_buffer(zone->tzid);
     }
@@ -276,12 +405,13 @@ static void icaltimezone_reset(icaltimezone *zone)
 
     //    icaltimezone_changes_lock();
     if (zone->changes) {
-        icalarray_free(zone->changes);
+        icaltimezone_transitions_free(zone->changes);
         zone->changes = NULL;
     }
     //    icaltimezone_changes_unlock();
 
     icaltimezone_init(zone);
+    zone->expansion_window = expansion_window;
 }
 
 /** @brief Initializes an icaltimezone. */
@@ -296,6 +426,7 @@ static void icaltimezone_init(icaltimezone *zone)
     zone->builtin_timezone = NULL;
     zone->end_year = 0;
     zone->changes = NULL;
+    zone->expansion_window = ICALTIMEZONE_EXTRA_COVERAGE;
 }
 
 /** @brief Gets the TZID, LOCATION/X-LIC-LOCATION and TZNAME properties of
@@ -502,28 +633,82 @@ static void icaltimezone_ensure_coverage(icaltimezone *zone, int end_year)
         changes_end_year = icaltimezone_minimum_expansion_year;
     }
 
-    changes_end_year += ICALTIMEZONE_EXTRA_COVERAGE;
+    changes_end_year += zone->expansion_window;
+
+    /* The replaced arrays are kept until the zone is freed, so at least
+       double the covered span when extending it, to not keep many of them.
+       This may go past the window, which is only a minimum. */
+    if (zone->changes &&
+        changes_end_year < 2 * zone->end_year - icaltimezone_minimum_expansion_year) {
+        changes_end_year = 2 * zone->end_year - icaltimezone_minimum_expansion_year;
+    }
 
     if (changes_end_year > ICALTIMEZONE_MAX_YEAR) {
         changes_end_year = ICALTIMEZONE_MAX_YEAR;
     }
 
+    if (end_year > ICALTIMEZONE_MAX_YEAR) {
+        end_year = ICALTIMEZONE_MAX_YEAR;
+    }
+
     if (!zone->changes || zone->end_year < end_year) {
         icaltimezone_expand_changes(zone, changes_end_year);
     }
 }
 
+/** @brief Returns the changes of the zone, expanded at least up to the
+ * given year.
+ *
+ * The returned array is not modified later and stays valid until the zone
+ * is freed, so it can be searched without holding any lock.
+ */
+static icaltimezonetransitions *icaltimezone_get_changes(icaltimezone *zone, int end_year)
+{
+    icaltimezonetransitions *changes;
+
+    if (end_year > ICALTIMEZONE_MAX_YEAR) {
+        end_year = ICALTIMEZONE_MAX_YEAR;
+    }
+
+#if defined(ICALTIMEZONE_LOCKFREE_CHANGES)
+    /* The changes are published before their end year, so if the end year
+       is far enough then so are the changes we load after it. */
+    if (changes_load(&zone->end_year) >= end_year) {
+        changes = changes_load(&zone->changes);
+        if (changes) {
+            return changes;
+        }
+    }
+#endif
+
+    icaltimezone_changes_lock();
+    icaltimezone_ensure_coverage(zone, end_year);
+    changes = zone->changes;
+    icaltimezone_changes_unlock();
+
+    return changes;
+}
+
 /* Hold the icaltimezone_changes_lock(); before calling this function */
 static void icaltimezone_expand_changes(icaltimezone *zone, int end_year)
 {
     icalarray *changes;
+    icaltimezonetransitions *transitions;
     icalcomponent *comp;
+    int expanded_year = 0;
 
 #ifdef ICALTIMEZONE_DEBUG_PRINT
     printf("\nExpanding changes for: %s to year: %i\n", zone->tzid, end_year);
 #endif
 
-    changes = icalarray_new(sizeof(icaltimezonechange), 32);
+    /* Extend the changes we already have by the years after them, rather
+       than expanding all of the recurrences again from their DTSTART. */
+    if (zone->changes && zone->end_year < end_year) {
+        changes = icalarray_copy(zone->changes->changes);
+        expanded_year = zone->end_year;
+    } else {
+        changes = icalarray_new(sizeof(icaltimezonechange), 32);
+    }
     if (!changes) {
         return;
     }
@@ -531,7 +716,7 @@ static void icaltimezone_expand_changes(icaltimezone *zone, int end_year)
     /* Scan the STANDARD and DAYLIGHT subcomponents. */
     comp = icalcomponent_get_first_component(zone->component, ICAL_ANY_COMPONENT);
     while (comp) {
-        icaltimezone_expand_vtimezone(comp, end_year, changes);
+        icaltimezone_expand_vtimezone_after(comp, expanded_year, end_year, changes);
         comp = icalcomponent_get_next_component(zone->component, ICAL_ANY_COMPONENT);
     }
 
@@ -539,16 +724,159 @@ static void icaltimezone_expand_changes(icaltimezone *zone, int end_year)
        matter. */
     icalarray_sort(changes, icaltimezone_compare_change_fn);
 
-    if (zone->changes) {
-        icalarray_free(zone->changes);
-        zone->changes = 0;
+    transitions = icaltimezone_transitions_new(changes);
+    if (!transitions) {
+        return;
+    }
+
+    /* Other threads may still be searching the old changes, so retire them
+       instead of freeing them. */
+    transitions->retired = zone->changes;
+
+    /* Publish the complete changes before the year they cover */
+    changes_store(&zone->changes, transitions);
+    changes_store(&zone->end_year, end_year);
+}
+
+/** @brief Returns the number of seconds since the epoch of a time given by
+ * its parts, in the proleptic Gregorian calendar.
+ */
+static int64_t icaltimezone_seconds(int year, int month, int day, int hour, int minute, int second)
+{
+    int64_t days = icaltime_days_from_civil(year, month, day);
+
+    return ((days * 24 + hour) * 60 + minute) * 60 + second;
+}
+
+/** @brief Builds the search tables for a sorted array of changes, taking
+ * ownership of the array.
+ */
+static icaltimezonetransitions *icaltimezone_transitions_new(icalarray *changes)
+{
+    icaltimezonetransitions *transitions;
+    size_t num_changes, i;
+    char *values;
+
+    if (!changes) {
+        return NULL;
+    }
+
+    num_changes = changes->num_elements;
+    transitions = (icaltimezonetransitions *)icalmemory_new_buffer(sizeof(icaltimezonetransitions));
+    values = (char *)icalmemory_new_buffer((num_changes ? num_changes : 1) *
+                                           (3 * sizeof(int64_t) + sizeof(*transitions->offsets)));
+    if (!transitions || !values) {
+        icalmemory_free_buffer(transitions);
+        icalmemory_free_buffer(values);
+        icalarray_free(changes);
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return NULL;
+    }
+
+    transitions->changes = changes;
+    transitions->num_changes = num_changes;
+    transitions->utc = (int64_t *)values;
+    transitions->local = transitions->utc + num_changes;
+    transitions->overlap_end = transitions->local + num_changes;
+    transitions->offsets = (icaltimezoneoffset(*)[3])(transitions->overlap_end + num_changes);
+    transitions->before.utc_offset = 0;
+    transitions->before.is_daylight = 0;
+    transitions->retired = NULL;
+
+    for (i = 0; i < num_changes; i++) {
+        const icaltimezonechange *change = icalarray_element_at(changes, i);
+        icaltimezoneoffset *offsets = transitions->offsets[i];
+        int64_t utc = icaltimezone_seconds(change->year, change->month, change->day,
+                                           change->hour, change->minute, change->second);
+
+        transitions->utc[i] = utc;
+
+        /* If the clock is going backward, the change applies from the
+           first of the local times which are used twice, e.g. if the time
+           change is at 2:00AM local time and the clock is going back to
+           1:00AM it applies from 1:00AM. */
+        transitions->local[i] = utc + (change->utc_offset < change->prev_utc_offset ? change->utc_offset : change->prev_utc_offset);
+        transitions->overlap_end[i] = transitions->local[i];
+
+        offsets[0].utc_offset = change->utc_offset;
+        offsets[0].is_daylight = change->is_daylight;
+        offsets[1] = offsets[2] = offsets[0];
+
+        /* Until the local time the clock went back from, use the change
+           with the daylight setting which matches the time, or the one with
+           standard time if we don't know. */
+        if (i > 0 && change->utc_offset < change->prev_utc_offset) {
+            const icaltimezonechange *prev_change = icalarray_element_at(changes, i - 1);
+            int want_daylight;
+
+            transitions->overlap_end[i] = utc + change->prev_utc_offset;
+
+            for (want_daylight = 0; want_daylight <= 1; want_daylight++) {
+                if (change->is_daylight != want_daylight &&
+                    prev_change->is_daylight == want_daylight) {
+                    offsets[1 + want_daylight].utc_offset = prev_change->utc_offset;
+                    offsets[1 + want_daylight].is_daylight = prev_change->is_daylight;
+                }
+            }
+        }
+    }
+
+    /* Before the first change we have no data, so we use its prev UTC
+       offset. */
+    if (num_changes > 0) {
+        const icaltimezonechange *first_change = icalarray_element_at(changes, 0);
+
+        transitions->before.utc_offset = first_change->prev_utc_offset;
+        transitions->before.is_daylight = !first_change->is_daylight;
     }
 
-    zone->changes = changes;
-    zone->end_year = end_year;
+    return transitions;
+}
+
+void icaltimezone_set_expansion_window(icaltimezone *zone, int years)
+{
+    icalerror_check_arg_rv(zone, "zone");
+    icalerror_check_arg_rv(years >= 0, "years");
+
+    icaltimezone_changes_lock();
+    zone->expansion_window = years;
+    icaltimezone_changes_unlock();
+}
+
+int icaltimezone_get_expansion_window(const icaltimezone *zone)
+{
+    icalerror_check_arg_rz(zone, "zone");
+
+    return zone->expansion_window;
+}
+
+/** @brief Frees the changes, together with all of the changes they replaced. */
+static void icaltimezone_transitions_free(icaltimezonetransitions *changes)
+{
+    while (changes) {
+        icaltimezonetransitions *retired = changes->retired;
+
+        icalarray_free(changes->changes);
+        icalmemory_free_buffer(changes->utc);
+        icalmemory_free_buffer(changes);
+        changes = retired;
+    }
 }
 
 void icaltimezone_expand_vtimezone(icalcomponent *comp, int end_year, icalarray *changes)
+{
+    icaltimezone_expand_vtimezone_after(comp, 0, end_year, changes);
+}
+
+/** @brief Expands the STANDARD or DAYLIGHT component @p comp up to @p end_year,
+ * when @p changes already holds its changes up to @p expanded_year, or
+ * nothing if that is 0.
+ *
+ * The DTSTART and RDATEs are always added in full, so only the RRULE
+ * occurrences in the years after @p expanded_year are appended.
+ */
+static void icaltimezone_expand_vtimezone_after(icalcomponent *comp, int expanded_year,
+                                                int end_year, icalarray *changes)
 {
     icaltimezonechange change;
     icalproperty *prop;
@@ -624,7 +952,7 @@ void icaltimezone_expand_vtimezone(icalcomponent *comp, int end_year, icalarray
 
     /* If the STANDARD/DAYLIGHT component has no recurrence rule, we add
        a single change for the DTSTART. */
-    if (!has_rrule) {
+    if (!has_rrule && !expanded_year) {
         change.year = dtstart.year;
         change.month = dtstart.month;
         change.day = dtstart.day;
@@ -646,12 +974,15 @@ void icaltimezone_expand_vtimezone(icalcomponent *comp, int end_year, icalarray
 
     /* The component has recurrence data, so we expand that now. */
     prop = icalcomponent_get_first_property(comp, ICAL_ANY_PROPERTY);
-    while (prop && (has_rdate || has_rrule)) {
+    while (prop && ((has_rdate && !expanded_year) || has_rrule)) {
 #ifdef ICALTIMEZONE_DEBUG_PRINT
         printf("Expanding property...\n");
 #endif
         switch (icalproperty_isa(prop)) {
         case ICAL_RDATE_PROPERTY:
+            if (expanded_year) {
+                break;
+            }
             rdate = icalproperty_get_rdate(prop);
             change.year = rdate.time.year;
             change.month = rdate.time.month;
@@ -722,9 +1053,21 @@ void icaltimezone_expand_vtimezone(icalcomponent *comp, int end_year, icalarray
 
                 icaltimezone_adjust_change(&change, 0, 0, 0, -change.prev_utc_offset);
 
-                icalarray_append(changes, &change);
+                if (!expanded_year) {
+                    icalarray_append(changes, &change);
+                }
 
                 rrule_iterator = icalrecur_iterator_new(rrule, dtstart);
+                if (rrule_iterator && expanded_year >= dtstart.year) {
+                    /* Continue with the first year not expanded yet */
+                    struct icaltimetype start = dtstart;
+
+                    start.year = expanded_year + 1;
+                    start.month = 1;
+                    start.day = 1;
+                    start.hour = start.minute = start.second = 0;
+                    (void)icalrecur_iterator_set_start(rrule_iterator, start);
+                }
                 for (; rrule_iterator;) {
                     occ = icalrecur_iterator_next(rrule_iterator);
                     /* Skip dtstart since we just added it */
@@ -734,6 +1077,9 @@ void icaltimezone_expand_vtimezone(icalcomponent *comp, int end_year, icalarray
                     if (occ.year > end_year || icaltime_is_null_time(occ)) {
                         break;
                     }
+                    if (occ.year <= expanded_year) {
+                        continue;
+                    }
                     change.year = occ.year;
                     change.month = occ.month;
                     change.day = occ.day;
@@ -829,177 +1175,151 @@ void icaltimezone_convert_time(struct icaltimetype *tt,
     icaltime_adjust(tt, 0, 0, 0, utc_offset);
 }
 
-int icaltimezone_get_utc_offset(icaltimezone *zone, const struct icaltimetype *tt, int *is_daylight)
+/** @brief Sets the date and time of @p tt from a number of seconds since
+ * the epoch, in the proleptic Gregorian calendar.
+ */
+static void icaltimezone_set_seconds(struct icaltimetype *tt, int64_t seconds)
 {
-    icaltimezonechange *zone_change, *prev_zone_change;
-    icaltimezonechange tt_change = {0}, tmp_change = {0};
-    size_t change_num, change_num_to_use;
-    int found_change;
-    int step, utc_offset_change, cmp;
-    int want_daylight;
-
-    if (tt == NULL) {
-        return 0;
-    }
+    int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    int64_t time = seconds - days * 86400;
+    int64_t year;
+
+    icaltime_civil_from_days(days, &year, &tt->month, &tt->day);
+    tt->year = (int)year;
+    tt->hour = (int)(time / 3600);
+    tt->minute = (int)(time / 60 % 60);
+    tt->second = (int)(time % 60);
+}
 
-    if (is_daylight) {
-        *is_daylight = 0;
-    }
+/** @brief Returns a year on or after the one of a number of seconds since
+ * the epoch, for expanding the changes far enough.
+ */
+static int icaltimezone_year_not_before(int64_t seconds)
+{
+    /* The average Gregorian year has 365.2425 days */
+    int64_t year = 1970 + seconds / 31556952 + (seconds >= 0 ? 1 : 0);
 
-    /* For local times and UTC return 0. */
-    if (zone == NULL || zone == &utc_timezone) {
+    if (year > ICALTIMEZONE_MAX_YEAR) {
+        return ICALTIMEZONE_MAX_YEAR;
+    } else if (year < 0) {
         return 0;
     }
 
-    /* Use the builtin icaltimezone if possible. */
-    if (zone->builtin_timezone) {
-        zone = zone->builtin_timezone;
-    }
+    return (int)year;
+}
 
-    icaltimezone_changes_lock();
+void icaltimezone_convert_times(icaltimezone *from_zone, icaltimezone *to_zone,
+                                struct icaltimetype *tts, size_t n)
+{
+    icaltimezonecursor from, to;
+    size_t i;
 
-    /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage(zone, tt->year);
+    icalerror_check_arg_rv(tts || n == 0, "tts");
 
-    if (!zone->changes || zone->changes->num_elements == 0) {
-        icaltimezone_changes_unlock();
-        return 0;
+    /* We don't need to do anything if both timezones are the same, or we are
+       converting floating times. */
+    if (from_zone == to_zone || from_zone == NULL) {
+        return;
     }
 
-    /* Copy the time parts of the icaltimetype to an icaltimezonechange so we
-       can use our comparison function on it. */
-    tt_change.year = tt->year;
-    tt_change.month = tt->month;
-    tt_change.day = tt->day;
-    tt_change.hour = tt->hour;
-    tt_change.minute = tt->minute;
-    tt_change.second = tt->second;
-
-    /* This should find a change close to the time, either the change before
-       it or the change after it. */
-    change_num = icaltimezone_find_nearby_change(zone, &tt_change);
-
-    /* Now move backwards or forwards to find the timezone change that applies
-       to tt. It should only have to do 1 or 2 steps. */
-    zone_change = icalarray_element_at(zone->changes, change_num);
-    step = 1;
-    found_change = 0;
-    change_num_to_use = (size_t)-1; // invalid on purpose
-    for (;;) {
-        /* Copy the change, so we can adjust it. */
-        tmp_change = *zone_change;
-
-        /* If the clock is going backward, check if it is in the region of time
-           that is used twice. If it is, use the change with the daylight
-           setting which matches tt, or use standard if we don't know. */
-        if (tmp_change.utc_offset < tmp_change.prev_utc_offset) {
-            /* If the time change is at 2:00AM local time and the clock is
-               going back to 1:00AM we adjust the change to 1:00AM. We may
-               have the wrong change but we'll figure that out later. */
-            icaltimezone_adjust_change(&tmp_change, 0, 0, 0, tmp_change.utc_offset);
-        } else {
-            icaltimezone_adjust_change(&tmp_change, 0, 0, 0, tmp_change.prev_utc_offset);
-        }
-
-        cmp = icaltimezone_compare_change_fn(&tt_change, &tmp_change);
+    icaltimezone_cursor_init(&from, from_zone);
+    icaltimezone_cursor_init(&to, to_zone);
 
-        /* If the given time is on or after this change, then this change may
-           apply, but we continue as a later change may be the right one.
-           If the given time is before this change, then if we have already
-           found a change which applies we can use that, else we need to step
-           backwards. */
-        if (cmp >= 0) {
-            found_change = 1;
-            change_num_to_use = change_num;
-        } else {
-            step = -1;
-        }
+    for (i = 0; i < n; i++) {
+        struct icaltimetype *tt = &tts[i];
+        const icaltimezoneoffset *offset;
+        int64_t seconds;
 
-        /* If we are stepping backwards through the changes and we have found
-           a change that applies, then we know this is the change to use so
-           we exit the loop. */
-        if (step == -1 && found_change == 1) {
-            break;
+        if (icaltime_is_date(*tt)) {
+            continue;
         }
 
-        /* If we go past the start of the changes array, then we have no data
-           for this time so we return the prev UTC offset. */
-        if (change_num == 0 && step < 0) {
-            if (is_daylight) {
-                *is_daylight = !tmp_change.is_daylight;
-            }
+        seconds = icaltimezone_seconds(tt->year, tt->month, tt->day, tt->hour, tt->minute, tt->second);
 
-            icaltimezone_changes_unlock();
+        /* Convert the time to UTC, and then to the new timezone, like
+           icaltimezone_convert_time(). UTC may be in the next year. */
+        offset = icaltimezone_cursor_local(&from, tt->year, seconds, tt->is_daylight);
+        seconds -= offset->utc_offset;
+        offset = icaltimezone_cursor_utc(&to, tt->year + 1, seconds);
+        seconds += offset->utc_offset;
 
-            return tmp_change.prev_utc_offset;
-        }
+        icaltimezone_set_seconds(tt, seconds);
+        tt->is_daylight = offset->is_daylight;
+        tt->zone = to_zone;
+    }
+}
 
-        change_num += (size_t)step;
+void icaltimezone_convert_timets(icaltimezone *from_zone, icaltimezone *to_zone,
+                                 icaltime_t *times, size_t n)
+{
+    icaltimezonecursor from, to;
+    size_t i;
 
-        if (change_num >= zone->changes->num_elements) {
-            break;
-        }
+    icalerror_check_arg_rv(times || n == 0, "times");
 
-        zone_change = icalarray_element_at(zone->changes, change_num);
+    if (from_zone == to_zone || from_zone == NULL) {
+        return;
     }
 
-    /* If we didn't find a change to use, then we have a bug! */
-    icalerror_assert(found_change == 1, "No applicable timezone change found");
+    icaltimezone_cursor_init(&from, from_zone);
+    icaltimezone_cursor_init(&to, to_zone);
 
-    /* Now we just need to check if the time is in the overlapped region of
-       time when clocks go back. */
-    zone_change = icalarray_element_at(zone->changes, change_num_to_use);
+    for (i = 0; i < n; i++) {
+        int64_t seconds = (int64_t)times[i];
+        int year = icaltimezone_year_not_before(seconds);
 
-    utc_offset_change = zone_change->utc_offset - zone_change->prev_utc_offset;
-    if (utc_offset_change < 0 && change_num_to_use > 0) {
-        tmp_change = *zone_change;
-        icaltimezone_adjust_change(&tmp_change, 0, 0, 0, tmp_change.prev_utc_offset);
+        seconds -= icaltimezone_cursor_local(&from, year, seconds, 0)->utc_offset;
+        seconds += icaltimezone_cursor_utc(&to, year, seconds)->utc_offset;
+        times[i] = (icaltime_t)seconds;
+    }
+}
 
-        if (icaltimezone_compare_change_fn(&tt_change, &tmp_change) < 0) {
-            /* The time is in the overlapped region, so we may need to use
-               either the current zone_change or the previous one. If the
-               time has the is_daylight field set we use the matching change,
-               else we use the change with standard time. */
-            prev_zone_change = icalarray_element_at(zone->changes, change_num_to_use - 1);
+int icaltimezone_get_utc_offset(icaltimezone *zone, const struct icaltimetype *tt, int *is_daylight)
+{
+    icaltimezonecursor *cursor, fallback;
+    const icaltimezoneoffset *offset;
+    bool cached;
+    int64_t local;
 
-            /* I was going to add an is_daylight flag to struct icaltimetype,
-               but iCalendar doesn't let us distinguish between standard and
-               daylight time anyway, so there's no point. So we just use the
-               standard time instead. */
-            want_daylight = (tt->is_daylight == 1) ? 1 : 0;
+    if (tt == NULL) {
+        return 0;
+    }
 
-#ifdef ICALTIMEZONE_DEBUG_PRINT
-            if (zone_change->is_daylight == prev_zone_change->is_daylight) {
-                printf(" **** Same is_daylight setting\n");
-            }
-#endif
+    if (is_daylight) {
+        *is_daylight = 0;
+    }
 
-            if (zone_change->is_daylight != want_daylight &&
-                prev_zone_change->is_daylight == want_daylight) {
-                zone_change = prev_zone_change;
-            }
-        }
+    /* For local times and UTC return 0. */
+    if (zone == NULL || zone == &utc_timezone) {
+        return 0;
     }
 
-    /* Now we know exactly which timezone change applies to the time, so
-       we can return the UTC offset and whether it is a daylight time. */
-    if (is_daylight) {
-        *is_daylight = zone_change->is_daylight;
+    /* Use the builtin icaltimezone if possible. */
+    if (zone->builtin_timezone) {
+        zone = zone->builtin_timezone;
     }
-    utc_offset_change = zone_change->utc_offset;
 
-    icaltimezone_changes_unlock();
+    /* Search the changes from where the last lookup in the zone ended, if
+       this thread did one recently. The changes are expanded up to the
+       given time. */
+    cursor = icaltimezone_get_thread_cursor(zone, &fallback, &cached);
+    local = icaltimezone_seconds(tt->year, tt->month, tt->day, tt->hour, tt->minute, tt->second);
+    offset = icaltimezone_cursor_local(cursor, tt->year, local, tt->is_daylight);
+    icaltimezone_count_thread_cursor(cursor, cached);
 
-    return utc_offset_change;
+    if (is_daylight) {
+        *is_daylight = offset->is_daylight;
+    }
+
+    return offset->utc_offset;
 }
 
 int icaltimezone_get_utc_offset_of_utc_time(icaltimezone *zone,
                                             const struct icaltimetype *tt, int *is_daylight)
 {
-    icaltimezonechange *zone_change, tt_change, tmp_change;
-    size_t change_num, change_num_to_use;
-    int found_change = 1;
-    int step, utc_offset;
+    icaltimezonecursor *cursor, fallback;
+    const icaltimezoneoffset *offset;
+    bool cached;
 
     if (is_daylight) {
         *is_daylight = 0;
@@ -1015,124 +1335,263 @@ int icaltimezone_get_utc_offset_of_utc_time(icaltimezone *zone,
         zone = zone->builtin_timezone;
     }
 
-    icaltimezone_changes_lock();
+    cursor = icaltimezone_get_thread_cursor(zone, &fallback, &cached);
+    offset = icaltimezone_cursor_utc(cursor, tt->year,
+                                     icaltimezone_seconds(tt->year, tt->month, tt->day,
+                                                          tt->hour, tt->minute, tt->second));
+    icaltimezone_count_thread_cursor(cursor, cached);
 
-    /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage(zone, tt->year);
+    if (is_daylight) {
+        *is_daylight = offset->is_daylight;
+    }
+
+    return offset->utc_offset;
+}
+
+/** @brief Returns the number of the sorted values which are on or before
+ * the given value.
+ *
+ * This is a binary search which halves the range without branching on the
+ * comparison, so that it compiles to conditional moves.
+ */
+static size_t icaltimezone_count_not_after(const int64_t *values, size_t num_values, int64_t value)
+{
+    const int64_t *base = values;
 
-    if (!zone->changes || zone->changes->num_elements == 0) {
-        icaltimezone_changes_unlock();
+    if (num_values == 0) {
         return 0;
     }
 
-    /* Copy the time parts of the icaltimetype to an icaltimezonechange so we
-       can use our comparison function on it. */
-    tt_change.year = tt->year;
-    tt_change.month = tt->month;
-    tt_change.day = tt->day;
-    tt_change.hour = tt->hour;
-    tt_change.minute = tt->minute;
-    tt_change.second = tt->second;
-
-    /* This should find a change close to the time, either the change before
-       it or the change after it. */
-    change_num = icaltimezone_find_nearby_change(zone, &tt_change);
-
-    /* Now move backwards or forwards to find the timezone change that applies
-       to tt. It should only have to do 1 or 2 steps. */
-    zone_change = icalarray_element_at(zone->changes, change_num);
-    step = 1;
-    found_change = 0;
-    change_num_to_use = (size_t)-1; // invalid on purpose
-    for (;;) {
-        /* Copy the change and adjust it to UTC. */
-        tmp_change = *zone_change;
-
-        /* If the given time is on or after this change, then this change may
-           apply, but we continue as a later change may be the right one.
-           If the given time is before this change, then if we have already
-           found a change which applies we can use that, else we need to step
-           backwards. */
-        if (icaltimezone_compare_change_fn(&tt_change, &tmp_change) >= 0) {
-            found_change = 1;
-            change_num_to_use = change_num;
-        } else {
-            step = -1;
-        }
+    while (num_values > 1) {
+        size_t half = num_values / 2;
 
-        /* If we are stepping backwards through the changes and we have found
-           a change that applies, then we know this is the change to use so
-           we exit the loop. */
-        if (step == -1 && found_change == 1) {
-            break;
-        }
+        base = (base[half] <= value) ? base + half : base;
+        num_values -= half;
+    }
 
-        /* If we go past the start of the changes array, then we have no data
-           for this time so we return the prev UTC offset. */
-        if (change_num == 0 && step < 0) {
-            if (is_daylight) {
-                *is_daylight = !tmp_change.is_daylight;
-            }
+    return (size_t)(base - values) + (*base <= value);
+}
 
-            icaltimezone_changes_unlock();
+/** The offset of UTC and floating times */
+static const icaltimezoneoffset icaltimezone_zero_offset = {0, 0};
 
-            return tmp_change.prev_utc_offset;
-        }
+static void icaltimezone_cursor_init(icaltimezonecursor *cursor, icaltimezone *zone)
+{
+    /* Use the builtin icaltimezone if possible. */
+    if (zone && zone->builtin_timezone) {
+        zone = zone->builtin_timezone;
+    }
 
-        change_num += (size_t)step;
+    cursor->zone = (zone == &utc_timezone) ? NULL : zone;
+    cursor->changes = NULL;
+    cursor->change_num = 0;
+    cursor->searched = false;
+}
 
-        if (change_num >= zone->changes->num_elements) {
-            break;
+/** @brief Moves the cursor to the number of changes which apply from a
+ * time on or before @p value, in UTC or local time.
+ *
+ * Times looked up in increasing order mostly stay before the same change or
+ * pass a few, so a few steps forward are tried before searching.
+ */
+static size_t icaltimezone_cursor_seek(icaltimezonecursor *cursor, int year, int64_t value, bool utc)
+{
+    const icaltimezonetransitions *changes;
+    const int64_t *values;
+    size_t num_changes, change_num, steps;
+
+    /* Always get the current changes of the zone, which is cheap once they
+       are expanded far enough. The changes the cursor searched last may have
+       been freed with their zone, even if another one took its place. */
+    changes = icaltimezone_get_changes(cursor->zone, year);
+    if (changes != cursor->changes) {
+        cursor->changes = changes;
+        cursor->change_num = 0;
+    }
+    if (!changes) {
+        return 0;
+    }
+
+    values = utc ? changes->utc : changes->local;
+    num_changes = changes->num_changes;
+    change_num = cursor->change_num <= num_changes ? cursor->change_num : 0;
+    cursor->searched = false;
+
+    if (change_num > 0 && values[change_num - 1] > value) {
+        change_num = icaltimezone_count_not_after(values, change_num, value);
+        cursor->searched = true;
+    } else {
+        for (steps = 0; change_num < num_changes && values[change_num] <= value; steps++) {
+            if (steps == 4) {
+                change_num += icaltimezone_count_not_after(values + change_num,
+                                                           num_changes - change_num, value);
+                cursor->searched = true;
+                break;
+            }
+            change_num++;
         }
+    }
+
+    cursor->change_num = change_num;
+    return change_num;
+}
 
-        zone_change = icalarray_element_at(zone->changes, change_num);
+/** @brief Returns the offset of a local time, like icaltimezone_get_utc_offset(). */
+static const icaltimezoneoffset *icaltimezone_cursor_local(icaltimezonecursor *cursor, int year,
+                                                           int64_t local, int is_daylight)
+{
+    const icaltimezonetransitions *changes;
+    size_t change_num;
+
+    if (!cursor->zone) {
+        return &icaltimezone_zero_offset;
     }
 
-    /* If we didn't find a change to use, then we have a bug! */
-    icalerror_assert(found_change == 1, "No applicable timezone change found");
+    change_num = icaltimezone_cursor_seek(cursor, year, local, false);
+    changes = cursor->changes;
 
-    /* Now we know exactly which timezone change applies to the time, so
-       we can return the UTC offset and whether it is a daylight time. */
-    zone_change = icalarray_element_at(zone->changes, change_num_to_use);
-    if (is_daylight) {
-        *is_daylight = zone_change->is_daylight;
+    if (!changes || changes->num_changes == 0) {
+        return &icaltimezone_zero_offset;
+    } else if (change_num == 0) {
+        return &changes->before;
+    } else if (local < changes->overlap_end[change_num - 1]) {
+        return &changes->offsets[change_num - 1][(is_daylight == 1) ? 2 : 1];
     }
-    utc_offset = zone_change->utc_offset;
 
-    icaltimezone_changes_unlock();
+    return &changes->offsets[change_num - 1][0];
+}
+
+/** @brief Returns the offset of a UTC time, like icaltimezone_get_utc_offset_of_utc_time(). */
+static const icaltimezoneoffset *icaltimezone_cursor_utc(icaltimezonecursor *cursor, int year,
+                                                         int64_t utc)
+{
+    const icaltimezonetransitions *changes;
+    size_t change_num;
+
+    if (!cursor->zone) {
+        return &icaltimezone_zero_offset;
+    }
+
+    change_num = icaltimezone_cursor_seek(cursor, year, utc, true);
+    changes = cursor->changes;
 
-    return utc_offset;
+    if (!changes || changes->num_changes == 0) {
+        return &icaltimezone_zero_offset;
+    } else if (change_num == 0) {
+        return &changes->before;
+    }
+
+    return &changes->offsets[change_num - 1][0];
+}
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+static pthread_key_t thread_cursors_key;
+static pthread_once_t thread_cursors_key_once = PTHREAD_ONCE_INIT;
+
+static void thread_cursors_destroy(void *buf)
+{
+    free(buf);
+    pthread_setspecific(thread_cursors_key, NULL);
+}
+
+static void thread_cursors_key_alloc(void)
+{
+    pthread_key_create(&thread_cursors_key, thread_cursors_destroy);
+}
+#else
+static ICAL_GLOBAL_VAR icaltimezonethreadcursors global_thread_cursors;
+#endif
+
+/* Not allocated with icalmemory_new_buffer(), as the cursors stay around
+   for the lifetime of the thread */
+static icaltimezonethreadcursors *icaltimezone_get_thread_cursors(void)
+{
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    icaltimezonethreadcursors *cursors;
+
+    pthread_once(&thread_cursors_key_once, thread_cursors_key_alloc);
+
+    cursors = pthread_getspecific(thread_cursors_key);
+    if (!cursors) {
+        cursors = calloc(1, sizeof(icaltimezonethreadcursors));
+        pthread_setspecific(thread_cursors_key, cursors);
+    }
+
+    return cursors;
+#else
+    return &global_thread_cursors;
+#endif
 }
 
-/** @brief Returns the index of a timezone change which is close to the time
- * given in change.
+/** @brief Returns the cursor of the calling thread for the zone, or
+ * @p fallback initialized for it if the thread has no cursors.
+ *
+ * The zone is only compared with those of the cursors, so a cursor left
+ * for a freed zone is harmless: seeking gets the changes from the zone
+ * passed in and only uses the position of the cursor as a starting point.
  *
- * Hold icaltimezone_changes_lock(); before calling this function.
-*/
-static size_t icaltimezone_find_nearby_change(icaltimezone *zone, const icaltimezonechange *change)
+ * @p cached is set to whether the thread already had a cursor for the zone.
+ */
+static icaltimezonecursor *icaltimezone_get_thread_cursor(icaltimezone *zone,
+                                                          icaltimezonecursor *fallback,
+                                                          bool *cached)
 {
-    icaltimezonechange *zone_change;
-    size_t lower, middle, upper;
-    int cmp;
-
-    /* Do a simple binary search. */
-    lower = middle = 0;
-    upper = zone->changes->num_elements;
-
-    while (lower < upper) {
-        middle = (lower + upper) / 2;
-        zone_change = icalarray_element_at(zone->changes, middle);
-        cmp = icaltimezone_compare_change_fn(change, zone_change);
-        if (cmp == 0) {
-            break;
-        } else if (cmp < 0) {
-            upper = middle;
-        } else {
-            lower = middle + 1;
+    icaltimezonethreadcursors *cursors = icaltimezone_get_thread_cursors();
+    icaltimezonecursor *cursor;
+    int i;
+
+    *cached = false;
+    if (!cursors) {
+        icaltimezone_cursor_init(fallback, zone);
+        return fallback;
+    }
+
+    cursors->lookups++;
+    for (i = 0; i < ICALTIMEZONE_THREAD_CURSORS; i++) {
+        cursor = &cursors->cursors[i];
+        if (cursor->zone == zone) {
+            *cached = true;
+            return cursor;
         }
     }
 
-    return middle;
+    cursor = &cursors->cursors[cursors->next];
+    cursors->next = (cursors->next + 1) % ICALTIMEZONE_THREAD_CURSORS;
+    icaltimezone_cursor_init(cursor, zone);
+
+    return cursor;
+}
+
+/** @brief Counts a lookup as a hit if the thread had a cursor for the zone
+ * which did not need to search.
+ */
+static void icaltimezone_count_thread_cursor(const icaltimezonecursor *cursor, bool cached)
+{
+    if (cached && !cursor->searched) {
+        icaltimezone_get_thread_cursors()->hits++;
+    }
+}
+
+void icaltimezone_get_offset_cache_statistics(size_t *lookups, size_t *hits)
+{
+    icaltimezonethreadcursors *cursors = icaltimezone_get_thread_cursors();
+
+    if (lookups) {
+        *lookups = cursors ? cursors->lookups : 0;
+    }
+    if (hits) {
+        *hits = cursors ? cursors->hits : 0;
+    }
+}
+
+void icaltimezone_reset_offset_cache_statistics(void)
+{
+    icaltimezonethreadcursors *cursors = icaltimezone_get_thread_cursors();
+
+    if (cursors) {
+        cursors->lookups = 0;
+        cursors->hits = 0;
+    }
 }
 
 /** @brief Adds (or subtracts) a time from an icaltimezonechange.
@@ -1379,15 +1838,103 @@ void icaltimezone_free_builtin_timezones(void)
     icaltimezone_builtin_lock();
     icaltimezone_array_free(builtin_timezones);
     builtin_timezones = 0;
+    icalmemory_free_buffer(builtin_timezones_index);
+    builtin_timezones_index = NULL;
+    builtin_timezones_index_mask = 0;
+    builtin_timezones_indexed = 0;
     icaltimezone_builtin_unlock();
+
+    icaltzutil_free_cache();
+}
+
+static size_t icaltimezone_location_hash(const char *location)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+
+    while (*location) {
+        hash ^= (unsigned char)*location++;
+        hash *= 16777619U;
+    }
+
+    return (size_t)hash;
+}
+
+/** @brief Builds builtin_timezones_index for the given timezones. */
+static void icaltimezone_index_builtin_timezones(icalarray *timezones)
+{
+    size_t num_slots = 16, i;
+
+    while (num_slots < 2 * timezones->num_elements) {
+        num_slots *= 2;
+    }
+
+    builtin_timezones_index = (icaltimezone **)icalmemory_new_buffer(num_slots * sizeof(icaltimezone *));
+    if (!builtin_timezones_index) {
+        /* The zones are still found by a sequential search */
+        builtin_timezones_index_mask = 0;
+        builtin_timezones_indexed = 0;
+        return;
+    }
+    memset(builtin_timezones_index, 0, num_slots * sizeof(icaltimezone *));
+    builtin_timezones_index_mask = num_slots - 1;
+
+    for (i = 0; i < timezones->num_elements; i++) {
+        icaltimezone *zone = icalarray_element_at(timezones, i);
+        size_t slot;
+
+        if (!zone->location) {
+            continue;
+        }
+
+        slot = icaltimezone_location_hash(zone->location) & builtin_timezones_index_mask;
+        while (builtin_timezones_index[slot]) {
+            slot = (slot + 1) & builtin_timezones_index_mask;
+        }
+        builtin_timezones_index[slot] = zone;
+    }
+
+    builtin_timezones_indexed = timezones->num_elements;
+}
+
+/** @brief Returns the builtin timezone with the given location, if it is
+ * in builtin_timezones already.
+ */
+static icaltimezone *icaltimezone_find_builtin_timezone(const char *location)
+{
+    icaltimezone *zone;
+    size_t i;
+
+    if (builtin_timezones_index) {
+        size_t slot = icaltimezone_location_hash(location) & builtin_timezones_index_mask;
+
+        while ((zone = builtin_timezones_index[slot]) != NULL) {
+            if (strcmp(location, zone->location) == 0) {
+                return zone;
+            }
+            slot = (slot + 1) & builtin_timezones_index_mask;
+        }
+    }
+
+    /* The zones which are not in the index are few, so we just do a
+       sequential search */
+    for (i = builtin_timezones_indexed; builtin_timezones && i < builtin_timezones->num_elements; i++) {
+        const char *zone_location;
+
+        zone = icalarray_element_at(builtin_timezones, i);
+        zone_location = icaltimezone_get_location(zone);
+        if (zone_location && strcmp(location, zone_location) == 0) {
+            return zone;
+        }
+    }
+
+    return NULL;
 }
 
 icaltimezone *icaltimezone_get_builtin_timezone(const char *location)
 {
     icalcomponent *comp;
     icaltimezone *zone;
-    size_t lower;
-    const char *zone_location;
 
     if (!location || !location[0]) {
         return NULL;
@@ -1401,14 +1948,9 @@ icaltimezone *icaltimezone_get_builtin_timezone(const char *location)
         return &utc_timezone;
     }
 
-    /* The zones from the system are not stored in alphabetical order,
-       so we just do a sequential search */
-    for (lower = 0; lower < builtin_timezones->num_elements; lower++) {
-        zone = icalarray_element_at(builtin_timezones, lower);
-        zone_location = icaltimezone_get_location(zone);
-        if (zone_location && strcmp(location, zone_location) == 0) {
-            return zone;
-        }
+    zone = icaltimezone_find_builtin_timezone(location);
+    if (zone) {
+        return zone;
     }
 
     /* Check whether file exists, but is not mentioned in zone.tab.
@@ -1698,6 +2240,14 @@ static void icaltimezone_parse_zone_tab(void)
 
     icalarray *timezones = icalarray_new(sizeof(icaltimezone), 1024);
 
+    /* Use the zones.tab compiled into the library, unless the files are
+       to be read from a given directory */
+    const char *embedded = icaltimezone_get_embedded_zone(NULL);
+    if (embedded) {
+        fp = NULL;
+        goto parse;
+    }
+
     if (!use_builtin_tzdata) {
         zonedir = icaltzutil_get_zone_directory();
         zonetab = ZONES_TAB_SYSTEM_FILENAME;
@@ -1744,8 +2294,9 @@ static void icaltimezone_parse_zone_tab(void)
         return;
     }
 
+parse:
 #if !defined(__clang_analyzer__)
-    while (fgets(buf, (int)sizeof(buf), fp)) {
+    while (icaltimezone_read_line(buf, sizeof(buf), fp, &embedded)) {
         if (*buf == '#') {
             continue;
         }
@@ -1818,9 +2369,12 @@ static void icaltimezone_parse_zone_tab(void)
     }
 #endif // __clang_analyzer__
 
+    icaltimezone_index_builtin_timezones(timezones);
     builtin_timezones = timezones;
 
-    fclose(fp);
+    if (fp) {
+        fclose(fp);
+    }
 }
 
 /** @brief Loads the builtin VTIMEZONE data for the given timezone. */
@@ -1852,6 +2406,15 @@ static void icaltimezone_load_builtin_timezone(icaltimezone *zone)
         size_t filename_len;
         FILE *fp;
         icalparser *parser;
+        const char *embedded = icaltimezone_get_embedded_zone(zone->location);
+
+        if (embedded) {
+            parser = icalparser_new();
+            icalparser_set_gen_data(parser, &embedded);
+            comp = icalparser_parse(parser, icaltimezone_load_get_embedded_line_fn);
+            icalparser_free(parser);
+            goto loaded;
+        }
 
         filename_len = strlen(get_zone_directory_builtin()) + strlen(zone->location) + 6;
 
@@ -1882,6 +2445,7 @@ static void icaltimezone_load_builtin_timezone(icaltimezone *zone)
         icalparser_free(parser);
         fclose(fp);
 
+    loaded:
         /* Find the VTIMEZONE component inside the VCALENDAR. There should be 1. */
         subcomp = icalcomponent_get_first_component(comp, ICAL_VTIMEZONE_COMPONENT);
 
@@ -1954,6 +2518,78 @@ static char *icaltimezone_load_get_line_fn(char *s, size_t size, void *data)
     return fgets(s, (int)size, (FILE *)data);
 }
 
+/** @brief Callback used from icalparser_parse() for the embedded zones */
+static char *icaltimezone_load_get_embedded_line_fn(char *s, size_t size, void *data)
+{
+    return icaltimezone_read_line(s, size, NULL, (const char **)data);
+}
+
+/** @brief Reads a line like fgets(), from @p fp, or if that is NULL from the
+ * text at @p *embedded, which is advanced past the line.
+ */
+static char *icaltimezone_read_line(char *s, size_t size, FILE *fp, const char **embedded)
+{
+    const char *text = *embedded;
+    size_t len = 0;
+
+    if (fp) {
+        return fgets(s, (int)size, fp);
+    }
+
+    if (!text || !*text || size == 0) {
+        return NULL;
+    }
+
+    while (len + 1 < size && text[len]) {
+        if (text[len++] == '\n') {
+            break;
+        }
+    }
+
+    memcpy(s, text, len);
+    s[len] = '\0';
+    *embedded = text + len;
+
+    return s;
+}
+
+#if defined(USE_EMBEDDED_TZDATA)
+static int icaltimezone_compare_embedded_zone(const void *location, const void *zone)
+{
+    return strcmp((const char *)location, ((const struct embedded_zone *)zone)->location);
+}
+#endif
+
+/** @brief Returns the VCALENDAR of the builtin timezone with the given
+ * location which is compiled into the library, or with a NULL location the
+ * zones.tab file.
+ *
+ * Returns NULL if the data is not compiled in, or if it is not to be used
+ * because the zone files are to be read from another directory.
+ */
+static const char *icaltimezone_get_embedded_zone(const char *location)
+{
+#if defined(USE_EMBEDDED_TZDATA)
+    const struct embedded_zone *zone;
+
+    if (!use_builtin_tzdata || zone_files_directory) {
+        return NULL;
+    }
+
+    if (!location) {
+        return embedded_zones_tab;
+    }
+
+    zone = bsearch(location, embedded_zones, sizeof(embedded_zones) / sizeof(embedded_zones[0]),
+                   sizeof(embedded_zones[0]), icaltimezone_compare_embedded_zone);
+
+    return zone ? zone->vcalendar : NULL;
+#else
+    _unused(location);
+    return NULL;
+#endif
+}
+
 /*
  * DEBUGGING
  */
@@ -1962,21 +2598,23 @@ bool icaltimezone_dump_changes(icaltimezone *zone, int max_year, FILE *fp)
 {
     static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
                                      "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    const icaltimezonetransitions *changes;
     icaltimezonechange *zone_change;
     size_t change_num;
     char buffer[8];
 
     /* Make sure the changes array is expanded up to the given time. */
-    icaltimezone_ensure_coverage(zone, max_year);
+    changes = icaltimezone_get_changes(zone, max_year);
+    if (!changes) {
+        return false;
+    }
 
 #ifdef ICALTIMEZONE_DEBUG_PRINT
-    printf("Num changes: %zu\n", zone->changes->num_elements);
+    printf("Num changes: %zu\n", changes->num_changes);
 #endif
 
-    icaltimezone_changes_lock();
-
-    for (change_num = 0; change_num < zone->changes->num_elements; change_num++) {
-        zone_change = icalarray_element_at(zone->changes, change_num);
+    for (change_num = 0; change_num < changes->num_changes; change_num++) {
+        zone_change = icalarray_element_at(changes->changes, change_num);
 
         if (zone_change->year > max_year) {
             break;
@@ -1994,8 +2632,6 @@ bool icaltimezone_dump_changes(icaltimezone *zone, int max_year, FILE *fp)
         fprintf(fp, "\n");
     }
 
-    icaltimezone_changes_unlock();
-
     return true;
 }
 
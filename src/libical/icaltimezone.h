@@ -135,6 +135,43 @@ LIBICAL_ICAL_EXPORT void icaltimezone_convert_time(struct icaltimetype *tt,
                                                    icaltimezone *from_zone,
                                                    icaltimezone *to_zone);
 
+/**
+ * @brief Converts an array of times from one timezone to another.
+ *
+ * Each of the @p n times is converted like with icaltimezone_convert_time().
+ * The timezone changes are only searched once, for times in increasing
+ * order they are then walked along with the times.
+ *
+ * @param from_zone The timezone of the times, or NULL for floating times
+ * @param to_zone The timezone to convert the times to
+ * @param tts The times to convert, in place
+ * @param n The number of times
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltimezone_convert_times(icaltimezone *from_zone,
+                                                    icaltimezone *to_zone,
+                                                    struct icaltimetype *tts, size_t n);
+
+/**
+ * @brief Converts an array of local times, as seconds, from one timezone to another.
+ *
+ * Each of the @p n times is a local time in @p from_zone given as the number
+ * of seconds since 1970-01-01 00:00:00 in that zone, like icaltime_as_timet()
+ * of a floating time. It is replaced by the same instant as local time in
+ * @p to_zone, counted the same way. With the UTC timezone as @p from_zone
+ * this converts UTC instants to local times. Local times which occur twice
+ * when the clock goes back are taken as standard time.
+ *
+ * @param from_zone The timezone of the times, or NULL for floating times
+ * @param to_zone The timezone to convert the times to
+ * @param times The times to convert, in place
+ * @param n The number of times
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltimezone_convert_timets(icaltimezone *from_zone,
+                                                     icaltimezone *to_zone,
+                                                     icaltime_t *times, size_t n);
+
 /*
  * Getting offsets from UTC.
  */
@@ -157,6 +194,55 @@ LIBICAL_ICAL_EXPORT int icaltimezone_get_utc_offset_of_utc_time(icaltimezone *zo
                                                                 const struct icaltimetype *tt,
                                                                 int *is_daylight);
 
+/**
+ * @brief Gets the statistics of the offset lookups of the calling thread.
+ *
+ * Each thread remembers where its offset lookups in the last few timezones
+ * ended, so that a following lookup in the same timezone, such as for the
+ * next occurrence of a recurrence, usually finds its offset without
+ * searching the timezone changes. A lookup is counted as a hit if it did.
+ *
+ * @param lookups Set to the number of lookups, if not NULL
+ * @param hits Set to the number of lookups which were hits, if not NULL
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltimezone_get_offset_cache_statistics(size_t *lookups, size_t *hits);
+
+/**
+ * @brief Resets the statistics of the offset lookups of the calling thread to zero.
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltimezone_reset_offset_cache_statistics(void);
+
+/**
+ * @brief Sets how many years ahead the timezone changes of @p zone are expanded.
+ *
+ * When a time needs changes which were not expanded yet, they are expanded
+ * up to its year (or the current year, if that is later) plus @p years.
+ * Later expansions only append the years not covered yet. A larger window
+ * means fewer expansions when walking forward in time, a smaller one less
+ * work and memory for a zone that is only looked up around a few dates.
+ * The default is 5 years.
+ *
+ * The window is a minimum. The arrays of changes that an extension replaces
+ * are kept until the zone is freed, because lookups may still be reading
+ * them. So an extension at least doubles the span of years covered since
+ * the current year, which can reach further ahead than the window.
+ *
+ * @param zone The timezone
+ * @param years The number of years, at least 0
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT void icaltimezone_set_expansion_window(icaltimezone *zone, int years);
+
+/**
+ * @brief Returns how many years ahead the timezone changes of @p zone are expanded.
+ *
+ * @see icaltimezone_set_expansion_window()
+ * @since 4.0
+ */
+LIBICAL_ICAL_EXPORT int icaltimezone_get_expansion_window(const icaltimezone *zone);
+
 /*
  * Handling arrays of timezones. Mainly for internal use.
  */
@@ -204,7 +290,12 @@ LIBICAL_ICAL_EXPORT void icaltimezone_truncate_vtimezone(icalcomponent *vtz,
 /** Gets the directory to look for the zonefiles */
 LIBICAL_ICAL_EXPORT const char *icaltimezone_get_zone_directory(void);
 
-/** Sets the directory to look for the zonefiles */
+/** Sets the directory to look for the zonefiles
+ *
+ * If the builtin timezone data is compiled into the library, setting a
+ * directory makes the builtin timezones to be read from its files instead.
+ * Changing the directory only affects builtin timezones loaded afterwards.
+ */
 LIBICAL_ICAL_EXPORT void icaltimezone_set_zone_directory(const char *path);
 
 /** Frees the memory dedicated to the zonefile directory */
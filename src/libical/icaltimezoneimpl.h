@@ -55,10 +55,17 @@ struct _icaltimezone {
        If we need to calculate a date past this we need to expand the
        timezone component data from scratch. */
 
-    icalarray *changes;
-    /**< A dynamically-allocated array of time zone changes, sorted by the
-       time of the change in local time. So we can do fast binary-searches
-       to convert from local time to UTC. */
+    struct _icaltimezonetransitions *changes;
+    /**< The dynamically-allocated time zone changes, sorted by the time of
+       the change, with flat tables of their instants in UTC and local time
+       so we can do fast binary-searches to convert from local time to UTC
+       and back. Once published the changes are never modified, so they can
+       be read without holding a lock. */
+
+    int expansion_window;
+    /**< The number of years past the requested year (or the current year,
+       if that is later) to which the changes are expanded, so that lookups
+       in the following years don't need to expand them again. */
 };
 
 #endif /*ICALTIMEZONE_IMPL */
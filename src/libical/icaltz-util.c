@@ -18,6 +18,15 @@
 
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+#include <pthread.h>
+// To serialize the accesses to the cache of fetched timezones
+static pthread_mutex_t tzcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 #if defined(sun) && defined(__SVR4)
 #include <sys/types.h>
@@ -125,8 +134,206 @@ typedef struct
     icaltime_t transition;
     long int change;
 } leap;
+
+/* A location for which no VTIMEZONE could be built from the zone directory */
+struct tzcache_miss {
+    struct tzcache_miss *next;  /* in the hash bucket */
+    struct tzcache_miss *newer; /* in the list of misses by last use */
+    struct tzcache_miss *older;
+    char *full_path;
+    char *stamp_path; /* the file, or the nearest directory above it */
+    time_t mtime;     /* of stamp_path */
+    time_t checked;   /* when the miss was last found still valid */
+    bool settled;     /* whether stamp_path was last modified before that */
+};
+
+#define TZCACHE_BUCKETS 64
+
+/* The misses are limited to this many, dropping the least recently used */
+#define TZCACHE_MAX_MISSES 256
+
+/* A miss is checked against the mtime of its stamp_path at most this often */
+#define TZCACHE_REVALIDATE_SECONDS 1
+
+static ICAL_GLOBAL_VAR struct tzcache_miss *tzcache_misses[TZCACHE_BUCKETS];
+static ICAL_GLOBAL_VAR struct tzcache_miss *tzcache_newest = NULL;
+static ICAL_GLOBAL_VAR struct tzcache_miss *tzcache_oldest = NULL;
+static ICAL_GLOBAL_VAR size_t tzcache_num_misses = 0;
 //@endcond
 
+static void tzcache_lock(void)
+{
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_mutex_lock(&tzcache_mutex);
+#endif
+}
+
+static void tzcache_unlock(void)
+{
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_mutex_unlock(&tzcache_mutex);
+#endif
+}
+
+static struct tzcache_miss **tzcache_bucket(const char *full_path)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+
+    while (*full_path) {
+        hash ^= (unsigned char)*full_path++;
+        hash *= 16777619U;
+    }
+
+    return &tzcache_misses[hash % TZCACHE_BUCKETS];
+}
+
+/** @brief Stamps @p miss with the mtime of its file, or of the nearest
+    directory above it within the zone directory if it does not exist. */
+static void tzcache_stamp(struct tzcache_miss *miss, size_t zonedir_len)
+{
+    struct stat st;
+    char *slash;
+
+    miss->checked = time(NULL);
+    miss->mtime = 0;
+    miss->settled = false;
+
+    while (stat(miss->stamp_path, &st) != 0) {
+        slash = strrchr(miss->stamp_path, '/');
+        if (!slash || (size_t)(slash - miss->stamp_path) < zonedir_len) {
+            return;
+        }
+        *slash = '\0';
+    }
+
+    miss->mtime = st.st_mtime;
+    /* A change within the same second would go unnoticed */
+    miss->settled = (st.st_mtime < miss->checked - 1);
+}
+
+/** @brief Returns whether nothing changed at the stamp of @p miss since it
+    was recorded.  Must be called with the cache locked. */
+static bool tzcache_is_current(struct tzcache_miss *miss)
+{
+    time_t now = time(NULL);
+    struct stat st;
+
+    if (now - miss->checked < TZCACHE_REVALIDATE_SECONDS) {
+        return true;
+    }
+
+    if (!miss->settled || stat(miss->stamp_path, &st) != 0 || st.st_mtime != miss->mtime) {
+        return false;
+    }
+
+    miss->checked = now;
+    return true;
+}
+
+static void tzcache_unlink(struct tzcache_miss *miss)
+{
+    if (miss->newer) {
+        miss->newer->older = miss->older;
+    } else {
+        tzcache_newest = miss->older;
+    }
+    if (miss->older) {
+        miss->older->newer = miss->newer;
+    } else {
+        tzcache_oldest = miss->newer;
+    }
+}
+
+static void tzcache_link_newest(struct tzcache_miss *miss)
+{
+    miss->newer = NULL;
+    miss->older = tzcache_newest;
+    if (tzcache_newest) {
+        tzcache_newest->newer = miss;
+    } else {
+        tzcache_oldest = miss;
+    }
+    tzcache_newest = miss;
+}
+
+/** @brief Removes @p miss from the cache and frees it.  Must be called with
+    the cache locked. */
+static void tzcache_remove(struct tzcache_miss *miss)
+{
+    struct tzcache_miss **link = tzcache_bucket(miss->full_path);
+
+    while (*link != miss) {
+        link = &(*link)->next;
+    }
+    *link = miss->next;
+
+    tzcache_unlink(miss);
+    tzcache_num_misses--;
+    icalmemory_free_buffer(miss);
+}
+
+/** @brief Returns whether fetching the file failed before, and nothing
+    changed in the zone directory since that could make it succeed. */
+static bool tzcache_find_miss(const char *full_path)
+{
+    struct tzcache_miss *miss;
+    bool found = false;
+
+    tzcache_lock();
+    for (miss = *tzcache_bucket(full_path); miss; miss = miss->next) {
+        if (strcmp(miss->full_path, full_path) == 0) {
+            if (tzcache_is_current(miss)) {
+                tzcache_unlink(miss);
+                tzcache_link_newest(miss);
+                found = true;
+            } else {
+                tzcache_remove(miss);
+            }
+            break;
+        }
+    }
+    tzcache_unlock();
+
+    return found;
+}
+
+static void tzcache_add_miss(const char *full_path, size_t zonedir_len)
+{
+    struct tzcache_miss *miss, **bucket;
+    size_t size = strlen(full_path) + 1;
+
+    miss = icalmemory_new_buffer(sizeof(struct tzcache_miss) + 2 * size);
+    if (!miss) {
+        return;
+    }
+    miss->full_path = (char *)(miss + 1);
+    memcpy(miss->full_path, full_path, size);
+    miss->stamp_path = miss->full_path + size;
+    memcpy(miss->stamp_path, full_path, size);
+    tzcache_stamp(miss, zonedir_len);
+
+    tzcache_lock();
+    if (tzcache_num_misses >= TZCACHE_MAX_MISSES) {
+        tzcache_remove(tzcache_oldest);
+    }
+    bucket = tzcache_bucket(full_path);
+    miss->next = *bucket;
+    *bucket = miss;
+    tzcache_link_newest(miss);
+    tzcache_num_misses++;
+    tzcache_unlock();
+}
+
+void icaltzutil_free_cache(void)
+{
+    tzcache_lock();
+    while (tzcache_oldest) {
+        tzcache_remove(tzcache_oldest);
+    }
+    tzcache_unlock();
+}
+
 static int decode(const void *ptr)
 {
     if ((BYTE_ORDER == BIG_ENDIAN) && sizeof(int) == 4) {
@@ -445,7 +652,8 @@ static void terminate_rrule(struct zone_context *zone)
     }
 }
 
-icalcomponent *icaltzutil_fetch_timezone(const char *location)
+/** @brief Builds the VTIMEZONE for @p location from the TZif file at @p full_path. */
+static icalcomponent *fetch_timezone_file(const char *location, const char *full_path)
 {
     tzinfo header = {0};
     size_t i, num_trans, num_chars, num_leaps, num_isstd, num_isgmt;
@@ -453,9 +661,7 @@ icalcomponent *icaltzutil_fetch_timezone(const char *location)
     size_t size;
     int trans_size = 4;
 
-    const char *zonedir;
     FILE *f = NULL;
-    char *full_path = NULL;
     icaltime_t *transitions = NULL;
     char *r_trans = NULL, *temp;
     int *trans_idx = NULL;
@@ -487,23 +693,6 @@ icalcomponent *icaltzutil_fetch_timezone(const char *location)
         goto error;
     }
 
-    if (icaltimezone_get_builtin_tzdata()) {
-        goto error;
-    }
-
-    zonedir = icaltzutil_get_zone_directory();
-    if (!zonedir) {
-        icalerror_set_errno(ICAL_FILE_ERROR);
-        goto error;
-    }
-
-    size = strlen(zonedir) + strlen(location) + 2;
-    full_path = (char *)icalmemory_new_buffer(size);
-    if (full_path == NULL) {
-        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
-        goto error;
-    }
-    snprintf(full_path, size, "%s/%s", zonedir, location);
     if ((f = fopen(full_path, "rb")) == 0) {
         icalerror_set_errno(ICAL_FILE_ERROR);
         goto error;
@@ -1000,10 +1189,6 @@ error:
         fclose(f);
     }
 
-    if (full_path) {
-        icalmemory_free_buffer(full_path);
-    }
-
     if (transitions) {
         icalmemory_free_buffer(transitions);
     }
@@ -1039,3 +1224,43 @@ error:
 
     return tz_comp;
 }
+
+icalcomponent *icaltzutil_fetch_timezone(const char *location)
+{
+    const char *zonedir;
+    char *full_path;
+    size_t size;
+    icalcomponent *comp = NULL;
+
+    if (icaltimezone_get_builtin_tzdata()) {
+        return NULL;
+    }
+
+    zonedir = icaltzutil_get_zone_directory();
+    if (!zonedir) {
+        icalerror_set_errno(ICAL_FILE_ERROR);
+        return NULL;
+    }
+
+    size = strlen(zonedir) + strlen(location) + 2;
+    full_path = (char *)icalmemory_new_buffer(size);
+    if (full_path == NULL) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return NULL;
+    }
+    snprintf(full_path, size, "%s/%s", zonedir, location);
+
+    /* Do not look again for files which are missing or not usable */
+    if (tzcache_find_miss(full_path)) {
+        icalerror_set_errno(ICAL_FILE_ERROR);
+    } else {
+        comp = fetch_timezone_file(location, full_path);
+        if (!comp) {
+            tzcache_add_miss(full_path, strlen(zonedir));
+        }
+    }
+
+    icalmemory_free_buffer(full_path);
+
+    return comp;
+}
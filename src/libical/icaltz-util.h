@@ -44,4 +44,12 @@ LIBICAL_ICAL_EXPORT void icaltzutil_set_zone_directory(const char *zonepath);
  */
 LIBICAL_ICAL_NO_EXPORT icalcomponent *icaltzutil_fetch_timezone(const char *location);
 
+/**
+ * Forgets the locations for which icaltzutil_fetch_timezone() found no usable
+ * file, so that they are looked up in the zoneinfo directory again.
+ *
+ * @since 4.0
+ */
+LIBICAL_ICAL_NO_EXPORT void icaltzutil_free_cache(void);
+
 #endif
@@ -18,6 +18,7 @@
 #include "icalerror.h"
 #include "icalmemory.h"
 #include "icaltime.h"
+#include "icaltime_p.h"
 
 #include <ctype.h>
 #include <locale.h>
@@ -553,12 +554,21 @@ static icalvalue *icalvalue_new_from_string_with_error(icalvalue_kind kind,
 
     case ICAL_UTCOFFSET_VALUE: {
         int t, utcoffset, hours, minutes, seconds;
+        size_t len = strlen(str);
 
         /* treat the UTCOFSET string as a decimal number, disassemble its digits
                and reconstruct it as sections */
-        t = strtol(str, 0, 10);
+        if ((len == 5 || len == 7) && (str[0] == '+' || str[0] == '-') &&
+            icaltime_scan_digits(str + 1, (int)len - 1, &t)) {
+            /* the usual forms +HHMM and +HHMMSS, without calling strtol() */
+            if (str[0] == '-') {
+                t = -t;
+            }
+        } else {
+            t = strtol(str, 0, 10);
+        }
         /* add phantom seconds field */
-        if (strlen(str) < 7) {
+        if (len < 7) {
             t *= 100;
         }
         hours = (t / 10000);
@@ -11,6 +11,8 @@
 #endif
 
 #include "icalclassify.h"
+#include "icaldirset.h"
+#include "icalfileset.h"
 #include "icalmemory.h"
 
 #include <ctype.h>
@@ -50,6 +52,31 @@ char *icalclassify_lowercase(const char *str)
     return xnew;
 }
 
+struct icalclassify_overlaps {
+    struct icaltime_span span;
+    icalcomponent *return_set;
+};
+
+static void icalclassify_find_overlaps_callback(icalcomponent *c, void *data)
+{
+    struct icalclassify_overlaps *overlaps = data;
+    struct icaltime_span span;
+
+    icalerror_clear_errno();
+
+    span = icalcomponent_get_span(c);
+
+    if (icalerrno != ICAL_NO_ERROR) {
+        return;
+    }
+
+    if (overlaps->span.start < span.end && overlaps->span.end > span.start) {
+        icalcomponent *clone = icalcomponent_clone(c);
+
+        icalcomponent_add_component(overlaps->return_set, clone);
+    }
+}
+
 /** Returns a set of components that intersect in time with comp. For
 component X and Y to intersect:
     X.DTSTART < Y.DTEND && X.DTEND > Y.DTSTART
@@ -57,39 +84,36 @@ component X and Y to intersect:
 
 icalcomponent *icalclassify_find_overlaps(icalset *set, icalcomponent *comp)
 {
-    icalcomponent *return_set;
+    struct icalclassify_overlaps overlaps;
     icalcomponent *c;
-    struct icaltime_span span, compspan;
 
     icalerror_clear_errno();
-    compspan = icalcomponent_get_span(comp);
+    overlaps.span = icalcomponent_get_span(comp);
 
     if (icalerrno != ICAL_NO_ERROR) {
         return 0;
     }
 
-    return_set = icalcomponent_new(ICAL_XROOT_COMPONENT);
-
-    for (c = icalset_get_first_component(set); c != 0; c = icalset_get_next_component(set)) {
-        icalerror_clear_errno();
+    overlaps.return_set = icalcomponent_new(ICAL_XROOT_COMPONENT);
 
-        span = icalcomponent_get_span(c);
-
-        if (icalerrno != ICAL_NO_ERROR) {
-            continue;
-        }
-
-        if (compspan.start < span.end && compspan.end > span.start) {
-            icalcomponent *clone = icalcomponent_clone(c);
-
-            icalcomponent_add_component(return_set, clone);
+    if (set->kind == ICAL_FILE_SET) {
+        /* Only look at the components in the time index which may overlap */
+        icalfileset_foreach_in_span(set, overlaps.span.start, overlaps.span.end,
+                                    icalclassify_find_overlaps_callback, &overlaps);
+    } else if (set->kind == ICAL_DIR_SET) {
+        /* Only look at the clusters which may overlap */
+        icaldirset_foreach_in_span(set, overlaps.span.start, overlaps.span.end,
+                                   icalclassify_find_overlaps_callback, &overlaps);
+    } else {
+        for (c = icalset_get_first_component(set); c != 0; c = icalset_get_next_component(set)) {
+            icalclassify_find_overlaps_callback(c, &overlaps);
         }
     }
 
-    if (icalcomponent_count_components(return_set, ICAL_ANY_COMPONENT) != 0) {
-        return return_set;
+    if (icalcomponent_count_components(overlaps.return_set, ICAL_ANY_COMPONENT) != 0) {
+        return overlaps.return_set;
     } else {
-        icalcomponent_free(return_set);
+        icalcomponent_free(overlaps.return_set);
         return 0;
     }
 }
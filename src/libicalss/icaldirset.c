@@ -17,9 +17,14 @@
 #include "icaldirset.h"
 #include "icaldirsetimpl.h"
 #include "icalfileset.h"
+#include "icalfileset_p.h"
+#include "icalmemory.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #if defined(HAVE_DIRENT_H)
 #include <dirent.h>
@@ -29,8 +34,987 @@
 #include <sys/utsname.h>
 #endif
 
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* The size of the cluster files kept parsed by default */
+#define ICALDIRSET_DEFAULT_CACHE_SIZE (8 * 1024 * 1024)
+
 /** Default options used when NULL is passed to icalset_new() **/
-static icaldirset_options icaldirset_options_default = {O_RDWR | O_CREAT};
+static icaldirset_options icaldirset_options_default = {O_RDWR | O_CREAT,
+                                                        ICALDIRSET_DEFAULT_CACHE_SIZE, 0};
+
+/******* clusters kept parsed, and being prefetched *********/
+
+/* The modification time and size of a file when it was read. It is not
+   valid if the file could be changed again within the resolution of the
+   modification time without changing it. */
+struct icaldirset_stamp {
+    time_t mtime;
+    long long size;
+    bool valid;
+};
+
+/* A cluster which has not been changed since it was read */
+struct icaldirset_cached {
+    struct icaldirset_cached *prev; /**< used more recently */
+    struct icaldirset_cached *next; /**< used less recently */
+    icalcluster *cluster;
+    struct icaldirset_stamp stamp;
+};
+
+/* A cluster file being parsed on a worker thread */
+struct icaldirset_prefetch {
+    char *path; /**< NULL if the slot is free */
+    icalcluster *cluster;
+    struct icaldirset_stamp stamp;
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    pthread_t thread;
+#endif
+};
+
+struct icaldirset_cache {
+    struct icaldirset_cached *first; /**< used most recently */
+    struct icaldirset_cached *last;
+    size_t size;                     /**< of the files of the cached clusters */
+    struct icaldirset_stamp current; /**< of the file of the current cluster */
+    struct icaldirset_stamp listed;  /**< of the directory when it was listed */
+    struct icaldirset_prefetch *prefetch;
+    int num_prefetch;
+};
+
+static struct icaldirset_stamp icaldirset_stat(const char *path)
+{
+    struct icaldirset_stamp stamp;
+    struct stat sbuf;
+
+    memset(&stamp, 0, sizeof(stamp));
+    if (stat(path, &sbuf) == 0) {
+        stamp.mtime = sbuf.st_mtime;
+        stamp.size = (long long)sbuf.st_size;
+        stamp.valid = (sbuf.st_mtime < time(0) - 1);
+    }
+
+    return stamp;
+}
+
+static bool icaldirset_stamp_is_current(const struct icaldirset_stamp *stamp, const char *path)
+{
+    struct icaldirset_stamp now;
+
+    if (!stamp->valid) {
+        return false;
+    }
+
+    now = icaldirset_stat(path);
+    return now.mtime == stamp->mtime && now.size == stamp->size;
+}
+
+static void icaldirset_cache_unlink(struct icaldirset_cache *cache,
+                                    struct icaldirset_cached *cached)
+{
+    if (cached->prev) {
+        cached->prev->next = cached->next;
+    } else {
+        cache->first = cached->next;
+    }
+    if (cached->next) {
+        cached->next->prev = cached->prev;
+    } else {
+        cache->last = cached->prev;
+    }
+    cache->size -= (size_t)cached->stamp.size;
+}
+
+/* Keeps the cluster in the cache, or frees it if it does not fit */
+static void icaldirset_cache_put(icaldirset *dset, icalcluster *cluster,
+                                 const struct icaldirset_stamp *stamp)
+{
+    struct icaldirset_cache *cache = dset->cache;
+    struct icaldirset_cached *cached;
+
+    if (!cache || !stamp->valid || (size_t)stamp->size > dset->options.cache_size ||
+        (cached = malloc(sizeof(*cached))) == 0) {
+        icalcluster_free(cluster);
+        return;
+    }
+
+    cached->cluster = cluster;
+    cached->stamp = *stamp;
+    cached->prev = 0;
+    cached->next = cache->first;
+    if (cache->first) {
+        cache->first->prev = cached;
+    } else {
+        cache->last = cached;
+    }
+    cache->first = cached;
+    cache->size += (size_t)stamp->size;
+
+    /* Evict the clusters used least recently */
+    while (cache->size > dset->options.cache_size) {
+        cached = cache->last;
+        icaldirset_cache_unlink(cache, cached);
+        icalcluster_free(cached->cluster);
+        free(cached);
+    }
+}
+
+/* Returns the cached cluster of the file if the file has not changed
+   since, removing it from the cache */
+static icalcluster *icaldirset_cache_take(icaldirset *dset, const char *path,
+                                          struct icaldirset_stamp *stamp)
+{
+    struct icaldirset_cache *cache = dset->cache;
+    struct icaldirset_cached *cached;
+    icalcluster *cluster;
+
+    for (cached = cache ? cache->first : 0; cached != 0; cached = cached->next) {
+        if (strcmp(icalcluster_key(cached->cluster), path) == 0) {
+            break;
+        }
+    }
+
+    if (!cached) {
+        return 0;
+    }
+
+    icaldirset_cache_unlink(cache, cached);
+    cluster = cached->cluster;
+    *stamp = cached->stamp;
+    free(cached);
+
+    if (!icaldirset_stamp_is_current(stamp, path)) {
+        icalcluster_free(cluster);
+        return 0;
+    }
+
+    return cluster;
+}
+
+/* Reads the cluster of a file, like icalfileset_produce_icalcluster() but
+   without changing whether errors are fatal, and without copying the
+   components, so it can be called on worker threads */
+static icalcluster *icaldirset_read_cluster(const char *path)
+{
+    icalset *fileset = icalfileset_new_reader(path);
+    icalcluster *cluster = icalcluster_new(path, NULL);
+
+    if (fileset && cluster) {
+        icalcomponent *from = icalfileset_get_component(fileset);
+        icalcomponent *to = icalcluster_get_component(cluster);
+        icalcomponent *c;
+
+        while ((c = icalcomponent_get_first_component(from, ICAL_ANY_COMPONENT)) != 0) {
+            icalcomponent_remove_component(from, c);
+            icalcomponent_add_component(to, c);
+        }
+    }
+
+    if (fileset) {
+        icalset_free(fileset);
+    }
+
+    return cluster;
+}
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+static void *icaldirset_prefetch_run(void *data)
+{
+    struct icaldirset_prefetch *prefetch = data;
+
+    prefetch->stamp = icaldirset_stat(prefetch->path);
+    prefetch->cluster = icaldirset_read_cluster(prefetch->path);
+
+    return 0;
+}
+#endif
+
+/* Waits for the worker thread, and returns the prefetched cluster */
+static icalcluster *icaldirset_prefetch_finish(struct icaldirset_prefetch *prefetch,
+                                               struct icaldirset_stamp *stamp)
+{
+    icalcluster *cluster;
+
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    (void)pthread_join(prefetch->thread, 0);
+#endif
+
+    cluster = prefetch->cluster;
+    *stamp = prefetch->stamp;
+    free(prefetch->path);
+    memset(prefetch, 0, sizeof(*prefetch));
+
+    return cluster;
+}
+
+/* Returns the prefetched cluster of the file if the file has not changed
+   since */
+static icalcluster *icaldirset_prefetch_take(icaldirset *dset, const char *path,
+                                             struct icaldirset_stamp *stamp)
+{
+    struct icaldirset_cache *cache = dset->cache;
+    icalcluster *cluster;
+    int i;
+
+    for (i = 0; cache && i < cache->num_prefetch; i++) {
+        if (cache->prefetch[i].path && strcmp(cache->prefetch[i].path, path) == 0) {
+            cluster = icaldirset_prefetch_finish(&cache->prefetch[i], stamp);
+            if (cluster && !icaldirset_stamp_is_current(stamp, path)) {
+                icalcluster_free(cluster);
+                cluster = 0;
+            }
+            return cluster;
+        }
+    }
+
+    return 0;
+}
+
+/* Starts parsing the cluster files after the current one on worker
+   threads. Clusters prefetched for other files are moved to the cache. */
+static void icaldirset_prefetch_next(icaldirset *dset)
+{
+#if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
+    struct icaldirset_cache *cache = dset->cache;
+    struct icaldirset_stamp stamp;
+    icalcluster *cluster;
+    icalpvl_elem e;
+    char path[MAXPATHLEN];
+    int i, j, n;
+
+    if (!cache || cache->num_prefetch == 0 || icalerror_get_errors_are_fatal()) {
+        return;
+    }
+
+    /* Collect the clusters which are not needed next */
+    for (i = 0; i < cache->num_prefetch; i++) {
+        if (!cache->prefetch[i].path) {
+            continue;
+        }
+        for (e = dset->directory_iterator, n = 0;
+             e != 0 && n <= cache->num_prefetch; e = icalpvl_next(e), n++) {
+            snprintf(path, sizeof(path), "%s/%s", dset->dir, (char *)icalpvl_data(e));
+            if (n > 0 && strcmp(path, cache->prefetch[i].path) == 0) {
+                break;
+            }
+        }
+        if (e == 0 || n > cache->num_prefetch) {
+            cluster = icaldirset_prefetch_finish(&cache->prefetch[i], &stamp);
+            if (cluster) {
+                icaldirset_cache_put(dset, cluster, &stamp);
+            }
+        }
+    }
+
+    /* Start the ones which are neither cached nor being prefetched */
+    e = dset->directory_iterator ? icalpvl_next(dset->directory_iterator) : 0;
+    for (n = 0; e != 0 && n < cache->num_prefetch; e = icalpvl_next(e), n++) {
+        struct icaldirset_cached *cached;
+        struct icaldirset_prefetch *prefetch = 0;
+
+        snprintf(path, sizeof(path), "%s/%s", dset->dir, (char *)icalpvl_data(e));
+
+        for (cached = cache->first; cached != 0; cached = cached->next) {
+            if (strcmp(icalcluster_key(cached->cluster), path) == 0) {
+                break;
+            }
+        }
+        for (j = 0; cached == 0 && j < cache->num_prefetch; j++) {
+            if (cache->prefetch[j].path == 0) {
+                prefetch = prefetch ? prefetch : &cache->prefetch[j];
+            } else if (strcmp(cache->prefetch[j].path, path) == 0) {
+                break;
+            }
+        }
+        if (cached != 0 || j < cache->num_prefetch || prefetch == 0) {
+            continue;
+        }
+
+        prefetch->path = strdup(path);
+        if (prefetch->path &&
+            pthread_create(&prefetch->thread, 0, icaldirset_prefetch_run, prefetch) != 0) {
+            free(prefetch->path);
+            prefetch->path = 0;
+        }
+    }
+#else
+    _unused(dset);
+#endif
+}
+
+/* Returns the cluster of the file, from the cache or from the prefetched
+   clusters if the file has not changed since, or else reads it */
+static icalcluster *icaldirset_get_cluster(icaldirset *dset, const char *path)
+{
+    struct icaldirset_stamp stamp;
+    icalcluster *cluster;
+
+    cluster = icaldirset_cache_take(dset, path, &stamp);
+    if (!cluster) {
+        cluster = icaldirset_prefetch_take(dset, path, &stamp);
+    }
+    if (!cluster) {
+        stamp = icaldirset_stat(path);
+        cluster = icalfileset_produce_icalcluster(path);
+    }
+
+    if (dset->cache) {
+        dset->cache->current = stamp;
+    }
+
+    return cluster;
+}
+
+static void icaldirset_manifest_forget(icaldirset *dset, const char *path);
+
+/* Keeps the current cluster in the cache if it has not been changed, or
+   else frees it */
+static void icaldirset_put_cluster(icaldirset *dset)
+{
+    if (dset->cluster == 0) {
+        return;
+    }
+
+    if (dset->cache && !icalcluster_is_changed(dset->cluster)) {
+        icaldirset_cache_put(dset, dset->cluster, &dset->cache->current);
+    } else {
+        /* The changes are dropped, and the file is read again */
+        icaldirset_manifest_forget(dset, icalcluster_key(dset->cluster));
+        icalcluster_free(dset->cluster);
+    }
+    dset->cluster = 0;
+}
+
+static void icaldirset_cache_free(icaldirset *dset)
+{
+    struct icaldirset_cache *cache = dset->cache;
+    struct icaldirset_cached *cached;
+    struct icaldirset_stamp stamp;
+    int i;
+
+    if (!cache) {
+        return;
+    }
+
+    for (i = 0; i < cache->num_prefetch; i++) {
+        if (cache->prefetch[i].path) {
+            icalcluster_free(icaldirset_prefetch_finish(&cache->prefetch[i], &stamp));
+        }
+    }
+    free(cache->prefetch);
+
+    while ((cached = cache->first) != 0) {
+        icaldirset_cache_unlink(cache, cached);
+        icalcluster_free(cached->cluster);
+        free(cached);
+    }
+
+    free(cache);
+    dset->cache = 0;
+}
+
+/******* the manifest of the clusters, with their UIDs and times *********/
+
+/* The file in the directory which the manifest is written to, and the one
+   it is written to first so that it is replaced at once */
+#define ICALDIRSET_MANIFEST ".manifest"
+#define ICALDIRSET_MANIFEST_NEW ".manifest.new"
+#define ICALDIRSET_MANIFEST_HEADER "ICALDIRSET-MANIFEST 1\n"
+
+#define ICALDIRSET_HASH_BASIS 2166136261U
+#define ICALDIRSET_HASH(hash, c) (((hash) ^ (unsigned char)(c)) * 16777619U)
+
+/* A UID of the components of a cluster */
+struct icaldirset_uid {
+    struct icaldirset_uid *next;            /**< in the same bucket */
+    struct icaldirset_uid *next_in_cluster; /**< of the same cluster */
+    size_t cluster;                         /**< index of the entry of the cluster */
+    uint32_t hash;
+    char *uid;
+};
+
+/* What a cluster file holds */
+struct icaldirset_entry {
+    char *name;                    /**< of the file in the directory */
+    struct icaldirset_stamp stamp; /**< of the file the entry was taken from */
+    int64_t lower;                 /**< bounds of the spans of the components */
+    int64_t upper;
+    bool listed;                   /**< whether the file was in the directory when last listed */
+    bool changed;                  /**< whether the entry is of the changed current cluster */
+    struct icaldirset_uid *uids;
+};
+
+struct icaldirset_manifest {
+    struct icaldirset_entry *entries;
+    size_t num_entries;
+    struct icaldirset_uid **buckets; /**< the number of buckets is a power of two */
+    size_t num_buckets;
+    size_t num_uids;
+};
+
+static icalerrorenum icaldirset_read_directory(icaldirset *dset);
+
+static uint32_t icaldirset_hash_uid(const char *uid)
+{
+    uint32_t hash = ICALDIRSET_HASH_BASIS;
+
+    while (*uid) {
+        hash = ICALDIRSET_HASH(hash, *uid++);
+    }
+
+    return hash;
+}
+
+/* Returns the UID of the component, or of the first one in a VCALENDAR */
+static const char *icaldirset_get_uid(icalcomponent *comp)
+{
+    icalcomponent *inner = icalcomponent_get_inner(comp);
+    icalproperty *p = inner ? icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY) : 0;
+
+    return p ? icalproperty_get_uid(p) : 0;
+}
+
+static void icaldirset_entry_clear(struct icaldirset_manifest *manifest, size_t index)
+{
+    struct icaldirset_entry *entry = &manifest->entries[index];
+    struct icaldirset_uid *u, **prev;
+
+    while ((u = entry->uids) != 0) {
+        for (prev = &manifest->buckets[u->hash & (manifest->num_buckets - 1)]; *prev != u;
+             prev = &(*prev)->next) {
+        }
+        *prev = u->next;
+        entry->uids = u->next_in_cluster;
+        manifest->num_uids--;
+        free(u->uid);
+        free(u);
+    }
+
+    entry->lower = INT64_MAX;
+    entry->upper = INT64_MIN;
+}
+
+static bool icaldirset_manifest_grow(struct icaldirset_manifest *manifest)
+{
+    size_t num_buckets = manifest->num_buckets ? 2 * manifest->num_buckets : 64;
+    struct icaldirset_uid **buckets = calloc(num_buckets, sizeof(*buckets));
+    size_t i;
+
+    if (!buckets) {
+        return false;
+    }
+
+    for (i = 0; i < manifest->num_buckets; i++) {
+        struct icaldirset_uid *u, *next;
+
+        for (u = manifest->buckets[i]; u != 0; u = next) {
+            next = u->next;
+            u->next = buckets[u->hash & (num_buckets - 1)];
+            buckets[u->hash & (num_buckets - 1)] = u;
+        }
+    }
+
+    free(manifest->buckets);
+    manifest->buckets = buckets;
+    manifest->num_buckets = num_buckets;
+
+    return true;
+}
+
+static void icaldirset_entry_add_uid(struct icaldirset_manifest *manifest, size_t index,
+                                     const char *uid)
+{
+    uint32_t hash = icaldirset_hash_uid(uid);
+    struct icaldirset_uid *u;
+
+    if (manifest->num_uids >= manifest->num_buckets && !icaldirset_manifest_grow(manifest)) {
+        return;
+    }
+
+    for (u = manifest->buckets[hash & (manifest->num_buckets - 1)]; u != 0; u = u->next) {
+        if (u->cluster == index && u->hash == hash && strcmp(u->uid, uid) == 0) {
+            return;
+        }
+    }
+
+    u = malloc(sizeof(*u));
+    if (!u || (u->uid = strdup(uid)) == 0) {
+        free(u);
+        return;
+    }
+
+    u->cluster = index;
+    u->hash = hash;
+    u->next = manifest->buckets[hash & (manifest->num_buckets - 1)];
+    manifest->buckets[hash & (manifest->num_buckets - 1)] = u;
+    u->next_in_cluster = manifest->entries[index].uids;
+    manifest->entries[index].uids = u;
+    manifest->num_uids++;
+}
+
+/* Removes the UID from the entry unless a component of the cluster still
+   has it */
+static void icaldirset_entry_remove_uid(struct icaldirset_manifest *manifest, size_t index,
+                                        icalcluster *cluster, const char *uid)
+{
+    struct icaldirset_uid **u, **prev, *removed;
+    icalcompiter i;
+
+    for (i = icalcomponent_begin_component(icalcluster_get_component(cluster), ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
+        const char *c_uid = icaldirset_get_uid(icalcompiter_deref(&i));
+
+        if (c_uid && strcmp(c_uid, uid) == 0) {
+            return;
+        }
+    }
+
+    for (u = &manifest->entries[index].uids; *u != 0; u = &(*u)->next_in_cluster) {
+        if (strcmp((*u)->uid, uid) == 0) {
+            break;
+        }
+    }
+    if (*u == 0) {
+        return;
+    }
+
+    removed = *u;
+    *u = removed->next_in_cluster;
+    for (prev = &manifest->buckets[removed->hash & (manifest->num_buckets - 1)];
+         *prev != removed; prev = &(*prev)->next) {
+    }
+    *prev = removed->next;
+    manifest->num_uids--;
+    free(removed->uid);
+    free(removed);
+}
+
+static void icaldirset_entry_add_component(struct icaldirset_manifest *manifest, size_t index,
+                                           icalcomponent *comp)
+{
+    struct icaldirset_entry *entry = &manifest->entries[index];
+    const char *uid = icaldirset_get_uid(comp);
+    int64_t lower, upper;
+
+    if (uid) {
+        icaldirset_entry_add_uid(manifest, index, uid);
+    }
+
+    icalfileset_get_span_bounds(comp, &lower, &upper);
+    if (entry->lower > lower) {
+        entry->lower = lower;
+    }
+    if (entry->upper < upper) {
+        entry->upper = upper;
+    }
+}
+
+/* Takes the UIDs and times of the components of the cluster */
+static void icaldirset_entry_set(struct icaldirset_manifest *manifest, size_t index,
+                                 icalcluster *cluster, const struct icaldirset_stamp *stamp)
+{
+    icalcompiter i;
+
+    icaldirset_entry_clear(manifest, index);
+    manifest->entries[index].stamp = *stamp;
+    manifest->entries[index].changed = false;
+
+    if (!cluster) {
+        manifest->entries[index].stamp.valid = false;
+        return;
+    }
+
+    for (i = icalcomponent_begin_component(icalcluster_get_component(cluster), ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
+        icaldirset_entry_add_component(manifest, index, icalcompiter_deref(&i));
+    }
+}
+
+/* Returns the index of the entry of the cluster file, adding it if needed,
+   or the number of entries if it cannot be added */
+static size_t icaldirset_manifest_entry(struct icaldirset_manifest *manifest, const char *name)
+{
+    struct icaldirset_entry *entries, *entry;
+    size_t i;
+
+    for (i = 0; i < manifest->num_entries; i++) {
+        if (strcmp(manifest->entries[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    entries = realloc(manifest->entries, (manifest->num_entries + 1) * sizeof(*entries));
+    if (!entries) {
+        return manifest->num_entries;
+    }
+    manifest->entries = entries;
+
+    entry = &entries[manifest->num_entries];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = strdup(name);
+    if (!entry->name) {
+        return manifest->num_entries;
+    }
+    entry->lower = INT64_MAX;
+    entry->upper = INT64_MIN;
+    entry->listed = true;
+
+    return manifest->num_entries++;
+}
+
+/* Reads the manifest written last, whose entries are checked against their
+   files when they are used */
+static struct icaldirset_manifest *icaldirset_manifest_load(icaldirset *dset)
+{
+    struct icaldirset_manifest *manifest;
+    char path[MAXPATHLEN], *buf, *pos, *end, *line_end;
+    size_t index, size = 0;
+    struct stat sbuf;
+    int fd;
+
+    if (dset->manifest) {
+        return dset->manifest;
+    }
+
+    manifest = calloc(1, sizeof(*manifest));
+    if (!manifest || !icaldirset_manifest_grow(manifest)) {
+        free(manifest);
+        return 0;
+    }
+    dset->manifest = manifest;
+
+    snprintf(path, sizeof(path), "%s/%s", dset->dir, ICALDIRSET_MANIFEST);
+    fd = open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return manifest;
+    }
+
+    buf = 0;
+    if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0) {
+        buf = malloc((size_t)sbuf.st_size + 1);
+    }
+    while (buf && size < (size_t)sbuf.st_size) {
+        IO_SSIZE_T sz = read(fd, buf + size, (IO_SIZE_T)((size_t)sbuf.st_size - size));
+
+        if (sz <= 0) {
+            break;
+        }
+        size += (size_t)sz;
+    }
+    close(fd);
+
+    if (!buf) {
+        return manifest;
+    }
+    buf[size] = '\0';
+
+    if (strncmp(buf, ICALDIRSET_MANIFEST_HEADER, strlen(ICALDIRSET_MANIFEST_HEADER)) != 0) {
+        free(buf);
+        return manifest;
+    }
+
+    index = manifest->num_entries;
+    pos = buf + strlen(ICALDIRSET_MANIFEST_HEADER);
+    end = buf + size;
+    while (pos < end && (line_end = memchr(pos, '\n', (size_t)(end - pos))) != 0) {
+        long long mtime, file_size, lower, upper;
+        int valid, name_pos = 0;
+
+        *line_end = '\0';
+        if (sscanf(pos, "CLUSTER %d %lld %lld %lld %lld %n", &valid, &mtime, &file_size,
+                   &lower, &upper, &name_pos) == 5 &&
+            name_pos > 0 && pos[name_pos] != '\0') {
+            index = icaldirset_manifest_entry(manifest, pos + name_pos);
+            if (index < manifest->num_entries) {
+                struct icaldirset_entry *entry = &manifest->entries[index];
+
+                icaldirset_entry_clear(manifest, index);
+                entry->stamp.mtime = (time_t)mtime;
+                entry->stamp.size = file_size;
+                entry->stamp.valid = (valid != 0);
+                entry->lower = (int64_t)lower;
+                entry->upper = (int64_t)upper;
+            }
+        } else if (strncmp(pos, "UID ", 4) == 0 && index < manifest->num_entries) {
+            icaldirset_entry_add_uid(manifest, index, pos + 4);
+        }
+        pos = line_end + 1;
+    }
+
+    free(buf);
+
+    return manifest;
+}
+
+/* Writes the manifest next to the clusters, and replaces the one written
+   before with it */
+static void icaldirset_manifest_write(icaldirset *dset)
+{
+    struct icaldirset_manifest *manifest = dset->manifest;
+    char path[MAXPATHLEN], new_path[MAXPATHLEN], line[MAXPATHLEN + 128];
+    char *buf, *pos;
+    size_t i, buf_size = 4096;
+    bool written;
+    int fd;
+
+    buf = icalmemory_new_buffer(buf_size);
+    if (!manifest || !buf) {
+        icalmemory_free_buffer(buf);
+        return;
+    }
+
+    pos = buf;
+    icalmemory_append_string(&buf, &pos, &buf_size, ICALDIRSET_MANIFEST_HEADER);
+    for (i = 0; i < manifest->num_entries; i++) {
+        struct icaldirset_entry *entry = &manifest->entries[i];
+        struct icaldirset_uid *u;
+
+        if (!entry->listed || entry->changed) {
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "CLUSTER %d %lld %lld %lld %lld %s\n",
+                 entry->stamp.valid ? 1 : 0, (long long)entry->stamp.mtime,
+                 entry->stamp.size, (long long)entry->lower, (long long)entry->upper,
+                 entry->name);
+        icalmemory_append_string(&buf, &pos, &buf_size, line);
+        for (u = entry->uids; u != 0; u = u->next_in_cluster) {
+            icalmemory_append_string(&buf, &pos, &buf_size, "UID ");
+            icalmemory_append_string(&buf, &pos, &buf_size, u->uid);
+            icalmemory_append_char(&buf, &pos, &buf_size, '\n');
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dset->dir, ICALDIRSET_MANIFEST);
+    snprintf(new_path, sizeof(new_path), "%s/%s", dset->dir, ICALDIRSET_MANIFEST_NEW);
+
+    fd = open(new_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        icalmemory_free_buffer(buf);
+        return;
+    }
+
+    written = true;
+    for (i = 0; i < (size_t)(pos - buf);) {
+        IO_SSIZE_T sz = write(fd, buf + i, (IO_SIZE_T)((size_t)(pos - buf) - i));
+
+        if (sz <= 0) {
+            written = false;
+            break;
+        }
+        i += (size_t)sz;
+    }
+#if defined(HAVE_FSYNC)
+    (void)fsync(fd);
+#endif
+    close(fd);
+    icalmemory_free_buffer(buf);
+
+#if defined(_WIN32)
+    /* rename() does not replace an existing file */
+    (void)unlink(path);
+#endif
+    if (!written || rename(new_path, path) != 0) {
+        (void)unlink(new_path);
+    }
+}
+
+/* Checks the entries of the manifest against the files in the directory,
+   and takes the UIDs and times of the clusters which changed */
+static struct icaldirset_manifest *icaldirset_manifest_refresh(icaldirset *dset)
+{
+    struct icaldirset_manifest *manifest = icaldirset_manifest_load(dset);
+    char current[MAXPATHLEN], path[MAXPATHLEN];
+    struct icaldirset_stamp stamp;
+    icalcluster *cluster;
+    icalpvl_elem e;
+    size_t i, index;
+    bool scanned = false;
+
+    if (!manifest) {
+        return 0;
+    }
+
+    /* Listing the directory again replaces the elements of the list */
+    current[0] = '\0';
+    if (dset->directory_iterator != 0) {
+        strncpy(current, (char *)icalpvl_data(dset->directory_iterator), sizeof(current) - 1);
+        current[sizeof(current) - 1] = '\0';
+    }
+    if (icaldirset_read_directory(dset) != ICAL_NO_ERROR) {
+        return 0;
+    }
+    dset->directory_iterator = 0;
+    for (e = icalpvl_head(dset->directory); current[0] != '\0' && e != 0; e = icalpvl_next(e)) {
+        if (strcmp((char *)icalpvl_data(e), current) == 0) {
+            dset->directory_iterator = e;
+            break;
+        }
+    }
+
+    for (i = 0; i < manifest->num_entries; i++) {
+        manifest->entries[i].listed = false;
+    }
+
+    for (e = icalpvl_head(dset->directory); e != 0; e = icalpvl_next(e)) {
+        index = icaldirset_manifest_entry(manifest, (char *)icalpvl_data(e));
+        if (index == manifest->num_entries) {
+            return 0;
+        }
+        manifest->entries[index].listed = true;
+
+        snprintf(path, sizeof(path), "%s/%s", dset->dir, manifest->entries[index].name);
+        if (manifest->entries[index].changed ||
+            icaldirset_stamp_is_current(&manifest->entries[index].stamp, path)) {
+            continue;
+        }
+
+        if (dset->cluster != 0 && strcmp(icalcluster_key(dset->cluster), path) == 0) {
+            stamp = dset->cache ? dset->cache->current : icaldirset_stat(path);
+            stamp.valid = stamp.valid && dset->cache;
+            icaldirset_entry_set(manifest, index, dset->cluster, &stamp);
+            continue;
+        }
+
+        cluster = icaldirset_cache_take(dset, path, &stamp);
+        if (!cluster) {
+            stamp = icaldirset_stat(path);
+            cluster = icaldirset_read_cluster(path);
+        }
+        icaldirset_entry_set(manifest, index, cluster, &stamp);
+        if (cluster) {
+            icaldirset_cache_put(dset, cluster, &stamp);
+        }
+        scanned = true;
+    }
+
+    for (i = 0; i < manifest->num_entries; i++) {
+        if (!manifest->entries[i].listed) {
+            icaldirset_entry_clear(manifest, i);
+            manifest->entries[i].stamp.valid = false;
+        }
+    }
+
+    /* Keep what was read for the next time the set is opened */
+    if (scanned && (dset->options.flags & (O_WRONLY | O_RDWR)) != 0) {
+        icaldirset_manifest_write(dset);
+    }
+
+    return manifest;
+}
+
+/* Marks the entry of the changed current cluster, which is dropped, to be
+   taken from its file again */
+static void icaldirset_manifest_forget(icaldirset *dset, const char *path)
+{
+    struct icaldirset_manifest *manifest = dset->manifest;
+    size_t i;
+
+    for (i = 0; manifest && i < manifest->num_entries; i++) {
+        if (strcmp(manifest->entries[i].name, path + strlen(dset->dir) + 1) == 0) {
+            manifest->entries[i].changed = false;
+            manifest->entries[i].stamp.valid = false;
+        }
+    }
+}
+
+/* Returns the entry of the current cluster, or NULL */
+static struct icaldirset_entry *icaldirset_manifest_current(icaldirset *dset, size_t *index)
+{
+    struct icaldirset_manifest *manifest = icaldirset_manifest_load(dset);
+
+    if (!manifest || !dset->cluster) {
+        return 0;
+    }
+
+    *index = icaldirset_manifest_entry(manifest,
+                                       icalcluster_key(dset->cluster) + strlen(dset->dir) + 1);
+
+    return (*index < manifest->num_entries) ? &manifest->entries[*index] : 0;
+}
+
+static void icaldirset_manifest_free(icaldirset *dset)
+{
+    struct icaldirset_manifest *manifest = dset->manifest;
+    size_t i;
+
+    if (!manifest) {
+        return;
+    }
+
+    for (i = 0; i < manifest->num_entries; i++) {
+        icaldirset_entry_clear(manifest, i);
+        free(manifest->entries[i].name);
+    }
+    free(manifest->entries);
+    free(manifest->buckets);
+    free(manifest);
+    dset->manifest = 0;
+}
+
+/* Makes the cluster of the file in the directory the current one, with
+   the iterator of the directory on it */
+static icalerrorenum icaldirset_use_cluster(icaldirset *dset, const char *name)
+{
+    char path[MAXPATHLEN];
+    icalpvl_elem e;
+
+    snprintf(path, sizeof(path), "%s/%s", dset->dir, name);
+
+    if (dset->cluster != 0 && strcmp(path, icalcluster_key(dset->cluster)) != 0) {
+        icaldirset_put_cluster(dset);
+    }
+
+    if (dset->cluster == 0) {
+        dset->cluster = icaldirset_get_cluster(dset, path);
+
+        if (dset->cluster == 0) {
+            return icalerrno;
+        }
+    }
+
+    for (e = icalpvl_head(dset->directory); e != 0; e = icalpvl_next(e)) {
+        if (strcmp((char *)icalpvl_data(e), name) == 0) {
+            dset->directory_iterator = e;
+            break;
+        }
+    }
+
+    return ICAL_NO_ERROR;
+}
+
+/* Makes the cluster which holds the component with the UID, or the
+   component itself if it is not NULL, the current one. Returns the
+   component, or NULL if none of the clusters with the UID holds it. */
+static icalcomponent *icaldirset_find_uid(icaldirset *dset,
+                                          struct icaldirset_manifest *manifest, const char *uid,
+                                          const icalcomponent *comp)
+{
+    struct icaldirset_uid *u;
+    uint32_t hash = icaldirset_hash_uid(uid);
+    icalcomponent *c;
+
+    for (u = manifest->buckets[hash & (manifest->num_buckets - 1)]; u != 0; u = u->next) {
+        if (u->hash != hash || strcmp(u->uid, uid) != 0 ||
+            icaldirset_use_cluster(dset, manifest->entries[u->cluster].name) != ICAL_NO_ERROR) {
+            continue;
+        }
+
+        for (c = icalcluster_get_first_component(dset->cluster); c != 0;
+             c = icalcluster_get_next_component(dset->cluster)) {
+            const char *c_uid = icaldirset_get_uid(c);
+
+            if (comp ? (c == comp) : (c_uid != 0 && strcmp(c_uid, uid) == 0)) {
+                dset->first_component = 0;
+                return c;
+            }
+        }
+    }
+
+    return 0;
+}
 
 const char *icaldirset_path(icalset *set)
 {
@@ -51,13 +1035,32 @@ icalerrorenum icaldirset_commit(icalset *set)
     icaldirset *dset = (icaldirset *)set;
     icalset *fileset;
     icalfileset_options options = icalfileset_options_default;
+    struct icaldirset_stamp stamp;
+    struct icaldirset_entry *entry;
+    size_t index;
 
     options.cluster = dset->cluster;
 
     fileset = icalset_new(ICAL_FILE_SET, icalcluster_key(dset->cluster), &options);
 
     (void)fileset->commit(fileset);
-    fileset->free(fileset);
+    icalset_free(fileset);
+
+    /* The cluster is the same as its file now, which may be new */
+    icalcluster_commit(dset->cluster);
+    stamp = icaldirset_stat(icalcluster_key(dset->cluster));
+    if (dset->cache) {
+        dset->cache->current = stamp;
+        dset->cache->listed.valid = false;
+    }
+
+    /* Record what the file holds now in the manifest */
+    entry = icaldirset_manifest_current(dset, &index);
+    if (entry) {
+        icaldirset_entry_set(dset->manifest, index, dset->cluster, &stamp);
+        entry->listed = true;
+        icaldirset_manifest_write(dset);
+    }
 
     return ICAL_NO_ERROR;
 }
@@ -80,6 +1083,13 @@ static icalerrorenum icaldirset_read_directory(icaldirset *dset)
 #if defined(HAVE_DIRENT_H)
     struct dirent *de;
     DIR *dp;
+    struct icaldirset_stamp listed;
+
+    /* The listing is kept while the directory is not changed */
+    if (dset->cache && icaldirset_stamp_is_current(&dset->cache->listed, dset->dir)) {
+        return ICAL_NO_ERROR;
+    }
+    listed = icaldirset_stat(dset->dir);
 
     dp = opendir(dset->dir);
 
@@ -96,7 +1106,9 @@ static icalerrorenum icaldirset_read_directory(icaldirset *dset)
     /* load all of the cluster names in the directory list */
     for (de = readdir(dp); de != 0; de = readdir(dp)) {
         /* Remove known directory names  '.' and '..' */
-        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+            strcmp(de->d_name, ICALDIRSET_MANIFEST) == 0 ||
+            strcmp(de->d_name, ICALDIRSET_MANIFEST_NEW) == 0) {
             continue;
         }
 
@@ -104,6 +1116,10 @@ static icalerrorenum icaldirset_read_directory(icaldirset *dset)
     }
 
     closedir(dp);
+
+    if (dset->cache) {
+        dset->cache->listed = listed;
+    }
 #else
     struct _finddata_t c_file;
     intptr_t hFile;
@@ -120,7 +1136,9 @@ static icalerrorenum icaldirset_read_directory(icaldirset *dset)
         /* load all of the cluster names in the directory list */
         do {
             /* Remove known directory names  '.' and '..' */
-            if (strcmp(c_file.name, ".") == 0 || strcmp(c_file.name, "..") == 0) {
+            if (strcmp(c_file.name, ".") == 0 || strcmp(c_file.name, "..") == 0 ||
+                strcmp(c_file.name, ICALDIRSET_MANIFEST) == 0 ||
+                strcmp(c_file.name, ICALDIRSET_MANIFEST_NEW) == 0) {
                 continue;
             }
 
@@ -138,7 +1156,7 @@ static icalerrorenum icaldirset_read_directory(icaldirset *dset)
 icalset *icaldirset_init(icalset *set, const char *dir, void *options_in)
 {
     icaldirset *dset;
-    icaldirset_options *options = options_in;
+    icaldirset_options *options = (options_in) ? options_in : &icaldirset_options_default;
     struct stat sbuf;
 
     icalerror_check_arg_rz((dir != 0), "dir");
@@ -165,6 +1183,16 @@ icalset *icaldirset_init(icalset *set, const char *dir, void *options_in)
     dset->gauge = 0;
     dset->first_component = 0;
     dset->cluster = 0;
+    dset->manifest = 0;
+
+    dset->cache = calloc(1, sizeof(struct icaldirset_cache));
+    if (dset->cache && options->prefetch > 0) {
+        dset->cache->prefetch = calloc((size_t)options->prefetch,
+                                       sizeof(struct icaldirset_prefetch));
+        if (dset->cache->prefetch) {
+            dset->cache->num_prefetch = options->prefetch;
+        }
+    }
 
     return set;
 }
@@ -211,8 +1239,12 @@ void icaldirset_free(icalset *s)
 
     if (dset->cluster != 0) {
         icalcluster_free(dset->cluster);
+        dset->cluster = 0;
     }
 
+    icaldirset_cache_free(dset);
+    icaldirset_manifest_free(dset);
+
     while (dset->directory != 0 && (str = icalpvl_pop(dset->directory)) != 0) {
         free(str);
     }
@@ -238,17 +1270,15 @@ static icalerrorenum icaldirset_next_cluster(icaldirset *dset)
 
     if (dset->directory_iterator == 0) {
         /* There are no more clusters */
-        if (dset->cluster != 0) {
-            icalcluster_free(dset->cluster);
-            dset->cluster = 0;
-        }
+        icaldirset_put_cluster(dset);
         return ICAL_NO_ERROR;
     }
 
     snprintf(path, sizeof(path), "%s/%s", dset->dir, (char *)icalpvl_data(dset->directory_iterator));
 
-    icalcluster_free(dset->cluster);
-    dset->cluster = icalfileset_produce_icalcluster(path);
+    icaldirset_put_cluster(dset);
+    dset->cluster = icaldirset_get_cluster(dset, path);
+    icaldirset_prefetch_next(dset);
 
     return icalerrno;
 }
@@ -291,6 +1321,8 @@ icalerrorenum icaldirset_add_component(icalset *set, icalcomponent *comp)
     icalerrorenum error = ICAL_NO_ERROR;
     icalcomponent *inner;
     icaldirset *dset;
+    struct icaldirset_entry *entry;
+    size_t index;
 
     icalerror_check_arg_rz((set != 0), "set");
     icalerror_check_arg_rz((comp != 0), "comp");
@@ -335,12 +1367,11 @@ icalerrorenum icaldirset_add_component(icalset *set, icalcomponent *comp)
 
     /* Load the cluster and insert the object */
     if (dset->cluster != 0 && strcmp(clustername, icalcluster_key(dset->cluster)) != 0) {
-        icalcluster_free(dset->cluster);
-        dset->cluster = 0;
+        icaldirset_put_cluster(dset);
     }
 
     if (dset->cluster == 0) {
-        dset->cluster = icalfileset_produce_icalcluster(clustername);
+        dset->cluster = icaldirset_get_cluster(dset, clustername);
 
         if (dset->cluster == 0) {
             error = icalerrno;
@@ -355,6 +1386,12 @@ icalerrorenum icaldirset_add_component(icalset *set, icalcomponent *comp)
     /* Add the component to the cluster */
     (void)icalcluster_add_component(dset->cluster, comp);
 
+    entry = icaldirset_manifest_current(dset, &index);
+    if (entry) {
+        icaldirset_entry_add_component(dset->manifest, index, comp);
+        entry->changed = true;
+    }
+
     /* icalcluster_mark(impl->cluster); */
 
     return ICAL_NO_ERROR;
@@ -372,6 +1409,9 @@ icalerrorenum icaldirset_remove_component(icalset *set, icalcomponent *comp)
     icaldirset *dset;
     icalcomponent *filecomp;
     icalcompiter i;
+    struct icaldirset_entry *entry;
+    size_t index;
+    const char *uid;
     int found = 0;
 
     icalerror_check_arg_re((set != 0), "set", ICAL_BADARG_ERROR);
@@ -400,6 +1440,15 @@ icalerrorenum icaldirset_remove_component(icalset *set, icalcomponent *comp)
 
     (void)icalcluster_remove_component(dset->cluster, comp);
 
+    entry = icaldirset_manifest_current(dset, &index);
+    if (entry) {
+        entry->changed = true;
+        uid = icaldirset_get_uid(comp);
+        if (uid) {
+            icaldirset_entry_remove_uid(dset->manifest, index, dset->cluster, uid);
+        }
+    }
+
     /* icalcluster_mark(impl->cluster); */
 
     /* If the removal emptied the fileset, get the next fileset */
@@ -443,6 +1492,7 @@ icalcomponent *icaldirset_fetch_match(icalset *set, const icalcomponent *c)
 icalcomponent *icaldirset_fetch(icalset *set, icalcomponent_kind kind, const char *uid)
 {
     icaldirset *dset;
+    struct icaldirset_manifest *manifest;
     icalgauge *gauge;
     icalgauge *old_gauge;
     icalcomponent *c;
@@ -453,10 +1503,17 @@ icalcomponent *icaldirset_fetch(icalset *set, icalcomponent_kind kind, const cha
     icalerror_check_arg_rz((set != 0), "set");
     icalerror_check_arg_rz((uid != 0), "uid");
 
+    dset = (icaldirset *)set;
+
+    /* Only the clusters the manifest has the UID in are read */
+    manifest = icaldirset_manifest_refresh(dset);
+    if (manifest) {
+        return icaldirset_find_uid(dset, manifest, uid, 0);
+    }
+
     snprintf(sql, 256, "SELECT * FROM VEVENT WHERE UID = \"%s\"", uid);
 
     gauge = icalgauge_new_from_sql(sql, 0);
-    dset = (icaldirset *)set;
     old_gauge = dset->gauge;
     dset->gauge = gauge;
 
@@ -473,19 +1530,82 @@ icalcomponent *icaldirset_fetch(icalset *set, icalcomponent_kind kind, const cha
 
 int icaldirset_has_uid(icalset *set, const char *uid)
 {
+    struct icaldirset_manifest *manifest;
+    struct icaldirset_uid *u;
+    uint32_t hash;
     icalcomponent *c;
 
     icalerror_check_arg_rz((set != 0), "set");
     icalerror_check_arg_rz((uid != 0), "uid");
 
-    /* HACK. This is a temporary implementation. _has_uid should use a
-       database, and _fetch should use _has_uid, not the other way
-       around */
+    /* The manifest answers without reading any of the clusters */
+    manifest = icaldirset_manifest_refresh((icaldirset *)set);
+    if (manifest) {
+        hash = icaldirset_hash_uid(uid);
+        for (u = manifest->buckets[hash & (manifest->num_buckets - 1)]; u != 0; u = u->next) {
+            if (u->hash == hash && strcmp(u->uid, uid) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     c = icaldirset_fetch(set, 0, uid);
 
     return c != 0;
 }
 
+void icaldirset_foreach_in_span(icalset *set, icaltime_t start, icaltime_t end,
+                                void (*callback)(icalcomponent *comp, void *data),
+                                void *callback_data)
+{
+    icaldirset *dset = (icaldirset *)set;
+    struct icaldirset_manifest *manifest;
+    icalpvl_elem e;
+    icalcompiter i;
+    size_t index;
+    int64_t lower, upper;
+
+    icalerror_check_arg_rv(set != 0, "set");
+    icalerror_check_arg_rv(callback != 0, "callback");
+
+    manifest = icaldirset_manifest_refresh(dset);
+    if (!manifest && icaldirset_read_directory(dset) != ICAL_NO_ERROR) {
+        return;
+    }
+
+    for (e = icalpvl_head(dset->directory); e != 0; e = icalpvl_next(e)) {
+        const char *name = (const char *)icalpvl_data(e);
+
+        /* Skip the clusters whose components all end before or start after the span */
+        if (manifest) {
+            index = icaldirset_manifest_entry(manifest, name);
+            if (index < manifest->num_entries && (manifest->entries[index].upper < (int64_t)start ||
+                                                  manifest->entries[index].lower > (int64_t)end)) {
+                continue;
+            }
+        }
+
+        if (icaldirset_use_cluster(dset, name) != ICAL_NO_ERROR) {
+            continue;
+        }
+
+        for (i = icalcomponent_begin_component(icalcluster_get_component(dset->cluster),
+                                               ICAL_ANY_COMPONENT);
+             icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
+            icalcomponent *comp = icalcompiter_deref(&i);
+
+            icalfileset_get_span_bounds(comp, &lower, &upper);
+            if (upper < (int64_t)start || lower > (int64_t)end) {
+                continue;
+            }
+            if (dset->gauge == 0 || icalgauge_compare(dset->gauge, comp) == 1) {
+                (*callback)(comp, callback_data);
+            }
+        }
+    }
+}
+
 icalerrorenum icaldirset_select(icalset *set, icalgauge *gauge)
 {
     icaldirset *dset;
@@ -561,17 +1681,17 @@ icalcomponent *icaldirset_get_first_component(icalset *set)
        delete the current one and get a new one */
 
     if (dset->cluster != 0 && strcmp(path, icalcluster_key(dset->cluster)) != 0) {
-        icalcluster_free(dset->cluster);
-        dset->cluster = 0;
+        icaldirset_put_cluster(dset);
     }
 
     if (dset->cluster == 0) {
-        dset->cluster = icalfileset_produce_icalcluster(path);
+        dset->cluster = icaldirset_get_cluster(dset, path);
 
         if (dset->cluster == 0) {
             error = icalerrno;
         }
     }
+    icaldirset_prefetch_next(dset);
 
     if (error != ICAL_NO_ERROR) {
         icalerror_set_errno(error);
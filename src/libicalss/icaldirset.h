@@ -33,6 +33,14 @@
   year as MMYYYY) plus a unique serial number. The serial number is
   stored as a property of the cluster.
 
+  A manifest of the clusters, with the UIDs of their components and the
+  bounds of their times, is kept in the file .manifest in the directory.
+  It is replaced whenever a cluster is committed, or clusters are read
+  into it by a set opened for writing. Its entries are checked
+  against the modification times and sizes of the cluster files, so
+  icaldirset_fetch(), icaldirset_has_uid() and
+  icaldirset_foreach_in_span() only read the clusters they need.
+
 */
 
 #ifndef ICALDIRSET_H
@@ -87,6 +95,25 @@ LIBICAL_ICALSS_EXPORT icalcomponent *icaldirset_fetch(icalset *store,
 
 LIBICAL_ICALSS_EXPORT int icaldirset_has_uid(icalset *store, const char *uid);
 
+/**
+ * @brief Calls a function for the components which may overlap a span of time.
+ *
+ * Only the clusters whose components may overlap the span, as recorded in
+ * the manifest of the directory, are read. The callback is called for the
+ * components of those clusters which pass the gauge and whose span or any
+ * occurrence may overlap the span from @p start to @p end, like
+ * icalfileset_foreach_in_span(). It has to check the overlap itself, and it
+ * must not remove components from the set. The last of the clusters read
+ * is left as the current one.
+ *
+ * @since 4.0
+ */
+LIBICAL_ICALSS_EXPORT void icaldirset_foreach_in_span(icalset *set,
+                                                      icaltime_t start, icaltime_t end,
+                                                      void (*callback)(icalcomponent *comp,
+                                                                       void *data),
+                                                      void *callback_data);
+
 LIBICAL_ICALSS_EXPORT icalcomponent *icaldirset_fetch_match(icalset *set, const icalcomponent *c);
 
 /* Modifies components according to the MODIFY method of CAP. Works on
@@ -112,8 +139,20 @@ LIBICAL_ICALSS_EXPORT icalcomponent *icaldirsetiter_to_next(icalset *set, icalse
 
 LIBICAL_ICALSS_EXPORT icalcomponent *icaldirsetiter_to_prior(icalset *set, icalsetiter *i);
 
+/**
+ * @brief Options for opening an icaldirset.
+ *
+ * Clusters which have not been changed are kept parsed in memory, up to
+ * @p cache_size bytes of their files, and used again as long as the
+ * modification times and sizes of their files stay the same. With
+ * @p prefetch set, the next cluster files of the directory are parsed on
+ * worker threads while the components of the current cluster are read,
+ * if libical is built with pthreads and errors are not fatal.
+ */
 typedef struct icaldirset_options {
-    int flags; /**< flags corresponding to the open() system call O_RDWR, etc. */
+    int flags;         /**< flags corresponding to the open() system call O_RDWR, etc. */
+    size_t cache_size; /**< size of the cluster files kept parsed, @since 4.0 */
+    int prefetch;      /**< number of cluster files parsed ahead, @since 4.0 */
 } icaldirset_options;
 
 #endif /* !ICALDIRSET_H */
@@ -28,6 +28,8 @@ struct icaldirset_impl {
     int first_component;             /**< ??? */
     icalpvl_list directory;          /**< ??? */
     icalpvl_elem directory_iterator; /**< ??? */
+    struct icaldirset_cache *cache;  /**< clusters kept parsed, and being prefetched */
+    struct icaldirset_manifest *manifest; /**< clusters with their UIDs and times */
 };
 
 #endif
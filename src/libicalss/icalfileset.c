@@ -15,11 +15,14 @@
 
 #include "icalfileset.h"
 #include "icalfilesetimpl.h"
+#include "icalfileset_p.h"
 #include "icalparser.h"
+#include "icaltimezone.h"
 #include "icalvalue.h"
 #include "icalmemory.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #if defined(_MSC_VER)
@@ -30,8 +33,24 @@ typedef int mode_t;
 #include <winbase.h>
 #endif
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
+
 /** Default options used when NULL is passed to icalset_new() **/
-icalfileset_options icalfileset_options_default = {O_RDWR | O_CREAT, 0644, 0, NULL};
+icalfileset_options icalfileset_options_default = {O_RDWR | O_CREAT, 0644, 0, NULL, 0, 0};
+
+/* FNV-1a */
+#define ICALFILESET_HASH_BASIS 2166136261U
+#define ICALFILESET_HASH(hash, c) (((hash) ^ (unsigned char)(c)) * 16777619U)
+
+/* The first line of a journal, with the size and hash of the file which
+   the records are applied to */
+#define ICALFILESET_JOURNAL_HEADER "ICALFILESET-JOURNAL %lu %lu\n"
+
+/* The journal is compacted into the file once it is larger than half of
+   the file, and at least this large */
+#define ICALFILESET_JOURNAL_MIN_COMPACT (1024 * 1024)
 
 static int _compare_ids(const char *compid, const char *matchid);
 
@@ -39,6 +58,16 @@ static int icalfileset_lock(icalfileset *set);
 static int icalfileset_unlock(icalfileset *set);
 static icalerrorenum icalfileset_read_file(icalfileset *set, int mode);
 static long icalfileset_filesize(icalfileset *set);
+static void icalfileset_index_free(icalfileset *fset);
+static void icalfileset_index_add(icalfileset *fset, icalcomponent *comp);
+static void icalfileset_index_remove(icalfileset *fset, icalcomponent *comp);
+static void icalfileset_replay_journal(icalfileset *fset);
+static void icalfileset_record_add(icalfileset *fset, icalcomponent *comp);
+static void icalfileset_record_remove(icalfileset *fset, icalcomponent *comp);
+static void icalfileset_free_records(icalfileset *fset);
+static bool icalfileset_lazy_open(icalfileset *fset, size_t size);
+static void icalfileset_lazy_free(icalfileset *fset);
+static void icalfileset_load(icalfileset *fset);
 
 icalset *icalfileset_new(const char *path)
 {
@@ -77,6 +106,14 @@ icalset *icalfileset_init(icalset *set, const char *path, void *options_in)
 
     fset->path = strdup(path);
     fset->options = *options;
+    fset->journal_fd = -1;
+    fset->file_hash = ICALFILESET_HASH_BASIS;
+
+    fset->journal_path = malloc(strlen(path) + sizeof(".journal"));
+    if (fset->journal_path) {
+        strcpy(fset->journal_path, path);
+        strcat(fset->journal_path, ".journal");
+    }
 
     flags = options->flags;
     mode = options->mode;
@@ -98,7 +135,10 @@ icalset *icalfileset_init(icalset *set, const char *path, void *options_in)
 
     (void)icalfileset_lock(fset);
 
-    if (cluster_file_size > 0) {
+    if (cluster_file_size > 0 && options->lazy && !options->cluster &&
+        icalfileset_lazy_open(fset, (size_t)cluster_file_size)) {
+        /* The components are parsed when they are reached */
+    } else if (cluster_file_size > 0) {
         /* cppcheck-suppress knownConditionTrueFalse; we might want to return an error some day */
         if (icalfileset_read_file(fset, mode) != ICAL_NO_ERROR) {
             icalfileset_free(set);
@@ -107,14 +147,23 @@ icalset *icalfileset_init(icalset *set, const char *path, void *options_in)
     }
 
     if (options->cluster) {
+        /* The cluster replaces what was read from the file */
+        if (fset->cluster) {
+            icalcomponent_free(fset->cluster);
+        }
         fset->cluster = icalcomponent_clone(icalcluster_get_component(options->cluster));
         fset->changed = 1;
+        fset->rewrite = true;
     }
 
     if (fset->cluster == 0) {
         fset->cluster = icalcomponent_new(ICAL_XROOT_COMPONENT);
     }
 
+    if (!options->cluster) {
+        icalfileset_replay_journal(fset);
+    }
+
     return set;
 }
 
@@ -134,7 +183,7 @@ icalcluster *icalfileset_produce_icalcluster(const char *path)
         ret = icalcluster_new(path, NULL);
     } else {
         ret = icalcluster_new(path, ((icalfileset *)fileset)->cluster);
-        icalfileset_free(fileset);
+        icalset_free(fileset);
     }
 
     icalerror_set_errors_are_fatal(errstate);
@@ -150,7 +199,15 @@ static char *icalfileset_read_from_file(char *s, size_t size, void *d)
     /* Simulate fgets -- read single characters and stop at '\n' */
 
     for (p = s; p < s + size - 1; p++) {
-        if (read(set->fd, p, 1) != 1 || *p == '\n') {
+        if (read(set->fd, p, 1) != 1) {
+            p++;
+            break;
+        }
+
+        /* Hash the file, to tell whether a journal was written for it */
+        set->file_size++;
+        set->file_hash = ICALFILESET_HASH(set->file_hash, *p);
+        if (*p == '\n') {
             p++;
             break;
         }
@@ -235,6 +292,9 @@ void icalfileset_free(icalset *set)
 
     fset = (icalfileset *)set;
 
+    icalfileset_index_free(fset);
+    icalfileset_lazy_free(fset);
+
     if (fset->cluster != 0) {
         (void)icalfileset_commit(set);
         icalcomponent_free(fset->cluster);
@@ -256,6 +316,18 @@ void icalfileset_free(icalset *set)
         free(fset->path);
         fset->path = 0;
     }
+
+    icalfileset_free_records(fset);
+
+    if (fset->journal_fd >= 0) {
+        close(fset->journal_fd);
+        fset->journal_fd = -1;
+    }
+
+    if (fset->journal_path != 0) {
+        free(fset->journal_path);
+        fset->journal_path = 0;
+    }
 }
 
 const char *icalfileset_path(icalset *set)
@@ -306,6 +378,330 @@ int icalfileset_unlock(icalfileset *set)
 #endif
 }
 
+/******* journal of the changes to the file *********/
+
+/* A change to append to the journal: an added component, which is
+   serialized when it is committed unless it has been removed already, or
+   the position in the cluster of a removed component */
+struct icalfileset_record {
+    icalcomponent *comp;
+    char *text;
+    size_t position;
+    bool is_remove;
+};
+
+static bool icalfileset_write_all(int fd, const char *buf, size_t size)
+{
+    while (size > 0) {
+        IO_SSIZE_T sz = write(fd, buf, (IO_SIZE_T)size);
+
+        if (sz <= 0) {
+            return false;
+        }
+        buf += sz;
+        size -= (size_t)sz;
+    }
+
+    return true;
+}
+
+static int icalfileset_truncate(int fd, size_t size)
+{
+#if !defined(_WIN32)
+    return ftruncate(fd, (off_t)size);
+#else
+    return chsize(fd, (long)size);
+#endif
+}
+
+static void icalfileset_sync(int fd)
+{
+#if defined(HAVE_FSYNC)
+    (void)fsync(fd);
+#elif defined(_WIN32)
+    (void)_commit(fd);
+#else
+    _unused(fd);
+#endif
+}
+
+static void icalfileset_free_records(icalfileset *fset)
+{
+    size_t i;
+
+    if (!fset->records) {
+        return;
+    }
+
+    for (i = 0; i < fset->records->num_elements; i++) {
+        struct icalfileset_record *record = icalarray_element_at(fset->records, i);
+
+        icalmemory_free_buffer(record->text);
+    }
+
+    icalarray_free(fset->records);
+    fset->records = 0;
+}
+
+static void icalfileset_append_record(icalfileset *fset, const struct icalfileset_record *record)
+{
+    if (!fset->records) {
+        fset->records = icalarray_new(sizeof(struct icalfileset_record), 16);
+        if (!fset->records) {
+            fset->rewrite = true;
+            return;
+        }
+    }
+
+    icalarray_append(fset->records, record);
+}
+
+static void icalfileset_record_add(icalfileset *fset, icalcomponent *comp)
+{
+    struct icalfileset_record record;
+
+    if (!fset->options.journal || fset->rewrite) {
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.comp = comp;
+    icalfileset_append_record(fset, &record);
+}
+
+static void icalfileset_record_remove(icalfileset *fset, icalcomponent *comp)
+{
+    struct icalfileset_record record;
+    icalcompiter i;
+    size_t j;
+
+    if (!fset->options.journal || fset->rewrite) {
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.is_remove = true;
+    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0 && icalcompiter_deref(&i) != comp; icalcompiter_next(&i)) {
+        record.position++;
+    }
+    if (icalcompiter_deref(&i) == 0) {
+        return;
+    }
+
+    /* The component may be freed once it is removed, so added records of
+       it are serialized now */
+    for (j = 0; fset->records && j < fset->records->num_elements; j++) {
+        struct icalfileset_record *added = icalarray_element_at(fset->records, j);
+
+        if (added->comp == comp) {
+            added->text = icalcomponent_as_ical_string_r(comp);
+            added->comp = 0;
+            if (!added->text) {
+                fset->rewrite = true;
+                return;
+            }
+        }
+    }
+
+    icalfileset_append_record(fset, &record);
+}
+
+/* Appends the records to the journal. Returns 1 if they were appended, 0
+   if the journal is too large and has to be compacted, or -1 on error. */
+static int icalfileset_append_journal(icalfileset *fset)
+{
+    char *buf, *pos, line[64];
+    size_t buf_size = 4096, i, compact_size;
+
+    buf = icalmemory_new_buffer(buf_size);
+    if (!buf || !fset->journal_path) {
+        icalmemory_free_buffer(buf);
+        return 0;
+    }
+    pos = buf;
+    *pos = '\0';
+
+    for (i = 0; fset->records && i < fset->records->num_elements; i++) {
+        struct icalfileset_record *record = icalarray_element_at(fset->records, i);
+
+        if (record->is_remove) {
+            snprintf(line, sizeof(line), "REMOVE %lu\n", (unsigned long)record->position);
+            icalmemory_append_string(&buf, &pos, &buf_size, line);
+        } else {
+            char *text = record->text ? record->text : icalcomponent_as_ical_string_r(record->comp);
+
+            if (!text) {
+                icalmemory_free_buffer(buf);
+                return 0;
+            }
+            snprintf(line, sizeof(line), "ADD %lu\n", (unsigned long)strlen(text));
+            icalmemory_append_string(&buf, &pos, &buf_size, line);
+            icalmemory_append_string(&buf, &pos, &buf_size, text);
+            if (text != record->text) {
+                icalmemory_free_buffer(text);
+            }
+        }
+    }
+
+    compact_size = fset->file_size / 2;
+    if (compact_size < ICALFILESET_JOURNAL_MIN_COMPACT) {
+        compact_size = ICALFILESET_JOURNAL_MIN_COMPACT;
+    }
+    if (fset->journal_size + (size_t)(pos - buf) > compact_size) {
+        icalmemory_free_buffer(buf);
+        return 0;
+    }
+
+    if (fset->journal_fd < 0) {
+        fset->journal_fd = open(fset->journal_path, O_RDWR | O_CREAT, (mode_t)fset->options.mode);
+        if (fset->journal_fd < 0) {
+            icalmemory_free_buffer(buf);
+            return -1;
+        }
+    }
+
+    if (!fset->journal_valid) {
+        /* Start the journal for the file as it was written */
+        snprintf(line, sizeof(line), ICALFILESET_JOURNAL_HEADER,
+                 (unsigned long)fset->file_size, (unsigned long)fset->file_hash);
+        if (lseek(fset->journal_fd, 0, SEEK_SET) < 0 ||
+            !icalfileset_write_all(fset->journal_fd, line, strlen(line))) {
+            icalmemory_free_buffer(buf);
+            return -1;
+        }
+        fset->journal_size = strlen(line);
+        fset->journal_valid = true;
+    }
+
+    /* Records which were not completely written before are overwritten */
+    if (lseek(fset->journal_fd, (off_t)fset->journal_size, SEEK_SET) < 0 ||
+        !icalfileset_write_all(fset->journal_fd, buf, (size_t)(pos - buf)) ||
+        icalfileset_truncate(fset->journal_fd, fset->journal_size + (size_t)(pos - buf)) < 0) {
+        icalmemory_free_buffer(buf);
+        return -1;
+    }
+    icalfileset_sync(fset->journal_fd);
+
+    fset->journal_size += (size_t)(pos - buf);
+    icalmemory_free_buffer(buf);
+    icalfileset_free_records(fset);
+
+    return 1;
+}
+
+/* Removes the journal, once the file has been written with its changes */
+static void icalfileset_remove_journal(icalfileset *fset)
+{
+    if (fset->journal_fd >= 0) {
+        close(fset->journal_fd);
+        fset->journal_fd = -1;
+    }
+
+    if (fset->journal_path) {
+#if defined(HAVE_UNLINK)
+        (void)unlink(fset->journal_path);
+#else
+        int fd = open(fset->journal_path, O_WRONLY | O_TRUNC, 0);
+
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    fset->journal_size = 0;
+    fset->journal_valid = false;
+}
+
+/* Applies the records of the journal to the cluster, if the journal was
+   written for the file as it was read */
+static void icalfileset_replay_journal(icalfileset *fset)
+{
+    char *buf, *pos, *end, *line_end, header[64];
+    unsigned long count;
+    struct stat sbuf;
+    size_t size = 0;
+    int fd;
+
+    if (!fset->journal_path) {
+        return;
+    }
+
+    fd = open(fset->journal_path, O_RDONLY, 0);
+    if (fd < 0) {
+        return;
+    }
+
+    /* The records apply to the whole cluster */
+    icalfileset_load(fset);
+
+    buf = 0;
+    if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0) {
+        buf = malloc((size_t)sbuf.st_size + 1);
+    }
+    while (buf && size < (size_t)sbuf.st_size) {
+        IO_SSIZE_T sz = read(fd, buf + size, (IO_SIZE_T)((size_t)sbuf.st_size - size));
+
+        if (sz <= 0) {
+            break;
+        }
+        size += (size_t)sz;
+    }
+    close(fd);
+
+    if (!buf) {
+        return;
+    }
+    buf[size] = '\0';
+
+    snprintf(header, sizeof(header), ICALFILESET_JOURNAL_HEADER,
+             (unsigned long)fset->file_size, (unsigned long)fset->file_hash);
+    if (strncmp(buf, header, strlen(header)) != 0) {
+        /* The journal was written for another version of the file */
+        free(buf);
+        return;
+    }
+
+    pos = buf + strlen(header);
+    end = buf + size;
+    while (pos < end && (line_end = memchr(pos, '\n', (size_t)(end - pos))) != 0) {
+        if (strncmp(pos, "ADD ", 4) == 0 && sscanf(pos + 4, "%lu", &count) == 1 &&
+            count <= (unsigned long)(end - line_end - 1)) {
+            char *text = line_end + 1, saved = text[count];
+            icalcomponent *comp;
+
+            text[count] = '\0';
+            comp = icalparser_parse_string(text);
+            text[count] = saved;
+            if (comp) {
+                icalcomponent_add_component(fset->cluster, comp);
+            }
+            pos = text + count;
+        } else if (strncmp(pos, "REMOVE ", 7) == 0 && sscanf(pos + 7, "%lu", &count) == 1) {
+            icalcompiter i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
+
+            while (count-- > 0 && icalcompiter_deref(&i) != 0) {
+                icalcompiter_next(&i);
+            }
+            if (icalcompiter_deref(&i) != 0) {
+                icalcomponent *comp = icalcompiter_deref(&i);
+
+                icalcomponent_remove_component(fset->cluster, comp);
+                icalcomponent_free(comp);
+            }
+            pos = line_end + 1;
+        } else {
+            /* A record which was not completely written */
+            break;
+        }
+    }
+
+    fset->journal_size = (size_t)(pos - buf);
+    fset->journal_valid = true;
+    free(buf);
+}
+
 /* Lifted from https://stackoverflow.com/questions/29079011/copy-file-function-in-c */
 /* cppcheck-suppress constParameter */
 static int file_copy(char fileSource[], char fileDestination[])
@@ -338,9 +734,10 @@ static int file_copy(char fileSource[], char fileDestination[])
 icalerrorenum icalfileset_commit(icalset *set)
 {
     char backupFile[MAXPATHLEN];
-    char *str;
+    char *str, *p;
     icalcomponent *c;
     size_t write_size = 0;
+    uint32_t write_hash = ICALFILESET_HASH_BASIS;
     icalfileset *fset = (icalfileset *)set;
 
     icalerror_check_arg_re((fset != 0), "set", ICAL_BADARG_ERROR);
@@ -351,6 +748,20 @@ icalerrorenum icalfileset_commit(icalset *set)
         return ICAL_NO_ERROR;
     }
 
+    if (fset->options.journal && !fset->rewrite) {
+        int appended = icalfileset_append_journal(fset);
+
+        if (appended < 0) {
+            icalerror_set_errno(ICAL_FILE_ERROR);
+            return ICAL_FILE_ERROR;
+        }
+        if (appended > 0) {
+            fset->changed = 0;
+            return ICAL_NO_ERROR;
+        }
+        /* Else the whole file is written, which compacts the journal */
+    }
+
     if (fset->options.safe_saves == 1) {
         strncpy(backupFile, fset->path, MAXPATHLEN - 4);
         strncat(backupFile, ".bak", MAXPATHLEN - 1);
@@ -379,11 +790,16 @@ icalerrorenum icalfileset_commit(icalset *set)
             return ICAL_FILE_ERROR;
         }
 
+        for (p = str; *p != '\0'; p++) {
+            write_hash = ICALFILESET_HASH(write_hash, *p);
+        }
         icalmemory_free_buffer(str);
         write_size += (size_t)sz;
     }
 
     fset->changed = 0;
+    fset->file_size = write_size;
+    fset->file_hash = write_hash;
 
 #if !defined(_WIN32)
     if (ftruncate(fset->fd, (off_t)write_size) < 0) {
@@ -397,6 +813,11 @@ icalerrorenum icalfileset_commit(icalset *set)
 #endif
 #endif
 
+    /* The file has all of the changes now */
+    icalfileset_free_records(fset);
+    icalfileset_remove_journal(fset);
+    fset->rewrite = false;
+
     return ICAL_NO_ERROR;
 }
 
@@ -404,7 +825,15 @@ void icalfileset_mark(icalset *set)
 {
     icalerror_check_arg_rv((set != 0), "set");
 
+    icalfileset_load((icalfileset *)set);
+
     ((icalfileset *)set)->changed = 1;
+
+    /* The components may have been changed outside of the set, so the
+       whole file is written, and the index is built again when it is
+       needed */
+    ((icalfileset *)set)->rewrite = true;
+    icalfileset_index_free((icalfileset *)set);
 }
 
 icalcomponent *icalfileset_get_component(icalset *set)
@@ -414,6 +843,7 @@ icalcomponent *icalfileset_get_component(icalset *set)
     icalerror_check_arg_rz((set != 0), "set");
 
     fset = (icalfileset *)set;
+    icalfileset_load(fset);
     return fset->cluster;
 }
 
@@ -427,9 +857,12 @@ icalerrorenum icalfileset_add_component(icalset *set, icalcomponent *child)
     icalerror_check_arg_re((child != 0), "child", ICAL_BADARG_ERROR);
 
     fset = (icalfileset *)set;
+    icalfileset_load(fset);
     icalcomponent_add_component(fset->cluster, child);
+    icalfileset_index_add(fset, child);
+    icalfileset_record_add(fset, child);
 
-    icalfileset_mark(set);
+    fset->changed = 1;
 
     return ICAL_NO_ERROR;
 }
@@ -442,9 +875,12 @@ icalerrorenum icalfileset_remove_component(icalset *set, icalcomponent *child)
     icalerror_check_arg_re((child != 0), "child", ICAL_BADARG_ERROR);
 
     fset = (icalfileset *)set;
+    icalfileset_load(fset);
+    icalfileset_index_remove(fset, child);
+    icalfileset_record_remove(fset, child);
     icalcomponent_remove_component(fset->cluster, child);
 
-    icalfileset_mark(set);
+    fset->changed = 1;
 
     return ICAL_NO_ERROR;
 }
@@ -459,6 +895,7 @@ int icalfileset_count_components(icalset *set, icalcomponent_kind kind)
     }
 
     fset = (icalfileset *)set;
+    icalfileset_load(fset);
     return icalcomponent_count_components(fset->cluster, kind);
 }
 
@@ -484,52 +921,6 @@ void icalfileset_clear(icalset *set)
     fset->gauge = 0;
 }
 
-icalcomponent *icalfileset_fetch(icalset *set, icalcomponent_kind kind, const char *uid)
-{
-    icalfileset *fset;
-    icalcompiter i;
-
-    _unused(kind);
-
-    icalerror_check_arg_rz(set != 0, "set");
-    fset = (icalfileset *)set;
-
-    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
-         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
-        icalcomponent *this = icalcompiter_deref(&i);
-        icalcomponent *inner;
-        icalproperty *p;
-        const char *this_uid;
-
-        for (inner = icalcomponent_get_first_component(this, ICAL_ANY_COMPONENT);
-             inner != 0; inner = icalcomponent_get_next_component(this, ICAL_ANY_COMPONENT)) {
-            p = icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY);
-            if (p) {
-                this_uid = icalproperty_get_uid(p);
-
-                if (this_uid == 0) {
-                    icalerror_warn("icalfileset_fetch found a component with no UID");
-                    continue;
-                }
-
-                if (strcmp(uid, this_uid) == 0) {
-                    return this;
-                }
-            }
-        }
-    }
-
-    return 0;
-}
-
-int icalfileset_has_uid(icalset *set, const char *uid)
-{
-    _unused(set);
-    _unused(uid);
-    assert(0); /* HACK, not implemented */
-    return 0;
-}
-
 /******* support routines for icalfileset_fetch_match *********/
 
 struct icalfileset_id {
@@ -541,7 +932,7 @@ struct icalfileset_id {
 static void icalfileset_id_free(struct icalfileset_id *id)
 {
     if (id->recurrence_id != 0) {
-        free(id->recurrence_id);
+        icalmemory_free_buffer(id->recurrence_id);
     }
 
     if (id->uid != 0) {
@@ -606,77 +997,1427 @@ static int _compare_ids(const char *compid, const char *matchid)
     return 0;
 }
 
-icalcomponent *icalfileset_fetch_match(icalset *set, const icalcomponent *comp)
-{
-    icalfileset *fset = (icalfileset *)set;
-    icalcompiter i;
+/******* index of the components by UID *********/
+
+/* A key of an indexed component: the UID of one of its inner components,
+   as looked up by icalfileset_fetch(), or the UID and RECURRENCE-ID of its
+   first real component, as looked up by icalfileset_fetch_match() */
+struct icalfileset_index_key {
+    struct icalfileset_index_key *next;    /**< next key in the bucket */
+    struct icalfileset_index_key *sibling; /**< next key of the component */
+    struct icalfileset_index_node *node;
+    uint32_t hash;
+    bool is_id;
+    char *uid;
+    char *recurrence_id;
+};
 
-    struct icalfileset_id comp_id, match_id;
+/* An indexed component, with its position in the cluster, so the first
+   one of several components with the same key is returned. Once the
+   bounds of the spans are indexed, it is also a node of a treap ordered
+   by the lower bound, in which each node has the largest upper bound of
+   its subtree. */
+struct icalfileset_index_node {
+    struct icalfileset_index_node *next; /**< next node in the bucket */
+    icalcomponent *comp;
+    size_t position;
+    struct icalfileset_index_key *keys;
+
+    int64_t lower;  /**< lower bound of the spans of the component */
+    int64_t upper;  /**< upper bound of the spans of the component */
+    int64_t max_upper;
+    uint32_t priority;
+    struct icalfileset_index_node *left;
+    struct icalfileset_index_node *right;
+};
 
-    comp_id = icalfileset_get_id(comp);
+struct icalfileset_index {
+    struct icalfileset_index_key **keys;   /**< keys, by hash */
+    struct icalfileset_index_node **nodes; /**< nodes, by component */
+    size_t num_buckets;                    /**< a power of 2, in both tables */
+    size_t num_keys;
+    size_t num_nodes;
+    size_t next_position;
 
-    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
-         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
-        icalcomponent *match = icalcompiter_deref(&i);
+    bool spanned;                       /**< whether the bounds are indexed */
+    struct icalfileset_index_node *spans; /**< root of the treap of bounds */
+};
 
-        match_id = icalfileset_get_id(match);
+static uint32_t icalfileset_hash_key(bool is_id, const char *uid, const char *recurrence_id)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
 
-        if (_compare_ids(comp_id.uid, match_id.uid) &&
-            _compare_ids(comp_id.recurrence_id, match_id.recurrence_id)) {
-            /* HACK. What to do with SEQUENCE? */
+    while (*uid) {
+        hash ^= (unsigned char)*uid++;
+        hash *= 16777619U;
+    }
 
-            icalfileset_id_free(&match_id);
-            icalfileset_id_free(&comp_id);
-            return match;
+    if (is_id) {
+        hash ^= recurrence_id ? 1U : 2U;
+        hash *= 16777619U;
+        while (recurrence_id && *recurrence_id) {
+            hash ^= (unsigned char)*recurrence_id++;
+            hash *= 16777619U;
         }
-
-        icalfileset_id_free(&match_id);
     }
 
-    icalfileset_id_free(&comp_id);
-    return 0;
+    return hash;
 }
 
-icalerrorenum icalfileset_modify(icalset *set, icalcomponent *old, icalcomponent *new)
+static size_t icalfileset_hash_component(const icalcomponent *comp)
 {
-    _unused(set);
-    _unused(old);
-    _unused(new);
-    assert(0); /* HACK, not implemented */
-    return ICAL_NO_ERROR;
+    return (size_t)((uintptr_t)comp >> 4) * 2654435761U;
 }
 
-/* Iterate through components */
-icalcomponent *icalfileset_get_current_component(icalset *set)
+/* Returns the value of the RECURRENCE-ID of the component, to be freed by
+   the caller, or NULL if it has none. */
+static char *icalfileset_get_recurrence_id_r(icalcomponent *inner)
 {
-    icalfileset *fset;
-
-    icalerror_check_arg_rz((set != 0), "set");
+    icalproperty *p = icalcomponent_get_first_property(inner, ICAL_RECURRENCEID_PROPERTY);
 
-    fset = (icalfileset *)set;
-    return icalcomponent_get_current_component(fset->cluster);
+    return p ? icalvalue_as_ical_string_r(icalproperty_get_value(p)) : NULL;
 }
 
-icalcomponent *icalfileset_get_first_component(icalset *set)
+/* Returns whether the component of the cluster has the given key */
+static bool icalfileset_has_key(icalcomponent *comp, bool is_id,
+                                const char *uid, const char *recurrence_id)
 {
-    icalcomponent *c = 0;
-    icalfileset *fset;
+    icalcomponent *inner;
+    icalproperty *p;
+    const char *this_uid;
+    char *this_recurrence_id;
+    bool same;
 
-    icalerror_check_arg_rz((set != 0), "set");
-    fset = (icalfileset *)set;
+    if (!is_id) {
+        for (inner = icalcomponent_get_first_component(comp, ICAL_ANY_COMPONENT);
+             inner != 0; inner = icalcomponent_get_next_component(comp, ICAL_ANY_COMPONENT)) {
+            p = icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY);
+            if (p) {
+                this_uid = icalproperty_get_uid(p);
 
-    do {
-        if (c == 0) {
-            c = icalcomponent_get_first_component(fset->cluster, ICAL_ANY_COMPONENT);
-        } else {
-            c = icalcomponent_get_next_component(fset->cluster, ICAL_ANY_COMPONENT);
-        }
+                if (this_uid == 0) {
+                    icalerror_warn("icalfileset_fetch found a component with no UID");
+                    continue;
+                }
 
-        if (c != 0 && (fset->gauge == 0 || icalgauge_compare(fset->gauge, c) == 1)) {
-            return c;
+                if (strcmp(uid, this_uid) == 0) {
+                    return true;
+                }
+            }
         }
+        return false;
+    }
 
-    } while (c != 0);
+    inner = icalcomponent_get_first_real_component(comp);
+    p = inner ? icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY) : 0;
+    this_uid = p ? icalproperty_get_uid(p) : 0;
+    if (!_compare_ids(this_uid, uid)) {
+        return false;
+    }
+
+    /* HACK. What to do with SEQUENCE? */
+    this_recurrence_id = icalfileset_get_recurrence_id_r(inner);
+    same = _compare_ids(this_recurrence_id, recurrence_id);
+    icalmemory_free_buffer(this_recurrence_id);
+
+    return same;
+}
+
+/* The spans of a component are looked up within this margin of the times
+   of its properties, which covers dates and differences of timezones */
+#define ICALFILESET_SPAN_MARGIN (2 * 24 * 60 * 60)
+
+/* The number of occurrences of a RRULE with COUNT which are expanded to
+   find its upper bound */
+#define ICALFILESET_SPAN_MAX_COUNT 10000
+
+static int64_t icalfileset_span_time(struct icaltimetype tt)
+{
+    return (int64_t)icaltime_as_timet_with_zone(tt, tt.zone ? tt.zone
+                                                            : icaltimezone_get_utc_timezone());
+}
+
+void icalfileset_get_span_bounds(icalcomponent *comp, int64_t *lower, int64_t *upper)
+{
+    struct icaltimetype dtstart, dtend;
+    icalproperty *p;
+    int64_t start, duration;
+
+    *lower = INT64_MIN;
+    *upper = INT64_MAX;
+
+    dtstart = icalcomponent_get_dtstart(comp);
+    if (icaltime_is_null_time(dtstart) && icalcomponent_isa(comp) == ICAL_VTODO_COMPONENT) {
+        dtstart = icalcomponent_get_due(comp);
+    }
+    if (icaltime_is_null_time(dtstart)) {
+        return;
+    }
+
+    dtend = icalcomponent_get_dtend(comp);
+    start = icalfileset_span_time(dtstart);
+    duration = icaltime_is_null_time(dtend) ? 0 : icalfileset_span_time(dtend) - start;
+    if (duration < 0) {
+        duration = 0;
+    }
+    duration += ICALFILESET_SPAN_MARGIN;
+
+    *lower = start - ICALFILESET_SPAN_MARGIN;
+    *upper = start + duration;
+
+    for (p = icalcomponent_get_first_property(comp, ICAL_RDATE_PROPERTY);
+         p != 0; p = icalcomponent_get_next_property(comp, ICAL_RDATE_PROPERTY)) {
+        struct icaldatetimeperiodtype rdate = icalproperty_get_rdate(p);
+        int64_t rdate_start, rdate_end;
+
+        if (!icaltime_is_null_time(rdate.time)) {
+            rdate_start = icalfileset_span_time(rdate.time);
+            rdate_end = rdate_start + duration;
+        } else if (!icaltime_is_null_time(rdate.period.start)) {
+            rdate_start = icalfileset_span_time(rdate.period.start);
+            rdate_end = (icaltime_is_null_time(rdate.period.end)
+                             ? icalfileset_span_time(icaltime_add(rdate.period.start,
+                                                                  rdate.period.duration))
+                             : icalfileset_span_time(rdate.period.end)) +
+                        duration;
+        } else {
+            continue;
+        }
+
+        if (*lower > rdate_start - ICALFILESET_SPAN_MARGIN) {
+            *lower = rdate_start - ICALFILESET_SPAN_MARGIN;
+        }
+        if (*upper < rdate_end) {
+            *upper = rdate_end;
+        }
+    }
+
+    for (p = icalcomponent_get_first_property(comp, ICAL_RRULE_PROPERTY);
+         p != 0; p = icalcomponent_get_next_property(comp, ICAL_RRULE_PROPERTY)) {
+        struct icalrecurrencetype *recur = icalproperty_get_rrule(p);
+        int64_t last = INT64_MAX - duration;
+
+        if (!recur) {
+            continue;
+        }
+
+        if (!icaltime_is_null_time(recur->until)) {
+            last = icalfileset_span_time(recur->until);
+        } else if (recur->count > 0 && recur->count <= ICALFILESET_SPAN_MAX_COUNT) {
+            icalrecur_iterator *ritr = icalrecur_iterator_new(recur, dtstart);
+            struct icaltimetype next;
+
+            if (ritr) {
+                last = start;
+                for (next = icalrecur_iterator_next(ritr); !icaltime_is_null_time(next);
+                     next = icalrecur_iterator_next(ritr)) {
+                    last = icalfileset_span_time(next);
+                }
+                icalrecur_iterator_free(ritr);
+            }
+        }
+
+        if (*upper < last + duration) {
+            *upper = last + duration;
+        }
+    }
+}
+
+static bool icalfileset_span_less(const struct icalfileset_index_node *a,
+                                  const struct icalfileset_index_node *b)
+{
+    return a->lower < b->lower || (a->lower == b->lower && a->position < b->position);
+}
+
+static void icalfileset_span_update(struct icalfileset_index_node *node)
+{
+    node->max_upper = node->upper;
+    if (node->left && node->left->max_upper > node->max_upper) {
+        node->max_upper = node->left->max_upper;
+    }
+    if (node->right && node->right->max_upper > node->max_upper) {
+        node->max_upper = node->right->max_upper;
+    }
+}
+
+static struct icalfileset_index_node *icalfileset_span_insert(struct icalfileset_index_node *root,
+                                                             struct icalfileset_index_node *node)
+{
+    struct icalfileset_index_node *child;
+
+    if (!root) {
+        node->left = node->right = 0;
+        icalfileset_span_update(node);
+        return node;
+    }
+
+    if (icalfileset_span_less(node, root)) {
+        root->left = icalfileset_span_insert(root->left, node);
+        if (root->left->priority > root->priority) {
+            /* Rotate right */
+            child = root->left;
+            root->left = child->right;
+            icalfileset_span_update(root);
+            child->right = root;
+            root = child;
+        }
+    } else {
+        root->right = icalfileset_span_insert(root->right, node);
+        if (root->right->priority > root->priority) {
+            /* Rotate left */
+            child = root->right;
+            root->right = child->left;
+            icalfileset_span_update(root);
+            child->left = root;
+            root = child;
+        }
+    }
+
+    icalfileset_span_update(root);
+    return root;
+}
+
+static struct icalfileset_index_node *icalfileset_span_merge(struct icalfileset_index_node *a,
+                                                            struct icalfileset_index_node *b)
+{
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+
+    if (a->priority > b->priority) {
+        a->right = icalfileset_span_merge(a->right, b);
+        icalfileset_span_update(a);
+        return a;
+    } else {
+        b->left = icalfileset_span_merge(a, b->left);
+        icalfileset_span_update(b);
+        return b;
+    }
+}
+
+static struct icalfileset_index_node *icalfileset_span_remove(struct icalfileset_index_node *root,
+                                                             struct icalfileset_index_node *node)
+{
+    if (!root) {
+        return 0;
+    }
+
+    if (root == node) {
+        return icalfileset_span_merge(root->left, root->right);
+    }
+
+    if (icalfileset_span_less(node, root)) {
+        root->left = icalfileset_span_remove(root->left, node);
+    } else {
+        root->right = icalfileset_span_remove(root->right, node);
+    }
+
+    icalfileset_span_update(root);
+    return root;
+}
+
+/* Indexes the bounds of the spans of the component of the node */
+static void icalfileset_span_add(struct icalfileset_index *index,
+                                 struct icalfileset_index_node *node)
+{
+    icalfileset_get_span_bounds(node->comp, &node->lower, &node->upper);
+    node->priority = (uint32_t)(node->position * 2654435761U);
+    index->spans = icalfileset_span_insert(index->spans, node);
+}
+
+/* Appends the nodes whose bounds overlap the span */
+static void icalfileset_span_find(struct icalfileset_index_node *node,
+                                  int64_t start, int64_t end, icalarray *found)
+{
+    while (node && node->max_upper > start) {
+        icalfileset_span_find(node->left, start, end, found);
+        if (node->lower >= end) {
+            return;
+        }
+        if (node->upper > start) {
+            icalarray_append(found, &node);
+        }
+        node = node->right;
+    }
+}
+
+static void icalfileset_index_free(icalfileset *fset)
+{
+    struct icalfileset_index *index = fset->index;
+    struct icalfileset_index_node *node, *next_node;
+    struct icalfileset_index_key *key, *next_key;
+    size_t i;
+
+    if (!index) {
+        return;
+    }
+
+    for (i = 0; i < index->num_buckets; i++) {
+        for (node = index->nodes[i]; node != 0; node = next_node) {
+            next_node = node->next;
+            for (key = node->keys; key != 0; key = next_key) {
+                next_key = key->sibling;
+                free(key->uid);
+                icalmemory_free_buffer(key->recurrence_id);
+                free(key);
+            }
+            free(node);
+        }
+    }
+
+    free(index->keys);
+    free(index->nodes);
+    free(index);
+    fset->index = 0;
+}
+
+/* Doubles the number of buckets. Returns false if out of memory. */
+static bool icalfileset_index_grow(struct icalfileset_index *index)
+{
+    size_t num_buckets = 2 * index->num_buckets, i;
+    struct icalfileset_index_key **keys, *key, *next_key;
+    struct icalfileset_index_node **nodes, *node, *next_node;
+
+    keys = calloc(num_buckets, sizeof(*keys));
+    nodes = calloc(num_buckets, sizeof(*nodes));
+    if (!keys || !nodes) {
+        free(keys);
+        free(nodes);
+        return false;
+    }
+
+    for (i = 0; i < index->num_buckets; i++) {
+        for (key = index->keys[i]; key != 0; key = next_key) {
+            next_key = key->next;
+            key->next = keys[key->hash & (num_buckets - 1)];
+            keys[key->hash & (num_buckets - 1)] = key;
+        }
+        for (node = index->nodes[i]; node != 0; node = next_node) {
+            size_t bucket = icalfileset_hash_component(node->comp) & (num_buckets - 1);
+
+            next_node = node->next;
+            node->next = nodes[bucket];
+            nodes[bucket] = node;
+        }
+    }
+
+    free(index->keys);
+    free(index->nodes);
+    index->keys = keys;
+    index->nodes = nodes;
+    index->num_buckets = num_buckets;
+
+    return true;
+}
+
+static bool icalfileset_index_add_key(struct icalfileset_index *index,
+                                      struct icalfileset_index_node *node,
+                                      bool is_id, const char *uid, char *recurrence_id)
+{
+    struct icalfileset_index_key *key, **bucket;
+
+    key = malloc(sizeof(*key));
+    if (!key) {
+        icalmemory_free_buffer(recurrence_id);
+        return false;
+    }
+
+    key->node = node;
+    key->is_id = is_id;
+    key->uid = strdup(uid);
+    key->recurrence_id = recurrence_id;
+    key->sibling = node->keys;
+    node->keys = key;
+    if (!key->uid) {
+        return false;
+    }
+
+    key->hash = icalfileset_hash_key(is_id, uid, recurrence_id);
+    bucket = &index->keys[key->hash & (index->num_buckets - 1)];
+    key->next = *bucket;
+    *bucket = key;
+    index->num_keys++;
+
+    return true;
+}
+
+/* Indexes a component added to the end of the cluster, if the index has
+   been built. Frees the index if out of memory. */
+static void icalfileset_index_add(icalfileset *fset, icalcomponent *comp)
+{
+    struct icalfileset_index *index = fset->index;
+    struct icalfileset_index_node *node, **bucket;
+    icalcomponent *inner;
+    icalproperty *p;
+    const char *uid;
+    bool added = true;
+
+    if (!index) {
+        return;
+    }
+
+    while (index->num_nodes >= index->num_buckets || index->num_keys >= index->num_buckets) {
+        if (!icalfileset_index_grow(index)) {
+            icalfileset_index_free(fset);
+            return;
+        }
+    }
+
+    node = malloc(sizeof(*node));
+    if (!node) {
+        icalfileset_index_free(fset);
+        return;
+    }
+
+    node->comp = comp;
+    node->position = index->next_position++;
+    node->keys = 0;
+    bucket = &index->nodes[icalfileset_hash_component(comp) & (index->num_buckets - 1)];
+    node->next = *bucket;
+    *bucket = node;
+    index->num_nodes++;
+
+    for (inner = icalcomponent_get_first_component(comp, ICAL_ANY_COMPONENT);
+         inner != 0 && added; inner = icalcomponent_get_next_component(comp, ICAL_ANY_COMPONENT)) {
+        p = icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY);
+        uid = p ? icalproperty_get_uid(p) : 0;
+        if (uid) {
+            added = icalfileset_index_add_key(index, node, false, uid, NULL);
+        }
+    }
+
+    inner = icalcomponent_get_first_real_component(comp);
+    p = inner ? icalcomponent_get_first_property(inner, ICAL_UID_PROPERTY) : 0;
+    uid = p ? icalproperty_get_uid(p) : 0;
+    if (uid && added) {
+        added = icalfileset_index_add_key(index, node, true, uid,
+                                          icalfileset_get_recurrence_id_r(inner));
+    }
+
+    if (!added) {
+        icalfileset_index_free(fset);
+    } else if (index->spanned) {
+        icalfileset_span_add(index, node);
+    }
+}
+
+static void icalfileset_index_remove(icalfileset *fset, icalcomponent *comp)
+{
+    struct icalfileset_index *index = fset->index;
+    struct icalfileset_index_node *node, **node_link;
+    struct icalfileset_index_key *key, *next_key, **key_link;
+
+    if (!index) {
+        return;
+    }
+
+    node_link = &index->nodes[icalfileset_hash_component(comp) & (index->num_buckets - 1)];
+    while (*node_link != 0 && (*node_link)->comp != comp) {
+        node_link = &(*node_link)->next;
+    }
+
+    node = *node_link;
+    if (!node) {
+        return;
+    }
+    *node_link = node->next;
+    index->num_nodes--;
+
+    if (index->spanned) {
+        index->spans = icalfileset_span_remove(index->spans, node);
+    }
+
+    for (key = node->keys; key != 0; key = next_key) {
+        next_key = key->sibling;
+        if (key->uid) {
+            key_link = &index->keys[key->hash & (index->num_buckets - 1)];
+            while (*key_link != key) {
+                key_link = &(*key_link)->next;
+            }
+            *key_link = key->next;
+            index->num_keys--;
+        }
+        free(key->uid);
+        icalmemory_free_buffer(key->recurrence_id);
+        free(key);
+    }
+    free(node);
+}
+
+/* Builds the index of the cluster, if it is not built yet. Returns false
+   if out of memory. */
+static bool icalfileset_index_build(icalfileset *fset)
+{
+    struct icalfileset_index *index;
+    icalcompiter i;
+
+    if (fset->index) {
+        return true;
+    }
+
+    index = calloc(1, sizeof(*index));
+    if (!index) {
+        return false;
+    }
+
+    index->num_buckets = 64;
+    index->keys = calloc(index->num_buckets, sizeof(*index->keys));
+    index->nodes = calloc(index->num_buckets, sizeof(*index->nodes));
+    fset->index = index;
+    if (!index->keys || !index->nodes) {
+        icalfileset_index_free(fset);
+        return false;
+    }
+
+    /* This does not move the iterator of the cluster used by
+       icalfileset_get_first_component() and _next */
+    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0 && fset->index != 0; icalcompiter_next(&i)) {
+        icalfileset_index_add(fset, icalcompiter_deref(&i));
+    }
+
+    return fset->index != 0;
+}
+
+static icalcomponent *icalfileset_index_lookup(struct icalfileset_index *index, bool is_id,
+                                              const char *uid, const char *recurrence_id)
+{
+    uint32_t hash = icalfileset_hash_key(is_id, uid, recurrence_id);
+    struct icalfileset_index_key *key;
+    struct icalfileset_index_node *found = 0;
+
+    for (key = index->keys[hash & (index->num_buckets - 1)]; key != 0; key = key->next) {
+        if (key->hash == hash && key->is_id == is_id && strcmp(key->uid, uid) == 0 &&
+            (!is_id || _compare_ids(key->recurrence_id, recurrence_id)) &&
+            (found == 0 || key->node->position < found->position)) {
+            found = key->node;
+        }
+    }
+
+    return found ? found->comp : 0;
+}
+
+/******* components of a file which are parsed when they are reached *********/
+
+/* The bounds of the spans of a component are estimated from the text of its
+   times, read as UTC, within this margin, which covers the differences of
+   timezones and the default duration of a date */
+#define ICALFILESET_LAZY_MARGIN (2 * ICALFILESET_SPAN_MARGIN)
+
+/* A top-level component in the file */
+struct icalfileset_entry {
+    size_t offset;
+    size_t length;
+    icalcomponent *comp; /**< the parsed component, or NULL */
+    int64_t lower;       /**< lower bound of the spans of the component */
+    int64_t upper;       /**< upper bound of the spans of the component */
+    bool opaque;         /**< whether its UIDs could not be scanned */
+    bool is_timezone;    /**< whether it is a VTIMEZONE, parsed into the cluster */
+};
+
+/* A UID of a component in the file, with its text in the mapped file */
+struct icalfileset_entry_uid {
+    const char *uid;
+    size_t length;
+    uint32_t hash;
+    size_t entry;
+    size_t next;   /**< next UID in the bucket, or SIZE_MAX */
+    bool is_child; /**< whether it is the UID of an inner component */
+};
+
+struct icalfileset_lazy {
+    char *map;
+    size_t map_size;
+    bool mapped;        /**< whether the file is mapped, or read into map */
+    icalarray *entries; /**< of struct icalfileset_entry, in the order of the file */
+    icalarray *uids;    /**< of struct icalfileset_entry_uid */
+    icalarray *opaque;  /**< of the size_t positions of the opaque entries */
+    size_t *buckets;    /**< first UID with each hash, or SIZE_MAX */
+    size_t mask;
+    size_t next_entry;      /**< position of the iterator */
+    icalcomponent *current; /**< component returned by the iterator */
+    icalcomponent *cluster; /**< the cluster of the set, with the VTIMEZONEs */
+};
+
+/* The times of the inner component of an entry, as scanned */
+struct icalfileset_scan_times {
+    int64_t start;
+    int64_t end;
+    int64_t due;
+    int64_t duration;
+    bool has_start;
+    bool has_end;
+    bool has_due;
+    bool unbounded_before;
+    bool unbounded_after;
+};
+
+static uint32_t icalfileset_hash_text(const char *text, size_t length)
+{
+    uint32_t hash = ICALFILESET_HASH_BASIS;
+
+    while (length-- > 0) {
+        hash = ICALFILESET_HASH(hash, *text++);
+    }
+
+    return hash;
+}
+
+/* Returns whether the line starts with the name, followed by a parameter
+   or the value */
+static bool icalfileset_scan_is(const char *line, const char *end, const char *name)
+{
+    size_t length = strlen(name);
+
+    return (size_t)(end - line) > length && strncasecmp(line, name, length) == 0 &&
+           (line[length] == ':' || line[length] == ';');
+}
+
+/* Returns the value of the content line, or NULL if there is none */
+static const char *icalfileset_scan_value(const char *line, const char *end)
+{
+    bool quoted = false;
+
+    for (; line < end; line++) {
+        if (*line == '"') {
+            quoted = !quoted;
+        } else if (*line == ':' && !quoted) {
+            return line + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Reads a DATE or DATE-TIME value as UTC. Returns false if it is not one. */
+static bool icalfileset_scan_time(const char *value, const char *end, int64_t *t)
+{
+    char buf[17];
+    size_t length = (size_t)(end - value), i;
+
+    if (length != 8 && length != 15 && !(length == 16 && value[15] == 'Z')) {
+        return false;
+    }
+
+    for (i = 0; i < length && i < 15; i++) {
+        if (i == 8 ? value[i] != 'T' : (value[i] < '0' || value[i] > '9')) {
+            return false;
+        }
+    }
+
+    memcpy(buf, value, length);
+    buf[length] = '\0';
+    *t = icalfileset_span_time(icaltime_from_string(buf));
+
+    return true;
+}
+
+/* Reads a DURATION value in seconds. Returns false if it is not one. */
+static bool icalfileset_scan_duration(const char *value, const char *end, int64_t *seconds)
+{
+    char buf[32];
+    size_t length = (size_t)(end - value);
+
+    if (length == 0 || length >= sizeof(buf) ||
+        strspn(value, "+-PTWDHMS0123456789") < length) {
+        return false;
+    }
+
+    memcpy(buf, value, length);
+    buf[length] = '\0';
+    *seconds = icaldurationtype_as_int(icaldurationtype_from_string(buf));
+
+    return true;
+}
+
+/* Scans a property of the inner component of an entry for the bounds of
+   its spans */
+static void icalfileset_scan_times(struct icalfileset_scan_times *times,
+                                   const char *line, const char *end)
+{
+    const char *value = icalfileset_scan_value(line, end);
+    int64_t t;
+
+    if (icalfileset_scan_is(line, end, "RRULE")) {
+        times->unbounded_after = true;
+    } else if (icalfileset_scan_is(line, end, "RDATE")) {
+        times->unbounded_before = true;
+        times->unbounded_after = true;
+    } else if (icalfileset_scan_is(line, end, "DTSTART")) {
+        if (value && icalfileset_scan_time(value, end, &t)) {
+            times->start = t;
+            times->has_start = true;
+        } else {
+            times->unbounded_before = true;
+            times->unbounded_after = true;
+        }
+    } else if (icalfileset_scan_is(line, end, "DTEND")) {
+        if (value && icalfileset_scan_time(value, end, &t)) {
+            times->end = t;
+            times->has_end = true;
+        } else {
+            times->unbounded_after = true;
+        }
+    } else if (icalfileset_scan_is(line, end, "DUE")) {
+        if (value && icalfileset_scan_time(value, end, &t)) {
+            times->due = t;
+            times->has_due = true;
+        } else {
+            times->unbounded_after = true;
+        }
+    } else if (icalfileset_scan_is(line, end, "DURATION")) {
+        if (value && icalfileset_scan_duration(value, end, &t)) {
+            times->duration = t;
+        } else {
+            times->unbounded_after = true;
+        }
+    }
+}
+
+static void icalfileset_scan_bounds(struct icalfileset_scan_times *times,
+                                    int64_t *lower, int64_t *upper)
+{
+    int64_t last;
+
+    *lower = INT64_MIN;
+    *upper = INT64_MAX;
+
+    if (!times->has_start) {
+        if (!times->has_due) {
+            return;
+        }
+        /* The start of a VTODO without DTSTART */
+        times->start = times->due;
+    }
+
+    last = times->start;
+    if (times->has_end && times->end > last) {
+        last = times->end;
+    }
+    if (times->has_due && times->due > last) {
+        last = times->due;
+    }
+    if (times->duration > 0 && times->start + times->duration > last) {
+        last = times->start + times->duration;
+    }
+
+    if (!times->unbounded_before) {
+        *lower = times->start - ICALFILESET_LAZY_MARGIN;
+    }
+    if (!times->unbounded_after) {
+        *upper = last + ICALFILESET_LAZY_MARGIN;
+    }
+}
+
+/* Returns whether the name is of a component returned by
+   icalcomponent_get_first_real_component() */
+static bool icalfileset_scan_is_real(const char *name, const char *end)
+{
+    static const char *const names[] = {
+        "VEVENT", "VTODO", "VJOURNAL", "VFREEBUSY", "VAVAILABILITY",
+        "VPOLL", "VPATCH", "VQUERY", "VAGENDA"};
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if ((size_t)(end - name) == strlen(names[i]) &&
+            strncasecmp(name, names[i], strlen(names[i])) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Scans the mapped file for the ranges of its top-level components, their
+   UIDs and the times of their inner components. Returns false if the file
+   does not consist of components only, or if out of memory. */
+static bool icalfileset_lazy_scan(struct icalfileset_lazy *lazy)
+{
+    const char *map = lazy->map, *p = map, *map_end = map + lazy->map_size;
+    const char *line, *end;
+    struct icalfileset_entry entry;
+    struct icalfileset_entry_uid uid;
+    struct icalfileset_scan_times times;
+    int depth = 0, inner_depth = 0;
+    bool in_inner = false, has_inner = false, tracked = false;
+    size_t i;
+
+    memset(&entry, 0, sizeof(entry));
+    memset(&uid, 0, sizeof(uid));
+    memset(&times, 0, sizeof(times));
+
+    while (p < map_end) {
+        line = p;
+        end = memchr(p, '\n', (size_t)(map_end - p));
+        p = end ? end + 1 : map_end;
+        if (!end) {
+            end = map_end;
+        }
+        if (end > line && end[-1] == '\r') {
+            end--;
+        }
+
+        if (end == line) {
+            continue;
+        }
+
+        if (*line == ' ' || *line == '\t') {
+            /* A folded line continues a value which was scanned */
+            if (depth == 0) {
+                return false;
+            }
+            if (tracked) {
+                entry.opaque = true;
+                times.unbounded_before = true;
+                times.unbounded_after = true;
+            }
+            continue;
+        }
+        tracked = false;
+
+        if (icalfileset_scan_is(line, end, "BEGIN")) {
+            const char *name = line + 6;
+
+            if (depth == 0) {
+                memset(&entry, 0, sizeof(entry));
+                memset(&times, 0, sizeof(times));
+                entry.offset = (size_t)(line - map);
+                has_inner = false;
+
+                /* The inner component of anything but a VCALENDAR is
+                   itself */
+                if ((size_t)(end - name) != 9 || strncasecmp(name, "VCALENDAR", 9) != 0) {
+                    has_inner = in_inner = true;
+                    inner_depth = 1;
+                }
+                entry.is_timezone =
+                    ((size_t)(end - name) == 9 && strncasecmp(name, "VTIMEZONE", 9) == 0);
+            } else if (depth == 1 && !has_inner && icalfileset_scan_is_real(name, end)) {
+                has_inner = in_inner = true;
+                inner_depth = 2;
+            }
+            depth++;
+            continue;
+        }
+
+        if (depth == 0) {
+            return false;
+        }
+
+        if (icalfileset_scan_is(line, end, "END")) {
+            depth--;
+            if (in_inner && depth < inner_depth) {
+                in_inner = false;
+            }
+            if (depth == 0) {
+                entry.length = (size_t)(p - map) - entry.offset;
+                icalfileset_scan_bounds(&times, &entry.lower, &entry.upper);
+                icalarray_append(lazy->entries, &entry);
+                if (entry.opaque) {
+                    i = lazy->entries->num_elements - 1;
+                    icalarray_append(lazy->opaque, &i);
+                }
+            }
+            continue;
+        }
+
+        if ((depth == 1 || depth == 2) && icalfileset_scan_is(line, end, "UID")) {
+            uid.uid = icalfileset_scan_value(line, end);
+            if (!uid.uid || memchr(uid.uid, '\\', (size_t)(end - uid.uid))) {
+                entry.opaque = true;
+            } else {
+                uid.length = (size_t)(end - uid.uid);
+                uid.hash = icalfileset_hash_text(uid.uid, uid.length);
+                uid.entry = lazy->entries->num_elements;
+                uid.is_child = (depth == 2);
+                icalarray_append(lazy->uids, &uid);
+            }
+            tracked = true;
+        } else if (in_inner && depth == inner_depth) {
+            icalfileset_scan_times(&times, line, end);
+            tracked = true;
+        }
+    }
+
+    if (depth != 0) {
+        return false;
+    }
+
+    /* Hash the UIDs */
+    for (lazy->mask = 15; lazy->mask < 2 * lazy->uids->num_elements; lazy->mask = 2 * lazy->mask + 1) {
+    }
+    lazy->buckets = malloc((lazy->mask + 1) * sizeof(size_t));
+    if (!lazy->buckets) {
+        return false;
+    }
+    for (i = 0; i <= lazy->mask; i++) {
+        lazy->buckets[i] = SIZE_MAX;
+    }
+    for (i = 0; i < lazy->uids->num_elements; i++) {
+        struct icalfileset_entry_uid *u = icalarray_element_at(lazy->uids, i);
+
+        u->next = lazy->buckets[u->hash & lazy->mask];
+        lazy->buckets[u->hash & lazy->mask] = i;
+    }
+
+    return true;
+}
+
+static void icalfileset_lazy_free(icalfileset *fset)
+{
+    struct icalfileset_lazy *lazy = fset->lazy;
+    size_t i;
+
+    if (!lazy) {
+        return;
+    }
+
+    for (i = 0; lazy->entries && i < lazy->entries->num_elements; i++) {
+        struct icalfileset_entry *entry = icalarray_element_at(lazy->entries, i);
+
+        /* The VTIMEZONEs are freed with the cluster */
+        if (entry->comp && !entry->is_timezone) {
+            icalcomponent_set_parent(entry->comp, 0);
+            icalcomponent_free(entry->comp);
+        }
+    }
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (lazy->mapped) {
+        (void)munmap(lazy->map, lazy->map_size);
+    } else
+#endif
+    {
+        free(lazy->map);
+    }
+
+    if (lazy->entries) {
+        icalarray_free(lazy->entries);
+    }
+    if (lazy->uids) {
+        icalarray_free(lazy->uids);
+    }
+    if (lazy->opaque) {
+        icalarray_free(lazy->opaque);
+    }
+    free(lazy->buckets);
+    free(lazy);
+    fset->lazy = 0;
+}
+
+/* Returns the component of the entry, which is parsed when it is first
+   reached, or NULL if it can not be parsed. A VTIMEZONE is added to the
+   cluster. The other components only get the cluster as their parent,
+   to find the VTIMEZONEs, and are added to it when the set is loaded. */
+static icalcomponent *icalfileset_lazy_get(struct icalfileset_lazy *lazy, size_t position)
+{
+    struct icalfileset_entry *entry = icalarray_element_at(lazy->entries, position);
+    char *text;
+
+    if (entry->comp || entry->length == 0) {
+        return entry->comp;
+    }
+
+    text = malloc(entry->length + 1);
+    if (!text) {
+        icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+        return 0;
+    }
+    memcpy(text, lazy->map + entry->offset, entry->length);
+    text[entry->length] = '\0';
+    entry->comp = icalparser_parse_string(text);
+    free(text);
+
+    if (entry->comp) {
+        if (entry->is_timezone) {
+            icalcomponent_add_component(lazy->cluster, entry->comp);
+        } else {
+            icalcomponent_set_parent(entry->comp, lazy->cluster);
+        }
+
+        /* The estimated bounds are replaced by the ones of the index */
+        icalfileset_get_span_bounds(entry->comp, &entry->lower, &entry->upper);
+    } else {
+        entry->length = 0;
+    }
+
+    return entry->comp;
+}
+
+/* Maps the file and scans it for its components. Returns false if the
+   file has to be read as a whole. */
+static bool icalfileset_lazy_open(icalfileset *fset, size_t size)
+{
+    struct icalfileset_lazy *lazy = calloc(1, sizeof(*lazy));
+    size_t i;
+
+    if (!lazy) {
+        return false;
+    }
+    fset->lazy = lazy;
+    lazy->map_size = size;
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    lazy->map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fset->fd, 0);
+    if (lazy->map == MAP_FAILED) {
+        lazy->map = 0;
+    } else {
+        lazy->mapped = true;
+    }
+#endif
+
+    if (!lazy->map) {
+        size_t read_size = 0;
+
+        lazy->map = malloc(size);
+        while (lazy->map && read_size < size) {
+            IO_SSIZE_T sz = read(fset->fd, lazy->map + read_size, (IO_SIZE_T)(size - read_size));
+
+            if (sz <= 0) {
+                break;
+            }
+            read_size += (size_t)sz;
+        }
+        lazy->map_size = read_size;
+    }
+
+    lazy->entries = icalarray_new(sizeof(struct icalfileset_entry), 256);
+    lazy->uids = icalarray_new(sizeof(struct icalfileset_entry_uid), 256);
+    lazy->opaque = icalarray_new(sizeof(size_t), 16);
+
+    if (!lazy->map || !lazy->entries || !lazy->uids || !lazy->opaque ||
+        !icalfileset_lazy_scan(lazy) ||
+        (lazy->cluster = icalcomponent_new(ICAL_XROOT_COMPONENT)) == 0) {
+        icalfileset_lazy_free(fset);
+        (void)lseek(fset->fd, 0, SEEK_SET);
+        return false;
+    }
+
+    /* The VTIMEZONEs are parsed into the cluster up front, so that the
+       TZIDs of the other components resolve, as if read eagerly */
+    fset->cluster = lazy->cluster;
+    for (i = 0; i < lazy->entries->num_elements; i++) {
+        if (((struct icalfileset_entry *)icalarray_element_at(lazy->entries, i))->is_timezone) {
+            (void)icalfileset_lazy_get(lazy, i);
+        }
+    }
+
+    return true;
+}
+
+/* Parses the components which were not reached yet, and moves all of them
+   into the cluster, so the set can be changed */
+static void icalfileset_load(icalfileset *fset)
+{
+    struct icalfileset_lazy *lazy = fset->lazy;
+    icalcomponent *comp;
+    size_t i;
+
+    if (!lazy) {
+        return;
+    }
+
+    /* Hash the file, to tell whether a journal was written for it */
+    fset->file_size = lazy->map_size;
+    for (i = 0; i < lazy->map_size; i++) {
+        fset->file_hash = ICALFILESET_HASH(fset->file_hash, lazy->map[i]);
+    }
+
+    for (i = 0; i < lazy->entries->num_elements; i++) {
+        struct icalfileset_entry *entry = icalarray_element_at(lazy->entries, i);
+
+        comp = icalfileset_lazy_get(lazy, i);
+        if (comp && !entry->is_timezone) {
+            icalcomponent_set_parent(comp, 0);
+            icalcomponent_add_component(fset->cluster, comp);
+        }
+        entry->comp = 0;
+    }
+
+    /* Continue an iteration from the same component */
+    if (lazy->current) {
+        for (comp = icalcomponent_get_first_component(fset->cluster, ICAL_ANY_COMPONENT);
+             comp != 0 && comp != lazy->current;
+             comp = icalcomponent_get_next_component(fset->cluster, ICAL_ANY_COMPONENT)) {
+        }
+    }
+
+    icalfileset_lazy_free(fset);
+}
+
+/* Returns the first component of the file with the given key, like
+   icalfileset_find(), parsing only the components with the UID */
+static icalcomponent *icalfileset_lazy_find(struct icalfileset_lazy *lazy, bool is_id,
+                                            const char *uid, const char *recurrence_id)
+{
+    size_t length = strlen(uid), found = SIZE_MAX, i, *position;
+    uint32_t hash = icalfileset_hash_text(uid, length);
+    struct icalfileset_entry_uid *u;
+    icalcomponent *comp;
+
+    for (i = lazy->buckets[hash & lazy->mask]; i != SIZE_MAX; i = u->next) {
+        u = icalarray_element_at(lazy->uids, i);
+        if (u->hash == hash && u->entry < found && (is_id || u->is_child) &&
+            u->length == length && memcmp(u->uid, uid, length) == 0) {
+            comp = icalfileset_lazy_get(lazy, u->entry);
+            if (comp && icalfileset_has_key(comp, is_id, uid, recurrence_id)) {
+                found = u->entry;
+            }
+        }
+    }
+
+    for (i = 0; i < lazy->opaque->num_elements; i++) {
+        position = icalarray_element_at(lazy->opaque, i);
+        if (*position < found) {
+            comp = icalfileset_lazy_get(lazy, *position);
+            if (comp && icalfileset_has_key(comp, is_id, uid, recurrence_id)) {
+                found = *position;
+            }
+        }
+    }
+
+    if (found == SIZE_MAX) {
+        return 0;
+    }
+
+    return ((struct icalfileset_entry *)icalarray_element_at(lazy->entries, found))->comp;
+}
+
+/* Returns the next component of the file which passes the gauge */
+static icalcomponent *icalfileset_lazy_next(icalfileset *fset)
+{
+    struct icalfileset_lazy *lazy = fset->lazy;
+    icalcomponent *comp;
+
+    while (lazy->next_entry < lazy->entries->num_elements) {
+        comp = icalfileset_lazy_get(lazy, lazy->next_entry++);
+        if (comp != 0 && (fset->gauge == 0 || icalgauge_compare(fset->gauge, comp) == 1)) {
+            lazy->current = comp;
+            return comp;
+        }
+    }
+
+    lazy->current = 0;
+    return 0;
+}
+
+static void icalfileset_lazy_foreach_in_span(icalfileset *fset, int64_t start, int64_t end,
+                                             void (*callback)(icalcomponent *comp, void *data),
+                                             void *callback_data)
+{
+    struct icalfileset_lazy *lazy = fset->lazy;
+    struct icalfileset_entry *entry;
+    icalcomponent *comp;
+    size_t i;
+
+    for (i = 0; i < lazy->entries->num_elements; i++) {
+        entry = icalarray_element_at(lazy->entries, i);
+        if (entry->lower >= end || entry->upper <= start) {
+            continue;
+        }
+
+        /* Check the bounds of the parsed component */
+        comp = icalfileset_lazy_get(lazy, i);
+        if (comp != 0 && entry->lower < end && entry->upper > start &&
+            (fset->gauge == 0 || icalgauge_compare(fset->gauge, comp) == 1)) {
+            (*callback)(comp, callback_data);
+        }
+    }
+}
+
+/* Returns the first component of the cluster with the given key */
+static icalcomponent *icalfileset_find(icalfileset *fset, bool is_id,
+                                       const char *uid, const char *recurrence_id)
+{
+    icalcomponent *comp;
+    icalcompiter i;
+    int attempt;
+
+    if (fset->lazy) {
+        return icalfileset_lazy_find(fset->lazy, is_id, uid, recurrence_id);
+    }
+
+    for (attempt = 0; attempt < 2 && icalfileset_index_build(fset); attempt++) {
+        comp = icalfileset_index_lookup(fset->index, is_id, uid, recurrence_id);
+        if (comp == 0 || icalfileset_has_key(comp, is_id, uid, recurrence_id)) {
+            return comp;
+        }
+
+        /* The component was changed without marking the set, so the
+           index is built again */
+        icalfileset_index_free(fset);
+    }
+
+    /* Without an index, search all of the components */
+    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
+        comp = icalcompiter_deref(&i);
+        if (icalfileset_has_key(comp, is_id, uid, recurrence_id)) {
+            return comp;
+        }
+    }
+
+    return 0;
+}
+
+icalcomponent *icalfileset_fetch(icalset *set, icalcomponent_kind kind, const char *uid)
+{
+    _unused(kind);
+
+    icalerror_check_arg_rz(set != 0, "set");
+    icalerror_check_arg_rz(uid != 0, "uid");
+
+    return icalfileset_find((icalfileset *)set, false, uid, NULL);
+}
+
+int icalfileset_has_uid(icalset *set, const char *uid)
+{
+    icalerror_check_arg_rz(set != 0, "set");
+    icalerror_check_arg_rz(uid != 0, "uid");
+
+    return icalfileset_fetch(set, ICAL_ANY_COMPONENT, uid) != 0;
+}
+
+icalcomponent *icalfileset_fetch_match(icalset *set, const icalcomponent *comp)
+{
+    icalfileset *fset = (icalfileset *)set;
+    icalcomponent *match;
+    struct icalfileset_id comp_id;
+
+    icalerror_check_arg_rz(set != 0, "set");
+    icalerror_check_arg_rz(comp != 0, "comp");
+
+    comp_id = icalfileset_get_id(comp);
+    match = icalfileset_find(fset, true, comp_id.uid, comp_id.recurrence_id);
+    icalfileset_id_free(&comp_id);
+
+    return match;
+}
+
+static int icalfileset_compare_positions(const void *a, const void *b)
+{
+    const struct icalfileset_index_node *node_a = *(struct icalfileset_index_node *const *)a;
+    const struct icalfileset_index_node *node_b = *(struct icalfileset_index_node *const *)b;
+
+    return (node_a->position > node_b->position) - (node_a->position < node_b->position);
+}
+
+void icalfileset_foreach_in_span(icalset *set, icaltime_t start, icaltime_t end,
+                                 void (*callback)(icalcomponent *comp, void *data),
+                                 void *callback_data)
+{
+    icalfileset *fset = (icalfileset *)set;
+    struct icalfileset_index_node **node;
+    icalarray *found;
+    icalcompiter i;
+    size_t j;
+
+    icalerror_check_arg_rv(set != 0, "set");
+    icalerror_check_arg_rv(callback != 0, "callback");
+
+    if (fset->lazy) {
+        icalfileset_lazy_foreach_in_span(fset, (int64_t)start, (int64_t)end,
+                                         callback, callback_data);
+        return;
+    }
+
+    found = icalarray_new(sizeof(struct icalfileset_index_node *), 64);
+    if (found && icalfileset_index_build(fset)) {
+        struct icalfileset_index *index = fset->index;
+
+        if (!index->spanned) {
+            /* Index the bounds of all the components on the first lookup */
+            for (j = 0; j < index->num_buckets; j++) {
+                struct icalfileset_index_node *n;
+
+                for (n = index->nodes[j]; n != 0; n = n->next) {
+                    icalfileset_span_add(index, n);
+                }
+            }
+            index->spanned = true;
+        }
+
+        icalfileset_span_find(index->spans, (int64_t)start, (int64_t)end, found);
+        icalarray_sort(found, icalfileset_compare_positions);
+
+        for (j = 0; j < found->num_elements; j++) {
+            node = icalarray_element_at(found, j);
+            if (fset->gauge == 0 || icalgauge_compare(fset->gauge, (*node)->comp) == 1) {
+                (*callback)((*node)->comp, callback_data);
+            }
+        }
+        icalarray_free(found);
+        return;
+    }
+
+    if (found) {
+        icalarray_free(found);
+    }
+
+    /* Without an index, all of the components are candidates */
+    for (i = icalcomponent_begin_component(fset->cluster, ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&i) != 0; icalcompiter_next(&i)) {
+        icalcomponent *comp = icalcompiter_deref(&i);
+
+        if (fset->gauge == 0 || icalgauge_compare(fset->gauge, comp) == 1) {
+            (*callback)(comp, callback_data);
+        }
+    }
+}
+
+icalerrorenum icalfileset_modify(icalset *set, icalcomponent *old, icalcomponent *new)
+{
+    _unused(set);
+    _unused(old);
+    _unused(new);
+    assert(0); /* HACK, not implemented */
+    return ICAL_NO_ERROR;
+}
+
+/* Iterate through components */
+icalcomponent *icalfileset_get_current_component(icalset *set)
+{
+    icalfileset *fset;
+
+    icalerror_check_arg_rz((set != 0), "set");
+
+    fset = (icalfileset *)set;
+    if (fset->lazy) {
+        return fset->lazy->current;
+    }
+
+    return icalcomponent_get_current_component(fset->cluster);
+}
+
+icalcomponent *icalfileset_get_first_component(icalset *set)
+{
+    icalcomponent *c = 0;
+    icalfileset *fset;
+
+    icalerror_check_arg_rz((set != 0), "set");
+    fset = (icalfileset *)set;
+
+    if (fset->lazy) {
+        fset->lazy->next_entry = 0;
+        return icalfileset_lazy_next(fset);
+    }
+
+    do {
+        if (c == 0) {
+            c = icalcomponent_get_first_component(fset->cluster, ICAL_ANY_COMPONENT);
+        } else {
+            c = icalcomponent_get_next_component(fset->cluster, ICAL_ANY_COMPONENT);
+        }
+
+        if (c != 0 && (fset->gauge == 0 || icalgauge_compare(fset->gauge, c) == 1)) {
+            return c;
+        }
+
+    } while (c != 0);
 
     return 0;
 }
@@ -689,6 +2430,10 @@ icalcomponent *icalfileset_get_next_component(icalset *set)
     icalerror_check_arg_rz((set != 0), "set");
     fset = (icalfileset *)set;
 
+    if (fset->lazy) {
+        return icalfileset_lazy_next(fset);
+    }
+
     do {
         c = icalcomponent_get_next_component(fset->cluster, ICAL_ANY_COMPONENT);
 
@@ -750,6 +2495,7 @@ icalsetiter icalfileset_begin_component(icalset *set, icalcomponent_kind kind, i
     itr.gauge = gauge;
 
     fset = (icalfileset *)set;
+    icalfileset_load(fset);
     citr = icalcomponent_begin_component(fset->cluster, kind);
     comp = icalcompiter_deref(&citr);
 
@@ -33,7 +33,9 @@ LIBICAL_ICALSS_EXPORT void icalfileset_free(icalset *cluster);
 LIBICAL_ICALSS_EXPORT const char *icalfileset_path(icalset *cluster);
 
 /* Mark the cluster as changed, so it will be written to disk when it
-   is freed. Commit writes to disk immediately. */
+   is freed. Commit writes to disk immediately. Components changed other
+   than with icalfileset_add_component() and _remove_component() must be
+   marked, so that they are indexed again by UID. */
 LIBICAL_ICALSS_EXPORT void icalfileset_mark(icalset *set);
 
 LIBICAL_ICALSS_EXPORT icalerrorenum icalfileset_commit(icalset *set);
@@ -54,7 +56,13 @@ LIBICAL_ICALSS_EXPORT icalerrorenum icalfileset_select(icalset *set, icalgauge *
 /** @brief Clears the gauge **/
 LIBICAL_ICALSS_EXPORT void icalfileset_clear(icalset *set);
 
-/** @brief Gets and searches for a component by uid **/
+/**
+ * @brief Gets and searches for a component by uid
+ *
+ * The components are looked up in an index by UID, which is built on the
+ * first lookup and kept up to date by icalfileset_add_component() and
+ * _remove_component().
+ */
 LIBICAL_ICALSS_EXPORT icalcomponent *icalfileset_fetch(icalset *set,
                                                        icalcomponent_kind kind, const char *uid);
 
@@ -62,6 +70,25 @@ LIBICAL_ICALSS_EXPORT int icalfileset_has_uid(icalset *set, const char *uid);
 
 LIBICAL_ICALSS_EXPORT icalcomponent *icalfileset_fetch_match(icalset *set, const icalcomponent *c);
 
+/**
+ * @brief Calls a function for the components which may overlap a span of time
+ *
+ * The components are looked up in an interval index of the bounds of their
+ * spans and of the occurrences of their recurrences, which is built on the
+ * first call and kept up to date like the index by UID. The callback is
+ * called in the order of the components in the set, for the components
+ * which pass the gauge and whose span or any occurrence may overlap the
+ * span from @p start to @p end. It has to check the overlap itself, and it
+ * must not remove components from the set.
+ *
+ * @since 4.0
+ */
+LIBICAL_ICALSS_EXPORT void icalfileset_foreach_in_span(icalset *set,
+                                                       icaltime_t start, icaltime_t end,
+                                                       void (*callback)(icalcomponent *comp,
+                                                                        void *data),
+                                                       void *callback_data);
+
 /**
  *  @brief Modifies components according to the MODIFY method of CAP.
  *
@@ -99,6 +126,21 @@ LIBICAL_ICALSS_EXPORT icalcomponent *icalfileset_get_component(icalset *cluster)
  * @brief Options for opening an icalfileset.
  *
  * These options should be passed to the icalset_new() function
+ *
+ * With @p journal set, icalfileset_commit() appends the components added
+ * and removed with icalfileset_add_component() and _remove_component()
+ * to a journal file next to the file, named like it with ".journal"
+ * appended, instead of writing the whole file. The file is written again,
+ * and the journal removed, once the journal grows past half of the size of
+ * the file, or when the set has been marked with icalfileset_mark(). An
+ * existing journal is applied when the file is read, whether the option is
+ * set or not.
+ *
+ * With @p lazy set, the file is mapped into memory and only scanned for the
+ * ranges of its top-level components, with their UIDs and the bounds of
+ * their times. A component is parsed when icalfileset_fetch(), an iterator
+ * or icalfileset_foreach_in_span() reaches it, and all of them are parsed
+ * once the set is changed or its cluster is needed as a whole.
  */
 
 typedef struct icalfileset_options {
@@ -106,6 +148,8 @@ typedef struct icalfileset_options {
     int mode;             /**< file mode */
     int safe_saves;       /**< to lock or not */
     icalcluster *cluster; /**< use this cluster to initialize data */
+    int journal;          /**< commit changes to a journal, @since 4.0 */
+    int lazy;             /**< parse components when they are reached, @since 4.0 */
 } icalfileset_options;
 
 extern icalfileset_options icalfileset_options_default;
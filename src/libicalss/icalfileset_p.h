@@ -0,0 +1,23 @@
+/*======================================================================
+ FILE: icalfileset_p.h
+
+ SPDX-FileCopyrightText: 2000, Eric Busboom <eric@civicknowledge.com>
+ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
+======================================================================*/
+
+#ifndef ICALFILESET_P_H
+#define ICALFILESET_P_H
+
+#include "libical_icalss_export.h"
+#include "icalcomponent.h"
+
+#include <stdint.h>
+
+/* Sets the bounds of the base span and of all the occurrences of the
+   component, as expanded by icalcomponent_foreach_recurrence() and
+   returned by icalcomponent_get_span(). A series without an end has no
+   upper bound, and a component without a start has no bounds. */
+LIBICAL_ICALSS_NO_EXPORT void icalfileset_get_span_bounds(icalcomponent *comp,
+                                                          int64_t *lower, int64_t *upper);
+
+#endif /* ICALFILESET_P_H */
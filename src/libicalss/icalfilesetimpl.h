@@ -14,6 +14,9 @@
 
 #include "icalfileset.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 struct icalfileset_impl {
     icalset super;               /**< parent class */
     char *path;                  /**< pathname of file */
@@ -23,6 +26,19 @@ struct icalfileset_impl {
     icalgauge *gauge;       /**< gauge for filtering out data */
     int changed;            /**< boolean flag, 1 if data has changed */
     int fd;                 /**< file descriptor */
+
+    struct icalfileset_index *index; /**< UID index of the cluster, built on demand */
+
+    size_t file_size;       /**< size of the file as last read or written */
+    uint32_t file_hash;     /**< hash of the file as last read or written */
+    char *journal_path;     /**< pathname of the journal */
+    int journal_fd;         /**< file descriptor of the journal, or -1 */
+    size_t journal_size;    /**< size of the valid records in the journal */
+    bool journal_valid;     /**< whether the journal is for the file as written */
+    bool rewrite;           /**< whether the changes are not all in records */
+    icalarray *records;     /**< records of changes to append to the journal */
+
+    struct icalfileset_lazy *lazy; /**< components of the file not loaded into the cluster yet */
 };
 
 #endif
@@ -11,8 +11,11 @@
 #endif
 
 #include "icalspanlist.h"
+#include "icaldirset.h"
+#include "icalfileset.h"
 #include "icaltimezone.h"
 
+#include <limits.h>
 #include <stdlib.h>
 
 struct icalspanlist_impl {
@@ -77,12 +80,49 @@ static void icalspanlist_new_callback(const icalcomponent *comp, const struct ic
     icalpvl_insert_ordered(sl->spans, compare_span, (void *)s);
 }
 
+struct icalspanlist_range {
+    icalspanlist *sl;
+    struct icaltimetype start;
+    struct icaltimetype end;
+};
+
+static void icalspanlist_new_component(icalcomponent *c, void *data)
+{
+    struct icalspanlist_range *range = data;
+    icalcomponent *inner;
+    icalcomponent_kind kind, inner_kind;
+
+    kind = icalcomponent_isa(c);
+    inner = icalcomponent_get_inner(c);
+
+    if (!inner) {
+        return;
+    }
+
+    inner_kind = icalcomponent_isa(inner);
+
+    if (kind != ICAL_VEVENT_COMPONENT && inner_kind != ICAL_VEVENT_COMPONENT) {
+        return;
+    }
+
+    icalerror_clear_errno();
+
+    icalcomponent_foreach_recurrence(c, range->start, range->end, icalspanlist_new_callback,
+                                     (void *)range->sl);
+}
+
+static icaltime_t icalspanlist_utc_time(struct icaltimetype tt)
+{
+    return icaltime_as_timet_with_zone(tt, tt.zone ? tt.zone : icaltimezone_get_utc_timezone());
+}
+
 icalspanlist *icalspanlist_new(icalset *set, struct icaltimetype start, struct icaltimetype end)
 {
     struct icaltime_span range;
+    struct icalspanlist_range components_range;
+    icaltime_t range_end;
     icalpvl_elem itr;
-    icalcomponent *c, *inner;
-    icalcomponent_kind kind, inner_kind;
+    icalcomponent *c;
     icalspanlist *sl;
     struct icaltime_span *freetime;
 
@@ -101,25 +141,35 @@ icalspanlist *icalspanlist_new(icalset *set, struct icaltimetype start, struct i
     /* Gets a list of spans of busy time from the events in the set
        and order the spans based on the start time */
 
-    for (c = icalset_get_first_component(set);
-         c != 0;
-         c = icalset_get_next_component(set)) {
-        kind = icalcomponent_isa(c);
-        inner = icalcomponent_get_inner(c);
+    components_range.sl = sl;
+    components_range.start = start;
+    components_range.end = end;
 
-        if (!inner) {
-            continue;
+    if (set->kind == ICAL_FILE_SET || set->kind == ICAL_DIR_SET) {
+        /* Only expand the components in the time index, or in the
+           clusters, which may overlap */
+        if (!icaltime_is_null_time(end)) {
+            range_end = icalspanlist_utc_time(end);
+        } else {
+#if (SIZEOF_ICALTIME_T > 4)
+            range_end = (icaltime_t)LONG_MAX;
+#else
+            range_end = (icaltime_t)INT_MAX;
+#endif
         }
-
-        inner_kind = icalcomponent_isa(inner);
-
-        if (kind != ICAL_VEVENT_COMPONENT && inner_kind != ICAL_VEVENT_COMPONENT) {
-            continue;
+        if (set->kind == ICAL_FILE_SET) {
+            icalfileset_foreach_in_span(set, icalspanlist_utc_time(start), range_end,
+                                        icalspanlist_new_component, &components_range);
+        } else {
+            icaldirset_foreach_in_span(set, icalspanlist_utc_time(start), range_end,
+                                       icalspanlist_new_component, &components_range);
+        }
+    } else {
+        for (c = icalset_get_first_component(set);
+             c != 0;
+             c = icalset_get_next_component(set)) {
+            icalspanlist_new_component(c, &components_range);
         }
-
-        icalerror_clear_errno();
-
-        icalcomponent_foreach_recurrence(c, start, end, icalspanlist_new_callback, (void *)sl);
     }
 
     /* Now Fill in the free time spans. loop through the spans. if the
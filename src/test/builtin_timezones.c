@@ -12,12 +12,18 @@
 
 #if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
 #include <pthread.h>
-#include <assert.h>
 #endif
 
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <assert.h>
+
 #include "libical/ical.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
 
@@ -68,6 +74,148 @@ static void test_get_component_threadsafety(void)
         pthread_join(thread[ii], NULL);
     }
 }
+
+#define N_YEARS 600
+
+struct offsets_thread_data {
+    icaltimezone *zone;
+    int first_year;
+};
+
+static int expected_offsets[N_YEARS][2];
+
+static void offsets_of_year(icaltimezone *zone, int year, int *offsets)
+{
+    icaltimetype tt = icaltime_from_string("19700115T120000Z");
+
+    tt.year = year;
+    offsets[0] = icaltimezone_get_utc_offset_of_utc_time(zone, &tt, NULL);
+    tt.month = 7;
+    offsets[1] = icaltimezone_get_utc_offset(zone, &tt, NULL);
+}
+
+static void *offsets_thread_func(void *user_data)
+{
+    const struct offsets_thread_data *data = user_data;
+    int offsets[2];
+    int ii;
+
+    /* Every thread starts at another year, so that the changes are expanded
+       while other threads are searching them */
+    for (ii = 0; ii < N_YEARS; ii++) {
+        int year = (data->first_year + ii) % N_YEARS;
+
+        offsets_of_year(data->zone, 1900 + year, offsets);
+        assert(offsets[0] == expected_offsets[year][0]);
+        assert(offsets[1] == expected_offsets[year][1]);
+    }
+
+    return NULL;
+}
+
+static void test_utc_offset_threadsafety(void)
+{
+    pthread_t thread[N_THREADS];
+    struct offsets_thread_data data[N_THREADS];
+    icalcomponent *vtimezone;
+    icaltimezone *expected, *zone;
+    int ii;
+
+    vtimezone = icaltimezone_get_component(icaltimezone_get_builtin_timezone("America/New_York"));
+
+    expected = icaltimezone_new();
+    icaltimezone_set_component(expected, icalcomponent_clone(vtimezone));
+    for (ii = 0; ii < N_YEARS; ii++) {
+        offsets_of_year(expected, 1900 + ii, expected_offsets[ii]);
+    }
+    icaltimezone_free(expected, 1);
+
+    zone = icaltimezone_new();
+    icaltimezone_set_component(zone, icalcomponent_clone(vtimezone));
+
+    for (ii = 0; ii < N_THREADS; ii++) {
+        data[ii].zone = zone;
+        data[ii].first_year = (N_YEARS - 1 - ii * 29) % N_YEARS;
+        pthread_create(&thread[ii], NULL, offsets_thread_func, &data[ii]);
+    }
+
+    for (ii = 0; ii < N_THREADS; ii++) {
+        pthread_join(thread[ii], NULL);
+    }
+
+    icaltimezone_free(zone, 1);
+}
+#endif
+
+#if defined(USE_EMBEDDED_TZDATA)
+
+#define N_EMBEDDED_YEARS 4
+
+/* Fingerprints a builtin timezone, to compare the zone loaded from the
+   data compiled into the library with the one loaded from the zone files */
+static void zone_fingerprint(icaltimezone *zone, char *buffer, size_t size)
+{
+    static const int years[N_EMBEDDED_YEARS] = {1950, 1990, 2025, 2060};
+    icaltimetype tt = icaltime_null_time();
+    size_t len;
+    int ii, is_daylight;
+
+    len = (size_t)snprintf(buffer, size, "%s %s %.4f %.4f", icaltimezone_get_location(zone),
+                           icaltimezone_get_tznames(zone), icaltimezone_get_latitude(zone),
+                           icaltimezone_get_longitude(zone));
+    for (ii = 0; ii < N_EMBEDDED_YEARS && len < size; ii++) {
+        tt.year = years[ii];
+        tt.month = 1;
+        tt.day = 15;
+        len += (size_t)snprintf(buffer + len, size - len, " %d",
+                                icaltimezone_get_utc_offset(zone, &tt, &is_daylight));
+        tt.month = 7;
+        len += (size_t)snprintf(buffer + len, size - len, "/%d",
+                                icaltimezone_get_utc_offset(zone, &tt, &is_daylight));
+    }
+}
+
+static void test_embedded_tzdata(void)
+{
+    icalarray *builtin_timezones;
+    char **fingerprints;
+    char buffer[512];
+    size_t ii, num_zones;
+
+    /* Without a zone directory the builtin timezones come from the library */
+    icaltimezone_free_zone_directory();
+    builtin_timezones = icaltimezone_get_builtin_timezones();
+    num_zones = builtin_timezones->num_elements;
+    assert(num_zones > 0);
+
+    fingerprints = calloc(num_zones, sizeof(char *));
+    assert(fingerprints != NULL);
+    for (ii = 0; ii < num_zones; ii++) {
+        icaltimezone *zone = icalarray_element_at(builtin_timezones, ii);
+        assert(icaltimezone_get_component(zone) != NULL);
+        zone_fingerprint(zone, buffer, sizeof(buffer));
+        fingerprints[ii] = strdup(buffer);
+    }
+
+    icaltimezone_free_builtin_timezones();
+    icaltimezone_set_zone_directory(TEST_ZONEDIR);
+
+    builtin_timezones = icaltimezone_get_builtin_timezones();
+    assert(builtin_timezones->num_elements == num_zones);
+    for (ii = 0; ii < num_zones; ii++) {
+        zone_fingerprint(icalarray_element_at(builtin_timezones, ii), buffer, sizeof(buffer));
+        if (strcmp(buffer, fingerprints[ii]) != 0) {
+            fprintf(stderr, "Embedded timezone differs from the zone file:\n  %s\n  %s\n",
+                    fingerprints[ii], buffer);
+            assert(0);
+        }
+        free(fingerprints[ii]);
+    }
+    free(fingerprints);
+
+    icaltimezone_free_builtin_timezones();
+}
+
 #endif
 
 int main(void)
@@ -77,11 +225,15 @@ int main(void)
     int dd, hh, zz, tried = 0;
     long zz2 = -1;
 
-    icaltimezone_set_zone_directory("../../zoneinfo");
     icaltimezone_set_tzid_prefix("/softwarestudio.org/");
+#if defined(USE_EMBEDDED_TZDATA)
+    test_embedded_tzdata();
+#endif
+    icaltimezone_set_zone_directory("../../zoneinfo");
 
 #if ICAL_SYNC_MODE == ICAL_SYNC_MODE_PTHREAD
     test_get_component_threadsafety();
+    test_utc_offset_threadsafety();
 #endif
 
     tt = icaltime_current_time_with_zone(icaltimezone_get_builtin_timezone("America/New_York"));
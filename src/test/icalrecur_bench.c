@@ -0,0 +1,383 @@
+/*======================================================================
+ FILE: icalrecur_bench.c
+
+ SPDX-FileCopyrightText: 2025 Contributors to the libical project <git@github.com:libical/libical>
+ SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
+======================================================================*/
+
+/*
+ * Benchmark for the libical recurrence iterator.
+ *
+ * Replays the rules of the icalrecur_test*.txt corpora, plus a few synthetic
+ * heavy rules, and measures:
+ *   next     - occurrences per second returned by icalrecur_iterator_next()
+ *   seek     - icalrecur_iterator_set_range() followed by one
+ *              icalrecur_iterator_next(), to a scattered occurrence
+ *   foreach  - spans per second passed to icalcomponent_foreach_recurrence()
+ *
+ * The results are written to stdout as tab separated values, one line per
+ * rule and benchmark, followed by one "total" line per benchmark.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <libical/ical.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct bench_rule {
+    char name[100];
+    char tzid[100];
+    char dtstart[100];
+    char rrule[1024];
+};
+
+struct bench_total {
+    const char *name;
+    long runs;
+    long operations;
+    double seconds;
+};
+
+static const struct bench_rule synthetic_rules[] = {
+    {"synthetic:secondly", "", "20250101T000000Z", "FREQ=SECONDLY;INTERVAL=7"},
+    {"synthetic:secondly-byminute", "", "20250101T000000Z", "FREQ=SECONDLY;BYMINUTE=0,30;BYSECOND=0,20,40"},
+    {"synthetic:minutely-workhours", "", "20250101T090000",
+     "FREQ=MINUTELY;INTERVAL=5;BYHOUR=9,10,11,12,13,14,15,16;BYDAY=MO,TU,WE,TH,FR"},
+    {"synthetic:hourly-zoned", "America/New_York", "20250301T000000", "FREQ=HOURLY;INTERVAL=3"},
+    {"synthetic:monthly-bysetpos", "", "20250101T100000Z", "FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1"},
+    {"synthetic:yearly-bysetpos", "", "20250101T100000Z",
+     "FREQ=YEARLY;BYMONTH=1,4,7,10;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=1,-1"},
+    {"synthetic:yearly-byweekno", "", "20250101T100000Z", "FREQ=YEARLY;BYWEEKNO=1,20,53;BYDAY=MO,FR"},
+    {"synthetic:weekly-until", "", "20250101T100000Z", "FREQ=WEEKLY;BYDAY=MO,WE,FR;UNTIL=20450101T000000Z"},
+    {"synthetic:rscale-chinese", "", "20250129", "RSCALE=CHINESE;FREQ=MONTHLY;BYMONTHDAY=1,15"},
+    {"synthetic:rscale-hebrew", "", "20250101", "RSCALE=HEBREW;FREQ=YEARLY;BYMONTH=5L;BYMONTHDAY=1;SKIP=FORWARD"},
+};
+
+static struct bench_total totals[] = {
+    {"next", 0, 0, 0.0},
+    {"seek", 0, 0, 0.0},
+    {"foreach", 0, 0, 0.0},
+};
+
+static double min_seconds = 0.02;
+static int max_occurrences = 1000;
+
+static double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void report(const struct bench_rule *r, struct bench_total *total,
+                   long runs, long operations, double seconds)
+{
+    double per_second = seconds > 0 ? (double)operations / seconds : 0.0;
+    double ns = operations > 0 ? seconds * 1e9 / (double)operations : 0.0;
+
+    printf("%s\t%s\t%ld\t%ld\t%.6f\t%.0f\t%.1f\t%s\n",
+           r ? r->name : "total", total->name, runs, operations, seconds, per_second, ns,
+           r ? r->rrule : "-");
+
+    if (r) {
+        total->runs += runs;
+        total->operations += operations;
+        total->seconds += seconds;
+    }
+}
+
+static long collect_occurrences(icalrecur_iterator *ritr, struct icaltimetype *occurrences)
+{
+    long n = 0;
+
+    while (n < max_occurrences) {
+        struct icaltimetype next = icalrecur_iterator_next(ritr);
+        if (icaltime_is_null_time(next)) {
+            break;
+        }
+        occurrences[n++] = next;
+    }
+
+    return n;
+}
+
+static void bench_next(const struct bench_rule *r, struct icalrecurrencetype *rrule,
+                       struct icaltimetype dtstart)
+{
+    long runs = 0, operations = 0;
+    clock_t start = clock();
+
+    do {
+        icalrecur_iterator *ritr = icalrecur_iterator_new(rrule, dtstart);
+        int n = 0;
+
+        while (n < max_occurrences && !icaltime_is_null_time(icalrecur_iterator_next(ritr))) {
+            n++;
+        }
+        icalrecur_iterator_free(ritr);
+
+        operations += n;
+        runs++;
+    } while (seconds_since(start) < min_seconds);
+
+    report(r, &totals[0], runs, operations, seconds_since(start));
+}
+
+static void bench_seek(const struct bench_rule *r, icalrecur_iterator *ritr,
+                       const struct icaltimetype *occurrences, long n)
+{
+    long runs = 0, operations = 0;
+    clock_t start = clock();
+
+    do {
+        /* Visit the occurrences in a scattered order, so that consecutive
+           seeks do not land in the same period */
+        for (long i = 0; i < n; i++) {
+            long k = (i * 7919) % n;
+
+            icalrecur_iterator_set_range(ritr, occurrences[k], icaltime_null_time());
+            (void)icalrecur_iterator_next(ritr);
+        }
+        operations += n;
+        runs++;
+    } while (seconds_since(start) < min_seconds);
+
+    report(r, &totals[1], runs, operations, seconds_since(start));
+}
+
+static void count_span(const icalcomponent *comp, const struct icaltime_span *span, void *data)
+{
+    _unused(comp);
+    _unused(span);
+
+    (*(long *)data)++;
+}
+
+static void bench_foreach(const struct bench_rule *r, struct icalrecurrencetype *rrule,
+                          struct icaltimetype dtstart, struct icaltimetype last)
+{
+    icalcomponent *comp = icalcomponent_new(ICAL_VEVENT_COMPONENT);
+    long runs = 0, operations = 0;
+    clock_t start;
+
+    icalcomponent_set_dtstart(comp, dtstart);
+    icalcomponent_set_duration(comp, icaldurationtype_from_string("PT1H"));
+    icalcomponent_add_property(comp, icalproperty_new_rrule(rrule));
+
+    icaltime_adjust(&last, 0, 0, 0, 1);
+
+    start = clock();
+    do {
+        icalcomponent_foreach_recurrence(comp, dtstart, last, count_span, &operations);
+        runs++;
+    } while (seconds_since(start) < min_seconds);
+
+    report(r, &totals[2], runs, operations, seconds_since(start));
+
+    icalcomponent_free(comp);
+}
+
+static int bench_rule(const struct bench_rule *r)
+{
+    struct icalrecurrencetype *rrule;
+    struct icaltimetype dtstart;
+    icalrecur_iterator *ritr;
+    struct icaltimetype *occurrences;
+    long n;
+
+    dtstart = icaltime_from_string(r->dtstart);
+    if (r->tzid[0]) {
+        dtstart = icaltime_set_timezone(&dtstart, icaltimezone_get_builtin_timezone(r->tzid));
+    }
+
+    rrule = icalrecurrencetype_new_from_string(r->rrule);
+    if (!rrule) {
+        return 0;
+    }
+
+    ritr = icalrecur_iterator_new(rrule, dtstart);
+    if (!ritr) {
+        /* e.g. the error cases of the corpora, or RSCALE without ICU */
+        icalrecurrencetype_unref(rrule);
+        icalerror_clear_errno();
+        return 0;
+    }
+
+    occurrences = malloc((size_t)max_occurrences * sizeof(*occurrences));
+    if (!occurrences) {
+        icalrecur_iterator_free(ritr);
+        icalrecurrencetype_unref(rrule);
+        return 0;
+    }
+
+    n = collect_occurrences(ritr, occurrences);
+    if (n > 0) {
+        bench_next(r, rrule, dtstart);
+        bench_seek(r, ritr, occurrences, n);
+        bench_foreach(r, rrule, dtstart, occurrences[n - 1]);
+    }
+
+    free(occurrences);
+    icalrecur_iterator_free(ritr);
+    icalrecurrencetype_unref(rrule);
+
+    return n > 0;
+}
+
+static int check_and_copy_field(const char *line, const char *pref, char *field, size_t field_size)
+{
+    size_t l = strlen(pref);
+    if (strncmp(line, pref, l) != 0) {
+        return 0;
+    }
+
+    size_t data_size = strlen(line) - l;
+    if (data_size >= field_size) {
+        return 1;
+    }
+
+    memcpy(field, &line[l], data_size + 1);
+    return 0;
+}
+
+static int bench_file(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "r");
+    struct bench_rule r;
+    const char *base;
+    int line_no = 0, rule_line_no = 0;
+    int eof = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "unable to open the input file '%s'\n", file_name);
+        return 1;
+    }
+
+    base = strrchr(file_name, '/');
+    base = base ? base + 1 : file_name;
+
+    memset(&r, 0, sizeof(r));
+
+    do {
+        char line[2048];
+        int yield;
+
+        if (fgets(line, sizeof(line), fp)) {
+            line_no++;
+
+            size_t l = strlen(line);
+            if (l > 0 && line[l - 1] == '\n') {
+                line[--l] = '\0';
+            }
+
+            if (l == 0) {
+                yield = 1;
+            } else if (line[0] == '#') {
+                continue;
+            } else {
+                if (r.rrule[0] == 0) {
+                    rule_line_no = line_no;
+                }
+
+                if (check_and_copy_field(line, "RRULE:", r.rrule, sizeof(r.rrule)) ||
+                    check_and_copy_field(line, "DTSTART:", r.dtstart, sizeof(r.dtstart))) {
+                    fprintf(stderr, "line buffer overflow: %s\n", line);
+                    fclose(fp);
+                    return 1;
+                }
+
+                yield = 0;
+            }
+        } else {
+            eof = 1;
+            yield = 1;
+        }
+
+        if (yield && r.rrule[0] != 0) {
+            snprintf(r.name, sizeof(r.name), "%s:%d", base, rule_line_no);
+            (void)bench_rule(&r);
+
+            memset(&r, 0, sizeof(r));
+        }
+    } while (!eof);
+
+    fclose(fp);
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f <input file>]... [-t <seconds>] [-n <occurrences>] [-s]\n", prog);
+    fprintf(stderr, "  -f  replay the rules of an icalrecur_test.txt style file (repeatable)\n");
+    fprintf(stderr, "  -t  minimum time spent on each rule and benchmark (default %g)\n", min_seconds);
+    fprintf(stderr, "  -n  maximum number of occurrences expanded per rule (default %d)\n", max_occurrences);
+    fprintf(stderr, "  -s  skip the synthetic rules\n");
+}
+
+/* cppcheck-suppress constParameter */
+int main(int argc, char *argv[])
+{
+    const char *default_file = "icalrecur_test.txt";
+    int nof_files = 0;
+    int synthetic = 1;
+    int ret = 0;
+    size_t i;
+
+    /* Do not use getopt for command line parsing -- for portability on Windows */
+    for (int a = 1; a < argc; ++a) {
+        if ((strcmp(argv[a], "-t") == 0) && (argc > a + 1)) {
+            min_seconds = atof(argv[++a]);
+            continue;
+        }
+
+        if ((strcmp(argv[a], "-n") == 0) && (argc > a + 1)) {
+            max_occurrences = atoi(argv[++a]);
+            if (max_occurrences < 1) {
+                max_occurrences = 1;
+            }
+            continue;
+        }
+
+        if (strcmp(argv[a], "-s") == 0) {
+            synthetic = 0;
+            continue;
+        }
+
+        if ((strcmp(argv[a], "-f") == 0) && (argc > a + 1)) {
+            ++a;
+            continue;
+        }
+
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("case\tbenchmark\truns\toperations\tseconds\tper_second\tns_per_operation\trrule\n");
+
+    for (int a = 1; a < argc; ++a) {
+        if ((strcmp(argv[a], "-t") == 0) || (strcmp(argv[a], "-n") == 0)) {
+            ++a;
+        } else if (strcmp(argv[a], "-f") == 0) {
+            ret |= bench_file(argv[++a]);
+            nof_files++;
+        }
+    }
+
+    if (nof_files == 0) {
+        ret |= bench_file(default_file);
+    }
+
+    if (synthetic) {
+        for (i = 0; i < sizeof(synthetic_rules) / sizeof(synthetic_rules[0]); i++) {
+            (void)bench_rule(&synthetic_rules[i]);
+        }
+    }
+
+    for (i = 0; i < sizeof(totals) / sizeof(totals[0]); i++) {
+        report(NULL, &totals[i], totals[i].runs, totals[i].operations, totals[i].seconds);
+    }
+
+    return ret;
+}
@@ -28,6 +28,9 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#if !defined(_WIN32)
+#include <utime.h>
+#endif
 
 #define TESTS_TZID_PREFIX "/softwarestudio.org/tests/"
 
@@ -906,6 +909,109 @@ void test_component_foreach_dtend_exact(void)
     test_component_foreach_dtend_daily(3, "20251031T220000", "PT24H", dtends);
 }
 
+struct foreach_parallel_span {
+    const icalcomponent *comp;
+    int comp_no;
+    struct icaltime_span span;
+};
+
+struct foreach_parallel_data {
+    icalarray *spans;
+    int comp_no;
+};
+
+static void test_component_foreach_parallel_callback(const icalcomponent *comp,
+                                                     const struct icaltime_span *span,
+                                                     void *data)
+{
+    struct foreach_parallel_data *fpd = (struct foreach_parallel_data *)data;
+    struct foreach_parallel_span fps;
+
+    fps.comp = comp;
+    fps.comp_no = fpd->comp_no;
+    fps.span = *span;
+    icalarray_append(fpd->spans, &fps);
+}
+
+static int test_component_foreach_parallel_compare(const void *a, const void *b)
+{
+    const struct foreach_parallel_span *fa = a, *fb = b;
+
+    if (fa->span.start != fb->span.start) {
+        return (fa->span.start < fb->span.start) ? -1 : 1;
+    }
+    return fa->comp_no - fb->comp_no;
+}
+
+void test_component_foreach_parallel(void)
+{
+    static const char *rrules[] = {
+        "FREQ=DAILY;INTERVAL=3",
+        "FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=30",
+        "FREQ=MONTHLY;BYMONTHDAY=1,15",
+        "FREQ=YEARLY;BYMONTH=2,8;BYDAY=-1SU",
+        "FREQ=HOURLY;INTERVAL=7;UNTIL=20250301T000000Z"};
+    icalcomponent *calendar = icalcomponent_new(ICAL_VCALENDAR_COMPONENT);
+    struct icaltimetype start = icaltime_from_string("20250101T000000Z");
+    struct icaltimetype end = icaltime_from_string("20250601T000000Z");
+    struct foreach_parallel_data serial, parallel;
+    icalcomponent *c;
+    size_t i;
+    int n;
+
+    for (n = 0; n < 100; n++) {
+        struct icaltimetype dtstart = icaltime_from_string("20241215T083000Z");
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(rrules[n % 5]);
+        icalcomponent *event = icalcomponent_new(ICAL_VEVENT_COMPONENT);
+
+        icaltime_adjust(&dtstart, n % 17, n % 5, n, 0);
+        icalcomponent_set_dtstart(event, dtstart);
+        icalcomponent_set_duration(event, icaldurationtype_from_string("PT45M"));
+        icalcomponent_add_property(event, icalproperty_new_rrule(recur));
+        icalrecurrencetype_unref(recur);
+        if (n % 9 == 0) {
+            icalcomponent_add_property(event, icalproperty_new_transp(ICAL_TRANSP_TRANSPARENT));
+        }
+        icalcomponent_add_component(calendar, event);
+    }
+
+    serial.spans = icalarray_new(sizeof(struct foreach_parallel_span), 256);
+    serial.comp_no = 0;
+    for (c = icalcomponent_get_first_component(calendar, ICAL_ANY_COMPONENT);
+         c != NULL;
+         c = icalcomponent_get_next_component(calendar, ICAL_ANY_COMPONENT)) {
+        icalcomponent_foreach_recurrence(c, start, end,
+                                         test_component_foreach_parallel_callback, &serial);
+        serial.comp_no++;
+    }
+    icalarray_sort(serial.spans, test_component_foreach_parallel_compare);
+
+    for (n = 0; n <= 4; n++) {
+        bool same = true;
+
+        parallel.spans = icalarray_new(sizeof(struct foreach_parallel_span), 256);
+        parallel.comp_no = 0;
+        icalcomponent_foreach_recurrence_parallel(calendar, start, end, n,
+                                                  test_component_foreach_parallel_callback,
+                                                  &parallel);
+
+        int_is("Number of spans", (int)parallel.spans->num_elements, (int)serial.spans->num_elements);
+        for (i = 0; same && i < serial.spans->num_elements && i < parallel.spans->num_elements; i++) {
+            const struct foreach_parallel_span *a = icalarray_element_at(serial.spans, i);
+            const struct foreach_parallel_span *b = icalarray_element_at(parallel.spans, i);
+
+            same = (a->comp == b->comp && a->span.start == b->span.start &&
+                    a->span.end == b->span.end && a->span.is_busy == b->span.is_busy);
+        }
+        ok("Spans are the same and in time order", same);
+
+        icalarray_free(parallel.spans);
+    }
+
+    icalarray_free(serial.spans);
+    icalcomponent_free(calendar);
+}
+
 void test_recur_iterator_set_start(void)
 {
     icaltimetype start = icaltime_from_string("20150526");
@@ -934,6 +1040,430 @@ void test_recur_iterator_on_jan_1(void)
     icalrecurrencetype_unref(recurrence);
 }
 
+void test_recur_iterator_set_start_zoned(void)
+{
+    static const char *rrules[] = {
+        "FREQ=HOURLY;INTERVAL=4",
+        "FREQ=HOURLY;INTERVAL=4;COUNT=1000",
+        "FREQ=MINUTELY;INTERVAL=150",
+        "FREQ=SECONDLY;INTERVAL=5400",
+        "FREQ=MINUTELY;INTERVAL=17;BYHOUR=9"};
+    static const char *starts[] = {
+        "20151101T000000", "20151101T013000", "20151101T030000",
+        "20151201T064337", "20160313T020000", "20160313T120000"};
+    static const char *date_rrules[] = {
+        "FREQ=SECONDLY;COUNT=20",
+        "FREQ=HOURLY;INTERVAL=5;UNTIL=20060701"};
+    icaltimezone *zone = icaltimezone_get_builtin_timezone("America/New_York");
+    icaltimetype dtstart = icaltime_from_string("20151011T114338");
+    icaltimetype date_dtstart = icaltime_from_string("20060607");
+    icaltimetype date_start = icaltime_from_string("20060612");
+    size_t i, j;
+
+    dtstart = icaltime_set_timezone(&dtstart, zone);
+
+    for (i = 0; i < sizeof(rrules) / sizeof(rrules[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(rrules[i]);
+
+        for (j = 0; j < sizeof(starts) / sizeof(starts[0]); j++) {
+            icaltimetype start = icaltime_from_string(starts[j]);
+            icalrecur_iterator *iterator = icalrecur_iterator_new(recur, dtstart);
+            icaltimetype expected, next;
+
+            start = icaltime_set_timezone(&start, zone);
+            while (!icaltime_is_null_time(expected = icalrecur_iterator_next(iterator)) &&
+                   icaltime_compare(expected, start) < 0) {
+            }
+            icalrecur_iterator_free(iterator);
+
+            iterator = icalrecur_iterator_new(recur, dtstart);
+            icalrecur_iterator_set_start(iterator, start);
+            next = icalrecur_iterator_next(iterator);
+            icalrecur_iterator_free(iterator);
+
+            if (VERBOSE) {
+                printf("%s from %s: %s\n", rrules[i], starts[j], icaltime_as_ical_string(expected));
+            }
+            str_is("icalrecur_iterator_set_start across a DST change",
+                   icaltime_as_ical_string(next), icaltime_as_ical_string(expected));
+        }
+        icalrecurrencetype_unref(recur);
+    }
+
+    /* Sub-daily rules with a DATE DTSTART are stepped by days */
+    for (i = 0; i < sizeof(date_rrules) / sizeof(date_rrules[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(date_rrules[i]);
+        icalrecur_iterator *iterator = icalrecur_iterator_new(recur, date_dtstart);
+        icaltimetype expected, next;
+        bool seeked;
+
+        while (!icaltime_is_null_time(expected = icalrecur_iterator_next(iterator)) &&
+               icaltime_compare(expected, date_start) < 0) {
+        }
+        icalrecur_iterator_free(iterator);
+
+        iterator = icalrecur_iterator_new(recur, date_dtstart);
+        seeked = icalrecur_iterator_set_start(iterator, date_start);
+        next = icalrecur_iterator_next(iterator);
+        icalrecur_iterator_free(iterator);
+
+        ok("icalrecur_iterator_set_start with a DATE DTSTART", seeked);
+        str_is("icalrecur_iterator_set_start with a DATE DTSTART steps by days",
+               icaltime_as_ical_string(next), icaltime_as_ical_string(expected));
+        icalrecurrencetype_unref(recur);
+    }
+}
+
+static int count_by_iteration(struct icalrecurrencetype *recur, icaltimetype dtstart,
+                              icaltimetype start, icaltimetype end)
+{
+    icalrecur_iterator *iterator = icalrecur_iterator_new(recur, dtstart);
+    icaltimetype next;
+    int count = 0;
+
+    while (!icaltime_is_null_time(next = icalrecur_iterator_next(iterator)) &&
+           icaltime_compare(next, end) < 0) {
+        if (icaltime_compare(next, start) >= 0) {
+            count++;
+        }
+    }
+    icalrecur_iterator_free(iterator);
+
+    return count;
+}
+
+void test_recur_count_in(void)
+{
+    static const struct {
+        const char *rrule;
+        const char *dtstart;
+        const char *tzid;
+    } rules[] = {
+        {"FREQ=DAILY;INTERVAL=3", "20240101T090000", NULL},
+        {"FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=50", "20240101T090000", NULL},
+        {"FREQ=WEEKLY;WKST=SU;INTERVAL=2;BYDAY=SU,TU", "20240102", NULL},
+        {"FREQ=MONTHLY;BYDAY=-1FR;UNTIL=20251231T000000", "20240126T120000", NULL},
+        {"FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1", "20240131T080000", NULL},
+        {"FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=29", "20240229", NULL},
+        {"FREQ=YEARLY;BYWEEKNO=1,20;BYDAY=TH;UNTIL=20300101", "20240104T100000", NULL},
+        {"FREQ=HOURLY;INTERVAL=5;BYHOUR=9,14,19;COUNT=100", "20240101T090000", NULL},
+        {"FREQ=HOURLY;INTERVAL=4", "20231011T114338", "America/New_York"},
+        {"FREQ=MINUTELY;INTERVAL=150;COUNT=5000", "20231011T114338", "America/New_York"},
+        {"FREQ=SECONDLY;UNTIL=20060822T170000Z", "20060607", NULL},
+        {"FREQ=MINUTELY;UNTIL=20060620", "20060607", NULL}};
+    static const char *ranges[][2] = {
+        {"20060101T000000", "20070101T000000"},
+        {"20060610", "20060701T120000"},
+        {"20230101T000000", "20240101T000000"},
+        {"20240101T000000", "20240201T000000"},
+        {"20240101T090000", "20240101T090001"},
+        {"20240215", "20260315"},
+        {"20250105T093000", "20290601T000000"},
+        {"20231105T000000", "20231107T024339"},
+        {"20300101T000000", "20240101T000000"}};
+    size_t i, j;
+
+    for (i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(rules[i].rrule);
+        icaltimetype dtstart = icaltime_from_string(rules[i].dtstart);
+        icaltimezone *zone = NULL;
+
+        if (rules[i].tzid) {
+            zone = icaltimezone_get_builtin_timezone(rules[i].tzid);
+            dtstart = icaltime_set_timezone(&dtstart, zone);
+        }
+
+        for (j = 0; j < sizeof(ranges) / sizeof(ranges[0]); j++) {
+            icaltimetype start = icaltime_from_string(ranges[j][0]);
+            icaltimetype end = icaltime_from_string(ranges[j][1]);
+            int expected;
+
+            if (zone) {
+                start = icaltime_set_timezone(&start, zone);
+                end = icaltime_set_timezone(&end, zone);
+            }
+            expected = count_by_iteration(recur, dtstart, start, end);
+
+            if (VERBOSE) {
+                printf("%s from %s in [%s, %s): %d\n", rules[i].rrule, rules[i].dtstart,
+                       ranges[j][0], ranges[j][1], expected);
+            }
+            int_is("icalrecur_count_in", icalrecur_count_in(recur, dtstart, start, end), expected);
+            int_is("icalrecur_has_occurrence_in",
+                   icalrecur_has_occurrence_in(recur, dtstart, start, end), expected > 0);
+        }
+        icalrecurrencetype_unref(recur);
+    }
+}
+
+void test_recur_iterator_next_timet(void)
+{
+    static const struct {
+        const char *rrule;
+        const char *dtstart;
+        const char *tzid;
+    } rules[] = {
+        {"FREQ=DAILY;INTERVAL=3;COUNT=40", "20240101T090000Z", NULL},
+        {"FREQ=WEEKLY;WKST=SU;INTERVAL=2;BYDAY=SU,TU;UNTIL=20250101", "20240102", NULL},
+        {"FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1;COUNT=30", "20240131T080000", NULL},
+        {"FREQ=YEARLY;BYMONTH=2;BYMONTHDAY=29;COUNT=5", "20240229T120000Z", NULL},
+        {"FREQ=HOURLY;INTERVAL=5;BYMINUTE=0,20;UNTIL=20240110T000000Z", "20240101T090000Z", NULL},
+        {"FREQ=WEEKLY;BYDAY=MO,FR;COUNT=30", "20240304T090000", "America/New_York"},
+        {"FREQ=HOURLY;COUNT=20", "20060607", NULL},
+        {"FREQ=MINUTELY;INTERVAL=2;UNTIL=20060620", "20060607", NULL},
+        {"FREQ=SECONDLY;COUNT=15", "20060607", NULL}};
+    size_t i;
+
+    for (i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(rules[i].rrule);
+        icaltimetype dtstart = icaltime_from_string(rules[i].dtstart);
+        icalrecur_iterator *iterator, *timet_iterator;
+        icaltimetype next;
+        icaltime_t next_timet;
+        int n = 0, mismatches = 0;
+
+        if (rules[i].tzid) {
+            dtstart = icaltime_set_timezone(&dtstart, icaltimezone_get_builtin_timezone(rules[i].tzid));
+        }
+
+        iterator = icalrecur_iterator_new(recur, dtstart);
+        timet_iterator = icalrecur_iterator_new(recur, dtstart);
+
+        while (!icaltime_is_null_time(next = icalrecur_iterator_next(iterator))) {
+            icaltime_t expected = icaltime_as_timet_with_zone(
+                next, next.zone ? next.zone : icaltimezone_get_utc_timezone());
+
+            /* Mix in some calls to icalrecur_iterator_next() */
+            if (n % 7 == 3) {
+                icaltimetype mixed = icalrecur_iterator_next(timet_iterator);
+
+                if (icaltime_compare(mixed, next) != 0) {
+                    mismatches++;
+                }
+            } else if (!icalrecur_iterator_next_timet(timet_iterator, &next_timet) ||
+                       next_timet != expected) {
+                mismatches++;
+            }
+            n++;
+        }
+
+        if (VERBOSE) {
+            printf("%s from %s: %d occurrences\n", rules[i].rrule, rules[i].dtstart, n);
+        }
+        int_is("icalrecur_iterator_next_timet matches icalrecur_iterator_next", mismatches, 0);
+        ok("icalrecur_iterator_next_timet ends with icalrecur_iterator_next",
+           !icalrecur_iterator_next_timet(timet_iterator, &next_timet));
+
+        icalrecur_iterator_free(iterator);
+        icalrecur_iterator_free(timet_iterator);
+        icalrecurrencetype_unref(recur);
+    }
+}
+
+void test_recur_iterator_prev(void)
+{
+    static const struct {
+        const char *rrule;
+        const char *dtstart;
+    } rules[] = {
+        {"FREQ=DAILY;INTERVAL=3;COUNT=40", "20240101T090000Z"},
+        {"FREQ=WEEKLY;WKST=SU;INTERVAL=2;BYDAY=SU,TU;UNTIL=20250101", "20240102"},
+        {"FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1;UNTIL=20270101T000000", "20240131T080000"},
+        {"FREQ=YEARLY;BYWEEKNO=1,53;BYDAY=TU,SA;COUNT=12", "20130101T000000"},
+        {"FREQ=HOURLY;INTERVAL=5;BYMINUTE=0,20;UNTIL=20240110T000000Z", "20240101T090000Z"},
+        {"FREQ=MINUTELY;INTERVAL=3;BYHOUR=6,20;COUNT=150", "20190204T061010"}};
+    static const char *both_paths[] = {
+        "FREQ=MINUTELY;INTERVAL=3", "FREQ=MINUTELY;INTERVAL=3;BYHOUR=6,20"};
+    static const struct {
+        const char *rrule;
+        const char *dtstart;
+        const char *tzid;
+        const char *from;
+    } ranges[] = {
+        {"FREQ=YEARLY;UNTIL=20050918T200000Z;BYMONTHDAY=-5;BYHOUR=5,9;WKST=TU",
+         "20011023T044500", "America/New_York", "20041027T094500"},
+        {"FREQ=DAILY;COUNT=15;BYMONTH=1,3", "20060514T230000", NULL, "20070115T230000"},
+        {"FREQ=DAILY;COUNT=15;BYMONTH=1,3", "20060514T230000", NULL, "20070115T230001"},
+        {"FREQ=YEARLY;INTERVAL=2;BYMONTH=2,4;BYHOUR=5,9", "20070519T100000", "America/New_York",
+         "20130419T050000"},
+        {"FREQ=MINUTELY;INTERVAL=17;BYHOUR=9;COUNT=120", "20011023T044500", "America/New_York",
+         "20011102T095001"},
+        {"FREQ=SECONDLY;INTERVAL=7;BYSECOND=0,3;COUNT=50", "20050101T000000", NULL,
+         "20050101T000704"}};
+    icaltimetype both_dtstart = icaltime_from_string("20190204T061010");
+    icaltimetype from = icaltime_from_string("20190204T062510");
+    icaltimetype reversed[2][6];
+    size_t i;
+
+    for (i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(rules[i].rrule);
+        icaltimetype dtstart = icaltime_from_string(rules[i].dtstart);
+        icalrecur_iterator *iterator = icalrecur_iterator_new(recur, dtstart);
+        icaltimetype occurrences[200], prev;
+        int n = 0, k, mismatches = 0;
+
+        while (n < 200 && !icaltime_is_null_time(occurrences[n] = icalrecur_iterator_next(iterator))) {
+            n++;
+        }
+
+        /* Walk back from the last occurrence */
+        for (k = n - 2; !icaltime_is_null_time(prev = icalrecur_iterator_prev(iterator)); k--) {
+            if (k < 0 || icaltime_compare(prev, occurrences[k]) != 0) {
+                mismatches++;
+                break;
+            }
+        }
+        int_is("icalrecur_iterator_prev reverses icalrecur_iterator_next", mismatches, 0);
+        int_is("icalrecur_iterator_prev ends at DTSTART", k, -1);
+
+        /* ... and forward again */
+        prev = icalrecur_iterator_next(iterator);
+        ok("icalrecur_iterator_next continues after icalrecur_iterator_prev",
+           n > 1 && icaltime_compare(prev, occurrences[1]) == 0);
+
+        /* Walk back from an occurrence in the middle, which is included */
+        icalrecur_iterator_set_range(iterator, occurrences[n / 2], dtstart);
+        for (k = n / 2; !icaltime_is_null_time(prev = icalrecur_iterator_prev(iterator)); k--) {
+            if (k < 0 || icaltime_compare(prev, occurrences[k]) != 0) {
+                mismatches++;
+                break;
+            }
+        }
+        int_is("icalrecur_iterator_set_range seeks the reverse iterator", mismatches, 0);
+        int_is("icalrecur_iterator_set_range reverse iterator ends at DTSTART", k, -1);
+
+        if (VERBOSE) {
+            printf("%s from %s: %d occurrences\n", rules[i].rrule, rules[i].dtstart, n);
+        }
+
+        icalrecur_iterator_free(iterator);
+        icalrecurrencetype_unref(recur);
+    }
+
+    /* Without BYHOUR, the occurrences are walked in local seconds, with it,
+       by the general iterator: both include 'from' */
+    for (i = 0; i < 2; i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(both_paths[i]);
+        icalrecur_iterator *iterator = icalrecur_iterator_new(recur, both_dtstart);
+        size_t k;
+
+        icalrecur_iterator_set_range(iterator, from, both_dtstart);
+        for (k = 0; k < 6; k++) {
+            reversed[i][k] = icalrecur_iterator_prev(iterator);
+        }
+        icalrecur_iterator_free(iterator);
+        icalrecurrencetype_unref(recur);
+    }
+    ok("Reverse range includes 'from'", icaltime_compare(reversed[0][0], from) == 0);
+    for (i = 0; i < 6; i++) {
+        str_is("Both iterators walk back alike", icaltime_as_ical_string(reversed[1][i]),
+               icaltime_as_ical_string(reversed[0][i]));
+    }
+
+    /* Reverse ranges start at the last occurrence at or before 'from' */
+    for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        struct icalrecurrencetype *recur = icalrecurrencetype_new_from_string(ranges[i].rrule);
+        icaltimetype dtstart = icaltime_from_string(ranges[i].dtstart);
+        icaltimetype start = icaltime_from_string(ranges[i].from);
+        icalrecur_iterator *iterator;
+        icaltimetype occurrences[200], prev;
+        int n = 0, k, last = -1, mismatches = 0;
+
+        if (ranges[i].tzid) {
+            icaltimezone *zone = icaltimezone_get_builtin_timezone(ranges[i].tzid);
+
+            dtstart = icaltime_set_timezone(&dtstart, zone);
+            start = icaltime_set_timezone(&start, zone);
+        }
+
+        iterator = icalrecur_iterator_new(recur, dtstart);
+        while (n < 200 && !icaltime_is_null_time(occurrences[n] = icalrecur_iterator_next(iterator))) {
+            if (icaltime_compare(occurrences[n], start) <= 0) {
+                last = n;
+            }
+            n++;
+        }
+
+        icalrecur_iterator_set_range(iterator, start, dtstart);
+        for (k = last; !icaltime_is_null_time(prev = icalrecur_iterator_prev(iterator)); k--) {
+            if (k < 0 || icaltime_compare(prev, occurrences[k]) != 0) {
+                mismatches++;
+                break;
+            }
+        }
+
+        if (VERBOSE) {
+            printf("%s from %s back from %s: %d of %d occurrences\n", ranges[i].rrule,
+                   ranges[i].dtstart, ranges[i].from, last + 1, n);
+        }
+        int_is("Reverse range walks back all occurrences", mismatches, 0);
+        int_is("Reverse range ends at DTSTART", k, -1);
+
+        icalrecur_iterator_free(iterator);
+        icalrecurrencetype_unref(recur);
+    }
+}
+
+void test_rscale_supported_calendars(void)
+{
+    icalarray *first = icalrecurrencetype_rscale_supported_calendars();
+    icalarray *second = icalrecurrencetype_rscale_supported_calendars();
+    bool same = (first->num_elements == second->num_elements);
+    bool has_gregorian = false;
+    size_t i;
+
+    ok("Supported calendars are listed", first->num_elements > 0);
+    for (i = 0; same && i < first->num_elements; i++) {
+        const char *cal = *(const char **)icalarray_element_at(first, i);
+
+        same = !strcmp(cal, *(const char **)icalarray_element_at(second, i));
+        has_gregorian |= (!strcmp(cal, "gregorian") || !strcmp(cal, "GREGORIAN"));
+    }
+    ok("Supported calendars are listed the same each time", same);
+    ok("Gregorian calendar is supported", has_gregorian);
+
+    icalarray_free(first);
+    icalarray_free(second);
+}
+
+void test_rscale_iterators_reuse(void)
+{
+    /* More time zones than the calendars kept for cloning per thread */
+    static const char *tzids[] = {
+        "America/New_York", "Europe/Berlin", "Asia/Tokyo", "Australia/Sydney",
+        "America/Los_Angeles", "Europe/London", "Asia/Kolkata", "Africa/Cairo",
+        "America/Sao_Paulo", "Pacific/Auckland", "Asia/Jerusalem"};
+    struct icalrecurrencetype *recur =
+        icalrecurrencetype_new_from_string("RSCALE=GREGORIAN;FREQ=MONTHLY;BYMONTHDAY=-1;COUNT=3");
+    size_t i;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < sizeof(tzids) / sizeof(tzids[0]); i++) {
+            icaltimetype dtstart = icaltime_from_string("20240131T090000");
+            icalrecur_iterator *iterator;
+            icaltimetype next;
+
+            dtstart = icaltime_set_timezone(&dtstart, icaltimezone_get_builtin_timezone(tzids[i]));
+            iterator = icalrecur_iterator_new(recur, dtstart);
+            ok("RSCALE iterator created", iterator != NULL);
+            if (!iterator) {
+                continue;
+            }
+
+            (void)icalrecur_iterator_next(iterator);
+            next = icalrecur_iterator_next(iterator);
+            ok("Second occurrence is February 29",
+               next.year == 2024 && next.month == 2 && next.day == 29 && next.hour == 9);
+            ok("Occurrence keeps the time zone", next.zone == dtstart.zone);
+
+            icalrecur_iterator_free(iterator);
+        }
+    }
+
+    icalrecurrencetype_unref(recur);
+}
+
 void test_memory(void)
 {
     size_t bufsize = 256;
@@ -2533,7 +3063,7 @@ void test_overlaps(void)
 
     icaltime_t hh = 1800; /* one half hour */
 
-    icalfileset_options options = {O_RDONLY, 0644, 0, NULL};
+    icalfileset_options options = {O_RDONLY, 0644, 0, NULL, 0, 0};
     set = icalset_new(ICAL_FILE_SET, TEST_DATADIR "/overlaps.ics", &options);
 
     c = icalcomponent_vanew(ICAL_VEVENT_COMPONENT,
@@ -2611,7 +3141,7 @@ void test_overlaps(void)
 void test_fblist(void)
 {
     icalspanlist *sl, *new_sl;
-    icalfileset_options options = {O_RDONLY, 0644, 0, NULL};
+    icalfileset_options options = {O_RDONLY, 0644, 0, NULL, 0, 0};
     icalset *set = icalset_new(ICAL_FILE_SET, TEST_DATADIR "/spanlist.ics", &options);
     struct icalperiodtype period;
     icalcomponent *comp, *fbcomp;
@@ -3000,6 +3530,25 @@ void test_time_parser(void)
         printf("%s\n", icaltime_as_ctime(tt));
     }
 
+    tt = icaltime_from_string("1997-01-02T10:20:30Z");
+    str_is("1997-01-02T10:20:30Z is valid", icaltime_as_ical_string(tt), "19970102T102030Z");
+
+    tt = icaltime_from_string("1997-01-0XT10:20:30");
+    ok("1997-01-0XT10:20:30 is null time", icaltime_is_null_time(tt));
+
+    tt = icaltime_from_string("1997010 T100000");
+    ok("1997010 T100000 is null time", icaltime_is_null_time(tt));
+
+    /* Signs are still taken by sscanf() */
+    tt = icaltime_from_string("1997-+1-02");
+    str_is("1997-+1-02 is valid", icaltime_as_ical_string(tt), "19970102");
+
+    str_is("P15DT5H0M20S", icaldurationtype_as_ical_string(icaldurationtype_from_string("P15DT5H0M20S")),
+           "P15DT5H20S");
+    ok("PT12345678901S is 1234567890 seconds",
+       icaldurationtype_from_string("PT12345678901S").seconds == 1234567890);
+    ok("PT1X is bad", icaldurationtype_is_bad_duration(icaldurationtype_from_string("PT1X")));
+
     icalerror_set_errors_are_fatal(true);
 }
 
@@ -3754,6 +4303,172 @@ void test_fileset(void)
 #endif
 }
 
+static icalcomponent *make_uid_component(const char *uid, const char *recurrence_id)
+{
+    icalcomponent *event = icalcomponent_vanew(ICAL_VEVENT_COMPONENT,
+                                               icalproperty_new_uid(uid), (void *)0);
+
+    if (recurrence_id) {
+        icalcomponent_add_property(event,
+                                   icalproperty_new_recurrenceid(icaltime_from_string(recurrence_id)));
+    }
+
+    return icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT,
+                               icalproperty_new_method(ICAL_METHOD_REQUEST), event, (void *)0);
+}
+
+void test_fileset_index(void)
+{
+#if defined(HAVE_UNLINK)
+    icalset *fs;
+    icalcomponent *c, *first, *exception, *match;
+    char uid[32];
+    int i;
+    const char *path = "test_fileset_index.ics";
+
+    unlink(path);
+
+    fs = icalfileset_new(path);
+    ok("icalfileset_new()", (fs != NULL));
+    assert(fs != 0);
+
+    for (i = 0; i != 100; i++) {
+        snprintf(uid, sizeof(uid), "uid-%d", i);
+        (void)icalfileset_add_component(fs, make_uid_component(uid, NULL));
+    }
+    exception = make_uid_component("uid-7", "20000101T120000Z");
+    (void)icalfileset_add_component(fs, exception);
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    /* The index is built from the file */
+    fs = icalfileset_new(path);
+    ok("icalfileset_has_uid() finds the first UID", icalfileset_has_uid(fs, "uid-0"));
+    ok("icalfileset_has_uid() finds the last UID", icalfileset_has_uid(fs, "uid-99"));
+    ok("icalfileset_has_uid() misses an unknown UID", !icalfileset_has_uid(fs, "uid-100"));
+
+    first = icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-7");
+    ok("icalfileset_fetch() finds the first component with the UID",
+       first != NULL && icalcomponent_get_first_property(icalcomponent_get_inner(first),
+                                                         ICAL_RECURRENCEID_PROPERTY) == NULL);
+
+    /* RECURRENCE-ID is part of the match */
+    c = make_uid_component("uid-7", "20000101T120000Z");
+    match = icalfileset_fetch_match(fs, c);
+    ok("icalfileset_fetch_match() finds the exception", match != NULL && match != first);
+    icalcomponent_free(c);
+
+    c = make_uid_component("uid-7", NULL);
+    ok("icalfileset_fetch_match() finds the master", icalfileset_fetch_match(fs, c) == first);
+    icalcomponent_free(c);
+
+    c = make_uid_component("uid-7", "20000102T120000Z");
+    ok("icalfileset_fetch_match() misses another instance", icalfileset_fetch_match(fs, c) == NULL);
+    icalcomponent_free(c);
+
+    /* Removing the first component finds the next one with the UID */
+    (void)icalfileset_remove_component(fs, first);
+    icalcomponent_free(first);
+    ok("icalfileset_fetch() finds the next component with the UID",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-7") == match);
+
+    /* Added components are found */
+    c = make_uid_component("uid-added", NULL);
+    (void)icalfileset_add_component(fs, c);
+    ok("icalfileset_fetch() finds an added component",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-added") == c);
+
+    /* Components changed in place are found after marking the set */
+    icalcomponent_set_uid(icalcomponent_get_inner(c), "uid-changed");
+    icalfileset_mark(fs);
+    ok("icalfileset_fetch() finds the changed UID",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-changed") == c);
+    ok("icalfileset_fetch() misses the old UID",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-added") == NULL);
+
+    /* and a stale entry is not returned even without marking it */
+    icalcomponent_set_uid(icalcomponent_get_inner(c), "uid-unmarked");
+    ok("icalfileset_fetch() does not return a stale entry",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-changed") == NULL);
+    ok("icalfileset_fetch() finds the unmarked UID",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-unmarked") == c);
+
+    icalset_free(fs);
+    unlink(path);
+#endif
+}
+
+static void append_uid_in_span(icalcomponent *comp, void *data)
+{
+    char *uids = data;
+    const char *uid = icalcomponent_get_uid(comp);
+
+    /* A VTIMEZONE has no UID, and no bounds either */
+    if (uid) {
+        strcat(uids, uid);
+    }
+}
+
+static const char *uids_in_span(icalset *fs, const char *start, const char *end)
+{
+    static char uids[64];
+
+    uids[0] = '\0';
+    icalfileset_foreach_in_span(fs, icaltime_as_timet(icaltime_from_string(start)),
+                                icaltime_as_timet(icaltime_from_string(end)),
+                                append_uid_in_span, uids);
+    return uids;
+}
+
+void test_fileset_span_index(void)
+{
+#if defined(HAVE_UNLINK)
+    icalset *fs;
+    icalcomponent *a;
+    const char *path = "test_fileset_span_index.ics";
+    const char *events[] = {
+        "BEGIN:VEVENT\nUID:a\nDTSTART:20240110T100000Z\nDTEND:20240110T110000Z\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:b\nDTSTART:20240101T100000Z\nDURATION:PT1H\n"
+        "RRULE:FREQ=DAILY;COUNT=5\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:c\nDTSTART:20200101T100000Z\nDURATION:PT1H\n"
+        "RRULE:FREQ=WEEKLY\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:d\nDTSTART:20240501T100000Z\nDURATION:PT1H\n"
+        "RDATE:20240601T100000Z\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:e\nDTSTART:20230101T100000Z\nDURATION:PT1H\n"
+        "RRULE:FREQ=WEEKLY;UNTIL=20231231T000000Z\nEND:VEVENT\n"};
+    size_t i;
+
+    unlink(path);
+
+    fs = icalfileset_new(path);
+    ok("icalfileset_new()", (fs != NULL));
+    assert(fs != 0);
+
+    a = icalparser_parse_string(events[0]);
+    (void)icalfileset_add_component(fs, a);
+    for (i = 1; i < sizeof(events) / sizeof(events[0]); i++) {
+        (void)icalfileset_add_component(fs, icalparser_parse_string(events[i]));
+    }
+
+    str_is("open-ended series and event", uids_in_span(fs, "20240110T090000Z", "20240110T120000Z"),
+           "ac");
+    str_is("series with COUNT", uids_in_span(fs, "20240103T090000Z", "20240103T120000Z"), "bc");
+    str_is("RDATE", uids_in_span(fs, "20240601T000000Z", "20240602T000000Z"), "cd");
+    str_is("series with UNTIL", uids_in_span(fs, "20230601T000000Z", "20230602T000000Z"), "ce");
+    str_is("before all", uids_in_span(fs, "20100101T000000Z", "20100102T000000Z"), "");
+
+    /* The index is kept up to date */
+    (void)icalfileset_remove_component(fs, a);
+    icalcomponent_free(a);
+    (void)icalfileset_add_component(fs, icalparser_parse_string(events[0]));
+    str_is("removed and added again", uids_in_span(fs, "20240110T090000Z", "20240110T120000Z"),
+           "ca");
+
+    icalset_free(fs);
+    unlink(path);
+#endif
+}
+
 void microsleep(int us)
 { /*us is in microseconds */
 #if defined(HAVE_NANOSLEEP)
@@ -3768,6 +4483,509 @@ void microsleep(int us)
 #endif /*Windows Sleep is useless for microsleeping */
 }
 
+static int count_fileset_components(icalset *fs)
+{
+    icalcomponent *c;
+    int count = 0;
+
+    for (c = icalfileset_get_first_component(fs); c != 0; c = icalfileset_get_next_component(fs)) {
+        count++;
+    }
+
+    return count;
+}
+
+static long file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    long size = -1;
+
+    if (f) {
+        if (fseek(f, 0, SEEK_END) == 0) {
+            size = ftell(f);
+        }
+        fclose(f);
+    }
+
+    return size;
+}
+
+void test_fileset_journal(void)
+{
+#if defined(HAVE_UNLINK)
+    icalfileset_options options = {O_RDWR | O_CREAT, 0644, 0, NULL, 1, 0};
+    icalset *fs;
+    icalcomponent *c;
+    char uid[32];
+    long size;
+    int i;
+    const char *path = "test_fileset_journal.ics";
+    const char *journal = "test_fileset_journal.ics.journal";
+    FILE *f;
+
+    unlink(path);
+    unlink(journal);
+
+    fs = icalfileset_new(path);
+    for (i = 0; i != 10; i++) {
+        snprintf(uid, sizeof(uid), "uid-%d", i);
+        (void)icalfileset_add_component(fs, make_uid_component(uid, NULL));
+    }
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+    size = file_size(path);
+
+    fs = icalset_new(ICAL_FILE_SET, path, &options);
+    ok("icalset_new() with a journal", (fs != NULL));
+    assert(fs != 0);
+
+    /* Later changes are appended to the journal */
+    c = icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-3");
+    ok("icalfileset_fetch() finds a component to remove", c != NULL);
+    (void)icalfileset_remove_component(fs, c);
+    icalcomponent_free(c);
+    (void)icalfileset_add_component(fs, make_uid_component("uid-added", NULL));
+    ok("icalfileset_commit() with a journal", icalfileset_commit(fs) == ICAL_NO_ERROR);
+    ok("the file is not written", file_size(path) == size);
+    ok("the changes are in the journal", file_size(journal) > 0);
+
+    /* A component which is added and removed before the commit */
+    c = make_uid_component("uid-transient", NULL);
+    (void)icalfileset_add_component(fs, c);
+    (void)icalfileset_remove_component(fs, c);
+    icalcomponent_free(c);
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    /* as if the last append was interrupted */
+    f = fopen(journal, "ab");
+    assert(f != 0);
+    fputs("ADD 100000\nBEGIN:VEVENT\n", f);
+    fclose(f);
+
+    /* The journal is replayed when the file is opened, with or without
+       the option */
+    fs = icalfileset_new(path);
+    ok("the replayed set has the components", count_fileset_components(fs) == 10);
+    ok("the removed component is not replayed",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-3") == NULL);
+    ok("the added component is replayed",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-added") != NULL);
+    ok("the transient component is not replayed",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-transient") == NULL);
+    icalset_free(fs);
+
+    /* Marking the set writes the whole file, and removes the journal */
+    fs = icalset_new(ICAL_FILE_SET, path, &options);
+    c = icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-added");
+    icalcomponent_set_uid(icalcomponent_get_inner(c), "uid-changed");
+    icalfileset_mark(fs);
+    (void)icalfileset_commit(fs);
+    ok("icalfileset_mark() writes the file", file_size(path) != size);
+    ok("icalfileset_mark() removes the journal", file_size(journal) < 0);
+    icalset_free(fs);
+
+    fs = icalfileset_new(path);
+    ok("the written set has the components", count_fileset_components(fs) == 10);
+    ok("the written set has the changed component",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-changed") != NULL);
+    icalset_free(fs);
+
+    /* A journal which was not written for the file is ignored */
+    fs = icalset_new(ICAL_FILE_SET, path, &options);
+    (void)icalfileset_add_component(fs, make_uid_component("uid-stale", NULL));
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+    fs = icalfileset_new(path);
+    c = icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-0");
+    (void)icalfileset_remove_component(fs, c);
+    icalcomponent_free(c);
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+    fs = icalfileset_new(path);
+    ok("the journal is removed with a written file", file_size(journal) < 0);
+    ok("the written file has the journaled component",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-stale") != NULL);
+    ok("the written file has the removal",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-0") == NULL);
+    icalset_free(fs);
+
+    unlink(path);
+    unlink(journal);
+#endif
+}
+
+void test_fileset_lazy(void)
+{
+#if defined(HAVE_UNLINK)
+    icalfileset_options options = {O_RDONLY, 0644, 0, NULL, 0, 1};
+    icalset *fs;
+    icalcomponent *c, *first;
+    char uid[32];
+    int i;
+    const char *path = "test_fileset_lazy.ics";
+    const char *span_path = "test_fileset_lazy_span.ics";
+    const char *zone_path = "test_fileset_lazy_zone.ics";
+    FILE *file;
+    struct icaltimetype dtstart;
+    const char *events[] = {
+        "BEGIN:VEVENT\nUID:a\nDTSTART:20240110T100000Z\nDTEND:20240110T110000Z\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:b\nDTSTART:20240101T100000Z\nDURATION:PT1H\n"
+        "RRULE:FREQ=DAILY;COUNT=5\nEND:VEVENT\n",
+        "BEGIN:VEVENT\nUID:d\nDTSTART;TZID=America/New_York:20240501T100000\nDURATION:PT1H\n"
+        "RDATE;TZID=America/New_York:20240601T100000\nEND:VEVENT\n"};
+
+    unlink(path);
+
+    fs = icalfileset_new(path);
+    for (i = 0; i != 100; i++) {
+        snprintf(uid, sizeof(uid), "uid-%d", i);
+        (void)icalfileset_add_component(fs, make_uid_component(uid, NULL));
+    }
+    (void)icalfileset_add_component(fs, make_uid_component("uid-7", "20000101T120000Z"));
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    fs = icalset_new(ICAL_FILE_SET, path, &options);
+    ok("icalset_new() reading lazily", (fs != NULL));
+    assert(fs != 0);
+
+    first = icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-7");
+    ok("icalfileset_fetch() finds the first component with the UID",
+       first != NULL && icalcomponent_get_first_property(icalcomponent_get_inner(first),
+                                                         ICAL_RECURRENCEID_PROPERTY) == NULL);
+    ok("icalfileset_fetch() misses an unknown UID",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-100") == NULL);
+
+    c = make_uid_component("uid-7", "20000101T120000Z");
+    ok("icalfileset_fetch_match() finds the exception",
+       icalfileset_fetch_match(fs, c) != NULL && icalfileset_fetch_match(fs, c) != first);
+    icalcomponent_free(c);
+
+    /* Iterating parses the rest of the components */
+    ok("iterating reaches all of the components", count_fileset_components(fs) == 101);
+    ok("the fetched component is returned again",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-7") == first);
+    icalset_free(fs);
+
+    /* The spans are looked up with the bounds scanned from the file */
+    unlink(span_path);
+    fs = icalfileset_new(span_path);
+    for (i = 0; i < (int)(sizeof(events) / sizeof(events[0])); i++) {
+        (void)icalfileset_add_component(fs, icalparser_parse_string(events[i]));
+    }
+    icalset_free(fs);
+
+    fs = icalset_new(ICAL_FILE_SET, span_path, &options);
+    str_is("icalfileset_foreach_in_span() finds an event",
+           uids_in_span(fs, "20240110T090000Z", "20240110T120000Z"), "a");
+    str_is("icalfileset_foreach_in_span() finds a series with COUNT",
+           uids_in_span(fs, "20240103T090000Z", "20240103T120000Z"), "b");
+    str_is("icalfileset_foreach_in_span() finds an RDATE with TZID",
+           uids_in_span(fs, "20240601T130000Z", "20240601T150000Z"), "d");
+    str_is("icalfileset_foreach_in_span() misses the gap",
+           uids_in_span(fs, "20240301T000000Z", "20240302T000000Z"), "");
+    icalset_free(fs);
+    unlink(span_path);
+
+    /* TZIDs resolve to the VTIMEZONEs at the top level of the file */
+    file = fopen(zone_path, "w");
+    assert(file != 0);
+    fputs("BEGIN:VTIMEZONE\nTZID:MyZone\nBEGIN:STANDARD\nDTSTART:19700101T000000\n"
+          "TZOFFSETFROM:+0500\nTZOFFSETTO:+0500\nEND:STANDARD\nEND:VTIMEZONE\n"
+          "BEGIN:VEVENT\nUID:z\nDTSTART;TZID=MyZone:20200601T120000\nDURATION:PT1H\nEND:VEVENT\n",
+          file);
+    fclose(file);
+
+    fs = icalset_new(ICAL_FILE_SET, zone_path, &options);
+    for (c = icalfileset_get_first_component(fs);
+         c != 0 && icalcomponent_isa(c) != ICAL_VEVENT_COMPONENT;
+         c = icalfileset_get_next_component(fs)) {
+    }
+    dtstart = c ? icalcomponent_get_dtstart(c) : icaltime_null_time();
+    str_is("the TZID of a lazily parsed component resolves",
+           dtstart.zone ? icaltimezone_get_tzid((icaltimezone *)dtstart.zone) : "(null)", "MyZone");
+    ok("the time of a lazily parsed component is in its zone",
+       icaltime_as_timet_with_zone(dtstart, dtstart.zone) == 1590994800);
+    str_is("icalfileset_foreach_in_span() finds the event in its zone",
+           uids_in_span(fs, "20200601T070000Z", "20200601T080000Z"), "z");
+    ok("iterating reaches the VTIMEZONE and the event", count_fileset_components(fs) == 2);
+    icalset_free(fs);
+    unlink(zone_path);
+
+    /* Changing the set loads all of the components */
+    options.flags = O_RDWR;
+    fs = icalset_new(ICAL_FILE_SET, path, &options);
+    first = icalfileset_get_first_component(fs);
+    c = icalfileset_get_next_component(fs);
+    (void)icalfileset_add_component(fs, make_uid_component("uid-added", NULL));
+    ok("the iterator continues after loading",
+       icalfileset_get_current_component(fs) == c &&
+           icalfileset_get_next_component(fs) != NULL);
+    ok("icalfileset_count_components() counts the loaded components",
+       icalfileset_count_components(fs, ICAL_ANY_COMPONENT) == 102);
+    (void)icalfileset_remove_component(fs, first);
+    icalcomponent_free(first);
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    fs = icalfileset_new(path);
+    ok("the changed set is written", count_fileset_components(fs) == 101);
+    ok("the added component is written",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-added") != NULL);
+    ok("the removed component is not written",
+       icalfileset_fetch(fs, ICAL_ANY_COMPONENT, "uid-0") == NULL);
+    icalset_free(fs);
+
+    unlink(path);
+#endif
+}
+
+#if defined(HAVE_UNLINK) && !defined(_WIN32)
+static void write_dirset_cluster(const char *path, const char *prefix, int n, time_t mtime)
+{
+    struct utimbuf times;
+    icalset *fs;
+    char uid[32];
+    int i;
+
+    unlink(path);
+    fs = icalfileset_new(path);
+    for (i = 0; i != n; i++) {
+        snprintf(uid, sizeof(uid), "%s-%d", prefix, i);
+        (void)icalfileset_add_component(fs, make_uid_component(uid, NULL));
+    }
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    times.actime = times.modtime = mtime;
+    (void)utime(path, &times);
+}
+
+/* Collects the components of the set, and returns their number */
+static int collect_dirset_components(icalset *s, icalcomponent **comps, int max, char *uids)
+{
+    icalcomponent *c;
+    int n = 0;
+
+    uids[0] = '\0';
+    for (c = icaldirset_get_first_component(s); c != 0; c = icaldirset_get_next_component(s)) {
+        if (n < max) {
+            comps[n] = c;
+        }
+        n++;
+        strcat(uids, icalcomponent_get_uid(c));
+        strcat(uids, " ");
+    }
+
+    return n;
+}
+#endif
+
+void test_dirset_cache(void)
+{
+#if defined(HAVE_UNLINK) && !defined(_WIN32)
+    icaldirset_options options = {O_RDWR | O_CREAT, 1024 * 1024, 2};
+    struct utimbuf times;
+    icalcomponent *first[8], *second[8];
+    char uids[256], prefetched_uids[256];
+    icalset *s;
+    time_t old = time(0) - 60;
+    int i, j, n, same;
+    bool estate;
+    const char *dir = "store-cache";
+    const char *paths[] = {"store-cache/a", "store-cache/b", "store-cache/c"};
+
+    (void)mkdir(dir, 0755);
+    for (i = 0; i != 3; i++) {
+        write_dirset_cluster(paths[i], paths[i] + strlen(dir) + 1, 2, old);
+    }
+    times.actime = times.modtime = old;
+    (void)utime(dir, &times);
+
+    s = icaldirset_new(dir);
+    ok("icaldirset_new() with the default cache", (s != NULL));
+    assert(s != 0);
+
+    n = collect_dirset_components(s, first, 8, uids);
+    int_is("iterating reaches all of the components", n, 6);
+    n = collect_dirset_components(s, second, 8, uids);
+    for (i = 0, same = 0; i != n; i++) {
+        same += (first[i] == second[i]);
+    }
+    int_is("iterating again returns the cached components", same, 6);
+
+    /* A cluster rewritten by somebody else is read again */
+    write_dirset_cluster(paths[1], "b", 3, old + 1);
+    n = collect_dirset_components(s, second, 8, uids);
+    int_is("iterating reaches the rewritten cluster", n, 7);
+    for (i = 0, same = 0; i != n && i != 8; i++) {
+        for (j = 0; j != 6; j++) {
+            same += (first[j] == second[i] && icalcomponent_get_uid(second[i])[0] != 'b');
+        }
+    }
+    int_is("the other clusters are still cached", same, 4);
+    icalset_free(s);
+
+    /* Clusters are only prefetched while errors are not fatal */
+    estate = icalerror_get_errors_are_fatal();
+    icalerror_set_errors_are_fatal(0);
+
+    s = icalset_new(ICAL_DIR_SET, dir, &options);
+    ok("icalset_new() with prefetching", (s != NULL));
+    assert(s != 0);
+    int_is("iterating with prefetching reaches all of the components",
+           collect_dirset_components(s, first, 8, prefetched_uids), 7);
+    str_is("iterating with prefetching returns the same components", prefetched_uids, uids);
+    n = collect_dirset_components(s, second, 8, prefetched_uids);
+    for (i = 0, same = 0; i != n; i++) {
+        same += (first[i] == second[i]);
+    }
+    int_is("the prefetched clusters are cached", same, 7);
+    icalset_free(s);
+
+    /* Without a cache, prefetched clusters are freed */
+    options.cache_size = 0;
+    s = icalset_new(ICAL_DIR_SET, dir, &options);
+    int_is("iterating without a cache reaches all of the components",
+           collect_dirset_components(s, first, 8, prefetched_uids), 7);
+    str_is("iterating without a cache returns the same components", prefetched_uids, uids);
+    icalset_free(s);
+
+    icalerror_set_errors_are_fatal(estate);
+
+    for (i = 0; i != 3; i++) {
+        unlink(paths[i]);
+    }
+    (void)rmdir(dir);
+#endif
+}
+
+#if defined(HAVE_UNLINK)
+static icalcomponent *make_dirset_event(const char *uid, const char *dtstart)
+{
+    char text[512];
+
+    snprintf(text, sizeof(text),
+             "BEGIN:VCALENDAR\nBEGIN:VEVENT\nUID:%s\nDTSTAMP:%s\nDTSTART:%s\n"
+             "DURATION:PT1H\nEND:VEVENT\nEND:VCALENDAR\n",
+             uid, dtstart, dtstart);
+
+    return icalparser_parse_string(text);
+}
+
+static void append_uid(icalcomponent *comp, void *data)
+{
+    strcat((char *)data, icalcomponent_get_uid(comp));
+    strcat((char *)data, " ");
+}
+
+static const char *dirset_uids_in_span(icalset *s, const char *start, const char *end)
+{
+    static char uids[256];
+
+    uids[0] = '\0';
+    icaldirset_foreach_in_span(s, icaltime_as_timet(icaltime_from_string(start)),
+                               icaltime_as_timet(icaltime_from_string(end)), append_uid, uids);
+
+    return uids;
+}
+#endif
+
+void test_dirset_manifest(void)
+{
+#if defined(HAVE_UNLINK)
+    icalset *s, *fs;
+    icalcomponent *c, *jan;
+    struct stat sbuf;
+    FILE *f;
+    int count;
+    const char *dir = "store-manifest";
+    const char *files[] = {"store-manifest/202301", "store-manifest/202302",
+                           "store-manifest/202303", "store-manifest/202404",
+                           "store-manifest/.manifest"};
+    size_t i;
+
+    (void)mkdir(dir, 0755);
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        unlink(files[i]);
+    }
+
+    s = icaldirset_new(dir);
+    ok("icaldirset_new() of an empty directory", (s != NULL));
+    assert(s != 0);
+
+    (void)icaldirset_add_component(s, make_dirset_event("jan-0", "20230110T100000Z"));
+    (void)icaldirset_add_component(s, make_dirset_event("jan-1", "20230120T100000Z"));
+    (void)icaldirset_commit(s);
+    (void)icaldirset_add_component(s, make_dirset_event("feb-0", "20230210T100000Z"));
+    (void)icaldirset_commit(s);
+    (void)icaldirset_add_component(s, make_dirset_event("mar-0", "20230310T100000Z"));
+    (void)icaldirset_commit(s);
+    ok("the manifest is written on commit", stat(files[4], &sbuf) == 0);
+
+    ok("icaldirset_has_uid() finds a UID", icaldirset_has_uid(s, "feb-0") == 1);
+    ok("icaldirset_has_uid() misses an unknown UID", icaldirset_has_uid(s, "feb-1") == 0);
+
+    c = icaldirset_fetch(s, ICAL_ANY_COMPONENT, "feb-0");
+    ok("icaldirset_fetch() finds a component",
+       c != NULL && strcmp(icalcomponent_get_uid(c), "feb-0") == 0);
+    ok("the cluster of the fetched component is the current one",
+       icaldirset_get_current_component(s) == c);
+
+    str_is("icaldirset_foreach_in_span() finds the components in a span",
+           dirset_uids_in_span(s, "20230115T000000Z", "20230125T000000Z"), "jan-1 ");
+    str_is("icaldirset_foreach_in_span() misses a gap",
+           dirset_uids_in_span(s, "20230401T000000Z", "20230501T000000Z"), "");
+
+    /* The fetched component is removed from its cluster */
+    (void)icaldirset_fetch(s, ICAL_ANY_COMPONENT, "mar-0");
+    jan = icaldirset_fetch(s, ICAL_ANY_COMPONENT, "jan-0");
+    ok("icaldirset_remove_component() removes the fetched component",
+       icaldirset_remove_component(s, jan) == ICAL_NO_ERROR);
+    icalcomponent_free(jan);
+    ok("the removed UID is not found before the commit", icaldirset_has_uid(s, "jan-0") == 0);
+    ok("the other UID of the cluster is still found", icaldirset_has_uid(s, "jan-1") == 1);
+    (void)icaldirset_commit(s);
+    ok("the removed UID is not found", icaldirset_has_uid(s, "jan-0") == 0);
+    icalset_free(s);
+
+    /* A cluster written by somebody else is taken into the manifest */
+    fs = icalfileset_new(files[3]);
+    (void)icalfileset_add_component(fs, make_dirset_event("apr-0", "20240410T100000Z"));
+    (void)icalfileset_commit(fs);
+    icalset_free(fs);
+
+    s = icaldirset_new(dir);
+    ok("the manifest is read again", icaldirset_has_uid(s, "jan-1") == 1);
+    ok("the removed UID is not found again", icaldirset_has_uid(s, "jan-0") == 0);
+    ok("the UID of the new cluster is found", icaldirset_has_uid(s, "apr-0") == 1);
+
+    for (c = icaldirset_get_first_component(s), count = 0; c != 0;
+         c = icaldirset_get_next_component(s)) {
+        count++;
+    }
+    int_is("iterating skips the manifest", count, 4);
+    icalset_free(s);
+
+    /* A damaged manifest is built again from the clusters */
+    f = fopen(files[4], "w");
+    if (f) {
+        fputs("ICALDIRSET-MANIFEST 1\nCLUSTER 1 0", f);
+        fclose(f);
+    }
+    s = icaldirset_new(dir);
+    ok("a damaged manifest is ignored",
+       icaldirset_fetch(s, ICAL_ANY_COMPONENT, "mar-0") != NULL);
+    icalset_free(s);
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        unlink(files[i]);
+    }
+    (void)rmdir(dir);
+#endif
+}
+
 void test_file_locks(void)
 {
 #if defined(HAVE_WAITPID) && defined(HAVE_FORK) && defined(HAVE_UNLINK)
@@ -4492,6 +5710,7 @@ void test_x_property(void)
 void test_utcoffset(void)
 {
     icalcomponent *c;
+    icalvalue *v;
 
     static const char test_icalcomp_str[] =
         "BEGIN:VTIMEZONE\n"
@@ -4508,6 +5727,18 @@ void test_utcoffset(void)
     if (c) {
         icalcomponent_free(c);
     }
+
+    v = icalvalue_new_from_string(ICAL_UTCOFFSET_VALUE, "-001608");
+    ok("-001608 is -968 seconds", icalvalue_get_utcoffset(v) == -968);
+    icalvalue_free(v);
+
+    v = icalvalue_new_from_string(ICAL_UTCOFFSET_VALUE, "+0530");
+    ok("+0530 is 19800 seconds", icalvalue_get_utcoffset(v) == 19800);
+    icalvalue_free(v);
+
+    v = icalvalue_new_from_string(ICAL_UTCOFFSET_VALUE, "0100");
+    ok("0100 is 3600 seconds", icalvalue_get_utcoffset(v) == 3600);
+    icalvalue_free(v);
 }
 
 void test_attach(void)
@@ -5274,6 +6505,299 @@ void test_timezone_from_builtin(void)
     icaltimezone_set_tzid_prefix(TESTS_TZID_PREFIX);
 }
 
+static void test_timezone_utc_offset_transitions(void)
+{
+    icaltimezone *zone = icaltimezone_get_builtin_timezone("Europe/Berlin");
+    struct icaltimetype tt;
+    int is_daylight;
+
+    /* UTC times on both sides of the changes in 2024 */
+    tt = icaltime_from_string("20240331T005959Z");
+    int_is("before spring change", icaltimezone_get_utc_offset_of_utc_time(zone, &tt, &is_daylight), 3600);
+    int_is("before spring change is standard", is_daylight, 0);
+    tt = icaltime_from_string("20240331T010000Z");
+    int_is("at spring change", icaltimezone_get_utc_offset_of_utc_time(zone, &tt, &is_daylight), 7200);
+    int_is("at spring change is daylight", is_daylight, 1);
+    tt = icaltime_from_string("20241027T005959Z");
+    int_is("before autumn change", icaltimezone_get_utc_offset_of_utc_time(zone, &tt, NULL), 7200);
+    tt = icaltime_from_string("20241027T010000Z");
+    int_is("at autumn change", icaltimezone_get_utc_offset_of_utc_time(zone, &tt, NULL), 3600);
+
+    /* Local times: the skipped hour is daylight time */
+    tt = icaltime_from_string("20240331T015959");
+    int_is("local before spring change", icaltimezone_get_utc_offset(zone, &tt, NULL), 3600);
+    tt = icaltime_from_string("20240331T023000");
+    int_is("local in skipped hour", icaltimezone_get_utc_offset(zone, &tt, NULL), 7200);
+    tt = icaltime_from_string("20240331T030000");
+    int_is("local after spring change", icaltimezone_get_utc_offset(zone, &tt, NULL), 7200);
+
+    /* The repeated hour is standard time, unless asked for daylight time */
+    tt = icaltime_from_string("20241027T015959");
+    int_is("local before repeated hour", icaltimezone_get_utc_offset(zone, &tt, NULL), 7200);
+    tt = icaltime_from_string("20241027T023000");
+    int_is("local in repeated hour", icaltimezone_get_utc_offset(zone, &tt, &is_daylight), 3600);
+    int_is("local in repeated hour is standard", is_daylight, 0);
+    tt.is_daylight = 1;
+    int_is("local daylight in repeated hour", icaltimezone_get_utc_offset(zone, &tt, &is_daylight), 7200);
+    int_is("local daylight in repeated hour is daylight", is_daylight, 1);
+    tt = icaltime_from_string("20241027T030000");
+    tt.is_daylight = 1;
+    int_is("local after repeated hour", icaltimezone_get_utc_offset(zone, &tt, NULL), 3600);
+}
+
+static void test_timezone_expansion_window(void)
+{
+    icaltimezone *builtin = icaltimezone_get_builtin_timezone("Europe/Berlin");
+    icaltimezone *zone = icaltimezone_new();
+    struct icaltimetype tt;
+    int year;
+
+    int_is("default expansion window", icaltimezone_get_expansion_window(zone), 5);
+    icaltimezone_set_expansion_window(zone, 0);
+    icaltimezone_set_component(zone, icalcomponent_clone(icaltimezone_get_component(builtin)));
+    int_is("expansion window kept by icaltimezone_set_component()", icaltimezone_get_expansion_window(zone), 0);
+
+    /* Extend the changes year by year, and once far ahead */
+    tt = icaltime_from_string("20000101T120000");
+    for (year = 2000; year <= 2100; year += 20) {
+        tt.year = year;
+        tt.month = 1;
+        int_is("winter offset", icaltimezone_get_utc_offset(zone, &tt, NULL),
+               icaltimezone_get_utc_offset(builtin, &tt, NULL));
+        tt.month = 7;
+        int_is("summer offset", icaltimezone_get_utc_offset(zone, &tt, NULL),
+               icaltimezone_get_utc_offset(builtin, &tt, NULL));
+    }
+    tt = icaltime_from_string("20991027T023000");
+    int_is("offset in repeated hour", icaltimezone_get_utc_offset(zone, &tt, NULL),
+           icaltimezone_get_utc_offset(builtin, &tt, NULL));
+    tt = icaltime_from_string("20990329T013000");
+    int_is("offset before change", icaltimezone_get_utc_offset(zone, &tt, NULL), 3600);
+    tt = icaltime_from_string("20990329T033000");
+    int_is("offset after change", icaltimezone_get_utc_offset(zone, &tt, NULL), 7200);
+
+    icaltimezone_free(zone, 1);
+}
+
+static void test_timezone_convert_times(void)
+{
+    icaltimezone *from = icaltimezone_get_builtin_timezone("America/New_York");
+    icaltimezone *to = icaltimezone_get_builtin_timezone("Europe/Berlin");
+    struct icaltimetype tts[8], tt;
+    icaltime_t times[3];
+    int ii;
+
+    /* Around the changes of both zones in March 2024, and one earlier */
+    tts[0] = icaltime_from_string("20240309T230000");
+    for (ii = 1; ii < 7; ii++) {
+        tts[ii] = tts[ii - 1];
+        icaltime_adjust(&tts[ii], 0, 8, 0, 0);
+    }
+    tts[7] = icaltime_from_string("19990101T120000");
+    for (ii = 0; ii < 8; ii++) {
+        tts[ii].zone = from;
+    }
+    tts[3] = icaltime_from_string("20240311");
+
+    icaltimezone_convert_times(from, to, tts, 8);
+    for (ii = 0; ii < 8; ii++) {
+        tt = tts[ii];
+        icaltimezone_convert_time(&tt, to, from);
+        icaltimezone_convert_time(&tt, from, to);
+        ok("converted like icaltimezone_convert_time()", icaltime_compare(tt, tts[ii]) == 0);
+    }
+    str_is("first time", icaltime_as_ical_string(tts[0]), "20240310T050000");
+    ok("first time is in the new zone", tts[0].zone == to);
+    str_is("date is not converted", icaltime_as_ical_string(tts[3]), "20240311");
+    str_is("earlier time", icaltime_as_ical_string(tts[7]), "19990101T180000");
+
+    /* UTC instants to local times in seconds */
+    times[0] = 1711846799; /* 20240331T005959Z */
+    times[1] = 1711850400; /* 20240331T020000Z */
+    times[2] = 1704067200; /* 20240101T000000Z */
+    icaltimezone_convert_timets(icaltimezone_get_utc_timezone(), to, times, 3);
+    ok("UTC to winter time", times[0] == 1711846799 + 3600);
+    ok("UTC to summer time", times[1] == 1711850400 + 7200);
+    ok("UTC to earlier winter time", times[2] == 1704067200 + 3600);
+}
+
+static void test_timezone_offset_cache(void)
+{
+    icaltimezone *zone = icaltimezone_get_builtin_timezone("Europe/Berlin");
+    struct icaltimetype tt = icaltime_from_string("20230101T120000");
+    size_t lookups, hits;
+    int ii, offset, is_daylight, summer = 0;
+
+    /* Make sure the changes are expanded, so no lookup below expands them */
+    (void)icaltimezone_get_utc_offset(zone, &tt, NULL);
+    icaltimezone_reset_offset_cache_statistics();
+
+    /* Every day of two years, passing four changes */
+    for (ii = 0; ii < 730; ii++) {
+        offset = icaltimezone_get_utc_offset(zone, &tt, &is_daylight);
+        ok("offset matches daylight", offset == (is_daylight ? 7200 : 3600));
+        summer += is_daylight;
+        icaltime_adjust(&tt, 1, 0, 0, 0);
+    }
+    ok("summer days", summer == 217 + 210);
+
+    icaltimezone_get_offset_cache_statistics(&lookups, &hits);
+    ok("all lookups counted", lookups == 730);
+    ok("all lookups were hits", hits == 730);
+
+    /* Going back needs a search */
+    tt = icaltime_from_string("20230701T120000");
+    offset = icaltimezone_get_utc_offset(zone, &tt, &is_daylight);
+    ok("summer offset", offset == 7200 && is_daylight);
+    offset = icaltimezone_get_utc_offset_of_utc_time(zone, &tt, &is_daylight);
+    ok("summer offset of UTC time", offset == 7200 && is_daylight);
+    icaltimezone_get_offset_cache_statistics(&lookups, &hits);
+    ok("going back is a miss", lookups == 732 && hits == 731);
+
+    icaltimezone_reset_offset_cache_statistics();
+    icaltimezone_get_offset_cache_statistics(&lookups, &hits);
+    ok("statistics reset", lookups == 0 && hits == 0);
+    icaltimezone_get_offset_cache_statistics(NULL, NULL);
+}
+
+static void test_timezone_unknown_location(void)
+{
+    int estate = icalerror_get_errors_are_fatal();
+    int ii;
+
+    icalerror_set_errors_are_fatal(false);
+
+    /* The misses are remembered until the builtin timezones are freed */
+    for (ii = 0; ii < 2; ii++) {
+        ok("unknown location is not found", icaltimezone_get_builtin_timezone("Nowhere/Unknown") == NULL);
+        ok("unknown TZID is not found",
+           icaltimezone_get_builtin_timezone_from_tzid("/freeassociation.sourceforge.net/Nowhere/Unknown") == NULL);
+        ok("known location is still found", icaltimezone_get_builtin_timezone("Europe/Berlin") != NULL);
+        if (ii == 0) {
+            icaltimezone_free_builtin_timezones();
+        }
+    }
+
+#if !defined(_WIN32)
+    /* A miss is looked up again once the zone directory has changed */
+    if (!icaltimezone_get_builtin_tzdata()) {
+        char *zonedir = strdup(icaltzutil_get_zone_directory());
+        char path[1024];
+        char buf[4096];
+        struct utimbuf times;
+        FILE *in, *out;
+        size_t n;
+
+        (void)unlink("zoneinfo-miss/Test/Zone");
+        (void)rmdir("zoneinfo-miss/Test");
+        (void)mkdir("zoneinfo-miss", 0755);
+        times.actime = times.modtime = time(0) - 60;
+        (void)utime("zoneinfo-miss", &times);
+        icaltzutil_set_zone_directory("zoneinfo-miss");
+
+        ok("location without a file is not found", icaltimezone_get_builtin_timezone("Test/Zone") == NULL);
+
+        (void)mkdir("zoneinfo-miss/Test", 0755);
+        snprintf(path, sizeof(path), "%s/Europe/Berlin", zonedir);
+        in = fopen(path, "rb");
+        out = fopen("zoneinfo-miss/Test/Zone", "wb");
+        while (in && out && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+            (void)fwrite(buf, 1, n, out);
+        }
+        if (in) {
+            fclose(in);
+        }
+        if (out) {
+            fclose(out);
+        }
+
+        (void)sleep(1);
+        ok("location is found after its directory changed",
+           icaltimezone_get_builtin_timezone("Test/Zone") != NULL);
+
+        icaltzutil_set_zone_directory(zonedir);
+        icaltimezone_free_builtin_timezones();
+        free(zonedir);
+    }
+#endif
+
+    icalerror_set_errors_are_fatal(estate);
+}
+
+static icalcomponent *merge_test_calendar(const char *offset, const char *uid)
+{
+    char buf[1024];
+
+    snprintf(buf, sizeof(buf),
+             "BEGIN:VCALENDAR\r\n"
+             "BEGIN:VTIMEZONE\r\n"
+             "TZID:Test\r\n"
+             "BEGIN:STANDARD\r\n"
+             "DTSTART:19700101T000000\r\n"
+             "TZOFFSETFROM:%s\r\n"
+             "TZOFFSETTO:%s\r\n"
+             "END:STANDARD\r\n"
+             "END:VTIMEZONE\r\n"
+             "BEGIN:VEVENT\r\n"
+             "UID:%s\r\n"
+             "DTSTART;TZID=Test:20240101T100000\r\n"
+             "END:VEVENT\r\n"
+             "END:VCALENDAR\r\n",
+             offset, offset, uid);
+
+    return icalparser_parse_string(buf);
+}
+
+static const char *merged_event_tzid(icalcomponent *comp, const char *uid)
+{
+    icalcomponent *event;
+
+    for (event = icalcomponent_get_first_component(comp, ICAL_VEVENT_COMPONENT);
+         event != NULL;
+         event = icalcomponent_get_next_component(comp, ICAL_VEVENT_COMPONENT)) {
+        if (strcmp(icalcomponent_get_uid(event), uid) == 0) {
+            icalproperty *prop = icalcomponent_get_first_property(event, ICAL_DTSTART_PROPERTY);
+
+            return icalparameter_get_tzid(icalproperty_get_first_parameter(prop, ICAL_TZID_PARAMETER));
+        }
+    }
+
+    return NULL;
+}
+
+static void test_merge_vtimezones(void)
+{
+    icalcomponent *comp = merge_test_calendar("+0100", "a");
+    icaltimezone *zone;
+
+    /* The same VTIMEZONE is not added again */
+    icalcomponent_merge_component(comp, merge_test_calendar("+0100", "b"));
+    int_is("same zone merged", icalcomponent_count_components(comp, ICAL_VTIMEZONE_COMPONENT), 1);
+    str_is("same zone TZID kept", merged_event_tzid(comp, "b"), "Test");
+
+    /* A different VTIMEZONE with the same TZID is renamed */
+    icalcomponent_merge_component(comp, merge_test_calendar("+0200", "c"));
+    int_is("different zone added", icalcomponent_count_components(comp, ICAL_VTIMEZONE_COMPONENT), 2);
+    str_is("different zone TZID renamed", merged_event_tzid(comp, "c"), "Test1");
+    zone = icalcomponent_get_timezone(comp, "Test1");
+    ok("renamed zone found", zone != NULL);
+    str_is("renamed zone TZID", icaltimezone_get_tzid(zone), "Test1");
+
+    /* The renamed VTIMEZONE is found again */
+    icalcomponent_merge_component(comp, merge_test_calendar("+0200", "d"));
+    int_is("renamed zone merged", icalcomponent_count_components(comp, ICAL_VTIMEZONE_COMPONENT), 2);
+    str_is("renamed zone TZID used", merged_event_tzid(comp, "d"), "Test1");
+
+    /* A third definition gets the next suffix */
+    icalcomponent_merge_component(comp, merge_test_calendar("+0300", "e"));
+    int_is("third zone added", icalcomponent_count_components(comp, ICAL_VTIMEZONE_COMPONENT), 3);
+    str_is("third zone TZID renamed", merged_event_tzid(comp, "e"), "Test2");
+    str_is("first event TZID kept", merged_event_tzid(comp, "a"), "Test");
+    int_is("events merged", icalcomponent_count_components(comp, ICAL_VEVENT_COMPONENT), 5);
+
+    icalcomponent_free(comp);
+}
+
 void test_icalvalue_decode_ical_string(void)
 {
     char buff[12];
@@ -6044,6 +7568,103 @@ void test_icaltime_as_timet(void)
     ok("icaltime_as_timet translates out of bounds correctly", icaltime_as_timet(tt) == -1);
 }
 
+void test_icaltime_timet_arrays(void)
+{
+    icaltimezone *zone = icaltimezone_get_builtin_timezone("America/New_York");
+    icaltime_t times[6] = {-2145916800, 0, 951782400, 1710050400, 1730613600, 253402300799};
+    icaltime_t times2[6];
+    struct icaltimetype tts[6], tt;
+    int ii;
+
+    icaltime_from_timets_with_zone(times, 6, 0, zone, tts);
+    for (ii = 0; ii < 6; ii++) {
+        tt = icaltime_from_timet_with_zone(times[ii], 0, zone);
+        ok("like icaltime_from_timet_with_zone()", icaltime_compare(tt, tts[ii]) == 0 &&
+                                                       tt.is_daylight == tts[ii].is_daylight &&
+                                                       tts[ii].zone == zone);
+    }
+    str_is("first time", icaltime_as_ical_string(tts[0]), "19011231T190000");
+    str_is("before DST", icaltime_as_ical_string(tts[3]), "20240310T010000");
+    str_is("DST ends", icaltime_as_ical_string(tts[4]), "20241103T010000");
+
+    icaltime_from_timets_with_zone(times, 6, 1, NULL, tts);
+    str_is("leap day as date", icaltime_as_ical_string(tts[2]), "20000229");
+    ok("floating", tts[2].zone == NULL && tts[2].is_date);
+
+    icaltime_from_timets_with_zone(times, 6, 0, NULL, tts);
+    icaltime_as_timets(tts, times2, 6);
+    for (ii = 0; ii < 6; ii++) {
+        ok("round trip", times2[ii] == times[ii]);
+    }
+
+    /* Adjusting over many years counts their leap days */
+    tt = icaltime_from_string("19000301");
+    icaltime_adjust(&tt, 365 * 200 + 49, 0, 0, 0);
+    str_is("200 years later", icaltime_as_ical_string(tt), "21000301");
+    icaltime_adjust(&tt, -(365 * 200 + 49), 0, 0, 0);
+    str_is("200 years earlier", icaltime_as_ical_string(tt), "19000301");
+}
+
+void test_icaltime_sort_key(void)
+{
+    icaltimezone *ny = icaltimezone_get_builtin_timezone("America/New_York");
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+    struct icaltimetype tts[5], a[2], b[3], merged[5];
+    icalcomponent *comps[3];
+    int ii;
+
+    tts[0] = icaltime_from_string("20240102T120000Z");
+    tts[1] = icaltime_from_string("20240102T080000"); /* 13:00Z */
+    tts[1].zone = ny;
+    tts[2] = icaltime_from_string("20240102");
+    tts[3] = icaltime_from_string("20240101T235959Z");
+    tts[4] = icaltime_from_string("20240102T065959"); /* 11:59:59Z */
+    tts[4].zone = ny;
+
+    ok("key of 1970-01-01T00:00:01Z", icaltime_sort_key(icaltime_from_string("19700101T000001Z")) == 3);
+    ok("key of 1970-01-01", icaltime_sort_key(icaltime_from_string("19700101")) == 0);
+    ok("key of floating time is as UTC",
+       icaltime_sort_key(icaltime_from_string("20240102T120000")) == icaltime_sort_key(tts[0]));
+    for (ii = 0; ii < 4; ii++) {
+        ok("keys compare like icaltime_compare()",
+           (icaltime_sort_key(tts[ii]) < icaltime_sort_key(tts[ii + 1])) ==
+               (icaltime_compare(tts[ii], tts[ii + 1]) < 0));
+    }
+
+    icaltime_sort(tts, 5);
+    str_is("sorted 0", icaltime_as_ical_string(tts[0]), "20240101T235959Z");
+    str_is("sorted 1", icaltime_as_ical_string(tts[1]), "20240102");
+    str_is("sorted 2", icaltime_as_ical_string(tts[2]), "20240102T065959");
+    str_is("sorted 3", icaltime_as_ical_string(tts[3]), "20240102T120000Z");
+    str_is("sorted 4", icaltime_as_ical_string(tts[4]), "20240102T080000");
+
+    a[0] = tts[0];
+    a[1] = tts[3];
+    b[0] = tts[1];
+    b[1] = tts[2];
+    b[2] = tts[4];
+    icaltime_merge(a, 2, b, 3, merged);
+    for (ii = 0; ii < 5; ii++) {
+        ok("merged", icaltime_compare(merged[ii], tts[ii]) == 0 && merged[ii].zone == tts[ii].zone);
+    }
+    ok("UTC stays first", merged[3].zone == utc);
+
+    comps[0] = icalcomponent_vanew(ICAL_VEVENT_COMPONENT,
+                                   icalproperty_new_dtstart(tts[4]),
+                                   (void *)0);
+    comps[1] = icalcomponent_new(ICAL_VEVENT_COMPONENT);
+    comps[2] = icalcomponent_vanew(ICAL_VEVENT_COMPONENT,
+                                   icalproperty_new_dtstart(tts[0]),
+                                   (void *)0);
+    icalcomponent_sort_by_dtstart(comps, 3);
+    ok("no DTSTART first", icalcomponent_get_first_property(comps[0], ICAL_DTSTART_PROPERTY) == NULL);
+    str_is("earlier DTSTART", icaltime_as_ical_string(icalcomponent_get_dtstart(comps[1])),
+           "20240101T235959Z");
+    for (ii = 0; ii < 3; ii++) {
+        icalcomponent_free(comps[ii]);
+    }
+}
+
 void test_icalcomponent_with_lastmodified(void)
 {
     /* for https://github.com/libical/libical/issues/585 */
@@ -6902,6 +8523,8 @@ int main(int argc, char *argv[])
 
     test_run("Test time parser functions", test_time_parser, do_test, do_header);
     test_run("Test icaltime_as_timet", test_icaltime_as_timet, do_test, do_header);
+    test_run("Test icaltime arrays of icaltime_t", test_icaltime_timet_arrays, do_test, do_header);
+    test_run("Test icaltime sort keys", test_icaltime_sort_key, do_test, do_header);
     test_run("Test time", test_time, do_test, do_header);
     test_run("Test calculation of DOY and WD", test_juldat_caldat, do_test, do_header);
     test_run("Test day of Year", test_doy, do_test, do_header);
@@ -6923,6 +8546,12 @@ int main(int argc, char *argv[])
     test_run("Test Gauge SQL", test_gauge_sql, do_test, do_header);
     test_run("Test Gauge Compare", test_gauge_compare, do_test, do_header);
     test_run("Test File Set", test_fileset, do_test, do_header);
+    test_run("Test File Set index", test_fileset_index, do_test, do_header);
+    test_run("Test File Set span index", test_fileset_span_index, do_test, do_header);
+    test_run("Test File Set journal", test_fileset_journal, do_test, do_header);
+    test_run("Test File Set lazy reader", test_fileset_lazy, do_test, do_header);
+    test_run("Test Dir Set cache", test_dirset_cache, do_test, do_header);
+    test_run("Test Dir Set manifest", test_dirset_manifest, do_test, do_header);
     test_run("Test File Set (Extended)", test_fileset_extended, do_test, do_header);
     test_run("Test Dir Set", test_dirset, do_test, do_header);
     test_run("Test Dir Set (Extended)", test_dirset_extended, do_test, do_header);
@@ -6951,8 +8580,15 @@ int main(int argc, char *argv[])
     test_run("Test icalcomponent_foreach_recurrence with start as date", test_component_foreach_start_as_date, do_test, do_header);
     test_run("Test icalcomponent_foreach_recurrence with nominal duration", test_component_foreach_dtend_nominal, do_test, do_header);
     test_run("Test icalcomponent_foreach_recurrence with exact duration", test_component_foreach_dtend_exact, do_test, do_header);
+    test_run("Test icalcomponent_foreach_recurrence_parallel", test_component_foreach_parallel, do_test, do_header);
     test_run("Test icalrecur_iterator_set_start with date", test_recur_iterator_set_start, do_test, do_header);
     test_run("Test weekly icalrecur_iterator on January 1", test_recur_iterator_on_jan_1, do_test, do_header);
+    test_run("Test icalrecur_iterator_set_start in a time zone", test_recur_iterator_set_start_zoned, do_test, do_header);
+    test_run("Test icalrecur_count_in", test_recur_count_in, do_test, do_header);
+    test_run("Test icalrecur_iterator_next_timet", test_recur_iterator_next_timet, do_test, do_header);
+    test_run("Test icalrecur_iterator_prev", test_recur_iterator_prev, do_test, do_header);
+    test_run("Test RSCALE supported calendars", test_rscale_supported_calendars, do_test, do_header);
+    test_run("Test reusing RSCALE calendars", test_rscale_iterators_reuse, do_test, do_header);
     test_run("Test Convenience", test_convenience, do_test, do_header);
     test_run("Test classify ", test_classify, do_test, do_header);
     test_run("Test Iterators", test_iterators, do_test, do_header);
@@ -6990,6 +8626,12 @@ int main(int argc, char *argv[])
     test_run("Test string_to_kind", test_string_to_kind, do_test, do_header);
     test_run("Test set DATE/DATE-TIME VALUE", test_set_date_datetime_value, do_test, do_header);
     test_run("Test timezone from builtin", test_timezone_from_builtin, do_test, do_header);
+    test_run("Test timezone UTC offsets at transitions", test_timezone_utc_offset_transitions, do_test, do_header);
+    test_run("Test timezone expansion window", test_timezone_expansion_window, do_test, do_header);
+    test_run("Test timezone batch conversion", test_timezone_convert_times, do_test, do_header);
+    test_run("Test timezone offset cache", test_timezone_offset_cache, do_test, do_header);
+    test_run("Test merging VTIMEZONEs", test_merge_vtimezones, do_test, do_header);
+    test_run("Test timezone unknown location", test_timezone_unknown_location, do_test, do_header);
     test_run("Test icalvalue_decode_ical_string", test_icalvalue_decode_ical_string, do_test, do_header);
 
     test_run("Test icalarray_sort", test_icalarray_sort, do_test, do_header);
@@ -0,0 +1,46 @@
+# SPDX-FileCopyrightText: 2025 Contributors to the libical project <git@github.com:libical/libical>
+# SPDX-License-Identifier: LGPL-2.1-only OR MPL-2.0
+
+# Compiles the zones.tab file and the VTIMEZONE files of the zoneinfo directory
+# into a C header, so that the builtin timezone data can be linked into the library.
+#
+# Usage: cmake -DZONEINFO_DIR:PATH=<zoneinfo> -DOUTPUT_FILE:FILEPATH=<header> -P embed_zoneinfo.cmake
+
+if(NOT ZONEINFO_DIR OR NOT OUTPUT_FILE)
+  message(FATAL_ERROR "ZONEINFO_DIR and OUTPUT_FILE must be set")
+endif()
+
+# Turns the content of a text file into the lines of a C string literal
+function(to_c_string _content _result)
+  string(REPLACE "\\" "\\\\" _content "${_content}")
+  string(REPLACE "\"" "\\\"" _content "${_content}")
+  string(REPLACE "\r" "" _content "${_content}")
+  string(REGEX REPLACE "\n$" "" _content "${_content}")
+  string(REPLACE "\n" "\\n\"\n    \"" _content "${_content}")
+  set(${_result} "    \"${_content}\\n\"" PARENT_SCOPE)
+endfunction()
+
+set(_tmp_file "${OUTPUT_FILE}.tmp")
+
+file(WRITE ${_tmp_file} "/* Generated by zoneinfo/embed_zoneinfo.cmake from the zoneinfo directory. Do not edit. */\n\n")
+
+file(READ ${ZONEINFO_DIR}/zones.tab _zones_tab)
+to_c_string("${_zones_tab}" _zones_tab)
+file(APPEND ${_tmp_file} "static const char embedded_zones_tab[] =\n${_zones_tab};\n\n")
+
+# Sorted by location (not by file name, "GB" < "GB-Eire" < "GB.ics"), for a binary search
+file(GLOB_RECURSE _locations RELATIVE ${ZONEINFO_DIR} ${ZONEINFO_DIR}/*.ics)
+list(TRANSFORM _locations REPLACE "\\.ics$" "")
+list(SORT _locations)
+
+file(APPEND ${_tmp_file} "static const struct embedded_zone {\n    const char *location;\n    const char *vcalendar;\n} embedded_zones[] = {\n")
+foreach(_location ${_locations})
+  file(READ ${ZONEINFO_DIR}/${_location}.ics _vcalendar)
+  to_c_string("${_vcalendar}" _vcalendar)
+  file(APPEND ${_tmp_file} "    {\"${_location}\",\n${_vcalendar}},\n")
+endforeach()
+file(APPEND ${_tmp_file} "};\n")
+
+# Only touch the header when it changes, to not rebuild the library needlessly
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${_tmp_file} ${OUTPUT_FILE})
+file(REMOVE ${_tmp_file})